@@ -0,0 +1,1772 @@
+// Micro-benchmarks of the parse and format APIs over generated corpora
+//
+// Every corpus is generated from a fixed seed so runs on different builds
+// parse exactly the same text, and the corpus of a smaller size is a prefix of
+// the corpus of a larger size. Build with -DCMAKE_BUILD_TYPE=Release for
+// meaningful numbers.
+//
+//     ipv6-bench [--json] [--counters] [--min N] [--max N] [--repeat N]
+//                [--seed N] [--corpus NAME] [--api NAME]
+//     ipv6-bench --latency [--json] [--iterations N]
+//     ipv6-bench --concurrent [--json] [--threads N] [--prefixes N] [--seed N]
+//     ipv6-bench --load [--json] [--threads N] [--prefixes N] [--seed N]
+//
+// With --counters the hardware counters of the best pass are read through
+// perf_event_open on Linux. Counters the kernel or container does not expose
+// are reported as null and the benchmark runs without them.
+//
+// With --latency every call of ipv6_from_str on a set of worst case inputs is
+// timed separately into a log linear histogram, reporting percentiles up to
+// p99.99 and the maximum so tail regressions show up even when the mean does
+// not move.
+//
+// With --concurrent a prefix table of --prefixes random prefixes is looked up
+// by 1, 2, 4 and up to --threads reader threads while one writer thread
+// inserts and removes prefixes, reporting lookups per second against the
+// number of readers.
+//
+// With --load the same prefixes are formatted as text and built into a table
+// twice: parsed and inserted one at a time, then parsed on --threads threads
+// and loaded in bulk.
+//
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L     // clock_gettime
+#define _DEFAULT_SOURCE             // syscall
+#endif
+
+#include "ipv6.h"
+#include "ipv6_ptable.h"
+#include "ipv6_internal.h"
+#include "ipv6_config.h"
+#include "ipv6_test_config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(HAVE_TIME_H)
+#include <time.h>
+#endif
+
+#if defined(HAVE_LINUX_PERF_EVENT_H) && defined(HAVE_UNISTD_H)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#define BENCH_HAVE_PERF 1
+#else
+#define BENCH_HAVE_PERF 0
+#endif
+
+#if !defined(_WIN32) && defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
+
+#if defined(_WIN32) || defined(HAVE_PTHREAD_H)
+#define BENCH_HAVE_THREADS 1
+#else
+#define BENCH_HAVE_THREADS 0
+#endif
+
+#if defined(HAVE_X86INTRIN_H) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define BENCH_HAVE_CYCLES 1
+#elif defined(HAVE_INTRIN_H) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define BENCH_HAVE_CYCLES 1
+#else
+#define BENCH_HAVE_CYCLES 0
+#endif
+
+#define BENCH_MAX_ENTRY         64          // longest generated entry in bytes
+#define BENCH_FORMAT_RING       (1u << 20)  // parsed addresses cycled by the format benchmarks
+#define BENCH_BATCH             64          // rows per ipv6_to_str_batch call
+#define BENCH_ROW               48          // batch output stride
+#define BENCH_STRING            128         // format buffer, larger than IPV6_STRING_SIZE
+#define BENCH_HIST_SUB_BITS     5           // 32 sub buckets per power of two, within 3.2%
+#define BENCH_HIST_SUB          (1u << BENCH_HIST_SUB_BITS)
+#define BENCH_HIST_BUCKETS      (64 * BENCH_HIST_SUB)
+#define BENCH_WARMUP            1000        // untimed calls before each latency case
+#define BENCH_MAX_THREADS       256
+#define BENCH_KEYS              (1u << 16)  // addresses cycled by the concurrent readers
+#define BENCH_CONCURRENT_MS     1000        // run time per reader count
+#define BENCH_CIDR_SIZE         48          // formatted prefix with its mask
+
+typedef enum {
+    BENCH_COUNTER_CYCLES,
+    BENCH_COUNTER_INSTRUCTIONS,
+    BENCH_COUNTER_BRANCH_MISSES,
+    BENCH_COUNTER_L1D_MISSES,
+    BENCH_COUNTER_L1I_MISSES,
+    BENCH_COUNTERS
+} bench_counter_t;
+
+static const char* bench_counter_names[BENCH_COUNTERS] = {
+    "cycles",
+    "instructions",
+    "branch_misses",
+    "l1d_misses",
+    "l1i_misses",
+};
+
+// Open counters, fd is -1 for counters that are not available
+typedef struct {
+    int                     fd[BENCH_COUNTERS];
+    bool                    enabled;
+} bench_perf_t;
+
+typedef struct {
+    uint64_t                state;
+} bench_rng_t;
+
+// Entries are stored back to back without separators
+typedef struct {
+    char*                   text;
+    uint8_t*                lengths;
+    size_t                  count;
+    size_t                  bytes;
+} bench_corpus_t;
+
+// Parsed addresses of a corpus for the format benchmarks
+typedef struct {
+    ipv6_address_full_t*    addrs;
+    size_t                  count;
+} bench_ring_t;
+
+typedef struct {
+    const char*             api;
+    const char*             corpus;
+    size_t                  entries;
+    size_t                  ok;             // operations that succeeded
+    uint64_t                bytes;          // bytes read or written per pass
+    uint64_t                ns;             // best pass
+    uint64_t                cycles;
+    uint64_t                counters[BENCH_COUNTERS];   // of the best pass
+    uint32_t                counted;                    // bit per valid counter
+} bench_result_t;
+
+typedef size_t (*bench_gen_func_t) (bench_rng_t* rng, char* out);
+
+typedef size_t (*bench_run_func_t) (
+    const bench_corpus_t* corpus,
+    const bench_ring_t* ring,
+    uint64_t* bytes);
+
+typedef struct {
+    const char*             name;
+    bench_gen_func_t        func;
+} bench_corpus_def_t;
+
+typedef struct {
+    const char*             name;
+    bench_run_func_t        func;
+    bool                    formats;        // needs parsed addresses
+} bench_api_def_t;
+
+typedef struct {
+    bool                    json;
+    bool                    counters;
+    bool                    latency;
+    bool                    concurrent;
+    bool                    load;
+    uint64_t                iterations;
+    uint32_t                threads;
+    size_t                  prefixes;
+    size_t                  min;
+    size_t                  max;
+    uint32_t                repeat;
+    uint64_t                seed;
+    const char*             corpus;
+    const char*             api;
+} bench_options_t;
+
+// Keeps the compiler from discarding benchmarked calls
+static volatile uint64_t bench_sink;
+
+//--------------------------------------------------------------------------------
+// xorshift64*, the state is never zero
+static uint64_t bench_rand (bench_rng_t* rng)
+{
+    rng->state ^= rng->state >> 12;
+    rng->state ^= rng->state << 25;
+    rng->state ^= rng->state >> 27;
+    return rng->state * UINT64_C(0x2545f4914f6cdd1d);
+}
+
+//--------------------------------------------------------------------------------
+static uint32_t bench_below (bench_rng_t* rng, uint32_t bound)
+{
+    return (uint32_t)(((bench_rand(rng) >> 32) * bound) >> 32);
+}
+
+//--------------------------------------------------------------------------------
+static uint64_t bench_now_ns (void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * UINT64_C(1000000000) + (uint64_t)now.tv_nsec;
+#endif
+}
+
+//--------------------------------------------------------------------------------
+// Reference cycles of the time stamp counter, 0 where there is none
+static uint64_t bench_cycles (void)
+{
+#if BENCH_HAVE_CYCLES
+    return (uint64_t)__rdtsc();
+#else
+    return 0;
+#endif
+}
+
+#if BENCH_HAVE_PERF
+//--------------------------------------------------------------------------------
+static int perf_open (uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // Scale counts when the PMU is shared between more events than it has
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+#define PERF_CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+#endif
+
+//--------------------------------------------------------------------------------
+// Open the counters of the calling thread, returns false with a reason if
+// none are available
+static bool perf_create (bench_perf_t* perf, const char** reason)
+{
+    bool any = false;
+
+    for (uint32_t i = 0; i < BENCH_COUNTERS; ++i) {
+        perf->fd[i] = -1;
+    }
+    perf->enabled = false;
+
+#if BENCH_HAVE_PERF
+    perf->fd[BENCH_COUNTER_CYCLES] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    perf->fd[BENCH_COUNTER_INSTRUCTIONS] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    perf->fd[BENCH_COUNTER_BRANCH_MISSES] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    perf->fd[BENCH_COUNTER_L1D_MISSES] = perf_open(PERF_TYPE_HW_CACHE, PERF_CACHE_MISS(PERF_COUNT_HW_CACHE_L1D));
+    perf->fd[BENCH_COUNTER_L1I_MISSES] = perf_open(PERF_TYPE_HW_CACHE, PERF_CACHE_MISS(PERF_COUNT_HW_CACHE_L1I));
+
+    *reason = errno == EACCES || errno == EPERM ?
+        "perf_event_open not permitted, see /proc/sys/kernel/perf_event_paranoid" :
+        "perf_event_open failed, hardware counters are not exposed";
+    for (uint32_t i = 0; i < BENCH_COUNTERS; ++i) {
+        any |= perf->fd[i] >= 0;
+    }
+#else
+    *reason = "perf_event_open is not available on this platform";
+#endif
+
+    perf->enabled = any;
+    return any;
+}
+
+//--------------------------------------------------------------------------------
+static void perf_destroy (bench_perf_t* perf)
+{
+#if BENCH_HAVE_PERF
+    for (uint32_t i = 0; perf->enabled && i < BENCH_COUNTERS; ++i) {
+        if (perf->fd[i] >= 0) {
+            close(perf->fd[i]);
+        }
+    }
+#endif
+    perf->enabled = false;
+}
+
+//--------------------------------------------------------------------------------
+static void perf_start (const bench_perf_t* perf)
+{
+#if BENCH_HAVE_PERF
+    for (uint32_t i = 0; perf->enabled && i < BENCH_COUNTERS; ++i) {
+        if (perf->fd[i] >= 0) {
+            ioctl(perf->fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(perf->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#else
+    (void)perf;
+#endif
+}
+
+//--------------------------------------------------------------------------------
+// Stop the counters and read them into `values`, returns a bit per counter
+// that was read
+static uint32_t perf_stop (const bench_perf_t* perf, uint64_t* values)
+{
+    uint32_t counted = 0;
+
+#if BENCH_HAVE_PERF
+    for (uint32_t i = 0; perf->enabled && i < BENCH_COUNTERS; ++i) {
+        uint64_t data[3];   // value, time enabled, time running
+
+        if (perf->fd[i] < 0) {
+            continue;
+        }
+
+        ioctl(perf->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(perf->fd[i], data, sizeof(data)) != (ssize_t)sizeof(data) || data[2] == 0) {
+            continue;
+        }
+
+        values[i] = data[2] < data[1] ?
+            (uint64_t)((double)data[0] * (double)data[1] / (double)data[2]) : data[0];
+        counted |= 1u << i;
+    }
+#else
+    (void)perf;
+    (void)values;
+#endif
+
+    return counted;
+}
+
+//--------------------------------------------------------------------------------
+static size_t gen_hex (char* out, uint16_t value, bool upper)
+{
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    size_t n = 0;
+
+    for (int32_t shift = 12; shift >= 0; shift -= 4) {
+        const uint32_t nibble = (value >> shift) & 0xf;
+        if (nibble || n || shift == 0) {
+            out[n++] = digits[nibble];
+        }
+    }
+
+    return n;
+}
+
+//--------------------------------------------------------------------------------
+static size_t gen_decimal (char* out, uint32_t value)
+{
+    char digits[10];
+    size_t count = 0, n = 0;
+
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    while (count) {
+        out[n++] = digits[--count];
+    }
+
+    return n;
+}
+
+//--------------------------------------------------------------------------------
+static size_t gen_ipv4 (bench_rng_t* rng, char* out)
+{
+    const uint64_t octets = bench_rand(rng);
+    size_t n = 0;
+
+    for (uint32_t i = 0; i < 4; ++i) {
+        if (i) {
+            out[n++] = '.';
+        }
+        n += gen_decimal(out + n, (uint32_t)(octets >> (i * 8)) & 0xff);
+    }
+
+    return n;
+}
+
+//--------------------------------------------------------------------------------
+// Write `count` components, replacing `run_len` components from `run` by "::"
+static size_t gen_components (
+    char* out,
+    const uint16_t* components,
+    int32_t count,
+    int32_t run,
+    int32_t run_len,
+    bool upper)
+{
+    bool separator = false;
+    size_t n = 0;
+
+    for (int32_t i = 0; i < count; ++i) {
+        if (i == run && run_len > 0) {
+            out[n++] = ':';
+            out[n++] = ':';
+            separator = false;
+            i += run_len - 1;
+            continue;
+        }
+
+        if (separator) {
+            out[n++] = ':';
+        }
+        n += gen_hex(out + n, components[i], upper);
+        separator = true;
+    }
+
+    return n;
+}
+
+//--------------------------------------------------------------------------------
+// Components shaped like global unicast traffic: a routing prefix, a random
+// subnet and an interface identifier with runs of zeros
+static void gen_address (bench_rng_t* rng, uint16_t* components, int32_t count)
+{
+    static const uint16_t prefixes[] = { 0x2001, 0x2a02, 0x2600, 0x2406, 0x2804, 0xfd12 };
+    const uint64_t bits = bench_rand(rng);
+
+    components[0] = prefixes[bench_below(rng, (uint32_t)(sizeof(prefixes) / sizeof(prefixes[0])))];
+    for (int32_t i = 1; i < count; ++i) {
+        // Roughly a third of the components are zero
+        components[i] = bench_below(rng, 3) ? (uint16_t)(bits >> (i * 8)) * 0x3b : 0;
+    }
+}
+
+//--------------------------------------------------------------------------------
+// Compressed IPv6 with a zero run of 2 or more components, `count` is 8 or 6
+// when an IPv4 address follows
+static size_t gen_v6_compressed (bench_rng_t* rng, char* out, int32_t count)
+{
+    uint16_t components[8];
+    const int32_t run_len = 2 + (int32_t)bench_below(rng, (uint32_t)count - 2);
+    const int32_t run = (int32_t)bench_below(rng, (uint32_t)(count - run_len + 1));
+
+    gen_address(rng, components, count);
+    for (int32_t i = run; i < run + run_len; ++i) {
+        components[i] = 0;
+    }
+
+    return gen_components(out, components, count, run, run_len, bench_below(rng, 16) == 0);
+}
+
+//--------------------------------------------------------------------------------
+static size_t gen_compressed (bench_rng_t* rng, char* out)
+{
+    return gen_v6_compressed(rng, out, 8);
+}
+
+//--------------------------------------------------------------------------------
+static size_t gen_full (bench_rng_t* rng, char* out)
+{
+    uint16_t components[8];
+
+    gen_address(rng, components, 8);
+    return gen_components(out, components, 8, -1, 0, false);
+}
+
+//--------------------------------------------------------------------------------
+static size_t gen_embedded (bench_rng_t* rng, char* out)
+{
+    static const char* prefixes[] = { "::ffff:", "64:ff9b::", "::" };
+    const uint32_t form = bench_below(rng, 4);
+    size_t n;
+
+    if (form < 3) {
+        n = strlen(prefixes[form]);
+        memcpy(out, prefixes[form], n);
+    }
+    else {
+        n = gen_v6_compressed(rng, out, 6);
+        if (out[n - 1] != ':' || out[n - 2] != ':') {
+            out[n++] = ':';
+        }
+    }
+
+    return n + gen_ipv4(rng, out + n);
+}
+
+//--------------------------------------------------------------------------------
+static size_t gen_cidr (bench_rng_t* rng, char* out)
+{
+    static const uint32_t masks[] = { 32, 48, 56, 64, 128 };
+    size_t n = gen_compressed(rng, out);
+
+    out[n++] = '/';
+    return n + gen_decimal(out + n, masks[bench_below(rng, 5)]);
+}
+
+//--------------------------------------------------------------------------------
+static size_t gen_port (bench_rng_t* rng, char* out)
+{
+    size_t n = 1;
+
+    out[0] = '[';
+    n += gen_compressed(rng, out + n);
+    out[n++] = ']';
+    out[n++] = ':';
+    return n + gen_decimal(out + n, 1 + bench_below(rng, 65535));
+}
+
+//--------------------------------------------------------------------------------
+// Link local addresses with a hex zone
+static size_t gen_zone (bench_rng_t* rng, char* out)
+{
+    uint16_t components[8];
+    size_t n;
+
+    gen_address(rng, components, 8);
+    components[0] = 0xfe80;
+    components[1] = components[2] = components[3] = 0;
+    n = gen_components(out, components, 8, 1, 3, false);
+    out[n++] = '%';
+    return n + gen_hex(out + n, (uint16_t)(1 + bench_below(rng, 0xff)), false);
+}
+
+//--------------------------------------------------------------------------------
+static size_t gen_ipv4_port (bench_rng_t* rng, char* out)
+{
+    size_t n = gen_ipv4(rng, out);
+
+    out[n++] = ':';
+    return n + gen_decimal(out + n, 1 + bench_below(rng, 65535));
+}
+
+//--------------------------------------------------------------------------------
+// Near misses of valid input and plain junk
+static size_t gen_invalid (bench_rng_t* rng, char* out)
+{
+    static const char junk[] = "0123456789abcdefgABCDEF:.[]/% -";
+    size_t n = bench_below(rng, 2) ? gen_compressed(rng, out) : gen_ipv4(rng, out);
+
+    switch (bench_below(rng, 5)) {
+        case 0:
+            out[bench_below(rng, (uint32_t)n)] = junk[16 + bench_below(rng, sizeof(junk) - 17)];
+            break;
+
+        case 1:
+            memcpy(out + n, "::1", 3);
+            n += 3;
+            break;
+
+        case 2:
+            n = 1 + bench_below(rng, (uint32_t)n);
+            out[n++] = ':';
+            break;
+
+        case 3:
+            memcpy(out + n, ":1:2:3:4", 8);
+            n += 8;
+            break;
+
+        default:
+            n = 1 + bench_below(rng, 24);
+            for (size_t i = 0; i < n; ++i) {
+                out[i] = junk[bench_below(rng, sizeof(junk) - 1)];
+            }
+            break;
+    }
+
+    return n;
+}
+
+//--------------------------------------------------------------------------------
+// Weighted towards compressed IPv6 and bare IPv4 as seen in access logs
+static size_t gen_mixed (bench_rng_t* rng, char* out)
+{
+    const uint32_t pick = bench_below(rng, 100);
+
+    if (pick < 35) return gen_compressed(rng, out);
+    if (pick < 40) return gen_full(rng, out);
+    if (pick < 50) return gen_embedded(rng, out);
+    if (pick < 60) return gen_cidr(rng, out);
+    if (pick < 70) return gen_port(rng, out);
+    if (pick < 75) return gen_zone(rng, out);
+    if (pick < 90) return gen_ipv4(rng, out);
+    if (pick < 95) return gen_ipv4_port(rng, out);
+    return gen_invalid(rng, out);
+}
+
+static const bench_corpus_def_t bench_corpora[] = {
+    { "compressed", gen_compressed },
+    { "full", gen_full },
+    { "embedded", gen_embedded },
+    { "cidr", gen_cidr },
+    { "port", gen_port },
+    { "zone", gen_zone },
+    { "ipv4", gen_ipv4 },
+    { "ipv4_port", gen_ipv4_port },
+    { "invalid", gen_invalid },
+    { "mixed", gen_mixed },
+};
+
+//--------------------------------------------------------------------------------
+static bool corpus_create (
+    bench_corpus_t* corpus,
+    const bench_corpus_def_t* def,
+    size_t count,
+    uint64_t seed)
+{
+    bench_rng_t rng;
+    size_t capacity = count * 24 + BENCH_MAX_ENTRY;
+
+    memset(corpus, 0, sizeof(bench_corpus_t));
+    corpus->text = (char*)malloc(capacity);
+    corpus->lengths = (uint8_t*)malloc(count);
+    if (!corpus->text || !corpus->lengths) {
+        return false;
+    }
+
+    rng.state = seed | 1;
+    for (size_t i = 0; i < count; ++i) {
+        char entry[BENCH_MAX_ENTRY];
+        const size_t length = def->func(&rng, entry);
+
+        if (corpus->bytes + length > capacity) {
+            char* text;
+            capacity *= 2;
+            text = (char*)realloc(corpus->text, capacity);
+            if (!text) {
+                return false;
+            }
+            corpus->text = text;
+        }
+
+        memcpy(corpus->text + corpus->bytes, entry, length);
+        corpus->lengths[i] = (uint8_t)length;
+        corpus->bytes += length;
+    }
+
+    corpus->count = count;
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+static void corpus_destroy (bench_corpus_t* corpus)
+{
+    free(corpus->text);
+    free(corpus->lengths);
+    memset(corpus, 0, sizeof(bench_corpus_t));
+}
+
+//--------------------------------------------------------------------------------
+// Parse the start of a corpus for the format benchmarks, zones point into the
+// corpus text
+static bool ring_create (bench_ring_t* ring, const bench_corpus_t* corpus)
+{
+    const size_t limit = corpus->count < BENCH_FORMAT_RING ? corpus->count : BENCH_FORMAT_RING;
+    const char* cp = corpus->text;
+
+    ring->count = 0;
+    ring->addrs = (ipv6_address_full_t*)malloc((limit ? limit : 1) * sizeof(ipv6_address_full_t));
+    if (!ring->addrs) {
+        return false;
+    }
+
+    for (size_t i = 0; i < limit; ++i) {
+        if (ipv6_from_str(cp, corpus->lengths[i], &ring->addrs[ring->count])) {
+            ring->count++;
+        }
+        cp += corpus->lengths[i];
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+static size_t run_from_str (
+    const bench_corpus_t* corpus,
+    const bench_ring_t* ring,
+    uint64_t* bytes)
+{
+    const char* cp = corpus->text;
+    ipv6_address_full_t addr;
+    uint64_t sum = 0;
+    size_t ok = 0;
+
+    (void)ring;
+    for (size_t i = 0; i < corpus->count; ++i) {
+        if (ipv6_from_str(cp, corpus->lengths[i], &addr)) {
+            sum += addr.address.components[7];
+            ok++;
+        }
+        cp += corpus->lengths[i];
+    }
+
+    bench_sink += sum;
+    *bytes = corpus->bytes;
+    return ok;
+}
+
+//--------------------------------------------------------------------------------
+static size_t run_to_str_options (
+    const bench_corpus_t* corpus,
+    const bench_ring_t* ring,
+    uint64_t* bytes,
+    uint32_t options)
+{
+    char buffer[BENCH_STRING];
+    uint64_t written = 0;
+    size_t ok = 0;
+
+    // One format per corpus entry, cycling over the parsed addresses
+    for (size_t i = 0, r = 0; i < corpus->count; ++i) {
+        const size_t length = ipv6_to_str_format(&ring->addrs[r], buffer, sizeof(buffer), options);
+        written += length;
+        ok += length != 0;
+        if (++r == ring->count) {
+            r = 0;
+        }
+    }
+
+    bench_sink += written;
+    *bytes = written;
+    return ok;
+}
+
+//--------------------------------------------------------------------------------
+static size_t run_to_str (
+    const bench_corpus_t* corpus,
+    const bench_ring_t* ring,
+    uint64_t* bytes)
+{
+    return run_to_str_options(corpus, ring, bytes, IPV6_FORMAT_DEFAULT);
+}
+
+//--------------------------------------------------------------------------------
+static size_t run_to_str_expanded (
+    const bench_corpus_t* corpus,
+    const bench_ring_t* ring,
+    uint64_t* bytes)
+{
+    return run_to_str_options(corpus, ring, bytes, IPV6_FORMAT_EXPANDED);
+}
+
+//--------------------------------------------------------------------------------
+static size_t run_to_str_batch (
+    const bench_corpus_t* corpus,
+    const bench_ring_t* ring,
+    uint64_t* bytes)
+{
+    char rows[BENCH_BATCH * BENCH_ROW];
+    size_t ok = 0, r = 0;
+
+    for (size_t i = 0; i < corpus->count; ) {
+        size_t lanes = corpus->count - i;
+        if (lanes > BENCH_BATCH) {
+            lanes = BENCH_BATCH;
+        }
+        if (lanes > ring->count - r) {
+            lanes = ring->count - r;
+        }
+
+        ok += ipv6_to_str_batch(&ring->addrs[r], lanes, rows, BENCH_ROW, IPV6_FORMAT_DEFAULT);
+        bench_sink += (uint8_t)rows[0];
+        i += lanes;
+        r += lanes;
+        if (r == ring->count) {
+            r = 0;
+        }
+    }
+
+    *bytes = (uint64_t)corpus->count * BENCH_ROW;
+    return ok;
+}
+
+//--------------------------------------------------------------------------------
+static size_t run_compare (
+    const bench_corpus_t* corpus,
+    const bench_ring_t* ring,
+    uint64_t* bytes)
+{
+    size_t equal = 0;
+
+    // Neighbours in the ring, with the last address compared to itself
+    for (size_t i = 0, r = 0; i < corpus->count; ++i) {
+        const size_t next = r + 1 < ring->count ? r + 1 : r;
+        equal += ipv6_compare(&ring->addrs[r], &ring->addrs[next], 0) == IPV6_COMPARE_OK;
+        if (++r == ring->count) {
+            r = 0;
+        }
+    }
+
+    bench_sink += equal;
+    *bytes = (uint64_t)corpus->count * 2 * sizeof(ipv6_address_t);
+    return equal;
+}
+
+static const bench_api_def_t bench_apis[] = {
+    { "ipv6_from_str", run_from_str, false },
+    { "ipv6_to_str", run_to_str, true },
+    { "ipv6_to_str_expanded", run_to_str_expanded, true },
+    { "ipv6_to_str_batch", run_to_str_batch, true },
+    { "ipv6_compare", run_compare, true },
+};
+
+//--------------------------------------------------------------------------------
+// Best of `repeat` timed passes after one warm up pass
+static void bench_run (
+    const bench_api_def_t* api,
+    const bench_corpus_t* corpus,
+    const bench_ring_t* ring,
+    const bench_perf_t* perf,
+    uint32_t repeat,
+    bench_result_t* result)
+{
+    result->ns = UINT64_MAX;
+    result->ok = api->func(corpus, ring, &result->bytes);
+
+    for (uint32_t i = 0; i < repeat; ++i) {
+        uint64_t counters[BENCH_COUNTERS];
+        uint64_t start_cycles, start, elapsed, cycles;
+        uint32_t counted;
+
+        perf_start(perf);
+        start_cycles = bench_cycles();
+        start = bench_now_ns();
+
+        api->func(corpus, ring, &result->bytes);
+
+        elapsed = bench_now_ns() - start;
+        cycles = bench_cycles() - start_cycles;
+        counted = perf_stop(perf, counters);
+
+        if (elapsed < result->ns) {
+            result->ns = elapsed;
+            result->cycles = cycles;
+            result->counted = counted;
+            memcpy(result->counters, counters, sizeof(counters));
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------
+// Write a JSON number or null if any of the counters in `mask` is missing
+static void bench_json_ratio (
+    const char* name,
+    const bench_result_t* result,
+    uint32_t mask,
+    double numerator,
+    double denominator)
+{
+    if ((result->counted & mask) != mask || denominator == 0.0) {
+        printf(", \"%s\": null", name);
+    }
+    else {
+        printf(", \"%s\": %.4f", name, numerator / denominator);
+    }
+}
+
+//--------------------------------------------------------------------------------
+static void bench_report (
+    const bench_options_t* options,
+    const bench_result_t* result,
+    bool first)
+{
+    const double ops = result->entries ? (double)result->entries : 1.0;
+    const double ns_per_op = (double)result->ns / ops;
+    const double cycles_per_op = (double)result->cycles / ops;
+    const double bytes_per_sec = result->ns ? (double)result->bytes * 1e9 / (double)result->ns : 0.0;
+
+    if (options->json) {
+        printf("%s\n    {\"api\": \"%s\", \"corpus\": \"%s\", \"entries\": %lu, \"ok\": %lu, "
+            "\"bytes\": %lu, \"ns_per_op\": %.3f, ",
+            first ? "" : ",",
+            result->api, result->corpus,
+            (unsigned long)result->entries, (unsigned long)result->ok,
+            (unsigned long)result->bytes, ns_per_op);
+        if (BENCH_HAVE_CYCLES) {
+            printf("\"cycles_per_op\": %.3f, ", cycles_per_op);
+        }
+        else {
+            printf("\"cycles_per_op\": null, ");
+        }
+        printf("\"bytes_per_sec\": %.0f", bytes_per_sec);
+
+        if (options->counters) {
+            const uint64_t* c = result->counters;
+
+            printf(", \"counters\": {");
+            for (uint32_t i = 0; i < BENCH_COUNTERS; ++i) {
+                if (result->counted & (1u << i)) {
+                    printf("%s\"%s\": %lu", i ? ", " : "", bench_counter_names[i], (unsigned long)c[i]);
+                }
+                else {
+                    printf("%s\"%s\": null", i ? ", " : "", bench_counter_names[i]);
+                }
+            }
+            printf("}");
+
+            bench_json_ratio("ipc", result,
+                (1u << BENCH_COUNTER_CYCLES) | (1u << BENCH_COUNTER_INSTRUCTIONS),
+                (double)c[BENCH_COUNTER_INSTRUCTIONS], (double)c[BENCH_COUNTER_CYCLES]);
+            bench_json_ratio("branch_misses_per_byte", result,
+                1u << BENCH_COUNTER_BRANCH_MISSES,
+                (double)c[BENCH_COUNTER_BRANCH_MISSES], (double)result->bytes);
+        }
+        printf("}");
+    }
+    else {
+        printf("%-22s %-11s %10lu %10lu %10.2f %10.2f %10.1f",
+            result->api, result->corpus,
+            (unsigned long)result->entries, (unsigned long)result->ok,
+            ns_per_op, cycles_per_op, bytes_per_sec / 1e6);
+
+        if (options->counters) {
+            const uint32_t ipc = (1u << BENCH_COUNTER_CYCLES) | (1u << BENCH_COUNTER_INSTRUCTIONS);
+            const uint64_t* c = result->counters;
+
+            if ((result->counted & ipc) == ipc && c[BENCH_COUNTER_CYCLES]) {
+                printf(" %6.2f", (double)c[BENCH_COUNTER_INSTRUCTIONS] / (double)c[BENCH_COUNTER_CYCLES]);
+            }
+            else {
+                printf(" %6s", "-");
+            }
+
+            if ((result->counted & (1u << BENCH_COUNTER_BRANCH_MISSES)) && result->bytes) {
+                printf(" %10.4f", (double)c[BENCH_COUNTER_BRANCH_MISSES] / (double)result->bytes);
+            }
+            else {
+                printf(" %10s", "-");
+            }
+        }
+        printf("\n");
+    }
+}
+
+//--------------------------------------------------------------------------------
+static bool parse_options (int argc, const char** argv, bench_options_t* options)
+{
+    options->json = false;
+    options->counters = false;
+    options->latency = false;
+    options->concurrent = false;
+    options->load = false;
+    options->iterations = 1000000;
+    options->threads = 0;
+    options->prefixes = 100000;
+    options->min = 1000;
+    options->max = 1000000;
+    options->repeat = 3;
+    options->seed = 1;
+    options->corpus = NULL;
+    options->api = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--json") == 0) {
+            options->json = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--counters") == 0) {
+            options->counters = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--latency") == 0) {
+            options->latency = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--concurrent") == 0) {
+            options->concurrent = true;
+            continue;
+        }
+
+        if (strcmp(arg, "--load") == 0) {
+            options->load = true;
+            continue;
+        }
+
+        if (!value) {
+            return false;
+        }
+
+        if (strcmp(arg, "--min") == 0) {
+            options->min = (size_t)strtoull(value, NULL, 10);
+        }
+        else if (strcmp(arg, "--max") == 0) {
+            options->max = (size_t)strtoull(value, NULL, 10);
+        }
+        else if (strcmp(arg, "--repeat") == 0) {
+            options->repeat = (uint32_t)strtoul(value, NULL, 10);
+        }
+        else if (strcmp(arg, "--seed") == 0) {
+            options->seed = strtoull(value, NULL, 10);
+        }
+        else if (strcmp(arg, "--corpus") == 0) {
+            options->corpus = value;
+        }
+        else if (strcmp(arg, "--iterations") == 0) {
+            options->iterations = strtoull(value, NULL, 10);
+        }
+        else if (strcmp(arg, "--api") == 0) {
+            options->api = value;
+        }
+        else if (strcmp(arg, "--threads") == 0) {
+            options->threads = (uint32_t)strtoul(value, NULL, 10);
+        }
+        else if (strcmp(arg, "--prefixes") == 0) {
+            options->prefixes = (size_t)strtoull(value, NULL, 10);
+        }
+        else {
+            return false;
+        }
+        ++i;
+    }
+
+    return options->min > 0 && options->min <= options->max &&
+        options->repeat > 0 && options->iterations > 0 &&
+        options->threads <= BENCH_MAX_THREADS && options->prefixes > 0;
+}
+
+//
+// Latency histograms of adversarial input
+//
+
+// Log linear histogram of tick counts: exact below BENCH_HIST_SUB, above that
+// each power of two is split into BENCH_HIST_SUB buckets
+typedef struct {
+    uint64_t                counts[BENCH_HIST_BUCKETS];
+    uint64_t                total;
+    uint64_t                max;
+} bench_hist_t;
+
+// A worst case input aimed at one parser state
+typedef struct {
+    const char*             name;
+    const char*             state;          // state_t the input spends its time in
+    const char*             text;
+    char                    pad;            // fills the input to IPV6_STRING_SIZE
+    bool                    leading;        // pad before the text instead of after
+    bool                    oversize;       // pad one byte past the limit
+} bench_case_def_t;
+
+static const bench_case_def_t bench_cases[] = {
+    { "baseline", "none", "::1", 0, false, false },
+    { "leading_whitespace", "none", "::1", ' ', true, false },
+    { "max_components", "addr_component", "1234:1234:1234:1234:1234:1234:1234:1234", ' ', false, false },
+    { "extra_component", "v6_separator", "1234:1234:1234:1234:1234:1234:1234:1234:1234", 0, false, false },
+    { "max_zerorun_move", "zerorun", "::1234:1234:1234:1234:1234:1234:1234", ' ', false, false },
+    { "second_zerorun_last", "zerorun", "1234:1234:1234::1234:1234:1234::", 0, false, false },
+    { "max_cidr", "cidr", "1234:1234:1234:1234:1234:1234:1234:1234/128", ' ', false, false },
+    { "max_zone", "iface", "fe80:1234:1234:1234:1234:1234:1234:1234/128%", 'f', false, false },
+    { "max_port", "port", "[1234:1234:1234:1234:1234:1234:1234:1234/128%abcdef0]:65535", 0, false, false },
+    { "post_addr_whitespace", "post_addr", "[1234:1234:1234:1234:1234:1234:1234:1234]:65535", ' ', false, false },
+    { "embedded_v4_last_octet", "error", "1234:1234:1234:1234:1234:1234:255.255.255.2555", 0, false, false },
+    { "invalid_last_char", "error", "[1234:1234:1234:1234:1234:1234:1234:1234/128%abcdef0]:6553x", 0, false, false },
+    { "size_exceeded", "error", "1234:1234:1234:1234:1234:1234:1234:1234", '0', true, true },
+};
+
+//--------------------------------------------------------------------------------
+static uint32_t hist_index (uint64_t value)
+{
+    uint32_t log = 0, shift;
+
+    if (value < BENCH_HIST_SUB) {
+        return (uint32_t)value;
+    }
+
+    while (value >> (log + 1)) {
+        log++;
+    }
+    shift = log - BENCH_HIST_SUB_BITS;
+    return (shift + 1) * BENCH_HIST_SUB + (uint32_t)((value >> shift) - BENCH_HIST_SUB);
+}
+
+//--------------------------------------------------------------------------------
+// Largest value counted in a bucket, percentiles are reported as upper bounds
+static uint64_t hist_upper (uint32_t index)
+{
+    uint32_t shift;
+
+    if (index < BENCH_HIST_SUB) {
+        return index;
+    }
+
+    shift = index / BENCH_HIST_SUB - 1;
+    return ((((uint64_t)(index % BENCH_HIST_SUB) + BENCH_HIST_SUB + 1) << shift) - 1);
+}
+
+//--------------------------------------------------------------------------------
+static void hist_record (bench_hist_t* hist, uint64_t value)
+{
+    hist->counts[hist_index(value)]++;
+    hist->total++;
+    if (value > hist->max) {
+        hist->max = value;
+    }
+}
+
+//--------------------------------------------------------------------------------
+static uint64_t hist_percentile (const bench_hist_t* hist, double percentile)
+{
+    const uint64_t rank = (uint64_t)(percentile / 100.0 * (double)hist->total + 0.5);
+    uint64_t seen = 0;
+
+    for (uint32_t i = 0; i < BENCH_HIST_BUCKETS; ++i) {
+        seen += hist->counts[i];
+        if (seen >= rank && seen > 0) {
+            const uint64_t upper = hist_upper(i);
+            return upper < hist->max ? upper : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+//--------------------------------------------------------------------------------
+// Ticks of the finest clock, the time stamp counter where there is one
+static uint64_t bench_ticks (void)
+{
+#if BENCH_HAVE_CYCLES
+    return bench_cycles();
+#else
+    return bench_now_ns();
+#endif
+}
+
+//--------------------------------------------------------------------------------
+// Build the input of a case, padded to the longest input the parser accepts
+static size_t case_input (const bench_case_def_t* def, char* out)
+{
+    const size_t text = strlen(def->text);
+    size_t length = text;
+
+    if (def->pad) {
+        length = IPV6_STRING_SIZE + (def->oversize ? 1 : 0);
+        memset(out, def->pad, length);
+        memcpy(def->leading ? out + length - text : out, def->text, text);
+    }
+    else {
+        memcpy(out, def->text, text);
+    }
+
+    out[length] = '\0';
+    return length;
+}
+
+//--------------------------------------------------------------------------------
+static int bench_latency (const bench_options_t* options)
+{
+    static bench_hist_t hist;
+    static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+    const uint32_t num_percentiles = (uint32_t)(sizeof(percentiles) / sizeof(percentiles[0]));
+    uint64_t overhead = UINT64_MAX;
+
+    // Smallest back to back reading of the clock is subtracted from every call
+    for (uint32_t i = 0; i < BENCH_WARMUP; ++i) {
+        const uint64_t start = bench_ticks();
+        const uint64_t elapsed = bench_ticks() - start;
+        overhead = elapsed < overhead ? elapsed : overhead;
+    }
+
+    if (options->json) {
+        printf("{\n  \"iterations\": %lu,\n  \"results\": [", (unsigned long)options->iterations);
+    }
+    else {
+        printf("%-24s %-15s %5s %3s %8s %8s %8s %8s %8s %8s\n",
+            "case", "state", "bytes", "ok", "p50", "p90", "p99", "p99.9", "p99.99", "max");
+    }
+
+    for (size_t c = 0; c < sizeof(bench_cases) / sizeof(bench_cases[0]); ++c) {
+        const bench_case_def_t* def = &bench_cases[c];
+        char input[BENCH_STRING];
+        const size_t length = case_input(def, input);
+        ipv6_address_full_t addr;
+        uint64_t start_ns, start_ticks;
+        double ns_per_tick;
+        bool ok = false;
+
+        for (uint32_t i = 0; i < BENCH_WARMUP; ++i) {
+            ok = ipv6_from_str(input, length, &addr);
+        }
+
+        memset(&hist, 0, sizeof(hist));
+        start_ns = bench_now_ns();
+        start_ticks = bench_ticks();
+        for (uint64_t i = 0; i < options->iterations; ++i) {
+            const uint64_t start = bench_ticks();
+            uint64_t elapsed;
+
+            bench_sink += ipv6_from_str(input, length, &addr);
+            elapsed = bench_ticks() - start;
+            hist_record(&hist, elapsed > overhead ? elapsed - overhead : 0);
+        }
+
+        // Convert ticks using the rate observed over the whole case
+        ns_per_tick = (double)(bench_now_ns() - start_ns) / (double)(bench_ticks() - start_ticks);
+
+        if (options->json) {
+            printf("%s\n    {\"case\": \"%s\", \"state\": \"%s\", \"bytes\": %u, \"ok\": %s",
+                c ? "," : "", def->name, def->state, (uint32_t)length, ok ? "true" : "false");
+            for (uint32_t p = 0; p < num_percentiles; ++p) {
+                printf(", \"p%g_ns\": %.1f", percentiles[p],
+                    (double)hist_percentile(&hist, percentiles[p]) * ns_per_tick);
+            }
+            printf(", \"max_ns\": %.1f}", (double)hist.max * ns_per_tick);
+        }
+        else {
+            printf("%-24s %-15s %5u %3s", def->name, def->state, (uint32_t)length, ok ? "yes" : "no");
+            for (uint32_t p = 0; p < num_percentiles; ++p) {
+                printf(" %8.1f", (double)hist_percentile(&hist, percentiles[p]) * ns_per_tick);
+            }
+            printf(" %8.1f\n", (double)hist.max * ns_per_tick);
+        }
+    }
+
+    if (options->json) {
+        printf("\n  ]\n}\n");
+    }
+    else {
+        printf("latencies in ns, percentiles are bucket upper bounds within 3.2%%\n");
+    }
+
+    return 0;
+}
+
+//
+// Concurrent prefix table lookups under updates, and bulk loading
+//
+
+typedef enum {
+    BENCH_READER,
+    BENCH_WRITER,
+    BENCH_PARSER
+} bench_role_t;
+
+typedef struct {
+    ipv6_ptable_t*          table;
+    const ipv6_address_full_t* prefixes;    // toggled by the writer
+    size_t                  num_prefixes;
+    const ipv6_address_full_t* keys;        // BENCH_KEYS addresses looked up by readers
+    uint64_t*               stop;           // set by the main thread to end the run
+    ipv6_ptable_loader_t*   loader;         // parsers fill slots first to first + count
+    const char* const*      texts;
+    size_t                  first;
+    size_t                  count;
+    uint64_t                seed;
+    uint64_t                operations;     // lookups, updates or prefixes parsed
+    uint64_t                found;          // lookups that found a prefix
+    bench_role_t            role;
+} bench_worker_t;
+
+//--------------------------------------------------------------------------------
+static void bench_worker_run (bench_worker_t* worker)
+{
+    bench_rng_t rng = { worker->seed | 1 };
+
+    if (worker->role == BENCH_PARSER) {
+        worker->operations = ipv6_ptable_loader_parse(worker->loader, worker->first,
+            worker->texts + worker->first, NULL, worker->count);
+    }
+    else if (worker->role == BENCH_WRITER) {
+        while (!IPV6_LOAD_ACQUIRE(worker->stop)) {
+            const ipv6_address_full_t* prefix = &worker->prefixes[bench_below(&rng, (uint32_t)worker->num_prefixes)];
+            if (bench_rand(&rng) & 1) {
+                ipv6_ptable_insert(worker->table, prefix, (uint32_t)worker->operations);
+            }
+            else {
+                ipv6_ptable_remove(worker->table, prefix);
+            }
+            worker->operations++;
+        }
+    }
+    else {
+        ipv6_ptable_reader_t* reader = ipv6_ptable_reader_attach(worker->table);
+        uint32_t values[BENCH_BATCH];
+        size_t offset = bench_below(&rng, BENCH_KEYS / BENCH_BATCH) * BENCH_BATCH;
+        size_t found = 0;
+
+        while (reader && !IPV6_LOAD_ACQUIRE(worker->stop)) {
+            found += ipv6_ptable_lookup_batch(reader, worker->keys + offset, values, BENCH_BATCH);
+            worker->operations += BENCH_BATCH;
+            offset = (offset + BENCH_BATCH) & (BENCH_KEYS - 1);
+        }
+
+        ipv6_ptable_reader_detach(reader);
+        worker->found = found;
+    }
+}
+
+#if BENCH_HAVE_THREADS
+#ifdef _WIN32
+typedef HANDLE bench_thread_t;
+
+//--------------------------------------------------------------------------------
+static DWORD WINAPI bench_thread_main (LPVOID arg)
+{
+    bench_worker_run((bench_worker_t*)arg);
+    return 0;
+}
+
+//--------------------------------------------------------------------------------
+static bool bench_thread_start (bench_thread_t* thread, bench_worker_t* worker)
+{
+    *thread = CreateThread(NULL, 0, bench_thread_main, worker, 0, NULL);
+    return *thread != NULL;
+}
+
+//--------------------------------------------------------------------------------
+static void bench_thread_join (bench_thread_t thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+//--------------------------------------------------------------------------------
+static void bench_sleep_ms (uint32_t ms)
+{
+    Sleep(ms);
+}
+#else
+typedef pthread_t bench_thread_t;
+
+//--------------------------------------------------------------------------------
+static void* bench_thread_main (void* arg)
+{
+    bench_worker_run((bench_worker_t*)arg);
+    return NULL;
+}
+
+//--------------------------------------------------------------------------------
+static bool bench_thread_start (bench_thread_t* thread, bench_worker_t* worker)
+{
+    return pthread_create(thread, NULL, bench_thread_main, worker) == 0;
+}
+
+//--------------------------------------------------------------------------------
+static void bench_thread_join (bench_thread_t thread)
+{
+    pthread_join(thread, NULL);
+}
+
+//--------------------------------------------------------------------------------
+static void bench_sleep_ms (uint32_t ms)
+{
+    struct timespec delay;
+    delay.tv_sec = ms / 1000;
+    delay.tv_nsec = (long)(ms % 1000) * 1000000L;
+    nanosleep(&delay, NULL);
+}
+#endif
+
+//--------------------------------------------------------------------------------
+static uint32_t bench_cores (void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (uint32_t)info.dwNumberOfProcessors;
+#elif defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+    const long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (uint32_t)online : 1;
+#else
+    return 1;
+#endif
+}
+
+//--------------------------------------------------------------------------------
+// Random prefixes from /16 to /64, one in eight an IPv4 prefix from /8 to /24
+static void bench_prefix (bench_rng_t* rng, ipv6_address_full_t* out)
+{
+    const uint64_t bits = bench_rand(rng);
+
+    memset(out, 0, sizeof(ipv6_address_full_t));
+    out->flags = IPV6_FLAG_HAS_MASK;
+    if ((bits & 7) == 0) {
+        out->flags |= IPV6_FLAG_IPV4_COMPAT;
+        out->mask = 8 + bench_below(rng, 17);
+        out->address.components[0] = (uint16_t)(bits >> 16);
+        out->address.components[1] = (uint16_t)(bits >> 32);
+    }
+    else {
+        out->mask = 16 + bench_below(rng, 49);
+        out->address.components[0] = (uint16_t)(0x2000 | ((bits >> 8) & 0x1ff));
+        for (uint32_t c = 1; c < 4; ++c) {
+            out->address.components[c] = (uint16_t)(bits >> (16 * c));
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------
+// Run `readers` reader threads and one writer for BENCH_CONCURRENT_MS
+static bool bench_concurrent_run (
+    bench_worker_t* workers,
+    uint32_t readers,
+    uint64_t* lookups,
+    uint64_t* updates,
+    uint64_t* ns)
+{
+    bench_thread_t threads[BENCH_MAX_THREADS + 1];
+    bool started = true;
+    uint32_t count = 0;
+    uint64_t start;
+
+    IPV6_STORE_RELEASE(workers[0].stop, 0);
+    for (uint32_t i = 0; i <= readers; ++i) {
+        workers[i].operations = 0;
+        workers[i].found = 0;
+    }
+
+    start = bench_now_ns();
+    for (; count <= readers && started; ++count) {
+        started = bench_thread_start(&threads[count], &workers[count]);
+    }
+    if (!started) {
+        count--;
+    }
+
+    bench_sleep_ms(BENCH_CONCURRENT_MS);
+    IPV6_STORE_RELEASE(workers[0].stop, 1);
+    for (uint32_t i = 0; i < count; ++i) {
+        bench_thread_join(threads[i]);
+    }
+    *ns = bench_now_ns() - start;
+
+    *updates = workers[0].operations;
+    *lookups = 0;
+    for (uint32_t i = 1; i <= readers; ++i) {
+        *lookups += workers[i].operations;
+        bench_sink += workers[i].found;
+    }
+
+    return started;
+}
+
+//--------------------------------------------------------------------------------
+static int bench_concurrent (const bench_options_t* options)
+{
+    const uint32_t max_readers = options->threads ? options->threads : bench_cores();
+    bench_rng_t rng = { options->seed * 31 + 7 };
+    bench_worker_t workers[BENCH_MAX_THREADS + 1];
+    ipv6_address_full_t* prefixes;
+    ipv6_address_full_t* keys;
+    ipv6_ptable_t* table;
+    uint64_t stop = 0;
+    double single = 0;
+    bool first = true;
+
+    prefixes = (ipv6_address_full_t*)malloc(options->prefixes * sizeof(ipv6_address_full_t));
+    keys = (ipv6_address_full_t*)malloc(BENCH_KEYS * sizeof(ipv6_address_full_t));
+    table = ipv6_ptable_create(max_readers);
+    if (!prefixes || !keys || !table) {
+        fprintf(stderr, "out of memory creating a table of %lu prefixes\n", (unsigned long)options->prefixes);
+        free(prefixes);
+        free(keys);
+        ipv6_ptable_destroy(table);
+        return 2;
+    }
+
+    for (size_t i = 0; i < options->prefixes; ++i) {
+        bench_prefix(&rng, &prefixes[i]);
+        ipv6_ptable_insert(table, &prefixes[i], (uint32_t)i);
+    }
+
+    // Keys fall inside the prefixes, with random bits past the mask
+    for (size_t i = 0; i < BENCH_KEYS; ++i) {
+        keys[i] = prefixes[bench_below(&rng, (uint32_t)options->prefixes)];
+        keys[i].flags &= ~IPV6_FLAG_HAS_MASK;
+        if (keys[i].flags & IPV6_FLAG_IPV4_COMPAT) {
+            keys[i].address.components[1] ^= (uint16_t)(bench_rand(&rng) & 0xff);
+        }
+        else {
+            keys[i].address.components[4] ^= (uint16_t)bench_rand(&rng);
+        }
+    }
+
+    memset(workers, 0, sizeof(workers));
+    for (uint32_t i = 0; i <= max_readers; ++i) {
+        workers[i].table = table;
+        workers[i].prefixes = prefixes;
+        workers[i].num_prefixes = options->prefixes;
+        workers[i].keys = keys;
+        workers[i].stop = &stop;
+        workers[i].seed = options->seed * 1000003 + i;
+        workers[i].role = i == 0 ? BENCH_WRITER : BENCH_READER;
+    }
+
+    if (options->json) {
+        printf("{\n  \"prefixes\": %lu,\n  \"results\": [", (unsigned long)options->prefixes);
+    }
+    else {
+        printf("%8s %14s %14s %8s %12s\n", "readers", "lookups/s", "per reader", "scaling", "updates/s");
+    }
+
+    for (uint32_t readers = 1; readers <= max_readers; readers = readers * 2 > max_readers && readers < max_readers ? max_readers : readers * 2) {
+        uint64_t lookups, updates, ns;
+
+        if (!bench_concurrent_run(workers, readers, &lookups, &updates, &ns)) {
+            fprintf(stderr, "could not start %u threads\n", readers + 1);
+            break;
+        }
+
+        const double rate = (double)lookups * 1e9 / (double)ns;
+        single = readers == 1 ? rate : single;
+
+        if (options->json) {
+            printf("%s\n    {\"readers\": %u, \"lookups_per_s\": %.0f, \"per_reader\": %.0f, "
+                "\"scaling\": %.2f, \"updates_per_s\": %.0f}",
+                first ? "" : ",", readers, rate, rate / readers, single > 0 ? rate / single : 0.0,
+                (double)updates * 1e9 / (double)ns);
+        }
+        else {
+            printf("%8u %14.0f %14.0f %8.2f %12.0f\n", readers, rate, rate / readers,
+                single > 0 ? rate / single : 0.0, (double)updates * 1e9 / (double)ns);
+        }
+        first = false;
+    }
+
+    if (options->json) {
+        printf("\n  ]\n}\n");
+    }
+
+    ipv6_ptable_destroy(table);
+    free(prefixes);
+    free(keys);
+    return 0;
+}
+
+//--------------------------------------------------------------------------------
+// Build a prefix table from text one insert at a time, then with the inputs
+// parsed on --threads threads and loaded in bulk
+static int bench_load (const bench_options_t* options)
+{
+    const uint32_t threads = options->threads ? options->threads : bench_cores();
+    const size_t count = options->prefixes;
+    bench_rng_t rng = { options->seed * 31 + 7 };
+    bench_worker_t workers[BENCH_MAX_THREADS];
+    bench_thread_t handles[BENCH_MAX_THREADS];
+    uint64_t insert_ns, parse_ns, load_ns, start;
+    size_t parsed = 0;
+    uint32_t started = 0;
+    bool loaded;
+
+    char* text = (char*)malloc(count * BENCH_CIDR_SIZE);
+    const char** texts = (const char**)malloc(count * sizeof(const char*));
+    ipv6_ptable_loader_t* loader = ipv6_ptable_loader_create(count);
+    ipv6_ptable_t* inserted = ipv6_ptable_create(0);
+    ipv6_ptable_t* bulk = ipv6_ptable_create(0);
+    if (!text || !texts || !loader || !inserted || !bulk) {
+        fprintf(stderr, "out of memory loading %lu prefixes\n", (unsigned long)count);
+        free(text);
+        free(texts);
+        ipv6_ptable_loader_destroy(loader);
+        ipv6_ptable_destroy(inserted);
+        ipv6_ptable_destroy(bulk);
+        return 2;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        ipv6_address_full_t prefix;
+        bench_prefix(&rng, &prefix);
+        char* cidr = text + i * BENCH_CIDR_SIZE;
+        const size_t length = ipv6_to_str(&prefix, cidr, BENCH_CIDR_SIZE);
+
+        // IPv4 addresses are formatted without their mask
+        if (prefix.flags & IPV6_FLAG_IPV4_COMPAT) {
+            snprintf(cidr + length, BENCH_CIDR_SIZE - length, "/%u", prefix.mask);
+        }
+        texts[i] = cidr;
+    }
+
+    start = bench_now_ns();
+    for (size_t i = 0; i < count; ++i) {
+        ipv6_address_full_t prefix;
+        if (ipv6_from_str(texts[i], strlen(texts[i]), &prefix)) {
+            ipv6_ptable_insert(inserted, &prefix, (uint32_t)i);
+        }
+    }
+    insert_ns = bench_now_ns() - start;
+
+    memset(workers, 0, sizeof(workers));
+    start = bench_now_ns();
+    for (uint32_t i = 0; i < threads; ++i) {
+        workers[i].loader = loader;
+        workers[i].texts = texts;
+        workers[i].first = count * i / threads;
+        workers[i].count = count * (i + 1) / threads - workers[i].first;
+        workers[i].role = BENCH_PARSER;
+        if (bench_thread_start(&handles[started], &workers[i])) {
+            started++;
+        }
+        else {
+            bench_worker_run(&workers[i]);
+        }
+    }
+    for (uint32_t i = 0; i < started; ++i) {
+        bench_thread_join(handles[i]);
+    }
+    parse_ns = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    loaded = ipv6_ptable_load(bulk, loader);
+    load_ns = bench_now_ns() - start;
+
+    for (uint32_t i = 0; i < threads; ++i) {
+        parsed += workers[i].operations;
+    }
+
+    if (options->json) {
+        printf("{\n  \"prefixes\": %lu,\n  \"parsed\": %lu,\n  \"threads\": %u,\n"
+            "  \"insert_ms\": %.1f,\n  \"parse_ms\": %.1f,\n  \"load_ms\": %.1f,\n  \"speedup\": %.2f\n}\n",
+            (unsigned long)count, (unsigned long)parsed, threads, insert_ns / 1e6, parse_ns / 1e6, load_ns / 1e6,
+            (double)insert_ns / (double)(parse_ns + load_ns));
+    }
+    else {
+        printf("%lu prefixes, %lu parsed\n", (unsigned long)count, (unsigned long)parsed);
+        printf("  parse and insert:         %10.1f ms\n", insert_ns / 1e6);
+        printf("  parse on %3u threads:     %10.1f ms\n", threads, parse_ns / 1e6);
+        printf("  sort and build:           %10.1f ms\n", load_ns / 1e6);
+        printf("  speedup:                  %10.2fx\n", (double)insert_ns / (double)(parse_ns + load_ns));
+    }
+
+    ipv6_ptable_loader_destroy(loader);
+    ipv6_ptable_destroy(inserted);
+    ipv6_ptable_destroy(bulk);
+    free(text);
+    free(texts);
+    return loaded ? 0 : 2;
+}
+#else
+//--------------------------------------------------------------------------------
+static int bench_concurrent (const bench_options_t* options)
+{
+    (void)options;
+    fprintf(stderr, "--concurrent needs threads\n");
+    return 1;
+}
+
+//--------------------------------------------------------------------------------
+static int bench_load (const bench_options_t* options)
+{
+    (void)options;
+    fprintf(stderr, "--load needs threads\n");
+    return 1;
+}
+#endif
+
+int main (int argc, const char** argv) {
+    bench_options_t options;
+    bench_perf_t perf;
+    bool first = true;
+
+    if (!parse_options(argc, argv, &options)) {
+        printf("usage: %s [--json] [--counters] [--min N] [--max N] [--repeat N] [--seed N] "
+            "[--corpus NAME] [--api NAME]\n", argv[0]);
+        printf("       %s --latency [--json] [--iterations N]\n", argv[0]);
+        printf("       %s --concurrent [--json] [--threads N] [--prefixes N] [--seed N]\n", argv[0]);
+        printf("       %s --load [--json] [--threads N] [--prefixes N] [--seed N]\n", argv[0]);
+        return 1;
+    }
+
+    if (options.latency) {
+        return bench_latency(&options);
+    }
+
+    if (options.concurrent) {
+        return bench_concurrent(&options);
+    }
+
+    if (options.load) {
+        return bench_load(&options);
+    }
+
+    perf.enabled = false;
+    if (options.counters) {
+        const char* reason = NULL;
+        if (!perf_create(&perf, &reason)) {
+            fprintf(stderr, "hardware counters disabled: %s\n", reason);
+        }
+    }
+
+    if (options.json) {
+        printf("{\n  \"seed\": %lu,\n  \"repeat\": %u,\n  \"counters\": %s,\n  \"results\": [",
+            (unsigned long)options.seed, options.repeat, perf.enabled ? "true" : "false");
+    }
+    else {
+        printf("%-22s %-11s %10s %10s %10s %10s %10s",
+            "api", "corpus", "entries", "ok", "ns/op", "cycles/op", "MB/s");
+        if (options.counters) {
+            printf(" %6s %10s", "IPC", "brmiss/B");
+        }
+        printf("\n");
+    }
+
+    for (size_t size = options.min; size <= options.max; size *= 10) {
+        for (size_t c = 0; c < sizeof(bench_corpora) / sizeof(bench_corpora[0]); ++c) {
+            const bench_corpus_def_t* def = &bench_corpora[c];
+            bench_corpus_t corpus;
+            bench_ring_t ring = { NULL, 0 };
+
+            if (options.corpus && strcmp(options.corpus, def->name) != 0) {
+                continue;
+            }
+
+            // Seeded per corpus so that smaller corpora are prefixes of larger ones
+            if (!corpus_create(&corpus, def, size, options.seed * 31 + c) ||
+                !ring_create(&ring, &corpus))
+            {
+                fprintf(stderr, "out of memory generating %lu %s entries\n",
+                    (unsigned long)size, def->name);
+                corpus_destroy(&corpus);
+                free(ring.addrs);
+                perf_destroy(&perf);
+                return 2;
+            }
+
+            for (size_t a = 0; a < sizeof(bench_apis) / sizeof(bench_apis[0]); ++a) {
+                const bench_api_def_t* api = &bench_apis[a];
+                bench_result_t result;
+
+                if ((options.api && strcmp(options.api, api->name) != 0) ||
+                    (api->formats && ring.count == 0))
+                {
+                    continue;
+                }
+
+                memset(&result, 0, sizeof(result));
+                result.api = api->name;
+                result.corpus = def->name;
+                result.entries = corpus.count;
+                bench_run(api, &corpus, &ring, &perf, options.repeat, &result);
+                bench_report(&options, &result, first);
+                first = false;
+            }
+
+            corpus_destroy(&corpus);
+            free(ring.addrs);
+        }
+
+        if (size > options.max / 10) {
+            break;
+        }
+    }
+
+    if (options.json) {
+        printf("\n  ]\n}\n");
+    }
+
+    perf_destroy(&perf);
+    return 0;
+}
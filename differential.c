@@ -0,0 +1,682 @@
+// Differential validation of the parser and formatter
+//
+// Generates addresses from the IPv6 and IPv4 grammars, mutates some of them
+// and checks every input against:
+//
+// - reference: ipv6_from_str against ipv6_from_str_diag with a diagnostic
+//   callback, which always runs the full state machine
+// - pton: acceptance and value against inet_pton for input without port,
+//   CIDR mask or zone
+// - lenient: input the parser accepts but inet_pton rejects, such as more
+//   than 4 hex digits or a "::" that stands for no components. These are
+//   known leniencies of the state machine and only fail the run with --strict
+// - ntop: ipv6_to_str against inet_ntop
+// - roundtrip: parsing the compressed and expanded output gives the same address
+//
+// Work is split across threads with one generator per thread so a run is
+// reproducible for a given seed and thread count. The exit code is 1 if any
+// check mismatched.
+//
+//     ipv6-differential [--count N] [--threads N] [--seed N] [--strict 1]
+//
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L     // clock_gettime, inet_ntop
+#endif
+
+#include "ipv6.h"
+#include "ipv6_config.h"
+#include "ipv6_test_config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_WINSOCK_2_H
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <winsock2.h>
+#endif
+
+#ifdef HAVE_WS_2_TCPIP_H
+#include <ws2tcpip.h>
+#endif
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#ifdef HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+
+#ifdef HAVE_ARPA_INET_H
+#include <arpa/inet.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if !defined(_WIN32) && defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#endif
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+#define DIFF_MAX_INPUT          64          // longest generated input including the nul
+#define DIFF_MAX_THREADS        256
+#define DIFF_MAX_EXAMPLES       2           // mismatches kept per check and thread
+#define DIFF_STRING             128
+#define DIFF_DETAIL             (2 * DIFF_STRING + 64)
+
+typedef enum {
+    DIFF_CHECK_REFERENCE,
+    DIFF_CHECK_PTON,
+    DIFF_CHECK_LENIENT,
+    DIFF_CHECK_NTOP,
+    DIFF_CHECK_ROUNDTRIP,
+    DIFF_CHECKS
+} diff_check_t;
+
+static const char* diff_check_names[DIFF_CHECKS] = {
+    "reference",
+    "pton",
+    "lenient",
+    "ntop",
+    "roundtrip",
+};
+
+typedef struct {
+    char                    input[DIFF_MAX_INPUT];
+    char                    detail[DIFF_DETAIL];
+} diff_example_t;
+
+typedef struct {
+    uint64_t                seed;
+    uint64_t                count;
+    uint64_t                inputs;
+    uint64_t                accepted;
+    uint64_t                extensions;     // port, mask or zone, not comparable to inet_pton
+    uint64_t                compared[DIFF_CHECKS];
+    uint64_t                mismatches[DIFF_CHECKS];
+    diff_example_t          examples[DIFF_CHECKS][DIFF_MAX_EXAMPLES];
+    uint32_t                num_examples[DIFF_CHECKS];
+} diff_worker_t;
+
+typedef struct {
+    uint64_t                state;
+} diff_rng_t;
+
+//--------------------------------------------------------------------------------
+// xorshift64*, the state is never zero
+static uint64_t diff_rand (diff_rng_t* rng)
+{
+    rng->state ^= rng->state >> 12;
+    rng->state ^= rng->state << 25;
+    rng->state ^= rng->state >> 27;
+    return rng->state * UINT64_C(0x2545f4914f6cdd1d);
+}
+
+//--------------------------------------------------------------------------------
+static uint32_t diff_below (diff_rng_t* rng, uint32_t bound)
+{
+    return (uint32_t)(((diff_rand(rng) >> 32) * bound) >> 32);
+}
+
+//--------------------------------------------------------------------------------
+static uint64_t diff_now_ns (void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * UINT64_C(1000000000) + (uint64_t)now.tv_nsec;
+#endif
+}
+
+//--------------------------------------------------------------------------------
+// Hex component of 1-4 digits, sometimes with leading zeros or upper case
+static size_t gen_hex (diff_rng_t* rng, char* out)
+{
+    static const char* digits[2] = { "0123456789abcdef", "0123456789ABCDEF" };
+    const char* set = digits[diff_below(rng, 8) == 0];
+    const uint32_t width = 1 + diff_below(rng, 4);
+    uint32_t value = (uint32_t)diff_rand(rng) & 0xffff;
+    size_t n = 0;
+
+    // Favour zero and short components as in real addresses
+    switch (diff_below(rng, 4)) {
+        case 0: value = 0; break;
+        case 1: value &= 0xff; break;
+        default: break;
+    }
+    value &= (uint32_t)((UINT64_C(1) << (width * 4)) - 1);
+
+    for (int32_t shift = (int32_t)width * 4 - 4; shift >= 0; shift -= 4) {
+        const uint32_t nibble = (value >> shift) & 0xf;
+        // Keep the padding only some of the time
+        if (nibble || n || shift == 0 || diff_below(rng, 2)) {
+            out[n++] = set[nibble];
+        }
+    }
+
+    return n;
+}
+
+//--------------------------------------------------------------------------------
+static size_t gen_ipv4 (diff_rng_t* rng, char* out)
+{
+    size_t n = 0;
+
+    for (uint32_t i = 0; i < 4; ++i) {
+        if (i) {
+            out[n++] = '.';
+        }
+        n += (size_t)sprintf(out + n, "%u", diff_below(rng, 256));
+    }
+
+    return n;
+}
+
+//--------------------------------------------------------------------------------
+// Any valid IPv6 text form: a single "::" anywhere or none, optionally ending
+// with an embedded IPv4 address
+static size_t gen_ipv6 (diff_rng_t* rng, char* out)
+{
+    const bool embed = diff_below(rng, 6) == 0;
+    const uint32_t slots = embed ? 6 : 8;
+    const bool zerorun = diff_below(rng, 4) != 0;
+    uint32_t before = 0, after = 0;
+    size_t n = 0;
+
+    if (zerorun) {
+        // The run covers at least one component
+        const uint32_t written = diff_below(rng, slots);
+        before = diff_below(rng, written + 1);
+        after = written - before;
+    }
+    else {
+        before = slots;
+    }
+
+    for (uint32_t i = 0; i < before; ++i) {
+        if (i) {
+            out[n++] = ':';
+        }
+        n += gen_hex(rng, out + n);
+    }
+
+    if (zerorun) {
+        out[n++] = ':';
+        out[n++] = ':';
+    }
+
+    for (uint32_t i = 0; i < after; ++i) {
+        if (i) {
+            out[n++] = ':';
+        }
+        n += gen_hex(rng, out + n);
+    }
+
+    if (embed) {
+        if (out[n - 1] != ':') {
+            out[n++] = ':';
+        }
+        n += gen_ipv4(rng, out + n);
+    }
+
+    return n;
+}
+
+//--------------------------------------------------------------------------------
+// Edit a valid form with characters of the address alphabet so most inputs
+// are near misses
+static size_t gen_mutate (diff_rng_t* rng, char* out, size_t n)
+{
+    static const char alphabet[] = "0123456789abcdefABCDEF:.";
+    const uint32_t edits = 1 + diff_below(rng, 3);
+
+    for (uint32_t e = 0; e < edits; ++e) {
+        const size_t at = n ? diff_below(rng, (uint32_t)n) : 0;
+        const char c = alphabet[diff_below(rng, sizeof(alphabet) - 1)];
+
+        switch (diff_below(rng, 4)) {
+            case 0:
+                if (n) {
+                    out[at] = c;
+                }
+                break;
+
+            case 1:
+                if (n + 1 < DIFF_MAX_INPUT - 8) {
+                    memmove(out + at + 1, out + at, n - at);
+                    out[at] = c;
+                    n++;
+                }
+                break;
+
+            case 2:
+                if (n > 1) {
+                    memmove(out + at, out + at + 1, n - at - 1);
+                    n--;
+                }
+                break;
+
+            default:
+                // Repeat a separator, which creates extra runs and empty components
+                if (n + 1 < DIFF_MAX_INPUT - 8) {
+                    memmove(out + at + 1, out + at, n - at);
+                    out[at] = diff_below(rng, 4) ? ':' : '.';
+                    n++;
+                }
+                break;
+        }
+    }
+
+    return n;
+}
+
+//--------------------------------------------------------------------------------
+static size_t gen_input (diff_rng_t* rng, char* out)
+{
+    static const char alphabet[] = "0123456789abcdefABCDEF:.";
+    const uint32_t pick = diff_below(rng, 16);
+    size_t n;
+
+    if (pick == 0) {
+        n = 1 + diff_below(rng, 40);
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = alphabet[diff_below(rng, sizeof(alphabet) - 1)];
+        }
+    }
+    else {
+        n = pick < 3 ? gen_ipv4(rng, out) : gen_ipv6(rng, out);
+        if (diff_below(rng, 2)) {
+            n = gen_mutate(rng, out, n);
+        }
+    }
+
+    out[n] = '\0';
+    return n;
+}
+
+//--------------------------------------------------------------------------------
+static void diff_mismatch (
+    diff_worker_t* worker,
+    diff_check_t check,
+    const char* input,
+    const char* detail)
+{
+    diff_example_t* example;
+
+    worker->mismatches[check]++;
+    if (worker->num_examples[check] == DIFF_MAX_EXAMPLES) {
+        return;
+    }
+
+    example = &worker->examples[check][worker->num_examples[check]++];
+    snprintf(example->input, sizeof(example->input), "%s", input);
+    snprintf(example->detail, sizeof(example->detail), "%s", detail);
+}
+
+//--------------------------------------------------------------------------------
+static void diff_bytes (const ipv6_address_t* address, uint8_t* bytes)
+{
+    for (uint32_t i = 0; i < IPV6_NUM_COMPONENTS; ++i) {
+        bytes[i * 2] = (uint8_t)(address->components[i] >> 8);
+        bytes[i * 2 + 1] = (uint8_t)address->components[i];
+    }
+}
+
+//--------------------------------------------------------------------------------
+static void diag_ignore (
+    ipv6_diag_event_t event,
+    const ipv6_diag_info_t* info,
+    void* user_data)
+{
+    (void)event;
+    (void)info;
+    (*(uint32_t*)user_data)++;
+}
+
+//--------------------------------------------------------------------------------
+static void check_reference (
+    diff_worker_t* worker,
+    const char* input,
+    size_t length,
+    const ipv6_address_full_t* addr,
+    bool ok)
+{
+    ipv6_address_full_t reference;
+    uint32_t events = 0;
+    bool reference_ok;
+
+    memset(&reference, 0, sizeof(reference));
+    reference_ok = ipv6_from_str_diag(input, length, &reference, diag_ignore, &events);
+
+    worker->compared[DIFF_CHECK_REFERENCE]++;
+    if (ok != reference_ok ||
+        (ok && memcmp(addr, &reference, sizeof(reference)) != 0) ||
+        (!ok && events == 0))
+    {
+        diff_mismatch(worker, DIFF_CHECK_REFERENCE, input,
+            ok != reference_ok ? "accepted by one entry point only" :
+            ok ? "different address" : "rejected without a diagnostic");
+    }
+}
+
+//--------------------------------------------------------------------------------
+static void check_pton (
+    diff_worker_t* worker,
+    const char* input,
+    const ipv6_address_full_t* addr,
+    bool ok)
+{
+    uint8_t expected[16], actual[16];
+    const bool v6 = inet_pton(AF_INET6, input, expected) == 1;
+    const bool v4 = !v6 && inet_pton(AF_INET, input, expected) == 1;
+
+    worker->compared[DIFF_CHECK_PTON]++;
+    if (!ok) {
+        if (v6 || v4) {
+            diff_mismatch(worker, DIFF_CHECK_PTON, input,
+                v6 ? "inet_pton(AF_INET6) accepted" : "inet_pton(AF_INET) accepted");
+        }
+        return;
+    }
+
+    worker->compared[DIFF_CHECK_LENIENT]++;
+    diff_bytes(&addr->address, actual);
+    if (addr->flags & IPV6_FLAG_IPV4_COMPAT) {
+        // IPv4 compatible addresses hold the IPv4 address in the first 4 bytes
+        if (!v4) {
+                diff_mismatch(worker, DIFF_CHECK_LENIENT, input, "inet_pton(AF_INET) rejected");
+        }
+        else if (memcmp(actual, expected, 4) != 0) {
+            diff_mismatch(worker, DIFF_CHECK_PTON, input, "IPv4 value differs");
+        }
+    }
+    else if (!v6) {
+        diff_mismatch(worker, DIFF_CHECK_LENIENT, input, "inet_pton(AF_INET6) rejected");
+    }
+    else if (memcmp(actual, expected, 16) != 0) {
+        diff_mismatch(worker, DIFF_CHECK_PTON, input, "IPv6 value differs");
+    }
+}
+
+//--------------------------------------------------------------------------------
+static void check_ntop (
+    diff_worker_t* worker,
+    const char* input,
+    const ipv6_address_full_t* addr)
+{
+    ipv6_address_full_t plain, reparsed;
+    char expected[DIFF_STRING], actual[DIFF_STRING], detail[DIFF_DETAIL];
+    uint8_t bytes[16];
+
+    // inet_ntop chooses dotted IPv4 output itself, format the plain address
+    memset(&plain, 0, sizeof(plain));
+    plain.address = addr->address;
+    diff_bytes(&plain.address, bytes);
+
+    worker->compared[DIFF_CHECK_NTOP]++;
+    if (!inet_ntop(AF_INET6, bytes, expected, sizeof(expected)) ||
+        !ipv6_to_str(&plain, actual, sizeof(actual)))
+    {
+        diff_mismatch(worker, DIFF_CHECK_NTOP, input, "formatting failed");
+        return;
+    }
+
+    if (strchr(expected, '.')) {
+        // Compare values when inet_ntop used an IPv4 suffix
+        if (!ipv6_from_str(expected, strlen(expected), &reparsed) ||
+            memcmp(&reparsed.address, &plain.address, sizeof(plain.address)) != 0)
+        {
+            sprintf(detail, "inet_ntop \"%s\" does not parse back", expected);
+            diff_mismatch(worker, DIFF_CHECK_NTOP, input, detail);
+        }
+    }
+    else if (strcmp(expected, actual) != 0) {
+        sprintf(detail, "ipv6_to_str \"%s\", inet_ntop \"%s\"", actual, expected);
+        diff_mismatch(worker, DIFF_CHECK_NTOP, input, detail);
+    }
+}
+
+//--------------------------------------------------------------------------------
+static void check_roundtrip (
+    diff_worker_t* worker,
+    const char* input,
+    const ipv6_address_full_t* addr)
+{
+    static const uint32_t formats[2] = { IPV6_FORMAT_DEFAULT, IPV6_FORMAT_EXPANDED };
+    char text[DIFF_STRING], detail[DIFF_DETAIL];
+    ipv6_address_full_t reparsed;
+    ipv6_address_t mapped;
+
+    // The expanded form writes IPv4 compatible addresses as IPv4 mapped
+    memset(&mapped, 0, sizeof(mapped));
+    mapped.components[5] = 0xffff;
+    mapped.components[6] = addr->address.components[0];
+    mapped.components[7] = addr->address.components[1];
+
+    worker->compared[DIFF_CHECK_ROUNDTRIP]++;
+    for (uint32_t f = 0; f < 2; ++f) {
+        const size_t length = ipv6_to_str_format(addr, text, sizeof(text), formats[f]);
+        const ipv6_address_t* expected =
+            (formats[f] & IPV6_FORMAT_EXPANDED) && (addr->flags & IPV6_FLAG_IPV4_COMPAT) ?
+            &mapped : &addr->address;
+
+        if (!length || !ipv6_from_str(text, length, &reparsed) ||
+            memcmp(&reparsed.address, expected, sizeof(*expected)) != 0 ||
+            reparsed.mask != addr->mask ||
+            reparsed.port != addr->port)
+        {
+            sprintf(detail, "\"%s\" does not parse back to the same address", text);
+            diff_mismatch(worker, DIFF_CHECK_ROUNDTRIP, input, detail);
+            return;
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------
+static void diff_run (diff_worker_t* worker)
+{
+    diff_rng_t rng;
+    char input[DIFF_MAX_INPUT];
+
+    rng.state = (worker->seed << 1) | 1;
+    for (uint64_t i = 0; i < worker->count; ++i) {
+        const size_t length = gen_input(&rng, input);
+        ipv6_address_full_t addr;
+        bool ok;
+
+        memset(&addr, 0, sizeof(addr));
+        ok = ipv6_from_str(input, length, &addr);
+        worker->inputs++;
+        worker->accepted += ok;
+
+        check_reference(worker, input, length, &addr, ok);
+
+        if (ok) {
+            check_roundtrip(worker, input, &addr);
+        }
+
+        // Ports, masks and zones are extensions inet_pton does not know
+        if (ok && ((addr.flags & (IPV6_FLAG_HAS_PORT | IPV6_FLAG_HAS_MASK)) || addr.iface_len)) {
+            worker->extensions++;
+            continue;
+        }
+
+        check_pton(worker, input, &addr, ok);
+        if (ok && !(addr.flags & IPV6_FLAG_IPV4_COMPAT)) {
+            check_ntop(worker, input, &addr);
+        }
+    }
+}
+
+#ifdef _WIN32
+//--------------------------------------------------------------------------------
+static DWORD WINAPI diff_thread (LPVOID arg)
+{
+    diff_run((diff_worker_t*)arg);
+    return 0;
+}
+#elif defined(HAVE_PTHREAD_H)
+//--------------------------------------------------------------------------------
+static void* diff_thread (void* arg)
+{
+    diff_run((diff_worker_t*)arg);
+    return NULL;
+}
+#endif
+
+//--------------------------------------------------------------------------------
+// Run the workers on their own threads, or one after the other where there
+// are no threads
+static void diff_run_all (diff_worker_t* workers, uint32_t count)
+{
+#ifdef _WIN32
+    HANDLE threads[DIFF_MAX_THREADS];
+
+    for (uint32_t i = 0; i < count; ++i) {
+        threads[i] = CreateThread(NULL, 0, diff_thread, &workers[i], 0, NULL);
+        if (!threads[i]) {
+            diff_run(&workers[i]);
+        }
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        if (threads[i]) {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+        }
+    }
+#elif defined(HAVE_PTHREAD_H)
+    pthread_t threads[DIFF_MAX_THREADS];
+    bool started[DIFF_MAX_THREADS];
+
+    for (uint32_t i = 0; i < count; ++i) {
+        started[i] = pthread_create(&threads[i], NULL, diff_thread, &workers[i]) == 0;
+        if (!started[i]) {
+            diff_run(&workers[i]);
+        }
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+#else
+    for (uint32_t i = 0; i < count; ++i) {
+        diff_run(&workers[i]);
+    }
+#endif
+}
+
+//--------------------------------------------------------------------------------
+static uint32_t default_threads (void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (uint32_t)info.dwNumberOfProcessors;
+#elif defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+    const long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (uint32_t)online : 1;
+#else
+    return 1;
+#endif
+}
+
+int main (int argc, const char** argv) {
+    uint64_t count = 10000000, seed = 1;
+    uint32_t num_threads = default_threads();
+    diff_worker_t* workers;
+    diff_worker_t total;
+    uint64_t start, elapsed, failures = 0;
+    bool valid = argc % 2 == 1, strict = false;
+
+    for (int i = 1; valid && i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--count") == 0) {
+            count = strtoull(argv[i + 1], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--threads") == 0) {
+            num_threads = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--seed") == 0) {
+            seed = strtoull(argv[i + 1], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--strict") == 0) {
+            strict = strcmp(argv[i + 1], "0") != 0;
+        }
+        else {
+            valid = false;
+        }
+    }
+
+    if (!valid || count == 0 || num_threads == 0 || num_threads > DIFF_MAX_THREADS) {
+        printf("usage: %s [--count N] [--threads N] [--seed N] [--strict 1]\n", argv[0]);
+        return 2;
+    }
+
+    workers = (diff_worker_t*)calloc(num_threads, sizeof(diff_worker_t));
+    if (!workers) {
+        return 2;
+    }
+
+    for (uint32_t i = 0; i < num_threads; ++i) {
+        workers[i].seed = seed * 0x9e3779b97f4a7c15ull + i;
+        workers[i].count = count / num_threads + (i < count % num_threads);
+    }
+
+    start = diff_now_ns();
+    diff_run_all(workers, num_threads);
+    elapsed = diff_now_ns() - start;
+
+    memset(&total, 0, sizeof(total));
+    for (uint32_t i = 0; i < num_threads; ++i) {
+        total.inputs += workers[i].inputs;
+        total.accepted += workers[i].accepted;
+        total.extensions += workers[i].extensions;
+        for (uint32_t c = 0; c < DIFF_CHECKS; ++c) {
+            total.compared[c] += workers[i].compared[c];
+            total.mismatches[c] += workers[i].mismatches[c];
+        }
+        for (uint32_t c = 0; c < DIFF_CHECKS; ++c) {
+            for (uint32_t e = 0; e < workers[i].num_examples[c]; ++e) {
+                const diff_example_t* example = &workers[i].examples[c][e];
+                printf("mismatch %-9s \"%s\": %s\n",
+                    diff_check_names[c], example->input, example->detail);
+            }
+        }
+    }
+
+    printf("inputs: %lu, accepted: %lu, with port/mask/zone: %lu, threads: %u, seed: %lu\n",
+        (unsigned long)total.inputs, (unsigned long)total.accepted,
+        (unsigned long)total.extensions, num_threads, (unsigned long)seed);
+    printf("throughput: %.0f inputs/s\n",
+        elapsed ? (double)total.inputs * 1e9 / (double)elapsed : 0.0);
+    for (uint32_t c = 0; c < DIFF_CHECKS; ++c) {
+        printf("  %-10s compared %12lu  mismatches %lu\n", diff_check_names[c],
+            (unsigned long)total.compared[c], (unsigned long)total.mismatches[c]);
+        if (c != DIFF_CHECK_LENIENT || strict) {
+            failures += total.mismatches[c];
+        }
+    }
+
+    free(workers);
+    return failures ? 1 : 0;
+}
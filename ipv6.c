@@ -1,5 +1,6 @@
 #include "ipv6.h"
 #include "ipv6_config.h"
+#include "ipv6_internal.h"
 
 
 #ifdef HAVE_STDIO_H
@@ -14,12 +15,28 @@
 #include <stdarg.h>
 #endif
 
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
 #if defined(PARSE_TRACE)
 #define IPV6_TRACE(...) printf(__VA_ARGS__)
 #else
 #define IPV6_TRACE(...)
 #endif
 
+//
+// USDT probes, a nop in the instruction stream until a tracer attaches
+//
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define IPV6_PROBE2(name, a, b) DTRACE_PROBE2(ipv6, name, a, b)
+#define IPV6_PROBE3(name, a, b, c) DTRACE_PROBE3(ipv6, name, a, b, c)
+#else
+#define IPV6_PROBE2(name, a, b)
+#define IPV6_PROBE3(name, a, b, c)
+#endif
+
 #ifdef HAVE__SNPRINTF_S
 #define platform_snprintf(buffer, bytes, format, ...) \
     _snprintf_s(buffer, bytes, _TRUNCATE, format, __VA_ARGS__)
@@ -99,14 +116,28 @@ typedef struct ipv6_reader_state_t {
     uint32_t                    flags;              // flags recording state
     ipv6_diag_func_t            diag_func;          // callback for diagnostics
     void*                       user_data;          // user data passed to diag callback
+    ipv6_trace_entry_t*         trace;              // trace entry being recorded or NULL
+    ipv6_diag_event_t           error_event;        // first diagnostic event that failed the parse
 } ipv6_reader_state_t;
 
+//
+// Ring of trace entries written by the thread it is attached to
+//
+struct ipv6_trace_t {
+    ipv6_trace_entry_t*         entries;
+    uint64_t                    capacity;
+    uint64_t                    started;            // number of entries begun
+    uint64_t                    published;          // number of complete entries
+};
+
+static IPV6_THREAD_LOCAL ipv6_trace_t* trace_current;
+static IPV6_THREAD_LOCAL ipv6_stats_t* stats_current;
+
 
 //
 // Enable this section to get a full dump of the parser
 //
 
-#if defined(PARSE_TRACE)
 //--------------------------------------------------------------------------------
 static const char* state_str (state_t state)
 {
@@ -125,6 +156,7 @@ static const char* state_str (state_t state)
     return "<unknown>";
 }
 
+#if defined(PARSE_TRACE)
 //--------------------------------------------------------------------------------
 static const char* eventclass_str (eventclass_t input)
 {
@@ -152,10 +184,14 @@ static const char* eventclass_str (eventclass_t input)
 #define CHANGE_STATE(value) \
     IPV6_TRACE("  * %s -> %s %s:%u\n", \
         state_str(state->current), state_str(value), __FILE__, (uint32_t)__LINE__); \
+    IPV6_PROBE3(state_change, state->current, value, state->position); \
+    trace_event(state, IPV6_TRACE_STATE, value); \
     state->current = value;
 
 #define BEGIN_TOKEN(offset) \
     IPV6_TRACE("  * %s: token begin at %u\n", state_str(state->current), state->position + offset); \
+    IPV6_PROBE2(token_begin, state->current, state->position + offset); \
+    trace_event(state, IPV6_TRACE_TOKEN, (uint32_t)(state->position + offset)); \
     state->token_position = state->position + offset; \
     state->token_len = 0; \
 
@@ -179,18 +215,41 @@ static const char* eventclass_str (eventclass_t input)
         action; \
     }
 
+//--------------------------------------------------------------------------------
+// Record a parser event into the attached trace entry
+static void trace_event (ipv6_reader_state_t* state,
+    ipv6_trace_kind_t kind,
+    uint32_t value)
+{
+    ipv6_trace_entry_t* entry = state->trace;
+
+    if (entry && entry->num_events < IPV6_TRACE_MAX_EVENTS) {
+        ipv6_trace_event_t* event = &entry->events[entry->num_events++];
+        event->kind = (uint8_t)kind;
+        event->state = (uint8_t)state->current;
+        event->value = (uint16_t)value;
+        event->position = state->position;
+    }
+}
+
 //--------------------------------------------------------------------------------
 // Indicate error, function here for breakpoints
 static void ipv6_error (ipv6_reader_state_t* state,
     ipv6_diag_event_t event,
     const char* message)
 {
+    IPV6_PROBE3(parse_error, event, state->position, message);
+    trace_event(state, IPV6_TRACE_ERROR, event);
+
     ipv6_diag_info_t info;
     info.message = message;
     info.input = state->input;
     info.position = state->position;
 
     state->diag_func(event, &info, state->user_data);
+    if (!(state->flags & READER_FLAG_ERROR)) {
+        state->error_event = event;
+    }
     state->flags |= READER_FLAG_ERROR;
     state->error_message = message;
     CHANGE_STATE(STATE_ERROR);
@@ -343,6 +402,14 @@ static void ipvx_parse_cidr (ipv6_reader_state_t* state) {
     state->address_full->flags |= IPV6_FLAG_HAS_MASK;
 }
 
+//--------------------------------------------------------------------------------
+static void ipvx_parse_iface (ipv6_reader_state_t* state) {
+    if (state->token_len > 0) {
+        state->address_full->iface = state->input + state->token_position;
+        state->address_full->iface_len = (uint32_t)state->token_len;
+    }
+}
+
 //--------------------------------------------------------------------------------
 static void ipvx_parse_port (ipv6_reader_state_t* state) {
     int32_t port = read_decimal_token(state);
@@ -474,6 +541,7 @@ static void ipv6_state_transition (
                 case EC_IFACE:
                     ipvx_parse_component(state);
                     CHANGE_STATE(STATE_IFACE);
+                    BEGIN_TOKEN(1); // start the interface token after the separator
                     break;
 
                 case EC_CIDR_MASK:
@@ -529,6 +597,7 @@ static void ipv6_state_transition (
 
                 case EC_IFACE:
                     CHANGE_STATE(STATE_IFACE);
+                    BEGIN_TOKEN(1); // start the interface token after the separator
                     break;
 
                 case EC_CIDR_MASK:
@@ -547,14 +616,17 @@ static void ipv6_state_transition (
             // TODO: identify all valid interface characters
             switch (input) {
                 case EC_WHITESPACE:
+                    ipvx_parse_iface(state);
                     CHANGE_STATE(STATE_NONE);
                     break;
 
                 case EC_CLOSE_BRACKET:
+                    ipvx_parse_iface(state);
                     CHANGE_STATE(STATE_POST_ADDR);
                     break;
 
                 default:
+                    state->token_len++;
                     break;
             }
             break;
@@ -578,6 +650,7 @@ static void ipv6_state_transition (
                 case EC_IFACE:
                     ipvx_parse_cidr(state);
                     CHANGE_STATE(STATE_IFACE);
+                    BEGIN_TOKEN(1); // start the interface token after the separator
                     break;
 
                 default:
@@ -623,143 +696,146 @@ static void ipv6_state_transition (
 }
 
 //--------------------------------------------------------------------------------
-bool IPV6_API_DEF(ipv6_from_str_diag) (
+static bool ipv6_parse (
     const char* input,
     size_t input_bytes,
     ipv6_address_full_t* out,
     ipv6_diag_func_t func,
-    void* user_data)
+    void* user_data,
+    ipv6_trace_entry_t* trace,
+    ipv6_reader_state_t* state)
 {
     const char *cp = input;
     const char* ep = input + input_bytes;
-    ipv6_reader_state_t state;
 
-    memset(&state, 0, sizeof(state));
+    memset(state, 0, sizeof(ipv6_reader_state_t));
 
-    state.diag_func = func;
-    state.user_data = user_data;
+    state->diag_func = func;
+    state->user_data = user_data;
+    state->trace = trace;
+    state->error_event = IPV6_DIAG_INVALID_INPUT;
 
     if (!input || !*input || !out) {
-        ipv6_error(&state, IPV6_DIAG_INVALID_INPUT,
+        ipv6_error(state, IPV6_DIAG_INVALID_INPUT,
             "Invalid input");
         return false;
     }
 
     if (input_bytes > IPV6_STRING_SIZE) {
-        ipv6_error(&state, IPV6_DIAG_STRING_SIZE_EXCEEDED,
+        ipv6_error(state, IPV6_DIAG_STRING_SIZE_EXCEEDED,
             "Input string size exceeded");
         return false;
     }
 
     memset(out, 0, sizeof(ipv6_address_full_t));
 
-    state.current = STATE_NONE;
-    state.input = input;
-    state.input_bytes = (int32_t)input_bytes;
-    state.address_full = out;
+    state->current = STATE_NONE;
+    state->input = input;
+    state->input_bytes = (int32_t)input_bytes;
+    state->address_full = out;
 
     while (*cp && cp < ep) {
         IPV6_TRACE(
             "  * parse state: %s, cp: '%c' (%02x) position: %d, flags: %08x\n",
-            state_str(state.current),
+            state_str(state->current),
             *cp,
             *cp,
-            state.position,
-            state.flags);
+            state->position,
+            state->flags);
 
         switch (*cp) {
             case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
-                ipv6_state_transition(&state, EC_DIGIT);
+                ipv6_state_transition(state, EC_DIGIT);
                 break;
 
             case 'A': case 'B': case 'C': case 'D': case 'E': case 'F':
             case 'a': case 'b': case 'c': case 'd': case 'e': case 'f':
-                ipv6_state_transition(&state, EC_HEX_DIGIT);
+                ipv6_state_transition(state, EC_HEX_DIGIT);
                 break;
 
             case ':':
-                ipv6_state_transition(&state, EC_V6_COMPONENT_SEP);
+                ipv6_state_transition(state, EC_V6_COMPONENT_SEP);
                 break;
 
             case '.':
-                ipv6_state_transition(&state, EC_V4_COMPONENT_SEP);
+                ipv6_state_transition(state, EC_V4_COMPONENT_SEP);
                 break;
 
             case '/':
-                ipv6_state_transition(&state, EC_CIDR_MASK);
+                ipv6_state_transition(state, EC_CIDR_MASK);
                 break;
 
             case '%':
-                ipv6_state_transition(&state, EC_IFACE);
+                ipv6_state_transition(state, EC_IFACE);
                 break;
 
             case '[':
-                state.brackets++;
-                ipv6_state_transition(&state, EC_OPEN_BRACKET);
+                state->brackets++;
+                ipv6_state_transition(state, EC_OPEN_BRACKET);
                 break;
 
             case ']':
-                ipv6_state_transition(&state, EC_CLOSE_BRACKET);
+                ipv6_state_transition(state, EC_CLOSE_BRACKET);
                 break;
 
             case ' ':
             case '\t':
             case '\n':
             case '\r':
-                ipv6_state_transition(&state, EC_WHITESPACE);
+                ipv6_state_transition(state, EC_WHITESPACE);
                 break;
 
 
             default:
-                ipv6_error(&state, IPV6_DIAG_INVALID_INPUT_CHAR,
+                ipv6_error(state, IPV6_DIAG_INVALID_INPUT_CHAR,
                     "Invalid input character");
                 break;
         }
 
         // Exit the parse if the last state change triggered an error
-        if (state.flags & READER_FLAG_ERROR) {
+        if (state->flags & READER_FLAG_ERROR) {
             return false;
         }
 
         cp++;
-        state.position++;
+        state->position++;
     }
 
     // Treat the end of input as whitespace to simplify state transitions
-    ipv6_state_transition(&state, EC_WHITESPACE);
+    ipv6_state_transition(state, EC_WHITESPACE);
 
     // Early out if there was an error processing the string
-    if ((state.flags & READER_FLAG_ERROR) != 0) {
+    if ((state->flags & READER_FLAG_ERROR) != 0) {
         return false;
     }
 
     // If an IPv4 compatible address was specified the rest of the IPv6 collapsing
     // rules can be skipped
-    if ((state.flags & READER_FLAG_IPV4_COMPAT) != 0) {
-        if (state.v4_octets != 4) {
-            ipv6_error(&state, IPV6_DIAG_V4_BAD_COMPONENT_COUNT,
+    if ((state->flags & READER_FLAG_IPV4_COMPAT) != 0) {
+        if (state->v4_octets != 4) {
+            ipv6_error(state, IPV6_DIAG_V4_BAD_COMPONENT_COUNT,
                 "IPv4 compatible address was used but required 4 octets");
             return false;
         }
-        state.address_full->flags |= IPV6_FLAG_IPV4_COMPAT;
+        state->address_full->flags |= IPV6_FLAG_IPV4_COMPAT;
         return true;
     }
 
     // Mark the presence of embedded IPv4 addresses
-    if (state.flags & READER_FLAG_IPV4_EMBEDDING) {
-        if (state.v4_octets != 4) {
-            ipv6_error(&state, IPV6_DIAG_V4_BAD_COMPONENT_COUNT,
+    if (state->flags & READER_FLAG_IPV4_EMBEDDING) {
+        if (state->v4_octets != 4) {
+            ipv6_error(state, IPV6_DIAG_V4_BAD_COMPONENT_COUNT,
                     "IPv4 address embedding was used but required 4 octets");
             return false;
         } else {
-            state.address_full->flags |= IPV6_FLAG_IPV4_EMBED;
+            state->address_full->flags |= IPV6_FLAG_IPV4_EMBED;
         }
     }
 
     // If there was no abbreviated run all components should be specified
-    if ((state.flags & READER_FLAG_ZERORUN) == 0) {
-        if (state.components < IPV6_NUM_COMPONENTS) {
-            ipv6_error(&state, IPV6_DIAG_V6_BAD_COMPONENT_COUNT,
+    if ((state->flags & READER_FLAG_ZERORUN) == 0) {
+        if (state->components < IPV6_NUM_COMPONENTS) {
+            ipv6_error(state, IPV6_DIAG_V6_BAD_COMPONENT_COUNT,
                 "Invalid component count");
             return false;
         }
@@ -770,7 +846,7 @@ bool IPV6_API_DEF(ipv6_from_str_diag) (
     uint16_t* src = out->address.components;
 
     // Number of components moving
-    int32_t move_count = state.components - state.zerorun;
+    int32_t move_count = state->components - state->zerorun;
     int32_t target = IPV6_NUM_COMPONENTS - move_count;
     if (move_count < 0 || move_count > IPV6_NUM_COMPONENTS) {
         IPV6_TRACE("invalid move_count: %d\n", move_count);
@@ -782,10 +858,10 @@ bool IPV6_API_DEF(ipv6_from_str_diag) (
     }
 
     // Copy the right side of the zero run
-    memcpy(&dst[target], &src[state.zerorun], move_count * sizeof(uint16_t));
+    memcpy(&dst[target], &src[state->zerorun], move_count * sizeof(uint16_t));
 
     // Copy the left side of the zero run
-    memcpy(&dst[0], &src[0], state.zerorun * sizeof(uint16_t));
+    memcpy(&dst[0], &src[0], state->zerorun * sizeof(uint16_t));
 
     // Everything else is zero, so just copy the destination array into the output directly
     memcpy(&(out->address.components[0]), &dst[0], IPV6_NUM_COMPONENTS * sizeof(uint16_t));
@@ -793,6 +869,84 @@ bool IPV6_API_DEF(ipv6_from_str_diag) (
     return true;
 }
 
+//--------------------------------------------------------------------------------
+// Start the next entry of a trace, it is published once the parse completes
+static ipv6_trace_entry_t* trace_begin (
+    ipv6_trace_t* trace,
+    const char* input,
+    size_t input_bytes)
+{
+    ipv6_trace_entry_t* entry = &trace->entries[trace->published % trace->capacity];
+    size_t length = 0;
+
+    // Readers drop the entry being overwritten once they see it started
+    IPV6_STORE_RELEASE(&trace->started, trace->published + 1);
+    IPV6_FENCE_RELEASE();
+
+    while (input && length < input_bytes && length < IPV6_TRACE_INPUT_SIZE - 1 && input[length]) {
+        entry->input[length] = input[length];
+        length++;
+    }
+
+    entry->input[length] = '\0';
+    entry->sequence = trace->published;
+    entry->result = 0;
+    entry->num_events = 0;
+    return entry;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_from_str_diag) (
+    const char* input,
+    size_t input_bytes,
+    ipv6_address_full_t* out,
+    ipv6_diag_func_t func,
+    void* user_data)
+{
+    ipv6_trace_t* trace = trace_current;
+    ipv6_stats_t* stats = stats_current;
+    ipv6_trace_entry_t* entry = NULL;
+    ipv6_reader_state_t state;
+    bool result;
+
+    IPV6_PROBE2(parse_begin, input, input_bytes);
+
+    if (trace) {
+        entry = trace_begin(trace, input, input_bytes);
+    }
+
+    result = ipv6_parse(input, input_bytes, out, func, user_data, entry, &state);
+
+    if (trace) {
+        entry->result = result;
+        IPV6_STORE_RELEASE(&trace->published, trace->published + 1);
+    }
+
+    // Plain increments, the block is only written by this thread
+    if (stats) {
+        stats->parses++;
+        stats->bytes += (uint64_t)(state.position < 0 ? 0 : state.position);
+        if (!result) {
+            stats->failures[state.error_event]++;
+        }
+        else {
+            stats->successes++;
+            if (out->flags & IPV6_FLAG_IPV4_COMPAT) {
+                stats->ipv4_compat++;
+            }
+            else if (out->flags & IPV6_FLAG_IPV4_EMBED) {
+                stats->ipv4_embed++;
+            }
+            else {
+                stats->ipv6++;
+            }
+        }
+    }
+
+    IPV6_PROBE2(parse_end, input, result);
+    return result;
+}
+
 //--------------------------------------------------------------------------------
 static void ipv6_default_diag (
     ipv6_diag_event_t event,
@@ -814,15 +968,59 @@ bool IPV6_API_DEF(ipv6_from_str) (
 }
 
 #define OUTPUT_TRUNCATED() \
-    IPV6_TRACE("  ! buffer truncated at position %u\n", (uint32_t)(wp - out)); \
+    IPV6_TRACE("  ! buffer truncated at position %u\n", (uint32_t)(wp - output)); \
     output_bytes = 0; \
     *output = '\0';
 
 //--------------------------------------------------------------------------------
-size_t IPV6_API_DEF(ipv6_to_str) (
+// Write 4 hex digits per component for 4 components, the digits of each
+// component are spread into the bytes of a 32bit word and converted to ASCII
+// in parallel: '0' + nibble, plus the distance to 'a' or 'A' for nibbles > 9
+static void format_expanded_lane (
+    char* out,
+    uint64_t lane,
+    uint32_t letter_offset)
+{
+    for (uint32_t i = 0; i < 4; ++i) {
+        const uint32_t component = (uint32_t)(lane >> (48 - i * 16)) & 0xffff;
+        const uint32_t nibbles =
+            (component & 0xf000) << 12 | (component & 0x0f00) << 8 |
+            (component & 0x00f0) << 4 | (component & 0x000f);
+        const uint32_t letters = ((nibbles + 0x06060606u) >> 4) & 0x01010101u;
+        const uint32_t ascii = nibbles + 0x30303030u + letters * letter_offset;
+
+        out[0] = (char)(ascii >> 24);
+        out[1] = (char)(ascii >> 16);
+        out[2] = (char)(ascii >> 8);
+        out[3] = (char)ascii;
+        out[4] = ':';
+        out += 5;
+    }
+}
+
+//--------------------------------------------------------------------------------
+// Write the IPV6_EXPANDED_LENGTH characters of the expanded form followed by a
+// separator that callers overwrite, `out` must have room for both
+static void format_expanded (
+    char* out,
+    const ipv6_address_full_t* in,
+    uint32_t options)
+{
+    // Distance from '9' + 1 to 'a' or 'A'
+    const uint32_t letter_offset = (options & IPV6_FORMAT_UPPERCASE) ? 7 : 39;
+    uint64_t hi, lo;
+
+    address_load_mapped(in, &hi, &lo);
+    format_expanded_lane(out, hi, letter_offset);
+    format_expanded_lane(out + 20, lo, letter_offset);
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_to_str_format) (
     const ipv6_address_full_t* in,
     char *output,
-    size_t output_bytes)
+    size_t output_bytes,
+    uint32_t options)
 {
     if (!in || !output) {
         return 0;
@@ -839,12 +1037,13 @@ size_t IPV6_API_DEF(ipv6_to_str) (
     const char* ep = output + output_bytes - 1; // end pointer with one octet for nul
     char token[IPV4_STRING_SIZE];
     token[0] = '\0';
+    const bool has_port = (in->flags & IPV6_FLAG_HAS_PORT) && !(options & IPV6_FORMAT_NO_BRACKETS);
 
     // If the address is an IPv4 compatible address shortcut the IPv6 rules and 
     // print an address or address:port
-    if (in->flags & IPV6_FLAG_IPV4_COMPAT) {
+    if ((in->flags & IPV6_FLAG_IPV4_COMPAT) && !(options & IPV6_FORMAT_EXPANDED)) {
         const uint32_t host_ipv4 = components[0] << 16 | components[1];
-        if (in->flags & IPV6_FLAG_HAS_PORT) {
+        if (has_port) {
             platform_snprintf(token, sizeof(token), "%d.%d.%d.%d:%d",
                 (uint8_t)(host_ipv4 >> 24),
                 (uint8_t)(host_ipv4 >> 16),
@@ -868,115 +1067,142 @@ size_t IPV6_API_DEF(ipv6_to_str) (
         return output_bytes;
     }
 
-    // For each component find the length of 0 digits that it covers (including
-    // itself), if that span is the current longest span of 0 digits record the
-    // position
-    uint32_t spans_position = 0;
-    uint32_t longest_span = 0;
-    uint32_t longest_position = 0;
-    uint8_t spans[IPV6_NUM_COMPONENTS] = { 0, };
-    for (uint32_t i = 0; i < IPV6_NUM_COMPONENTS; ++i) {
-        if (components[i]) {
-            if (spans[spans_position] > longest_span) {
-                longest_position = spans_position;
-                longest_span = spans[spans_position];
-            }
-            spans_position = i + 1;
-        }
-        else {
-            spans[spans_position]++;
-        }
-    }
-
-    // Check the last identified span
-    if (spans_position < IPV6_NUM_COMPONENTS && spans[spans_position] > longest_span) {
-        longest_position = spans_position;
-        longest_span = spans[spans_position];
-    }
-
     // Bracket the address to supply a port
-    if (in->flags & IPV6_FLAG_HAS_PORT) {
+    if (has_port) {
         *wp++ = '[';
     }
 
-    // Emit all of the components
-    for (uint32_t i = 0; i < IPV6_NUM_COMPONENTS; ++i) {
-        const char* cp = token;
+    if (options & IPV6_FORMAT_EXPANDED) {
+        // The separator written after the digits lands at most on the nul
+        if (ep - wp < IPV6_EXPANDED_LENGTH) {
+            OUTPUT_TRUNCATED();
+            return output_bytes;
+        }
+        format_expanded(wp, in, options);
+        wp += IPV6_EXPANDED_LENGTH;
+    }
+    else {
+        // For each component find the length of 0 digits that it covers (including
+        // itself), if that span is the current longest span of 0 digits record the
+        // position
+        uint32_t spans_position = 0;
+        uint32_t longest_span = 0;
+        uint32_t longest_position = 0;
+        uint8_t spans[IPV6_NUM_COMPONENTS] = { 0, };
+        for (uint32_t i = 0; i < IPV6_NUM_COMPONENTS; ++i) {
+            if (components[i]) {
+                if (spans[spans_position] > longest_span) {
+                    longest_position = spans_position;
+                    longest_span = spans[spans_position];
+                }
+                spans_position = i + 1;
+            }
+            else {
+                spans[spans_position]++;
+            }
+        }
 
-        // Write out the last two components as the IPv4 embed
-        if (i == 6 && in->flags & IPV6_FLAG_IPV4_EMBED) {
-            const uint32_t host_ipv4 = components[6] << 16 | components[7];
-            platform_snprintf(
-                token,
-                sizeof(token),
-                "%d.%d.%d.%d",
-                (uint8_t)(host_ipv4 >> 24),
-                (uint8_t)(host_ipv4 >> 16),
-                (uint8_t)(host_ipv4 >> 8),
-                (uint8_t)(host_ipv4));
-            i++;
-        } else {
-            platform_snprintf(
-                token,
-                sizeof(token),
-                "%x",
-                components[i]);
+        // Check the last identified span
+        if (spans_position < IPV6_NUM_COMPONENTS && spans[spans_position] > longest_span) {
+            longest_position = spans_position;
+            longest_span = spans[spans_position];
         }
 
-        // Skip the longest span of zeros by emitting the double colon abbreviation instead
-        // of the token and continuing on the component at the end of the span
-        if (i == longest_position && longest_span > 1) {
-            if (wp + 2 >= ep) {
-                OUTPUT_TRUNCATED();
-                return output_bytes;
+        // Emit all of the components
+        for (uint32_t i = 0; i < IPV6_NUM_COMPONENTS; ++i) {
+            const char* cp = token;
+
+            // Write out the last two components as the IPv4 embed
+            if (i == 6 && in->flags & IPV6_FLAG_IPV4_EMBED) {
+                const uint32_t host_ipv4 = components[6] << 16 | components[7];
+                platform_snprintf(
+                    token,
+                    sizeof(token),
+                    "%d.%d.%d.%d",
+                    (uint8_t)(host_ipv4 >> 24),
+                    (uint8_t)(host_ipv4 >> 16),
+                    (uint8_t)(host_ipv4 >> 8),
+                    (uint8_t)(host_ipv4));
+                i++;
+            } else {
+                platform_snprintf(
+                    token,
+                    sizeof(token),
+                    (options & IPV6_FORMAT_UPPERCASE) ? "%X" : "%x",
+                    components[i]);
             }
 
-            // The previous component already emitted a separator, or this is the
-            // the first separator
-            if (i > 0) {
-                *wp++ = ':';
+            // Skip the longest span of zeros by emitting the double colon abbreviation instead
+            // of the token and continuing on the component at the end of the span
+            if (i == longest_position && longest_span > 1) {
+                if (wp + 2 >= ep) {
+                    OUTPUT_TRUNCATED();
+                    return output_bytes;
+                }
+
+                // The previous component already emitted a separator, or this is the
+                // the first separator
+                if (i > 0) {
+                    *wp++ = ':';
+                } else {
+                    *wp++ = ':';
+                    *wp++ = ':';
+                }
+                i += (longest_span - 1);
+                continue;
             } else {
-                *wp++ = ':';
-                *wp++ = ':';
-            }
-            i += (longest_span - 1);
-            continue;
-        } else {
-            // Copy the token up to the terminator
-            while (wp < ep && *cp) {
-                *wp++ = *cp++;
+                // Copy the token up to the terminator
+                while (wp < ep && *cp) {
+                    *wp++ = *cp++;
+                }
+
+                if (i < IPV6_NUM_COMPONENTS - 1 && wp < ep) {
+                    *wp++ = ':';
+                }
             }
 
-            if (i < IPV6_NUM_COMPONENTS - 1 && wp < ep) {
-                *wp++ = ':';
+            if (wp == ep) {
+                // Truncated, return a deterministic result
+                OUTPUT_TRUNCATED();
+                return output_bytes;
             }
         }
-
-        if (wp == ep) {
-            // Truncated, return a deterministic result
-            OUTPUT_TRUNCATED();
-            return output_bytes;
-        }
     }
 
+    // The address may end exactly on the nul, anything after it is truncated
+    bool truncated = false;
+
     if (in->flags & IPV6_FLAG_HAS_MASK) {
         platform_snprintf(token, sizeof(token), "/%u", in->mask);
         const char* cp = token;
         while (wp < ep && *cp) {
             *wp++ = *cp++;
         }
+        truncated |= *cp != '\0';
+    }
+
+    if ((options & IPV6_FORMAT_ZONE) && in->iface && in->iface_len) {
+        const char* cp = in->iface;
+        const char* zone_end = in->iface + in->iface_len;
+        if (wp < ep) {
+            *wp++ = '%';
+        }
+        while (wp < ep && cp < zone_end) {
+            *wp++ = *cp++;
+        }
+        truncated |= cp < zone_end;
     }
 
-    if (in->flags & IPV6_FLAG_HAS_PORT) {
+    if (has_port) {
         platform_snprintf(token, sizeof(token), "]:%hu", in->port);
         const char* cp = token;
         while (wp < ep && *cp) {
             *wp++ = *cp++;
         }
+        truncated |= *cp != '\0';
     }
 
-    // Output truncated
-    if (wp == ep) {
+    if (truncated) {
         OUTPUT_TRUNCATED();
     }
     else {
@@ -986,6 +1212,56 @@ size_t IPV6_API_DEF(ipv6_to_str) (
     return output_bytes;
 }
 
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_to_str) (
+    const ipv6_address_full_t* in,
+    char *output,
+    size_t output_bytes)
+{
+    return ipv6_to_str_format(in, output, output_bytes, IPV6_FORMAT_DEFAULT);
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_to_str_batch) (
+    const ipv6_address_full_t* in,
+    size_t count,
+    char* output,
+    size_t output_stride,
+    uint32_t options)
+{
+    // Expanded rows without decorations have a fixed width and skip the
+    // general formatter
+    const uint32_t decorations = IPV6_FLAG_HAS_MASK | IPV6_FLAG_HAS_PORT;
+    size_t written = 0;
+
+    if (!in || !output || output_stride == 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        char* row = output + i * output_stride;
+        size_t length;
+
+        if ((options & IPV6_FORMAT_EXPANDED) &&
+            !(in[i].flags & decorations) &&
+            !((options & IPV6_FORMAT_ZONE) && in[i].iface_len) &&
+            output_stride > IPV6_EXPANDED_LENGTH)
+        {
+            format_expanded(row, &in[i], options);
+            length = IPV6_EXPANDED_LENGTH;
+        }
+        else {
+            length = ipv6_to_str_format(&in[i], row, output_stride, options);
+        }
+
+        // Pad the row so that the column holds no stale bytes
+        memset(row + length, 0, output_stride - length);
+        written += length != 0;
+    }
+
+    return written;
+}
+
 //--------------------------------------------------------------------------------
 ipv6_compare_result_t IPV6_API_DEF(ipv6_compare) (
     const ipv6_address_full_t* a,
@@ -1058,3 +1334,875 @@ ipv6_compare_result_t IPV6_API_DEF(ipv6_compare) (
 
     return IPV6_COMPARE_OK;
 }
+
+//
+// Address classification
+//
+// Addresses are normalized into two 64bit lanes (hi, lo) in network order and
+// matched against a table of (value, mask) pairs. IPv4 compatible addresses
+// are moved into the IPv4 mapped range ::ffff:0:0/96 so that a single table
+// covers both registries.
+//
+typedef struct {
+    uint64_t                hi_value;       // prefix bits of components[0..3]
+    uint64_t                lo_value;       // prefix bits of components[4..7]
+    uint64_t                hi_mask;
+    uint64_t                lo_mask;
+    uint32_t                bits;           // ipv6_class_t bits applied on match
+    uint32_t                scope;          // ipv6_scope_t applied on match, last match wins
+} ipv6_class_entry_t;
+
+// Internal bit used by entries that are globally reachable exceptions to a
+// larger non-global block, e.g. Teredo 2001::/32 inside of 2001::/23
+#define CLASS_GLOBAL_EXCEPTION  0x08000000
+
+#define CLASS_V6(hi, lo, n, bits) \
+    { UINT64_C(hi), UINT64_C(lo), PREFIX_HI_MASK(n), PREFIX_LO_MASK(n), bits, IPV6_SCOPE_NONE }
+#define CLASS_V4(v4, n, bits, scope) \
+    { UINT64_C(0), UINT64_C(0x0000ffff00000000) | UINT64_C(v4), PREFIX_HI_MASK(96 + (n)), PREFIX_LO_MASK(96 + (n)), bits, scope }
+
+static const ipv6_class_entry_t ipv6_class_table[] = {
+    CLASS_V6(0x0000000000000000, 0x0000000000000000, 128, IPV6_CLASS_UNSPECIFIED|IPV6_CLASS_BOGON),
+    CLASS_V6(0x0000000000000000, 0x0000000000000001, 128, IPV6_CLASS_LOOPBACK|IPV6_CLASS_BOGON),
+    CLASS_V6(0x0000000000000000, 0x0000ffff00000000, 96,  IPV6_CLASS_IPV4_MAPPED),
+    CLASS_V6(0x0064ff9b00000000, 0x0000000000000000, 96,  IPV6_CLASS_NAT64),
+    CLASS_V6(0x0064ff9b00010000, 0x0000000000000000, 48,  IPV6_CLASS_NAT64|IPV6_CLASS_BOGON),
+    CLASS_V6(0x0100000000000000, 0x0000000000000000, 64,  IPV6_CLASS_DISCARD|IPV6_CLASS_BOGON),
+    CLASS_V6(0x2001000000000000, 0x0000000000000000, 23,  IPV6_CLASS_IETF_PROTOCOL|IPV6_CLASS_BOGON),
+    CLASS_V6(0x2001000000000000, 0x0000000000000000, 32,  IPV6_CLASS_TEREDO|CLASS_GLOBAL_EXCEPTION),
+    CLASS_V6(0x2001000100000000, 0x0000000000000001, 128, CLASS_GLOBAL_EXCEPTION), // PCP anycast
+    CLASS_V6(0x2001000100000000, 0x0000000000000002, 128, CLASS_GLOBAL_EXCEPTION), // TURN anycast
+    CLASS_V6(0x2001000200000000, 0x0000000000000000, 48,  IPV6_CLASS_BENCHMARK),
+    CLASS_V6(0x2001000300000000, 0x0000000000000000, 32,  CLASS_GLOBAL_EXCEPTION), // AMT
+    CLASS_V6(0x2001000401120000, 0x0000000000000000, 48,  CLASS_GLOBAL_EXCEPTION), // AS112-v6
+    CLASS_V6(0x2001001000000000, 0x0000000000000000, 28,  IPV6_CLASS_ORCHID),
+    CLASS_V6(0x2001002000000000, 0x0000000000000000, 28,  IPV6_CLASS_ORCHID|CLASS_GLOBAL_EXCEPTION),
+    CLASS_V6(0x20010db800000000, 0x0000000000000000, 32,  IPV6_CLASS_DOCUMENTATION|IPV6_CLASS_BOGON),
+    CLASS_V6(0x2002000000000000, 0x0000000000000000, 16,  IPV6_CLASS_6TO4),
+    CLASS_V6(0x3fff000000000000, 0x0000000000000000, 20,  IPV6_CLASS_DOCUMENTATION|IPV6_CLASS_BOGON),
+    CLASS_V6(0xfc00000000000000, 0x0000000000000000, 7,   IPV6_CLASS_UNIQUE_LOCAL|IPV6_CLASS_PRIVATE|IPV6_CLASS_BOGON),
+    CLASS_V6(0xfe80000000000000, 0x0000000000000000, 10,  IPV6_CLASS_LINK_LOCAL|IPV6_CLASS_BOGON),
+    CLASS_V6(0xfec0000000000000, 0x0000000000000000, 10,  IPV6_CLASS_SITE_LOCAL|IPV6_CLASS_BOGON),
+    CLASS_V6(0xff00000000000000, 0x0000000000000000, 8,   IPV6_CLASS_MULTICAST),
+
+    CLASS_V4(0x00000000, 8,  IPV6_CLASS_UNSPECIFIED|IPV6_CLASS_BOGON, IPV6_SCOPE_NONE),
+    CLASS_V4(0x0a000000, 8,  IPV6_CLASS_PRIVATE|IPV6_CLASS_BOGON, IPV6_SCOPE_NONE),
+    CLASS_V4(0x64400000, 10, IPV6_CLASS_SHARED|IPV6_CLASS_BOGON, IPV6_SCOPE_NONE),
+    CLASS_V4(0x7f000000, 8,  IPV6_CLASS_LOOPBACK|IPV6_CLASS_BOGON, IPV6_SCOPE_NONE),
+    CLASS_V4(0xa9fe0000, 16, IPV6_CLASS_LINK_LOCAL|IPV6_CLASS_BOGON, IPV6_SCOPE_NONE),
+    CLASS_V4(0xac100000, 12, IPV6_CLASS_PRIVATE|IPV6_CLASS_BOGON, IPV6_SCOPE_NONE),
+    CLASS_V4(0xc0000000, 24, IPV6_CLASS_IETF_PROTOCOL|IPV6_CLASS_BOGON, IPV6_SCOPE_NONE),
+    CLASS_V4(0xc0000009, 32, CLASS_GLOBAL_EXCEPTION, IPV6_SCOPE_NONE), // PCP anycast
+    CLASS_V4(0xc000000a, 32, CLASS_GLOBAL_EXCEPTION, IPV6_SCOPE_NONE), // TURN anycast
+    CLASS_V4(0xc0000200, 24, IPV6_CLASS_DOCUMENTATION|IPV6_CLASS_BOGON, IPV6_SCOPE_NONE),
+    CLASS_V4(0xc0586300, 24, IPV6_CLASS_6TO4, IPV6_SCOPE_NONE),
+    CLASS_V4(0xc0a80000, 16, IPV6_CLASS_PRIVATE|IPV6_CLASS_BOGON, IPV6_SCOPE_NONE),
+    CLASS_V4(0xc6120000, 15, IPV6_CLASS_BENCHMARK|IPV6_CLASS_BOGON, IPV6_SCOPE_NONE),
+    CLASS_V4(0xc6336400, 24, IPV6_CLASS_DOCUMENTATION|IPV6_CLASS_BOGON, IPV6_SCOPE_NONE),
+    CLASS_V4(0xcb007100, 24, IPV6_CLASS_DOCUMENTATION|IPV6_CLASS_BOGON, IPV6_SCOPE_NONE),
+    CLASS_V4(0xe0000000, 4,  IPV6_CLASS_MULTICAST, IPV6_SCOPE_GLOBAL),
+    CLASS_V4(0xe0000000, 24, 0, IPV6_SCOPE_LINK_LOCAL),
+    CLASS_V4(0xef000000, 8,  0, IPV6_SCOPE_ORGANIZATION_LOCAL),
+    CLASS_V4(0xefff0000, 16, 0, IPV6_SCOPE_SITE_LOCAL),
+    CLASS_V4(0xf0000000, 4,  IPV6_CLASS_RESERVED|IPV6_CLASS_BOGON, IPV6_SCOPE_NONE),
+    CLASS_V4(0xffffffff, 32, IPV6_CLASS_BROADCAST|IPV6_CLASS_BOGON, IPV6_SCOPE_NONE),
+};
+
+// Number of addresses classified together by ipv6_classify_batch
+#define CLASSIFY_LANES 16
+
+//--------------------------------------------------------------------------------
+// Classify up to CLASSIFY_LANES normalized addresses, the table is walked once
+// and every lane is compared against each entry without branching
+static void classify_lanes (
+    const uint64_t* hi,
+    const uint64_t* lo,
+    const uint64_t* compat,
+    uint32_t* out,
+    uint32_t lanes)
+{
+    uint32_t bits[CLASSIFY_LANES] = { 0, };
+    uint32_t scope[CLASSIFY_LANES] = { 0, };
+
+    for (uint32_t e = 0; e < sizeof(ipv6_class_table) / sizeof(ipv6_class_table[0]); ++e) {
+        const ipv6_class_entry_t* entry = &ipv6_class_table[e];
+        const uint32_t has_scope = 0 - (uint32_t)(entry->scope != IPV6_SCOPE_NONE);
+        for (uint32_t j = 0; j < lanes; ++j) {
+            const uint32_t match = 0 - (uint32_t)(
+                ((hi[j] & entry->hi_mask) == entry->hi_value) &
+                ((lo[j] & entry->lo_mask) == entry->lo_value));
+            const uint32_t select = match & has_scope;
+            bits[j] |= entry->bits & match;
+            scope[j] = (scope[j] & ~select) | (entry->scope & select);
+        }
+    }
+
+    for (uint32_t j = 0; j < lanes; ++j) {
+        // IPv6 multicast carries the scope in the low nibble of the first octet pair
+        const uint32_t multicast = 0 - (uint32_t)((hi[j] >> 56) == 0xff);
+        const uint32_t exception = 0 - ((bits[j] & CLASS_GLOBAL_EXCEPTION) != 0);
+        const uint32_t is_compat = (uint32_t)compat[j];
+
+        scope[j] |= (uint32_t)(hi[j] >> 48) & 0xf & multicast;
+        bits[j] &= ~(IPV6_CLASS_BOGON & exception);
+        bits[j] &= ~(IPV6_CLASS_IPV4_MAPPED & is_compat);
+        bits[j] &= ~CLASS_GLOBAL_EXCEPTION;
+        out[j] = bits[j] | (scope[j] << IPV6_CLASS_SCOPE_SHIFT);
+    }
+}
+
+//--------------------------------------------------------------------------------
+uint32_t IPV6_API_DEF(ipv6_classify) (
+    const ipv6_address_full_t* in)
+{
+    uint64_t hi, lo, compat;
+    uint32_t result = 0;
+
+    if (!in) {
+        return 0;
+    }
+
+    compat = address_load_mapped(in, &hi, &lo);
+    classify_lanes(&hi, &lo, &compat, &result, 1);
+    return result;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_classify_batch) (
+    const ipv6_address_full_t* in,
+    uint32_t* out,
+    size_t count)
+{
+    uint64_t hi[CLASSIFY_LANES];
+    uint64_t lo[CLASSIFY_LANES];
+    uint64_t compat[CLASSIFY_LANES];
+
+    if (!in || !out) {
+        return;
+    }
+
+    while (count > 0) {
+        const uint32_t lanes = count < CLASSIFY_LANES ? (uint32_t)count : CLASSIFY_LANES;
+        for (uint32_t j = 0; j < lanes; ++j) {
+            compat[j] = address_load_mapped(&in[j], &hi[j], &lo[j]);
+        }
+        classify_lanes(hi, lo, compat, out, lanes);
+        in += lanes;
+        out += lanes;
+        count -= lanes;
+    }
+}
+
+//
+// IPv4-embedded IPv6 addresses (RFC 6052)
+//
+// The IPv4 address is split between the two lanes around the u-octet:
+//
+//     hi |= (v4 >> hi_shift) & hi_mask
+//     lo |= (v4 & lo_mask) << lo_shift
+//
+typedef struct {
+    uint32_t                prefix_len;
+    uint32_t                hi_shift;
+    uint64_t                hi_mask;
+    uint32_t                lo_shift;
+    uint64_t                lo_mask;
+} ipv6_nat64_layout_t;
+
+static const ipv6_nat64_layout_t ipv6_nat64_layouts[] = {
+    { 32,  0, UINT64_C(0xffffffff), 56, UINT64_C(0x00000000) },
+    { 40,  8, UINT64_C(0x00ffffff), 48, UINT64_C(0x000000ff) },
+    { 48, 16, UINT64_C(0x0000ffff), 40, UINT64_C(0x0000ffff) },
+    { 56, 24, UINT64_C(0x000000ff), 32, UINT64_C(0x00ffffff) },
+    { 64, 32, UINT64_C(0x00000000), 24, UINT64_C(0xffffffff) },
+    { 96, 32, UINT64_C(0x00000000),  0, UINT64_C(0xffffffff) },
+};
+
+//--------------------------------------------------------------------------------
+// Find the layout for the prefix, the u-octet mask is all ones when the u-octet
+// must be zero
+static const ipv6_nat64_layout_t* nat64_layout (
+    const ipv6_address_full_t* prefix,
+    uint64_t* hi,
+    uint64_t* lo,
+    uint64_t* u_mask)
+{
+    if (!prefix || (prefix->flags & IPV6_FLAG_HAS_MASK) == 0) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < sizeof(ipv6_nat64_layouts) / sizeof(ipv6_nat64_layouts[0]); ++i) {
+        const ipv6_nat64_layout_t* layout = &ipv6_nat64_layouts[i];
+        if (layout->prefix_len == prefix->mask) {
+            address_load(&prefix->address, hi, lo);
+            *hi &= PREFIX_HI_MASK(layout->prefix_len);
+            *lo &= PREFIX_LO_MASK(layout->prefix_len);
+            *u_mask = layout->prefix_len < 96 ? UINT64_C(0xff00000000000000) : 0;
+            return layout;
+        }
+    }
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------------------
+static size_t nat64_synthesize_block (
+    const ipv6_address_full_t* prefix,
+    const ipv6_address_full_t* in,
+    ipv6_address_full_t* out,
+    size_t count)
+{
+    const ipv6_nat64_layout_t* layout;
+    uint64_t prefix_hi, prefix_lo, u_mask;
+    size_t translated = 0;
+
+    if (!in || !out || (layout = nat64_layout(prefix, &prefix_hi, &prefix_lo, &u_mask)) == NULL) {
+        return 0;
+    }
+
+    const uint32_t embed = layout->prefix_len == 96 ? IPV6_FLAG_IPV4_EMBED : 0;
+    for (size_t i = 0; i < count; ++i) {
+        const ipv6_address_full_t src = in[i];
+        const uint64_t v4 = (uint64_t)src.address.components[0] << 16 | src.address.components[1];
+        const uint32_t valid = 0 - (uint32_t)((src.flags & IPV6_FLAG_IPV4_COMPAT) != 0);
+        const uint64_t valid64 = 0 - (uint64_t)(valid & 1);
+        uint64_t hi, lo;
+
+        address_load(&src.address, &hi, &lo);
+        hi = SELECT(valid64, prefix_hi | ((v4 >> layout->hi_shift) & layout->hi_mask), hi);
+        lo = SELECT(valid64, prefix_lo | ((v4 & layout->lo_mask) << layout->lo_shift), lo);
+
+        out[i] = src;
+        address_store(&out[i].address, hi, lo);
+        out[i].flags = SELECT(valid, (src.flags & IPV6_FLAG_HAS_PORT) | embed, src.flags);
+        out[i].mask = SELECT(valid, 0, src.mask);
+        translated += valid & 1;
+    }
+
+    return translated;
+}
+
+//--------------------------------------------------------------------------------
+static size_t nat64_extract_block (
+    const ipv6_address_full_t* prefix,
+    const ipv6_address_full_t* in,
+    ipv6_address_full_t* out,
+    size_t count)
+{
+    const ipv6_nat64_layout_t* layout;
+    uint64_t prefix_hi, prefix_lo, u_mask;
+    size_t translated = 0;
+
+    if (!in || !out || (layout = nat64_layout(prefix, &prefix_hi, &prefix_lo, &u_mask)) == NULL) {
+        return 0;
+    }
+
+    const uint64_t mask_hi = PREFIX_HI_MASK(layout->prefix_len);
+    const uint64_t mask_lo = PREFIX_LO_MASK(layout->prefix_len);
+    for (size_t i = 0; i < count; ++i) {
+        const ipv6_address_full_t src = in[i];
+        uint64_t hi, lo;
+
+        address_load(&src.address, &hi, &lo);
+        const uint32_t valid = 0 - (uint32_t)(
+            ((src.flags & IPV6_FLAG_IPV4_COMPAT) == 0) &
+            ((hi & mask_hi) == prefix_hi) &
+            ((lo & mask_lo) == prefix_lo) &
+            ((lo & u_mask) == 0));
+        const uint64_t valid64 = 0 - (uint64_t)(valid & 1);
+        const uint64_t v4 = ((hi & layout->hi_mask) << layout->hi_shift) | ((lo >> layout->lo_shift) & layout->lo_mask);
+
+        out[i] = src;
+        address_store(&out[i].address, SELECT(valid64, v4 << 32, hi), SELECT(valid64, 0, lo));
+        out[i].flags = SELECT(valid, (src.flags & IPV6_FLAG_HAS_PORT) | IPV6_FLAG_IPV4_COMPAT, src.flags);
+        out[i].mask = SELECT(valid, 0, src.mask);
+        translated += valid & 1;
+    }
+
+    return translated;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_nat64_synthesize) (
+    const ipv6_address_full_t* prefix,
+    const ipv6_address_full_t* ipv4,
+    ipv6_address_full_t* out)
+{
+    ipv6_address_full_t result;
+
+    if (!out || nat64_synthesize_block(prefix, ipv4, &result, 1) != 1) {
+        return false;
+    }
+
+    *out = result;
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_nat64_extract) (
+    const ipv6_address_full_t* prefix,
+    const ipv6_address_full_t* in,
+    ipv6_address_full_t* out)
+{
+    ipv6_address_full_t result;
+
+    if (!out || nat64_extract_block(prefix, in, &result, 1) != 1) {
+        return false;
+    }
+
+    *out = result;
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_nat64_synthesize_batch) (
+    const ipv6_address_full_t* prefix,
+    const ipv6_address_full_t* in,
+    ipv6_address_full_t* out,
+    size_t count)
+{
+    return nat64_synthesize_block(prefix, in, out, count);
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_nat64_extract_batch) (
+    const ipv6_address_full_t* prefix,
+    const ipv6_address_full_t* in,
+    ipv6_address_full_t* out,
+    size_t count)
+{
+    return nat64_extract_block(prefix, in, out, count);
+}
+
+//
+// Address truncation
+//
+// Component masks are built once per call for each address family and applied
+// with a full width AND over the 8 components, the family is selected by index
+// rather than by branching on the flags. Only IPv4 compatible addresses and
+// addresses in ::ffff:0:0/96 are IPv4, an IPv4 tail on any other address is
+// truncated with the IPv6 prefix length.
+//
+typedef enum {
+    TRUNCATE_IPV6           = 0,
+    TRUNCATE_IPV4_COMPAT    = 1,
+    TRUNCATE_IPV4_MAPPED    = 2,
+    TRUNCATE_FAMILIES       = 3,
+} truncate_family_t;
+
+//--------------------------------------------------------------------------------
+// Fill in components masks covering the first `prefix` bits starting at bit `offset`
+static void truncate_mask (
+    uint16_t* mask,
+    uint32_t offset,
+    uint32_t prefix)
+{
+    for (uint32_t i = 0; i < IPV6_NUM_COMPONENTS; ++i) {
+        const int32_t start = (int32_t)(i * 16);
+        const int32_t end = (int32_t)(offset + prefix);
+        int32_t bits = end - start;
+
+        bits = bits < 0 ? 0 : bits > 16 ? 16 : bits;
+        mask[i] = (uint16_t)(0xffff0000u >> bits);
+        // Components before the offset are kept intact
+        if (start + 16 <= (int32_t)offset) {
+            mask[i] = 0xffff;
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------
+static bool truncate_masks (
+    uint16_t masks[TRUNCATE_FAMILIES][IPV6_NUM_COMPONENTS],
+    uint32_t ipv4_prefix,
+    uint32_t ipv6_prefix)
+{
+    if (ipv4_prefix > 32 || ipv6_prefix > 128) {
+        return false;
+    }
+
+    truncate_mask(masks[TRUNCATE_IPV6], 0, ipv6_prefix);
+    truncate_mask(masks[TRUNCATE_IPV4_COMPAT], 0, ipv4_prefix);
+    truncate_mask(masks[TRUNCATE_IPV4_MAPPED], IPV4_EMBED_INDEX * 16, ipv4_prefix);
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+static void truncate_apply (
+    ipv6_address_full_t* addr,
+    uint16_t masks[TRUNCATE_FAMILIES][IPV6_NUM_COMPONENTS])
+{
+    uint64_t hi, lo;
+    const uint32_t compat = (uint32_t)(address_load_mapped(addr, &hi, &lo) & 1);
+    const uint32_t mapped = (hi == 0) & (lo >> 32 == 0xffff);
+    const uint16_t* mask = masks[compat | ((mapped & ~compat) << 1)];
+    uint16_t* components = addr->address.components;
+
+    for (uint32_t i = 0; i < IPV6_NUM_COMPONENTS; ++i) {
+        components[i] &= mask[i];
+    }
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_truncate_batch) (
+    ipv6_address_full_t* addrs,
+    size_t count,
+    uint32_t ipv4_prefix,
+    uint32_t ipv6_prefix)
+{
+    uint16_t masks[TRUNCATE_FAMILIES][IPV6_NUM_COMPONENTS];
+
+    if (!addrs || !truncate_masks(masks, ipv4_prefix, ipv6_prefix)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        truncate_apply(&addrs[i], masks);
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+// Parse, truncate and format one address, the address only lives on the stack
+static size_t truncate_str (
+    const char* input,
+    size_t input_bytes,
+    char* output,
+    size_t output_bytes,
+    uint16_t masks[TRUNCATE_FAMILIES][IPV6_NUM_COMPONENTS])
+{
+    ipv6_address_full_t addr;
+
+    if (!output || output_bytes == 0) {
+        return 0;
+    }
+
+    *output = '\0';
+    if (!ipv6_from_str(input, input_bytes, &addr)) {
+        return 0;
+    }
+
+    truncate_apply(&addr, masks);
+    return ipv6_to_str(&addr, output, output_bytes);
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_truncate_str) (
+    const char* input,
+    size_t input_bytes,
+    char* output,
+    size_t output_bytes,
+    uint32_t ipv4_prefix,
+    uint32_t ipv6_prefix)
+{
+    uint16_t masks[TRUNCATE_FAMILIES][IPV6_NUM_COMPONENTS];
+
+    if (!truncate_masks(masks, ipv4_prefix, ipv6_prefix)) {
+        if (output && output_bytes) {
+            *output = '\0';
+        }
+        return 0;
+    }
+
+    return truncate_str(input, input_bytes, output, output_bytes, masks);
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_truncate_str_batch) (
+    const char* const* inputs,
+    const size_t* input_bytes,
+    size_t count,
+    char* output,
+    size_t output_stride,
+    uint32_t ipv4_prefix,
+    uint32_t ipv6_prefix)
+{
+    uint16_t masks[TRUNCATE_FAMILIES][IPV6_NUM_COMPONENTS];
+    size_t rewritten = 0;
+
+    if (!inputs || !input_bytes || !output || output_stride == 0) {
+        return 0;
+    }
+
+    if (!truncate_masks(masks, ipv4_prefix, ipv6_prefix)) {
+        for (size_t i = 0; i < count; ++i) {
+            output[i * output_stride] = '\0';
+        }
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (truncate_str(inputs[i], input_bytes[i], output + i * output_stride, output_stride, masks)) {
+            rewritten++;
+        }
+    }
+
+    return rewritten;
+}
+
+#define ITER_LANES 8
+
+//--------------------------------------------------------------------------------
+// Load an iteration endpoint, IPv4 compatible addresses use the low 32 bits
+static void iter_load (
+    const ipv6_address_full_t* in,
+    uint64_t* hi,
+    uint64_t* lo)
+{
+    if (in->flags & IPV6_FLAG_IPV4_COMPAT) {
+        *hi = 0;
+        *lo = (uint64_t)in->address.components[0] << 16 | (uint64_t)in->address.components[1];
+    }
+    else {
+        address_load(&in->address, hi, lo);
+    }
+}
+
+//--------------------------------------------------------------------------------
+static void iter_store (
+    ipv6_address_full_t* out,
+    const ipv6_address_full_t* blank,
+    uint64_t hi,
+    uint64_t lo)
+{
+    *out = *blank;
+    if (blank->flags & IPV6_FLAG_IPV4_COMPAT) {
+        out->address.components[0] = (uint16_t)(lo >> 16);
+        out->address.components[1] = (uint16_t)lo;
+    }
+    else {
+        address_store(&out->address, hi, lo);
+    }
+}
+
+//--------------------------------------------------------------------------------
+static void iter_blank (
+    const ipv6_iter_t* iter,
+    ipv6_address_full_t* blank)
+{
+    memset(blank, 0, sizeof(ipv6_address_full_t));
+    blank->flags = iter->flags;
+}
+
+//--------------------------------------------------------------------------------
+// xorshift64*, the state is never zero
+static uint64_t iter_random (uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * UINT64_C(0x2545f4914f6cdd1d);
+}
+
+//--------------------------------------------------------------------------------
+// Produce the address of the current block and move to the next block
+static void iter_advance (
+    ipv6_iter_t* iter,
+    uint64_t* hi,
+    uint64_t* lo)
+{
+    // Addresses between the block start and the last address
+    const uint64_t remaining_lo = iter->last_lo - iter->lo;
+    const uint64_t remaining_hi = iter->last_hi - iter->hi - (iter->last_lo < iter->lo);
+    const bool last_block = remaining_hi == 0 && remaining_lo < iter->stride;
+    uint64_t offset = 0;
+
+    if (iter->random) {
+        const uint64_t span = last_block ? remaining_lo + 1 : iter->stride;
+        offset = iter_random(&iter->random) % span;
+    }
+
+    *lo = iter->lo + offset;
+    *hi = iter->hi + (*lo < iter->lo);
+
+    if (last_block) {
+        iter->done = 1;
+    }
+    else {
+        const uint64_t next = iter->lo + iter->stride;
+        iter->hi += next < iter->lo;
+        iter->lo = next;
+    }
+}
+
+//--------------------------------------------------------------------------------
+static bool iter_init (
+    ipv6_iter_t* iter,
+    uint64_t first_hi,
+    uint64_t first_lo,
+    uint64_t last_hi,
+    uint64_t last_lo,
+    uint32_t flags,
+    uint64_t stride,
+    uint64_t seed)
+{
+    if (first_hi > last_hi || (first_hi == last_hi && first_lo > last_lo)) {
+        return false;
+    }
+
+    iter->hi = first_hi;
+    iter->lo = first_lo;
+    iter->last_hi = last_hi;
+    iter->last_lo = last_lo;
+    iter->stride = stride ? stride : 1;
+    iter->random = seed;
+    iter->flags = flags & (IPV6_FLAG_IPV4_COMPAT|IPV6_FLAG_IPV4_EMBED);
+    iter->done = 0;
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_iter_init_cidr) (
+    ipv6_iter_t* iter,
+    const ipv6_address_full_t* cidr,
+    uint64_t stride,
+    uint64_t seed)
+{
+    uint64_t hi, lo, mask_hi, mask_lo;
+
+    if (!iter || !cidr) {
+        return false;
+    }
+
+    if (cidr->flags & IPV6_FLAG_IPV4_COMPAT) {
+        const uint32_t length = (cidr->flags & IPV6_FLAG_HAS_MASK) ? cidr->mask : 32;
+        if (length > 32) {
+            return false;
+        }
+        // The IPv4 address only spans the low 32 bits
+        mask_hi = ~UINT64_C(0);
+        mask_lo = PREFIX_LO_MASK(96 + length) | UINT64_C(0xffffffff00000000);
+    }
+    else {
+        const uint32_t length = (cidr->flags & IPV6_FLAG_HAS_MASK) ? cidr->mask : 128;
+        if (length > 128) {
+            return false;
+        }
+        mask_hi = PREFIX_HI_MASK(length);
+        mask_lo = PREFIX_LO_MASK(length);
+    }
+
+    iter_load(cidr, &hi, &lo);
+    return iter_init(iter, hi & mask_hi, lo & mask_lo, hi | ~mask_hi, lo | ~mask_lo,
+        cidr->flags, stride, seed);
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_iter_init_range) (
+    ipv6_iter_t* iter,
+    const ipv6_address_full_t* first,
+    const ipv6_address_full_t* last,
+    uint64_t stride,
+    uint64_t seed)
+{
+    uint64_t first_hi, first_lo, last_hi, last_lo;
+
+    if (!iter || !first || !last || ((first->flags ^ last->flags) & IPV6_FLAG_IPV4_COMPAT)) {
+        return false;
+    }
+
+    iter_load(first, &first_hi, &first_lo);
+    iter_load(last, &last_hi, &last_lo);
+    return iter_init(iter, first_hi, first_lo, last_hi, last_lo, first->flags, stride, seed);
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_iter_next) (
+    ipv6_iter_t* iter,
+    ipv6_address_full_t* out)
+{
+    ipv6_address_full_t blank;
+    uint64_t hi, lo;
+
+    if (!iter || !out || iter->done) {
+        return false;
+    }
+
+    iter_blank(iter, &blank);
+    iter_advance(iter, &hi, &lo);
+    iter_store(out, &blank, hi, lo);
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_iter_fill) (
+    ipv6_iter_t* iter,
+    ipv6_address_full_t* out,
+    size_t count)
+{
+    ipv6_address_full_t blank;
+    uint64_t hi[ITER_LANES], lo[ITER_LANES];
+    size_t written = 0;
+
+    if (!iter || !out) {
+        return 0;
+    }
+
+    iter_blank(iter, &blank);
+
+    // Whole groups of lanes are computed as offsets from the block start, the
+    // offsets must fit in 64 bits. Sampling and the tail go one at a time.
+    if (iter->random == 0 && iter->stride <= UINT64_MAX / ITER_LANES) {
+        const uint64_t span = (ITER_LANES - 1) * iter->stride;
+
+        while (!iter->done && count - written >= ITER_LANES) {
+            const uint64_t remaining_lo = iter->last_lo - iter->lo;
+            const uint64_t remaining_hi = iter->last_hi - iter->hi - (iter->last_lo < iter->lo);
+
+            if (remaining_hi == 0 && remaining_lo < span) {
+                break;
+            }
+
+            for (uint32_t j = 0; j < ITER_LANES; ++j) {
+                lo[j] = iter->lo + j * iter->stride;
+                hi[j] = iter->hi + (lo[j] < iter->lo);
+            }
+
+            for (uint32_t j = 0; j < ITER_LANES; ++j) {
+                iter_store(&out[written + j], &blank, hi[j], lo[j]);
+            }
+            written += ITER_LANES;
+
+            if (remaining_hi == 0 && remaining_lo - span < iter->stride) {
+                iter->done = 1;
+            }
+            else {
+                const uint64_t next = iter->lo + span + iter->stride;
+                iter->hi += next < iter->lo;
+                iter->lo = next;
+            }
+        }
+    }
+
+    while (written < count && !iter->done) {
+        iter_advance(iter, &hi[0], &lo[0]);
+        iter_store(&out[written++], &blank, hi[0], lo[0]);
+    }
+
+    return written;
+}
+
+//--------------------------------------------------------------------------------
+ipv6_trace_t* IPV6_API_DEF(ipv6_trace_create) (
+    size_t entries)
+{
+    ipv6_trace_t* trace;
+
+    if (entries == 0) {
+        return NULL;
+    }
+
+    trace = (ipv6_trace_t*)calloc(1, sizeof(ipv6_trace_t));
+    if (!trace) {
+        return NULL;
+    }
+
+    trace->entries = (ipv6_trace_entry_t*)calloc(entries, sizeof(ipv6_trace_entry_t));
+    if (!trace->entries) {
+        free(trace);
+        return NULL;
+    }
+
+    trace->capacity = entries;
+    return trace;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_trace_destroy) (
+    ipv6_trace_t* trace)
+{
+    if (trace) {
+        if (trace_current == trace) {
+            trace_current = NULL;
+        }
+        free(trace->entries);
+        free(trace);
+    }
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_trace_attach) (
+    ipv6_trace_t* trace)
+{
+    trace_current = trace;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_stats_attach) (
+    ipv6_stats_t* stats)
+{
+    stats_current = stats;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_stats_snapshot) (
+    const ipv6_stats_t* const* stats,
+    size_t count,
+    ipv6_stats_t* out)
+{
+    // Every field is a uint64_t counter, sum them as an array
+    const size_t counters = sizeof(ipv6_stats_t) / sizeof(uint64_t);
+    uint64_t* total = (uint64_t*)out;
+
+    if (!out) {
+        return;
+    }
+
+    memset(out, 0, sizeof(ipv6_stats_t));
+    for (size_t i = 0; stats && i < count; ++i) {
+        const volatile uint64_t* from = (const volatile uint64_t*)stats[i];
+        if (!from) {
+            continue;
+        }
+        for (size_t c = 0; c < counters; ++c) {
+            total[c] += from[c];
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_trace_read) (
+    const ipv6_trace_t* trace,
+    ipv6_trace_entry_t* out,
+    size_t max)
+{
+    uint64_t first, published, started, oldest;
+    size_t count = 0;
+    size_t skip = 0;
+
+    if (!trace || !out || max == 0) {
+        return 0;
+    }
+
+    published = IPV6_LOAD_ACQUIRE(&trace->published);
+    first = published > trace->capacity ? published - trace->capacity : 0;
+    if (published - first > max) {
+        first = published - max;
+    }
+
+    for (uint64_t i = first; i < published; ++i) {
+        out[count++] = trace->entries[i % trace->capacity];
+    }
+
+    // The writer may have started reusing slots during the copy, an entry
+    // begun after the copy started overwrote the oldest entry
+    IPV6_FENCE_ACQUIRE();
+    started = IPV6_LOAD_ACQUIRE(&trace->started);
+    oldest = started > trace->capacity ? started - trace->capacity : 0;
+    if (oldest > first) {
+        skip = oldest - first < count ? (size_t)(oldest - first) : count;
+        memmove(out, out + skip, (count - skip) * sizeof(ipv6_trace_entry_t));
+    }
+
+    return count - skip;
+}
+
+//--------------------------------------------------------------------------------
+const char* IPV6_API_DEF(ipv6_trace_state_str) (
+    uint32_t state)
+{
+    return state_str((state_t)state);
+}
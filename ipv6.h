@@ -43,6 +43,67 @@
 //
 // Full tracing can be enabled by running `cmake -DPARSE_TRACE=1`
 //
+// When `sys/sdt.h` is available the parser exposes USDT probes under the
+// provider `ipv6` that cost a nop when no tracer is attached:
+//
+//     parse_begin(input, input_bytes)
+//     parse_end(input, result)
+//     state_change(from_state, to_state, position)
+//     token_begin(state, position)
+//     parse_error(ipv6_diag_event_t, position, message)
+//
+// For example `bpftrace -e 'usdt:./ipv6-cmd:ipv6:parse_error { printf("%s\n", str(arg2)); }'`
+//
+// Without a tracer, see *ipv6_trace_t* to record the last parses of a thread
+// in process.
+//
+// ## Benchmarks
+//
+// `ipv6-bench` times the parse and format APIs over generated corpora of every
+// address form covered by the tests, growing tenfold from 1K entries up to
+// `--max` (1M by default, 100M needs about 3GB). Corpora are generated from
+// `--seed` so runs are repeatable, and `--json` writes results that diff
+// cleanly:
+//
+//     cmake -DCMAKE_BUILD_TYPE=Release .. && make ipv6-bench
+//     bin/ipv6-bench --json --max 10000000 > before.json
+//
+// Each result reports ns/op, time stamp counter cycles/op and bytes/s for one
+// API and corpus, the best of `--repeat` passes.
+// With `--counters` the cycles, instructions, branch misses and L1 data and
+// instruction cache misses of that pass are read through `perf_event_open`,
+// adding IPC and branch misses per input byte. Counters that are not exposed,
+// as in most containers, are reported as null.
+//
+// `ipv6-bench --latency` times single ipv6_from_str calls on worst case input
+// for every parser state: maximum length addresses, zones and ports, padding
+// whitespace and input that fails on the last character. It reports p50 to
+// p99.99 and the maximum per input from a log linear histogram.
+//
+// `ipv6-bench --concurrent` looks up a prefix table from 1, 2, 4 and up to
+// `--threads` reader threads while one writer inserts and removes prefixes.
+// Lookups per reader should stay flat as readers are added, as long as there
+// are more cores than threads.
+//
+// `ipv6-bench --load --prefixes 2000000` builds a prefix table from text
+// twice, parsing and inserting one prefix at a time and then parsing on
+// `--threads` threads with ipv6_ptable_loader_parse and building the table
+// with ipv6_ptable_load.
+//
+// ## Differential testing
+//
+// `ipv6-differential` generates addresses from the IPv6 and IPv4 grammars,
+// mutates half of them and checks each input on all cores against
+// `ipv6_from_str_diag`, `inet_pton`, `inet_ntop` and a format / parse round
+// trip, reporting throughput and mismatches. Any change to a fast path should
+// pass a large run with a zero exit code:
+//
+//     bin/ipv6-differential --count 500000000 --seed 7
+//
+// Input the parser accepts but `inet_pton` rejects, such as a leading single
+// `:` or a `::` next to 8 components, is counted as lenient and only fails the
+// run with `--strict 1`.
+//
 
 #include <stddef.h>
 #include <stdint.h>
@@ -144,6 +205,7 @@ typedef enum {
     IPV6_DIAG_INVALID_ABBREV                = 13,
     IPV6_DIAG_INVALID_DECIMAL_TOKEN         = 14,
     IPV6_DIAG_INVALID_HEX_TOKEN             = 15,
+    IPV6_DIAG_EVENT_COUNT,                          // number of events, keep last
 } ipv6_diag_event_t;
 // ~~~~
 
@@ -223,6 +285,68 @@ size_t IPV6_API_DECL(ipv6_to_str) (
 // ~~~~
 
 
+// ### ipv6_format_t
+//
+// Options for ipv6_to_str_format, combined as bit flags.
+//
+// The expanded form always prints 8 groups of 4 hex digits, exactly
+// IPV6_EXPANDED_LENGTH characters before any mask, zone or port. IPv4
+// compatible addresses are expanded as IPv4 mapped addresses
+// (`0000:0000:0000:0000:0000:ffff:0a00:0001`) and embedded IPv4 addresses are
+// printed in hex.
+//
+// ~~~~
+#define IPV6_EXPANDED_LENGTH 39
+
+typedef enum {
+    IPV6_FORMAT_DEFAULT     = 0x00000000,   // RFC 5952 compressed form
+    IPV6_FORMAT_EXPANDED    = 0x00000001,   // no zero compression, 4 digits per group
+    IPV6_FORMAT_UPPERCASE   = 0x00000002,   // upper case hex digits
+    IPV6_FORMAT_NO_BRACKETS = 0x00000004,   // omit the port and the brackets around the address
+    IPV6_FORMAT_ZONE        = 0x00000008,   // append the interface as %zone
+} ipv6_format_t;
+// ~~~~
+
+
+// ### ipv6_to_str_format
+//
+// Convert an address to an ASCII string with ipv6_format_t `options`,
+// ipv6_to_str is the same as passing IPV6_FORMAT_DEFAULT. The expanded form is
+// written with integer nibble arithmetic and no data dependent branches.
+//
+// Returns the size in bytes of the string minus the nul byte, 0 if the output
+// was truncated. An undecorated expanded address fits IPV6_EXPANDED_LENGTH + 1
+// bytes, the same as a row of ipv6_to_str_batch.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_to_str_format) (
+    const ipv6_address_full_t* in,
+    char* output,
+    size_t output_bytes,
+    uint32_t options);
+// ~~~~
+
+
+// ### ipv6_to_str_batch
+//
+// Format `count` addresses into fixed width rows for column storage. Row `i` is
+// written to `output + i * output_stride` and the rest of the row is filled
+// with nul bytes, rows that do not fit are written as empty strings. With
+// IPV6_FORMAT_EXPANDED and a stride of IPV6_EXPANDED_LENGTH + 1 every row is
+// the same width.
+//
+// Returns the number of rows written.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_to_str_batch) (
+    const ipv6_address_full_t* in,
+    size_t count,
+    char* output,
+    size_t output_stride,
+    uint32_t options);
+// ~~~~
+
+
 // ### ipv6_compare
 //
 // Compare two addresses, 0 (IPV6_COMPARE_OK) if equal, else ipv6_compare_result_t.
@@ -241,6 +365,432 @@ ipv6_compare_result_t IPV6_API_DECL(ipv6_compare) (
     uint32_t ignore_flags);
 // ~~~~
 
+
+// ### ipv6_class_t
+//
+// Special purpose address categories (RFC 6890 and successors) reported by
+// ipv6_classify. More than one category may apply, e.g. `fd00::1` is both
+// IPV6_CLASS_UNIQUE_LOCAL and IPV6_CLASS_PRIVATE.
+//
+// IPv4 compatible addresses are classified against the IPv4 registry, IPv4
+// mapped addresses (`::ffff:10.0.0.1`) receive both IPV6_CLASS_IPV4_MAPPED and
+// the categories of the embedded IPv4 address.
+//
+// IPV6_CLASS_BOGON is set for any address that the registry marks as not
+// globally reachable and should never be seen as a peer on the public internet.
+//
+// The multicast scope (see *ipv6_scope_t*) is stored in the upper 4 bits of the
+// result, use IPV6_CLASS_SCOPE to extract it.
+//
+// ~~~~
+typedef enum {
+    IPV6_CLASS_UNSPECIFIED      = 0x00000001,   // ::/128, 0.0.0.0/8
+    IPV6_CLASS_LOOPBACK         = 0x00000002,   // ::1/128, 127.0.0.0/8
+    IPV6_CLASS_IPV4_MAPPED      = 0x00000004,   // ::ffff:0:0/96
+    IPV6_CLASS_NAT64            = 0x00000008,   // 64:ff9b::/96, 64:ff9b:1::/48
+    IPV6_CLASS_DISCARD          = 0x00000010,   // 100::/64
+    IPV6_CLASS_IETF_PROTOCOL    = 0x00000020,   // 2001::/23, 192.0.0.0/24
+    IPV6_CLASS_TEREDO           = 0x00000040,   // 2001::/32
+    IPV6_CLASS_BENCHMARK        = 0x00000080,   // 2001:2::/48, 198.18.0.0/15
+    IPV6_CLASS_ORCHID           = 0x00000100,   // 2001:10::/28, 2001:20::/28
+    IPV6_CLASS_DOCUMENTATION    = 0x00000200,   // 2001:db8::/32, 3fff::/20, 192.0.2.0/24, ...
+    IPV6_CLASS_6TO4             = 0x00000400,   // 2002::/16
+    IPV6_CLASS_UNIQUE_LOCAL     = 0x00000800,   // fc00::/7
+    IPV6_CLASS_LINK_LOCAL       = 0x00001000,   // fe80::/10, 169.254.0.0/16
+    IPV6_CLASS_SITE_LOCAL       = 0x00002000,   // fec0::/10 (deprecated)
+    IPV6_CLASS_MULTICAST        = 0x00004000,   // ff00::/8, 224.0.0.0/4
+    IPV6_CLASS_PRIVATE          = 0x00008000,   // 10.0.0.0/8, 172.16.0.0/12, 192.168.0.0/16, fc00::/7
+    IPV6_CLASS_SHARED           = 0x00010000,   // 100.64.0.0/10 (carrier grade NAT)
+    IPV6_CLASS_RESERVED         = 0x00020000,   // 240.0.0.0/4
+    IPV6_CLASS_BROADCAST        = 0x00040000,   // 255.255.255.255/32
+    IPV6_CLASS_BOGON            = 0x00080000,   // not globally reachable
+} ipv6_class_t;
+
+#define IPV6_CLASS_SCOPE_SHIFT 28
+#define IPV6_CLASS_SCOPE(bits) ((ipv6_scope_t)(((bits) >> IPV6_CLASS_SCOPE_SHIFT) & 0xf))
+// ~~~~
+
+
+// ### ipv6_scope_t
+//
+// Multicast scope (RFC 7346), IPv4 multicast is mapped onto the same values
+// using the administratively scoped ranges of RFC 2365.
+//
+// ~~~~
+typedef enum {
+    IPV6_SCOPE_NONE                 = 0x0,  // not a multicast address
+    IPV6_SCOPE_INTERFACE_LOCAL      = 0x1,
+    IPV6_SCOPE_LINK_LOCAL           = 0x2,  // ff02::/16, 224.0.0.0/24
+    IPV6_SCOPE_REALM_LOCAL          = 0x3,
+    IPV6_SCOPE_ADMIN_LOCAL          = 0x4,
+    IPV6_SCOPE_SITE_LOCAL           = 0x5,  // ff05::/16, 239.255.0.0/16
+    IPV6_SCOPE_ORGANIZATION_LOCAL   = 0x8,  // ff08::/16, 239.0.0.0/8
+    IPV6_SCOPE_GLOBAL               = 0xe,  // ff0e::/16, 224.0.1.0 - 238.255.255.255
+} ipv6_scope_t;
+// ~~~~
+
+
+// ### ipv6_classify
+//
+// Classify an address into a bitmask of *ipv6_class_t* categories with the
+// multicast scope in the upper bits. The mask and port of the address are ignored.
+//
+// Classification is driven by a compact prefix table and evaluated without
+// data dependent branches.
+//
+// ~~~~
+uint32_t IPV6_API_DECL(ipv6_classify) (
+    const ipv6_address_full_t* in);
+// ~~~~
+
+
+// ### ipv6_classify_batch
+//
+// Classify `count` addresses from `in` into `out`, equivalent to calling
+// ipv6_classify for each element. Addresses are processed in fixed width
+// blocks so that the prefix compares can be vectorized.
+//
+// ~~~~
+void IPV6_API_DECL(ipv6_classify_batch) (
+    const ipv6_address_full_t* in,
+    uint32_t* out,
+    size_t count);
+// ~~~~
+
+// ### ipv6_nat64_synthesize
+//
+// Synthesize an IPv4-embedded IPv6 address (RFC 6052) from the IPv4 compatible
+// address `ipv4` (IPV6_FLAG_IPV4_COMPAT) and a translation prefix.
+//
+// The prefix length is read from the mask of `prefix` and must be one of
+// 32, 40, 48, 56, 64 or 96, e.g. `64:ff9b::/96`, `2001:db8:100::/40` or the
+// IPv4 mapped prefix `::ffff:0:0/96`. For prefixes shorter than 96 bits the
+// IPv4 address skips the reserved u-octet (bits 64-71) and the suffix is zero.
+//
+// The port of `ipv4` is carried over. /96 results are flagged with
+// IPV6_FLAG_IPV4_EMBED so they format as `64:ff9b::192.0.2.33`.
+//
+// Returns false if the prefix length is not supported or `ipv4` is not an
+// IPv4 compatible address.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_nat64_synthesize) (
+    const ipv6_address_full_t* prefix,
+    const ipv6_address_full_t* ipv4,
+    ipv6_address_full_t* out);
+// ~~~~
+
+
+// ### ipv6_nat64_extract
+//
+// Extract the IPv4 compatible address embedded in `in` using the translation
+// prefix, the inverse of ipv6_nat64_synthesize.
+//
+// Returns false if the prefix length is not supported, `in` is not within
+// the prefix or the u-octet is not zero.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_nat64_extract) (
+    const ipv6_address_full_t* prefix,
+    const ipv6_address_full_t* in,
+    ipv6_address_full_t* out);
+// ~~~~
+
+
+// ### ipv6_nat64_synthesize_batch / ipv6_nat64_extract_batch
+//
+// Translate `count` addresses with a single prefix. Elements that cannot be
+// translated (e.g. native IPv6 rows when synthesizing) are copied to `out`
+// unchanged, so mixed columns can be translated in place (`in == out`).
+//
+// Returns the number of translated elements.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_nat64_synthesize_batch) (
+    const ipv6_address_full_t* prefix,
+    const ipv6_address_full_t* in,
+    ipv6_address_full_t* out,
+    size_t count);
+
+size_t IPV6_API_DECL(ipv6_nat64_extract_batch) (
+    const ipv6_address_full_t* prefix,
+    const ipv6_address_full_t* in,
+    ipv6_address_full_t* out,
+    size_t count);
+// ~~~~
+
+// ### ipv6_truncate_batch
+//
+// Zero the host bits of `count` addresses in place for privacy compliant
+// logging, keeping `ipv4_prefix` bits (0-32) of IPv4 addresses and `ipv6_prefix`
+// bits (0-128) of IPv6 addresses, e.g. 24 and 48.
+//
+// IPv4 compatible addresses and addresses in `::ffff:0:0/96` are truncated as
+// IPv4 addresses. Any other address is truncated as IPv6, however it was
+// written: `2001:db8:aaaa::1.2.3.4` is the same as `2001:db8:aaaa::102:304`.
+// Flags, port and mask are not modified.
+//
+// Returns false if either prefix length is out of range.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_truncate_batch) (
+    ipv6_address_full_t* addrs,
+    size_t count,
+    uint32_t ipv4_prefix,
+    uint32_t ipv6_prefix);
+// ~~~~
+
+
+// ### ipv6_truncate_str
+//
+// Fused parse, truncate and format of a single address string, the output is
+// the same as calling ipv6_from_str, ipv6_truncate_batch and ipv6_to_str.
+//
+// Returns the size in bytes of the output string minus the nul byte, 0 if the
+// input could not be parsed or the output was truncated.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_truncate_str) (
+    const char* input,
+    size_t input_bytes,
+    char* output,
+    size_t output_bytes,
+    uint32_t ipv4_prefix,
+    uint32_t ipv6_prefix);
+// ~~~~
+
+
+// ### ipv6_truncate_str_batch
+//
+// Rewrite a column of `count` address strings in one pass. Row `i` is written
+// nul terminated to `output + i * output_stride`, rows that fail to parse are
+// written as empty strings so that no untruncated data is passed through.
+//
+// Returns the number of rows rewritten.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_truncate_str_batch) (
+    const char* const* inputs,
+    const size_t* input_bytes,
+    size_t count,
+    char* output,
+    size_t output_stride,
+    uint32_t ipv4_prefix,
+    uint32_t ipv6_prefix);
+// ~~~~
+
+// ### ipv6_iter_t
+//
+// Iterator over the addresses of a CIDR block or an inclusive range, the
+// fields are private. Addresses are visited in ascending order every `stride`
+// addresses. With a non-zero `seed` the iterator samples instead: it visits one
+// pseudo random address out of every block of `stride` addresses.
+//
+// IPv4 compatible inputs (`10.0.0.0/8`) iterate IPv4 compatible addresses,
+// all other inputs iterate the full 128 bits with the input's IPv4 embedded
+// flag, so `::ffff:10.0.0.0/104` iterates `::ffff:10.0.0.0` to
+// `::ffff:10.255.255.255`.
+//
+// ~~~~
+typedef struct {
+    uint64_t                hi;             // start of the next block
+    uint64_t                lo;
+    uint64_t                last_hi;        // last address in the range
+    uint64_t                last_lo;
+    uint64_t                stride;
+    uint64_t                random;         // sampling state, 0 when not sampling
+    uint32_t                flags;          // IPV6_FLAG_IPV4_* of the output
+    uint32_t                done;
+} ipv6_iter_t;
+// ~~~~
+
+
+// ### ipv6_iter_init_cidr / ipv6_iter_init_range
+//
+// Initialize an iterator over the block of `cidr` or over `first` to `last`
+// inclusive. A `cidr` without IPV6_FLAG_HAS_MASK iterates the single address,
+// host bits of `cidr` are ignored. A `stride` of 0 selects 1.
+//
+// Returns false if `first` is greater than `last` or the inputs are of
+// different families.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_iter_init_cidr) (
+    ipv6_iter_t* iter,
+    const ipv6_address_full_t* cidr,
+    uint64_t stride,
+    uint64_t seed);
+
+bool IPV6_API_DECL(ipv6_iter_init_range) (
+    ipv6_iter_t* iter,
+    const ipv6_address_full_t* first,
+    const ipv6_address_full_t* last,
+    uint64_t stride,
+    uint64_t seed);
+// ~~~~
+
+
+// ### ipv6_iter_next
+//
+// Write the next address to `out`, returns false when the iteration is done.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_iter_next) (
+    ipv6_iter_t* iter,
+    ipv6_address_full_t* out);
+// ~~~~
+
+
+// ### ipv6_iter_fill
+//
+// Write up to `count` next addresses to `out`. Without sampling the addresses
+// are computed as independent offsets from the current block in fixed width
+// lanes rather than one increment at a time.
+//
+// Returns the number of addresses written, less than `count` only when the
+// iteration is done.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_iter_fill) (
+    ipv6_iter_t* iter,
+    ipv6_address_full_t* out,
+    size_t count);
+// ~~~~
+
+// ### ipv6_trace_t
+//
+// Ring buffer of the most recent parses of a thread, for dumping the parser
+// state transitions of bad inputs in production without a rebuild.
+//
+// A trace is attached to the calling thread with ipv6_trace_attach, while
+// attached every ipv6_from_str call on that thread records its input (up to
+// IPV6_TRACE_INPUT_SIZE - 1 bytes), result and up to IPV6_TRACE_MAX_EVENTS
+// parser events. The thread writes without locks and ipv6_trace_read can be
+// called from any thread at any time.
+//
+// ~~~~
+#define IPV6_TRACE_INPUT_SIZE 72
+#define IPV6_TRACE_MAX_EVENTS 60
+
+typedef enum {
+    IPV6_TRACE_STATE        = 1,            // state change, value is the new state
+    IPV6_TRACE_TOKEN        = 2,            // token begin, value is the token position
+    IPV6_TRACE_ERROR        = 3,            // parse error, value is the ipv6_diag_event_t
+} ipv6_trace_kind_t;
+
+typedef struct {
+    uint8_t                 kind;           // ipv6_trace_kind_t
+    uint8_t                 state;          // parser state at the event
+    uint16_t                value;          // see ipv6_trace_kind_t
+    int32_t                 position;       // input position
+} ipv6_trace_event_t;
+
+typedef struct {
+    uint64_t                sequence;       // number of the parse on this trace
+    char                    input[IPV6_TRACE_INPUT_SIZE];
+    uint32_t                result;         // 1 if the address was parsed
+    uint32_t                num_events;
+    ipv6_trace_event_t      events[IPV6_TRACE_MAX_EVENTS];
+} ipv6_trace_entry_t;
+
+typedef struct ipv6_trace_t ipv6_trace_t;
+// ~~~~
+
+
+// ### ipv6_trace_create
+//
+// Create a trace holding the last `entries` parses, returns NULL if memory
+// could not be allocated. Detach a trace from its thread before destroying it.
+//
+// ~~~~
+ipv6_trace_t* IPV6_API_DECL(ipv6_trace_create) (
+    size_t entries);
+
+void IPV6_API_DECL(ipv6_trace_destroy) (
+    ipv6_trace_t* trace);
+// ~~~~
+
+
+// ### ipv6_trace_attach
+//
+// Record the parses of the calling thread into `trace`, NULL stops recording.
+// A trace must only be attached to one thread at a time.
+//
+// ~~~~
+void IPV6_API_DECL(ipv6_trace_attach) (
+    ipv6_trace_t* trace);
+// ~~~~
+
+
+// ### ipv6_trace_read
+//
+// Copy up to `max` of the most recent complete entries to `out`, oldest
+// first. Entries that were overwritten while copying are dropped.
+//
+// Returns the number of entries copied.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_trace_read) (
+    const ipv6_trace_t* trace,
+    ipv6_trace_entry_t* out,
+    size_t max);
+// ~~~~
+
+
+// ### ipv6_trace_state_str
+//
+// Name of a parser state recorded in ipv6_trace_event_t.
+//
+// ~~~~
+const char* IPV6_API_DECL(ipv6_trace_state_str) (
+    uint32_t state);
+// ~~~~
+
+// ### ipv6_stats_t
+//
+// Parse counters of one thread. A thread counts every ipv6_from_str call into
+// the block attached with ipv6_stats_attach using plain increments, there are
+// no atomics or callbacks on the parse path. Failures are counted by the
+// ipv6_diag_event_t that stopped the parse.
+//
+// ~~~~
+typedef struct {
+    uint64_t                parses;
+    uint64_t                successes;
+    uint64_t                ipv4_compat;    // successes by address family
+    uint64_t                ipv4_embed;
+    uint64_t                ipv6;
+    uint64_t                bytes;          // input bytes consumed by the parser
+    uint64_t                failures[IPV6_DIAG_EVENT_COUNT];
+} ipv6_stats_t;
+// ~~~~
+
+
+// ### ipv6_stats_attach
+//
+// Count the parses of the calling thread into `stats`, NULL stops counting.
+// A block must only be attached to one thread at a time and must stay valid
+// while attached.
+//
+// ~~~~
+void IPV6_API_DECL(ipv6_stats_attach) (
+    ipv6_stats_t* stats);
+// ~~~~
+
+
+// ### ipv6_stats_snapshot
+//
+// Sum `count` per thread blocks into `out`. Safe to call from any thread while
+// the owning threads keep counting, each counter is read once with a single
+// load so the snapshot may be a few parses behind.
+//
+// ~~~~
+void IPV6_API_DECL(ipv6_stats_snapshot) (
+    const ipv6_stats_t* const* stats,
+    size_t count,
+    ipv6_stats_t* out);
+// ~~~~
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
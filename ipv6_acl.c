@@ -0,0 +1,474 @@
+#include "ipv6_acl.h"
+#include "ipv6_config.h"
+#include "ipv6_internal.h"
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#define ACL_BATCH               16      // matches prefetched together in a batch
+#define ACL_PORTS               65536
+
+struct ipv6_acl_t {
+    uint64_t*               addr_hi;        // address interval starts, ascending
+    uint64_t*               addr_lo;
+    uint64_t*               addr_bits;      // `words` bit vector words per interval
+    uint32_t*               port_start;     // port interval starts, ascending
+    uint64_t*               port_bits;      // one more vector for addresses without a port
+    size_t                  addr_count;
+    size_t                  port_count;
+    size_t                  words;
+};
+
+// Address range of a rule in the IPv4 mapped form
+typedef struct {
+    uint64_t                hi;
+    uint64_t                lo;
+    uint64_t                end_hi;
+    uint64_t                end_lo;
+} acl_span_t;
+
+//--------------------------------------------------------------------------------
+static bool acl_less_equal (uint64_t a_hi, uint64_t a_lo, uint64_t b_hi, uint64_t b_lo)
+{
+    return (a_hi < b_hi) | ((a_hi == b_hi) & (a_lo <= b_lo));
+}
+
+//--------------------------------------------------------------------------------
+static int acl_compare_edge (const void* a, const void* b)
+{
+    const uint64_t* ea = (const uint64_t*)a;
+    const uint64_t* eb = (const uint64_t*)b;
+
+    if (ea[0] != eb[0]) {
+        return ea[0] < eb[0] ? -1 : 1;
+    }
+    return ea[1] < eb[1] ? -1 : ea[1] > eb[1];
+}
+
+//--------------------------------------------------------------------------------
+static int acl_compare_port (const void* a, const void* b)
+{
+    const uint32_t pa = *(const uint32_t*)a;
+    const uint32_t pb = *(const uint32_t*)b;
+    return pa < pb ? -1 : pa > pb;
+}
+
+//--------------------------------------------------------------------------------
+// Index of the last address interval starting at or before the address
+static size_t acl_search_addr (const ipv6_acl_t* acl, uint64_t hi, uint64_t lo)
+{
+    size_t base = 0, n = acl->addr_count;
+
+    while (n > 1) {
+        const size_t half = n / 2;
+        base = acl_less_equal(acl->addr_hi[base + half], acl->addr_lo[base + half], hi, lo) ? base + half : base;
+        n -= half;
+    }
+
+    return base;
+}
+
+//--------------------------------------------------------------------------------
+// Index of the last port interval starting at or before the port
+static size_t acl_search_port (const ipv6_acl_t* acl, uint32_t port)
+{
+    size_t base = 0, n = acl->port_count;
+
+    while (n > 1) {
+        const size_t half = n / 2;
+        base = acl->port_start[base + half] <= port ? base + half : base;
+        n -= half;
+    }
+
+    return base;
+}
+
+//--------------------------------------------------------------------------------
+// Bit vectors of the intervals an address falls in
+static void acl_rows (
+    const ipv6_acl_t* acl,
+    const ipv6_address_full_t* addr,
+    const uint64_t** addr_row,
+    const uint64_t** port_row)
+{
+    uint64_t hi, lo;
+
+    address_load_mapped(addr, &hi, &lo);
+    const size_t port = (addr->flags & IPV6_FLAG_HAS_PORT) ? acl_search_port(acl, addr->port) : acl->port_count;
+
+    *addr_row = acl->addr_bits + acl_search_addr(acl, hi, lo) * acl->words;
+    *port_row = acl->port_bits + port * acl->words;
+}
+
+//--------------------------------------------------------------------------------
+static uint32_t acl_first (const uint64_t* addr_row, const uint64_t* port_row, size_t words)
+{
+    for (size_t w = 0; w < words; ++w) {
+        const uint64_t both = addr_row[w] & port_row[w];
+        if (both) {
+            return (uint32_t)(w * 64 + count_trailing_zeros64(both));
+        }
+    }
+
+    return IPV6_ACL_NONE;
+}
+
+//--------------------------------------------------------------------------------
+// Parse a port number of 1 to 5 digits
+static bool acl_parse_port (const char* input, size_t bytes, uint32_t* port)
+{
+    *port = 0;
+    if (bytes == 0 || bytes > 5) {
+        return false;
+    }
+
+    for (size_t i = 0; i < bytes; ++i) {
+        if (input[i] < '0' || input[i] > '9') {
+            return false;
+        }
+        *port = *port * 10 + (uint32_t)(input[i] - '0');
+    }
+
+    return *port < ACL_PORTS;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_acl_rule_from_str) (
+    const char* input,
+    size_t input_bytes,
+    ipv6_acl_rule_t* out)
+{
+    size_t address_start = 0, address_end = input_bytes;
+    size_t ports = 0;                   // position of the port list
+    bool has_ports = false;
+
+    if (!input || !out || input_bytes == 0) {
+        return false;
+    }
+
+    if (input[0] == '[') {
+        const char* close = (const char*)memchr(input, ']', input_bytes);
+        if (!close) {
+            return false;
+        }
+        address_start = 1;
+        address_end = (size_t)(close - input);
+        if (address_end + 1 < input_bytes) {
+            if (input[address_end + 1] != ':') {
+                return false;
+            }
+            ports = address_end + 2;
+            has_ports = true;
+        }
+    }
+    else {
+        // Only IPv4 rules can have a port without brackets, they have a
+        // single colon
+        const char* colon = (const char*)memchr(input, ':', input_bytes);
+        if (colon && !memchr(colon + 1, ':', input_bytes - (size_t)(colon - input) - 1)) {
+            address_end = (size_t)(colon - input);
+            ports = address_end + 1;
+            has_ports = true;
+        }
+    }
+
+    memset(out, 0, sizeof(ipv6_acl_rule_t));
+    if (!ipv6_from_str(input + address_start, address_end - address_start, &out->prefix) ||
+        (out->prefix.flags & IPV6_FLAG_HAS_PORT))
+    {
+        return false;
+    }
+
+    out->port_max = ACL_PORTS - 1;
+    if (has_ports) {
+        const char* dash = (const char*)memchr(input + ports, '-', input_bytes - ports);
+        const size_t first_end = dash ? (size_t)(dash - input) : input_bytes;
+        uint32_t first, last;
+
+        if (!acl_parse_port(input + ports, first_end - ports, &first)) {
+            return false;
+        }
+        last = first;
+        if (dash && !acl_parse_port(dash + 1, input_bytes - first_end - 1, &last)) {
+            return false;
+        }
+        if (last < first) {
+            return false;
+        }
+
+        out->port_min = (uint16_t)first;
+        out->port_max = (uint16_t)last;
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+// Address range of a rule, false if the mask is out of range
+static bool acl_span (const ipv6_acl_rule_t* rule, acl_span_t* span)
+{
+    const uint64_t compat = address_load_mapped(&rule->prefix, &span->hi, &span->lo);
+    uint32_t bits = 128;
+
+    if (rule->prefix.flags & IPV6_FLAG_HAS_MASK) {
+        bits = compat ? 96 + rule->prefix.mask : rule->prefix.mask;
+    }
+    if (bits > 128) {
+        return false;
+    }
+
+    span->hi &= PREFIX_HI_MASK(bits);
+    span->lo &= PREFIX_LO_MASK(bits);
+    span->end_hi = span->hi | ~PREFIX_HI_MASK(bits);
+    span->end_lo = span->lo | ~PREFIX_LO_MASK(bits);
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+// Cut the address space at the start of every rule and after its end
+static bool acl_build_addr (ipv6_acl_t* acl, const acl_span_t* spans, size_t count)
+{
+    uint64_t* edges = (uint64_t*)malloc((2 * count + 1) * 2 * sizeof(uint64_t));
+    size_t n = 0;
+
+    if (!edges) {
+        return false;
+    }
+
+    edges[n * 2] = 0;
+    edges[n * 2 + 1] = 0;
+    n++;
+    for (size_t r = 0; r < count; ++r) {
+        edges[n * 2] = spans[r].hi;
+        edges[n * 2 + 1] = spans[r].lo;
+        n++;
+        if ((spans[r].end_hi & spans[r].end_lo) != UINT64_MAX) {
+            edges[n * 2 + 1] = spans[r].end_lo + 1;
+            edges[n * 2] = spans[r].end_hi + (edges[n * 2 + 1] == 0);
+            n++;
+        }
+    }
+
+    qsort(edges, n, 2 * sizeof(uint64_t), acl_compare_edge);
+
+    acl->addr_hi = (uint64_t*)malloc(n * sizeof(uint64_t));
+    acl->addr_lo = (uint64_t*)malloc(n * sizeof(uint64_t));
+    if (!acl->addr_hi || !acl->addr_lo) {
+        free(edges);
+        return false;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        if (acl->addr_count == 0 ||
+            acl->addr_hi[acl->addr_count - 1] != edges[i * 2] ||
+            acl->addr_lo[acl->addr_count - 1] != edges[i * 2 + 1])
+        {
+            acl->addr_hi[acl->addr_count] = edges[i * 2];
+            acl->addr_lo[acl->addr_count] = edges[i * 2 + 1];
+            acl->addr_count++;
+        }
+    }
+    free(edges);
+
+    acl->addr_bits = (uint64_t*)calloc(acl->addr_count * acl->words, sizeof(uint64_t));
+    if (!acl->addr_bits) {
+        return false;
+    }
+
+    for (size_t r = 0; r < count; ++r) {
+        size_t i = acl_search_addr(acl, spans[r].hi, spans[r].lo);
+
+        while (i < acl->addr_count &&
+            acl_less_equal(acl->addr_hi[i], acl->addr_lo[i], spans[r].end_hi, spans[r].end_lo))
+        {
+            acl->addr_bits[i * acl->words + r / 64] |= UINT64_C(1) << (r % 64);
+            i++;
+        }
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+// Cut the ports at the start of every rule and after its end, plus a vector
+// of the rules covering every port
+static bool acl_build_port (ipv6_acl_t* acl, const ipv6_acl_rule_t* rules, size_t count)
+{
+    uint32_t* edges = (uint32_t*)malloc((2 * count + 1) * sizeof(uint32_t));
+    size_t n = 0;
+
+    if (!edges) {
+        return false;
+    }
+
+    edges[n++] = 0;
+    for (size_t r = 0; r < count; ++r) {
+        edges[n++] = rules[r].port_min;
+        if (rules[r].port_max < ACL_PORTS - 1) {
+            edges[n++] = (uint32_t)rules[r].port_max + 1;
+        }
+    }
+
+    qsort(edges, n, sizeof(uint32_t), acl_compare_port);
+
+    acl->port_start = edges;
+    for (size_t i = 0; i < n; ++i) {
+        if (acl->port_count == 0 || edges[acl->port_count - 1] != edges[i]) {
+            edges[acl->port_count++] = edges[i];
+        }
+    }
+
+    acl->port_bits = (uint64_t*)calloc((acl->port_count + 1) * acl->words, sizeof(uint64_t));
+    if (!acl->port_bits) {
+        return false;
+    }
+
+    for (size_t r = 0; r < count; ++r) {
+        const uint64_t bit = UINT64_C(1) << (r % 64);
+
+        for (size_t i = acl_search_port(acl, rules[r].port_min);
+            i < acl->port_count && acl->port_start[i] <= rules[r].port_max; ++i)
+        {
+            acl->port_bits[i * acl->words + r / 64] |= bit;
+        }
+
+        if (rules[r].port_min == 0 && rules[r].port_max == ACL_PORTS - 1) {
+            acl->port_bits[acl->port_count * acl->words + r / 64] |= bit;
+        }
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+ipv6_acl_t* IPV6_API_DEF(ipv6_acl_build) (
+    const ipv6_acl_rule_t* rules,
+    size_t count)
+{
+    ipv6_acl_t* acl;
+    acl_span_t* spans;
+    bool valid = true;
+
+    if ((!rules && count) || count >= IPV6_ACL_NONE) {
+        return NULL;
+    }
+
+    spans = (acl_span_t*)malloc((count ? count : 1) * sizeof(acl_span_t));
+    acl = (ipv6_acl_t*)calloc(1, sizeof(ipv6_acl_t));
+    if (!spans || !acl) {
+        free(spans);
+        free(acl);
+        return NULL;
+    }
+
+    for (size_t r = 0; r < count; ++r) {
+        valid &= acl_span(&rules[r], &spans[r]);
+        valid &= rules[r].port_min <= rules[r].port_max;
+    }
+
+    acl->words = count ? (count + 63) / 64 : 1;
+    if (!valid || !acl_build_addr(acl, spans, count) || !acl_build_port(acl, rules, count)) {
+        ipv6_acl_destroy(acl);
+        acl = NULL;
+    }
+
+    free(spans);
+    return acl;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_acl_destroy) (
+    ipv6_acl_t* acl)
+{
+    if (acl) {
+        free(acl->addr_hi);
+        free(acl->addr_lo);
+        free(acl->addr_bits);
+        free(acl->port_start);
+        free(acl->port_bits);
+        free(acl);
+    }
+}
+
+//--------------------------------------------------------------------------------
+uint32_t IPV6_API_DEF(ipv6_acl_match) (
+    const ipv6_acl_t* acl,
+    const ipv6_address_full_t* addr)
+{
+    const uint64_t* addr_row;
+    const uint64_t* port_row;
+
+    if (!acl || !addr) {
+        return IPV6_ACL_NONE;
+    }
+
+    acl_rows(acl, addr, &addr_row, &port_row);
+    return acl_first(addr_row, port_row, acl->words);
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_acl_match_batch) (
+    const ipv6_acl_t* acl,
+    const ipv6_address_full_t* in,
+    uint32_t* out,
+    size_t count)
+{
+    const uint64_t* addr_rows[ACL_BATCH];
+    const uint64_t* port_rows[ACL_BATCH];
+    size_t matched = 0;
+
+    if (!acl || !in || !out) {
+        return 0;
+    }
+
+    while (count > 0) {
+        const uint32_t lanes = count < ACL_BATCH ? (uint32_t)count : ACL_BATCH;
+
+        // Find every row first, then combine them once their loads are in
+        // flight
+        for (uint32_t j = 0; j < lanes; ++j) {
+            acl_rows(acl, &in[j], &addr_rows[j], &port_rows[j]);
+            IPV6_PREFETCH(addr_rows[j]);
+            IPV6_PREFETCH(port_rows[j]);
+        }
+
+        for (uint32_t j = 0; j < lanes; ++j) {
+            out[j] = acl_first(addr_rows[j], port_rows[j], acl->words);
+            matched += out[j] != IPV6_ACL_NONE;
+        }
+
+        in += lanes;
+        out += lanes;
+        count -= lanes;
+    }
+
+    return matched;
+}
+
+//--------------------------------------------------------------------------------
+ipv6_acl_t* IPV6_API_DEF(ipv6_acl_publish) (
+    ipv6_acl_t** slot,
+    ipv6_acl_t* acl)
+{
+    if (!slot) {
+        return NULL;
+    }
+
+    return (ipv6_acl_t*)IPV6_EXCHANGE_PTR(slot, acl);
+}
+
+//--------------------------------------------------------------------------------
+const ipv6_acl_t* IPV6_API_DEF(ipv6_acl_current) (
+    ipv6_acl_t* const* slot)
+{
+    if (!slot) {
+        return NULL;
+    }
+
+    return (const ipv6_acl_t*)IPV6_LOAD_ACQUIRE_PTR(slot);
+}
@@ -0,0 +1,131 @@
+#pragma once
+// ## Access control lists
+//
+// Compiles an ordered list of (prefix, port range) rules such as
+// `[2001:db8::/32]:443` or `10.0.0.0/8:1000-2000` into a decision structure
+// that returns the first matching rule without walking the list.
+//
+// Each dimension is cut into the elementary intervals bounded by the rule
+// edges, and every interval holds a bit vector of the rules covering it. A
+// match searches the address intervals and the port intervals, then ANDs the
+// two bit vectors and returns the lowest set bit. The number of memory
+// accesses is bounded by `log2(2n + 1)` per dimension plus `2 * n / 64` for
+// `n` rules, independent of the order and overlap of the rules. The bit
+// vectors take up to `(2n + 1) * n / 4` bytes, e.g. 50MB for 10000 rules.
+//
+// The family of a rule follows from its prefix: IPv4 prefixes are stored as
+// IPv4 mapped prefixes (`10.0.0.0/8` is `::ffff:10.0.0.0/104`), so
+// `0.0.0.0/0` matches every IPv4 address and `::/0` matches every address.
+//
+// A compiled list is immutable and matching is thread safe. To change the
+// rules build a new list on a background thread, publish it with
+// ipv6_acl_publish while lookups continue against the old one, and destroy
+// the old list once no thread can still be using it.
+//
+
+#include "ipv6.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ### ipv6_acl_rule_t
+//
+// Rule matching addresses within `prefix` (the first `mask` bits if
+// IPV6_FLAG_HAS_MASK is set, otherwise all 128 bits) and ports from
+// `port_min` to `port_max` inclusive. The port and interface of `prefix` are
+// ignored.
+//
+// ~~~~
+#define IPV6_ACL_NONE UINT32_MAX
+
+typedef struct {
+    ipv6_address_full_t     prefix;
+    uint16_t                port_min;
+    uint16_t                port_max;
+} ipv6_acl_rule_t;
+// ~~~~
+
+
+// ### ipv6_acl_rule_from_str
+//
+// Parse a rule: an address or CIDR prefix, optionally followed by `:port` or
+// `:first-last`. IPv6 addresses with a port use brackets,
+// `[2001:db8::/32]:80-89`. Rules without a port match every port.
+//
+// Returns false if the rule does not parse.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_acl_rule_from_str) (
+    const char* input,
+    size_t input_bytes,
+    ipv6_acl_rule_t* out);
+// ~~~~
+
+
+// ### ipv6_acl_build
+//
+// Compile `count` rules in priority order, the id of a rule is its index.
+//
+// Returns NULL if a mask is above 128, a port range is empty or memory could
+// not be allocated.
+//
+// ~~~~
+typedef struct ipv6_acl_t ipv6_acl_t;
+
+ipv6_acl_t* IPV6_API_DECL(ipv6_acl_build) (
+    const ipv6_acl_rule_t* rules,
+    size_t count);
+
+void IPV6_API_DECL(ipv6_acl_destroy) (
+    ipv6_acl_t* acl);
+// ~~~~
+
+
+// ### ipv6_acl_match
+//
+// Id of the first rule matching the address and port of `addr`, or
+// IPV6_ACL_NONE. An address without IPV6_FLAG_HAS_PORT only matches rules
+// covering every port.
+//
+// ~~~~
+uint32_t IPV6_API_DECL(ipv6_acl_match) (
+    const ipv6_acl_t* acl,
+    const ipv6_address_full_t* addr);
+// ~~~~
+
+
+// ### ipv6_acl_match_batch
+//
+// Match `count` addresses into `out`, with the bit vectors of several
+// addresses prefetched together. Returns the number of addresses matching a
+// rule.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_acl_match_batch) (
+    const ipv6_acl_t* acl,
+    const ipv6_address_full_t* in,
+    uint32_t* out,
+    size_t count);
+// ~~~~
+
+
+// ### ipv6_acl_publish / ipv6_acl_current
+//
+// Atomically replace the list in `slot` with `acl` and return the previous
+// list, and read the list in `slot` from a lookup thread. Lookups that read
+// the slot before the swap keep using the previous list, so it must only be
+// destroyed after they finish.
+//
+// ~~~~
+ipv6_acl_t* IPV6_API_DECL(ipv6_acl_publish) (
+    ipv6_acl_t** slot,
+    ipv6_acl_t* acl);
+
+const ipv6_acl_t* IPV6_API_DECL(ipv6_acl_current) (
+    ipv6_acl_t* const* slot);
+// ~~~~
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,358 @@
+#include "ipv6_agg.h"
+#include "ipv6_config.h"
+#include "ipv6_internal.h"
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#define AGG_DEFAULT_PRECISION   10
+#define AGG_MIN_PRECISION       4
+#define AGG_MAX_PRECISION       16
+#define AGG_MAX_BUCKETS         (1u << 24)
+#define AGG_EMPTY               UINT32_MAX
+#define AGG_BATCH               16      // records keyed and prefetched together
+#define AGG_ALPHA_INF           0.7213475204444817      // 1 / (2 ln 2)
+
+typedef struct {
+    uint64_t                hi;             // masked prefix
+    uint64_t                lo;
+    uint64_t                records;
+    uint64_t                bytes;
+    uint32_t                hash;           // low bits of the prefix hash
+    uint32_t                ipv4;
+} agg_bucket_t;
+
+struct ipv6_agg_t {
+    agg_bucket_t*           buckets;        // in order of first use
+    uint8_t*                registers;      // 2^precision per bucket
+    uint32_t*               table;          // linear probing, bucket index or AGG_EMPTY
+    uint32_t                table_mask;
+    uint32_t                size;
+    uint32_t                max_buckets;
+    uint32_t                precision;
+    uint32_t                prefix[2];      // prefix length indexed by ipv4
+    uint64_t                mask_hi[2];
+    uint64_t                mask_lo[2];
+};
+
+//--------------------------------------------------------------------------------
+// Find the bucket of a prefix, inserting it if there is room.
+// Returns AGG_EMPTY if all buckets are in use.
+static uint32_t agg_bucket (
+    ipv6_agg_t* agg,
+    uint64_t hi,
+    uint64_t lo,
+    uint32_t ipv4,
+    uint32_t hash)
+{
+    uint32_t position = hash & agg->table_mask;
+    agg_bucket_t* bucket;
+
+    for (;;) {
+        const uint32_t index = agg->table[position];
+        if (index == AGG_EMPTY) {
+            break;
+        }
+
+        bucket = &agg->buckets[index];
+        if (bucket->hi == hi && bucket->lo == lo && bucket->ipv4 == ipv4) {
+            return index;
+        }
+        position = (position + 1) & agg->table_mask;
+    }
+
+    if (agg->size == agg->max_buckets) {
+        return AGG_EMPTY;
+    }
+
+    bucket = &agg->buckets[agg->size];
+    bucket->hi = hi;
+    bucket->lo = lo;
+    bucket->records = 0;
+    bucket->bytes = 0;
+    bucket->hash = hash;
+    bucket->ipv4 = ipv4;
+    agg->table[position] = agg->size;
+    return agg->size++;
+}
+
+//--------------------------------------------------------------------------------
+// Record a client hash in the HyperLogLog registers of a bucket
+static void agg_register (
+    uint8_t* registers,
+    uint32_t precision,
+    uint64_t hash)
+{
+    const uint32_t index = (uint32_t)(hash >> (64 - precision));
+    // The marker bit caps the rank at 65 - precision
+    const uint64_t rest = (hash << precision) | (UINT64_C(1) << (precision - 1));
+    const uint8_t rank = (uint8_t)(count_leading_zeros64(rest) + 1);
+
+    if (registers[index] < rank) {
+        registers[index] = rank;
+    }
+}
+
+//--------------------------------------------------------------------------------
+// x + sum(x^(2^k) * 2^(k-1)) for k >= 1
+static double agg_sigma (double x)
+{
+    double y = 1.0;
+    double z = x;
+    double previous;
+
+    do {
+        x *= x;
+        previous = z;
+        z += x * y;
+        y += y;
+    } while (z != previous);
+
+    return z;
+}
+
+//--------------------------------------------------------------------------------
+// Cardinality estimate of a register set using Ertl's improved estimator,
+// which is unbiased over the whole range without empirical corrections
+static uint64_t agg_estimate (
+    const uint8_t* registers,
+    uint32_t precision)
+{
+    const uint32_t m = 1u << precision;
+    const uint32_t q = 64 - precision;
+    uint32_t histogram[66];
+    double z;
+
+    memset(histogram, 0, sizeof(histogram));
+    for (uint32_t i = 0; i < m; ++i) {
+        histogram[registers[i]]++;
+    }
+
+    if (histogram[0] == m) {
+        return 0;
+    }
+
+    // Registers at q + 1 require every hash bit to be zero, they are counted
+    // as q which changes the estimate by less than 2^-q
+    z = (double)histogram[q + 1];
+    for (uint32_t k = q; k >= 1; --k) {
+        z = 0.5 * (z + histogram[k]);
+    }
+    z += m * agg_sigma((double)histogram[0] / m);
+
+    return (uint64_t)(AGG_ALPHA_INF * m * m / z + 0.5);
+}
+
+//--------------------------------------------------------------------------------
+ipv6_agg_t* IPV6_API_DEF(ipv6_agg_create) (
+    uint32_t ipv6_prefix,
+    uint32_t ipv4_prefix,
+    size_t max_buckets,
+    uint32_t precision)
+{
+    ipv6_agg_t* agg;
+    uint32_t table_size = 1;
+
+    if (precision == 0) {
+        precision = AGG_DEFAULT_PRECISION;
+    }
+
+    if (ipv6_prefix > 128 || ipv4_prefix > 32 ||
+        max_buckets == 0 || max_buckets > AGG_MAX_BUCKETS ||
+        precision < AGG_MIN_PRECISION || precision > AGG_MAX_PRECISION)
+    {
+        return NULL;
+    }
+
+    // Keep the table at most half full
+    while (table_size < 2 * max_buckets) {
+        table_size <<= 1;
+    }
+
+    agg = (ipv6_agg_t*)calloc(1, sizeof(ipv6_agg_t));
+    if (!agg) {
+        return NULL;
+    }
+
+    agg->buckets = (agg_bucket_t*)malloc(max_buckets * sizeof(agg_bucket_t));
+    agg->registers = (uint8_t*)calloc(max_buckets, (size_t)1 << precision);
+    agg->table = (uint32_t*)malloc(table_size * sizeof(uint32_t));
+    if (!agg->buckets || !agg->registers || !agg->table) {
+        ipv6_agg_destroy(agg);
+        return NULL;
+    }
+
+    memset(agg->table, 0xff, table_size * sizeof(uint32_t));
+    agg->table_mask = table_size - 1;
+    agg->max_buckets = (uint32_t)max_buckets;
+    agg->precision = precision;
+
+    // IPv4 keys live in the low 32 bits
+    agg->prefix[0] = ipv6_prefix;
+    agg->mask_hi[0] = PREFIX_HI_MASK(ipv6_prefix);
+    agg->mask_lo[0] = PREFIX_LO_MASK(ipv6_prefix);
+    agg->prefix[1] = ipv4_prefix;
+    agg->mask_hi[1] = ~UINT64_C(0);
+    agg->mask_lo[1] = PREFIX_LO_MASK(96 + ipv4_prefix);
+
+    return agg;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_agg_destroy) (
+    ipv6_agg_t* agg)
+{
+    if (agg) {
+        free(agg->buckets);
+        free(agg->registers);
+        free(agg->table);
+        free(agg);
+    }
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_agg_add) (
+    ipv6_agg_t* agg,
+    const ipv6_address_full_t* addr,
+    uint64_t bytes)
+{
+    return ipv6_agg_add_batch(agg, addr, &bytes, 1) == 1;
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_agg_add_batch) (
+    ipv6_agg_t* agg,
+    const ipv6_address_full_t* addrs,
+    const uint64_t* bytes,
+    size_t count)
+{
+    uint64_t client[AGG_BATCH], key_hi[AGG_BATCH], key_lo[AGG_BATCH];
+    uint32_t hash[AGG_BATCH], ipv4[AGG_BATCH];
+    size_t counted = 0;
+
+    if (!agg || !addrs) {
+        return 0;
+    }
+
+    while (count > 0) {
+        const uint32_t lanes = count < AGG_BATCH ? (uint32_t)count : AGG_BATCH;
+
+        // Key every record and issue the table loads first, then update
+        for (uint32_t j = 0; j < lanes; ++j) {
+            uint64_t hi, lo;
+
+            ipv4[j] = address_load_key(&addrs[j], &hi, &lo);
+            client[j] = address_hash(hi, lo);
+            key_hi[j] = hi & agg->mask_hi[ipv4[j]];
+            key_lo[j] = lo & agg->mask_lo[ipv4[j]];
+            hash[j] = (uint32_t)address_hash(key_hi[j], key_lo[j]);
+            IPV6_PREFETCH(&agg->table[hash[j] & agg->table_mask]);
+        }
+
+        for (uint32_t j = 0; j < lanes; ++j) {
+            const uint32_t index = agg_bucket(agg, key_hi[j], key_lo[j], ipv4[j], hash[j]);
+            if (index == AGG_EMPTY) {
+                continue;
+            }
+
+            agg->buckets[index].records++;
+            agg->buckets[index].bytes += bytes ? bytes[j] : 0;
+            agg_register(agg->registers + ((size_t)index << agg->precision), agg->precision, client[j]);
+            counted++;
+        }
+
+        addrs += lanes;
+        if (bytes) {
+            bytes += lanes;
+        }
+        count -= lanes;
+    }
+
+    return counted;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_agg_merge) (
+    ipv6_agg_t* dst,
+    const ipv6_agg_t* src)
+{
+    bool complete = true;
+
+    if (!dst || !src ||
+        dst->precision != src->precision ||
+        dst->prefix[0] != src->prefix[0] ||
+        dst->prefix[1] != src->prefix[1])
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < src->size; ++i) {
+        const agg_bucket_t* bucket = &src->buckets[i];
+        const uint8_t* from = src->registers + ((size_t)i << src->precision);
+        uint8_t* to;
+        const uint32_t index = agg_bucket(dst, bucket->hi, bucket->lo, bucket->ipv4, bucket->hash);
+
+        if (index == AGG_EMPTY) {
+            complete = false;
+            continue;
+        }
+
+        dst->buckets[index].records += bucket->records;
+        dst->buckets[index].bytes += bucket->bytes;
+
+        // The union of two sketches is the register wise maximum
+        to = dst->registers + ((size_t)index << dst->precision);
+        for (size_t r = 0; r < ((size_t)1 << dst->precision); ++r) {
+            to[r] = to[r] > from[r] ? to[r] : from[r];
+        }
+    }
+
+    return complete;
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_agg_flush) (
+    ipv6_agg_t* agg,
+    ipv6_agg_flush_func_t func,
+    void* user_data)
+{
+    ipv6_agg_bucket_t out;
+    size_t flushed;
+
+    if (!agg) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; func && i < agg->size; ++i) {
+        const agg_bucket_t* bucket = &agg->buckets[i];
+
+        memset(&out, 0, sizeof(out));
+        if (bucket->ipv4) {
+            out.prefix.flags = IPV6_FLAG_IPV4_COMPAT;
+            out.prefix.address.components[0] = (uint16_t)(bucket->lo >> 16);
+            out.prefix.address.components[1] = (uint16_t)bucket->lo;
+        }
+        else {
+            address_store(&out.prefix.address, bucket->hi, bucket->lo);
+        }
+        out.prefix.flags |= IPV6_FLAG_HAS_MASK;
+        out.prefix.mask = agg->prefix[bucket->ipv4];
+        out.records = bucket->records;
+        out.bytes = bucket->bytes;
+        out.clients = agg_estimate(agg->registers + ((size_t)i << agg->precision), agg->precision);
+
+        func(&out, user_data);
+    }
+
+    // Only the registers of used buckets need clearing
+    memset(agg->registers, 0, (size_t)agg->size << agg->precision);
+    memset(agg->table, 0xff, ((size_t)agg->table_mask + 1) * sizeof(uint32_t));
+    flushed = agg->size;
+    agg->size = 0;
+    return flushed;
+}
@@ -0,0 +1,138 @@
+#pragma once
+// ## Prefix aggregation
+//
+// Streaming rollup of traffic records per prefix, e.g. per customer /48, /56 or
+// /64, without formatting addresses. Each bucket counts records and bytes and
+// estimates the number of distinct client addresses with a HyperLogLog sketch.
+//
+// Memory is fixed at creation: `max_buckets` buckets with `2^precision` bytes
+// of HyperLogLog registers each. The relative error of the client estimate is
+// about `1.04 / sqrt(2^precision)`:
+//
+//     precision:        8      10     12     14
+//     register bytes:   256    1K     4K     16K
+//     standard error:   6.5%   3.3%   1.6%   0.8%
+//
+// IPv4 compatible addresses and addresses in `::ffff:0:0/96`, written either
+// as `::ffff:1.2.3.4` or `::ffff:102:304`, are aggregated at the IPv4 prefix
+// length. All other addresses are aggregated at the IPv6 prefix length,
+// including ones written with an IPv4 tail such as `64:ff9b::1.2.3.4`. For rollups at several prefix lengths use one aggregator per
+// prefix length.
+//
+// An aggregator is not thread safe. Shards on separate threads each use their
+// own aggregator and are combined with ipv6_agg_merge, merged client estimates
+// are exactly those of a single aggregator over the combined records.
+//
+
+#include "ipv6.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ### ipv6_agg_bucket_t
+//
+// Totals of one prefix. IPv4 prefixes are IPv4 compatible addresses, all
+// prefixes have IPV6_FLAG_HAS_MASK set with the prefix length in `mask`.
+//
+// ~~~~
+typedef struct {
+    ipv6_address_full_t     prefix;
+    uint64_t                records;        // number of addresses added
+    uint64_t                bytes;          // sum of the bytes added
+    uint64_t                clients;        // estimated distinct addresses
+} ipv6_agg_bucket_t;
+// ~~~~
+
+
+// ### ipv6_agg_create
+//
+// Create an aggregator keyed on the first `ipv6_prefix` bits (0-128) of IPv6
+// addresses and `ipv4_prefix` bits (0-32) of IPv4 addresses, holding at most
+// `max_buckets` prefixes. `precision` (4-16) sets the HyperLogLog register
+// count, 0 selects 10.
+//
+// Returns NULL if an argument is out of range or memory could not be allocated.
+//
+// ~~~~
+typedef struct ipv6_agg_t ipv6_agg_t;
+
+ipv6_agg_t* IPV6_API_DECL(ipv6_agg_create) (
+    uint32_t ipv6_prefix,
+    uint32_t ipv4_prefix,
+    size_t max_buckets,
+    uint32_t precision);
+
+void IPV6_API_DECL(ipv6_agg_destroy) (
+    ipv6_agg_t* agg);
+// ~~~~
+
+
+// ### ipv6_agg_add
+//
+// Add a record for an address, port, mask and interface are ignored.
+//
+// Returns false if the address belongs to a new prefix and all buckets are
+// in use, the record is not counted.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_agg_add) (
+    ipv6_agg_t* agg,
+    const ipv6_address_full_t* addr,
+    uint64_t bytes);
+// ~~~~
+
+
+// ### ipv6_agg_add_batch
+//
+// Add `count` records with the matching `bytes`, a NULL `bytes` adds 0 bytes
+// per record. Bucket slots are prefetched ahead of the updates.
+//
+// Returns the number of records counted.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_agg_add_batch) (
+    ipv6_agg_t* agg,
+    const ipv6_address_full_t* addrs,
+    const uint64_t* bytes,
+    size_t count);
+// ~~~~
+
+
+// ### ipv6_agg_merge
+//
+// Add the buckets of `src` into `dst`, both must have been created with the
+// same prefix lengths and precision. `src` is not modified.
+//
+// Returns false if the configurations differ or `dst` ran out of buckets, in
+// which case the buckets that did not fit are not merged.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_agg_merge) (
+    ipv6_agg_t* dst,
+    const ipv6_agg_t* src);
+// ~~~~
+
+
+// ### ipv6_agg_flush
+//
+// Call `func` for every bucket in the order the prefixes were first seen, then
+// empty the aggregator for the next interval. `func` may be NULL to only empty
+// the aggregator.
+//
+// Returns the number of buckets flushed.
+//
+// ~~~~
+typedef void (*ipv6_agg_flush_func_t) (
+    const ipv6_agg_bucket_t* bucket,
+    void* user_data);
+
+size_t IPV6_API_DECL(ipv6_agg_flush) (
+    ipv6_agg_t* agg,
+    ipv6_agg_flush_func_t func,
+    void* user_data);
+// ~~~~
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
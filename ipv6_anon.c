@@ -0,0 +1,302 @@
+#include "ipv6_anon.h"
+#include "ipv6_config.h"
+#include "ipv6_internal.h"
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#define ANON_DEFAULT_CACHE_ENTRIES  (64 * 1024)
+#define ANON_V6_STEPS               32      // nibbles in an IPv6 address
+#define ANON_V4_STEPS               8       // nibbles in an IPv4 address
+
+//
+// Separate the IPv4 and IPv6 trees so that they never share nodes
+//
+typedef enum {
+    ANON_DOMAIN_V6          = 0,
+    ANON_DOMAIN_V4          = 1,
+} anon_domain_t;
+
+//
+// A memoized prefix tree node, the flip bits of the nibble following the
+// prefix of `depth` nibbles of (hi, lo)
+//
+typedef struct {
+    uint64_t                hi;             // prefix bits of the input
+    uint64_t                lo;
+    uint64_t                flips;          // PRF output, 15 flip bits for the next 4 bits
+    uint32_t                tag;            // depth | domain << 8 | valid bit
+    uint32_t                pad0;
+} anon_node_t;
+
+#define ANON_TAG(domain, depth) ((uint32_t)(depth) | (uint32_t)(domain) << 8 | 0x10000u)
+
+struct ipv6_anon_t {
+    uint64_t                k0;             // SipHash key
+    uint64_t                k1;
+    anon_node_t*            cache;          // direct mapped node cache
+    size_t                  cache_mask;     // number of cache entries - 1
+    uint64_t                last_hi;        // input of the previous address
+    uint64_t                last_lo;
+    uint64_t                last_out_hi;    // output of the previous address
+    uint64_t                last_out_lo;
+    uint32_t                last_domain;    // domain of the previous address
+    uint32_t                last_steps;     // number of valid entries in last_flips
+    uint64_t                last_flips[ANON_V6_STEPS];
+};
+
+//--------------------------------------------------------------------------------
+#define SIPROUND \
+    v0 += v1; v1 = (v1 << 13) | (v1 >> 51); v1 ^= v0; v0 = (v0 << 32) | (v0 >> 32); \
+    v2 += v3; v3 = (v3 << 16) | (v3 >> 48); v3 ^= v2; \
+    v0 += v3; v3 = (v3 << 21) | (v3 >> 43); v3 ^= v0; \
+    v2 += v1; v1 = (v1 << 17) | (v1 >> 47); v1 ^= v2; v2 = (v2 << 32) | (v2 >> 32);
+
+//--------------------------------------------------------------------------------
+// SipHash-2-4 of the 24 byte little-endian message (m0, m1, m2), only called on
+// a cache miss and kept out of line so the tree walk stays small
+static IPV6_NOINLINE uint64_t anon_prf (
+    const ipv6_anon_t* anon,
+    uint64_t m0,
+    uint64_t m1,
+    uint64_t m2)
+{
+    uint64_t v0 = anon->k0 ^ UINT64_C(0x736f6d6570736575);
+    uint64_t v1 = anon->k1 ^ UINT64_C(0x646f72616e646f6d);
+    uint64_t v2 = anon->k0 ^ UINT64_C(0x6c7967656e657261);
+    uint64_t v3 = anon->k1 ^ UINT64_C(0x7465646279746573);
+    const uint64_t m[4] = { m0, m1, m2, UINT64_C(24) << 56 };
+
+    for (uint32_t i = 0; i < 4; ++i) {
+        v3 ^= m[i];
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m[i];
+    }
+
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+//--------------------------------------------------------------------------------
+// Permute a nibble using the 15 flip bits of a 4 level binary tree, each output
+// bit is the input bit flipped by the tree node selected by the input bits above it
+static uint64_t anon_nibble (
+    uint64_t nibble,
+    uint64_t flips)
+{
+    return nibble ^ (
+        (flips & 1) << 3 |
+        ((flips >> (1 + (nibble >> 3))) & 1) << 2 |
+        ((flips >> (3 + (nibble >> 2))) & 1) << 1 |
+        ((flips >> (7 + (nibble >> 1))) & 1));
+}
+
+//--------------------------------------------------------------------------------
+// Find the node for the prefix in the cache, computing it on a miss
+static uint64_t anon_node (
+    ipv6_anon_t* anon,
+    uint32_t tag,
+    uint64_t hi,
+    uint64_t lo)
+{
+    uint64_t hash = hi * UINT64_C(0x9e3779b97f4a7c15)
+        ^ lo * UINT64_C(0xc2b2ae3d27d4eb4f)
+        ^ tag * UINT64_C(0x165667b19e3779f9);
+    hash = (hash ^ (hash >> 32)) * UINT64_C(0xd6e8feb86659fd93);
+    anon_node_t* node = &anon->cache[(hash ^ (hash >> 32)) & anon->cache_mask];
+
+    if (node->tag != tag || node->hi != hi || node->lo != lo) {
+        node->hi = hi;
+        node->lo = lo;
+        node->tag = tag;
+        node->flips = anon_prf(anon, hi, lo, tag);
+    }
+
+    return node->flips;
+}
+
+//--------------------------------------------------------------------------------
+// Permute nibbles [first, last) of one 64bit lane, `lane` selects hi (0) or lo (1)
+// and `prefix_hi` is the complete hi lane when walking the lo lane
+static uint64_t anon_lane (
+    ipv6_anon_t* anon,
+    anon_domain_t domain,
+    uint32_t lane,
+    uint32_t first,
+    uint32_t last,
+    uint32_t reuse,
+    uint64_t prefix_hi,
+    uint64_t in,
+    uint64_t out)
+{
+    uint64_t prefix = in & PREFIX_HI_MASK((first & 15) * 4);
+
+    for (uint32_t d = first; d < last; ++d) {
+        const uint32_t shift = 60 - (d & 15) * 4;
+        const uint64_t nibble = (in >> shift) & 0xf;
+        uint64_t flips;
+
+        if (d == reuse) {
+            flips = anon->last_flips[d];
+        } else {
+            flips = lane == 0
+                ? anon_node(anon, ANON_TAG(domain, d), prefix, 0)
+                : anon_node(anon, ANON_TAG(domain, d), prefix_hi, prefix);
+            anon->last_flips[d] = flips;
+        }
+
+        out |= anon_nibble(nibble, flips) << shift;
+        prefix |= nibble << shift;
+    }
+
+    return out;
+}
+
+//--------------------------------------------------------------------------------
+// Permute the first `steps` nibbles of (hi, lo) in place
+static void anon_permute (
+    ipv6_anon_t* anon,
+    anon_domain_t domain,
+    uint32_t steps,
+    uint64_t* hi,
+    uint64_t* lo)
+{
+    const uint64_t in_hi = *hi;
+    const uint64_t in_lo = *lo;
+    uint64_t out_hi = 0;
+    uint64_t out_lo = 0;
+    uint32_t common = 0;
+    uint32_t reuse = steps;
+
+    // Output nibbles along the common prefix with the previous address are
+    // unchanged and the node at the first differing nibble is the same
+    if (anon->last_domain == (uint32_t)domain && anon->last_steps == steps) {
+        const uint32_t bits = in_hi != anon->last_hi
+            ? count_leading_zeros64(in_hi ^ anon->last_hi)
+            : 64 + count_leading_zeros64(in_lo ^ anon->last_lo);
+        common = bits / 4 < steps ? bits / 4 : steps;
+        reuse = common;
+        out_hi = anon->last_out_hi & PREFIX_HI_MASK(common * 4);
+        out_lo = anon->last_out_lo & PREFIX_LO_MASK(common * 4);
+    }
+
+    if (common < 16) {
+        out_hi = anon_lane(anon, domain, 0, common, steps < 16 ? steps : 16, reuse, 0, in_hi, out_hi);
+    }
+    if (steps > 16) {
+        out_lo = anon_lane(anon, domain, 1, common > 16 ? common : 16, steps, reuse, in_hi, in_lo, out_lo);
+    }
+
+    anon->last_hi = in_hi;
+    anon->last_lo = in_lo;
+    anon->last_out_hi = out_hi;
+    anon->last_out_lo = out_lo;
+    anon->last_domain = (uint32_t)domain;
+    anon->last_steps = steps;
+
+    *hi = out_hi;
+    *lo = out_lo;
+}
+
+//--------------------------------------------------------------------------------
+ipv6_anon_t* IPV6_API_DEF(ipv6_anon_create) (
+    const uint8_t key[IPV6_ANON_KEY_SIZE],
+    size_t cache_entries)
+{
+    ipv6_anon_t* anon;
+    size_t entries = 1;
+
+    if (!key) {
+        return NULL;
+    }
+
+    if (cache_entries == 0) {
+        cache_entries = ANON_DEFAULT_CACHE_ENTRIES;
+    }
+    while (entries < cache_entries) {
+        entries <<= 1;
+    }
+
+    anon = (ipv6_anon_t*)calloc(1, sizeof(ipv6_anon_t));
+    if (!anon) {
+        return NULL;
+    }
+
+    anon->cache = (anon_node_t*)calloc(entries, sizeof(anon_node_t));
+    if (!anon->cache) {
+        free(anon);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        anon->k0 |= (uint64_t)key[i] << (i * 8);
+        anon->k1 |= (uint64_t)key[i + 8] << (i * 8);
+    }
+    anon->cache_mask = entries - 1;
+    return anon;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_anon_destroy) (
+    ipv6_anon_t* anon)
+{
+    if (anon) {
+        free(anon->cache);
+        free(anon);
+    }
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_anon_batch) (
+    ipv6_anon_t* anon,
+    const ipv6_address_full_t* in,
+    ipv6_address_full_t* out,
+    size_t count)
+{
+    if (!anon || !in || !out) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        ipv6_address_full_t addr = in[i];
+        uint16_t* c = addr.address.components;
+        uint64_t hi, lo;
+        const uint64_t compat = address_load_mapped(&addr, &hi, &lo);
+
+        // Only IPv4 compatible and ::ffff:0:0/96 addresses are IPv4, an IPv4
+        // tail on any other address is permuted with the rest of the address
+        if (compat || (hi == 0 && lo >> 32 == 0xffff)) {
+            // Move the IPv4 address to the top of the first lane
+            const uint32_t index = compat ? 0 : IPV4_EMBED_INDEX;
+            hi = lo << 32;
+            lo = 0;
+            anon_permute(anon, ANON_DOMAIN_V4, ANON_V4_STEPS, &hi, &lo);
+            c[index] = (uint16_t)(hi >> 48);
+            c[index + 1] = (uint16_t)(hi >> 32);
+        } else {
+            anon_permute(anon, ANON_DOMAIN_V6, ANON_V6_STEPS, &hi, &lo);
+            address_store(&addr.address, hi, lo);
+        }
+
+        out[i] = addr;
+    }
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_anon_address) (
+    ipv6_anon_t* anon,
+    const ipv6_address_full_t* in,
+    ipv6_address_full_t* out)
+{
+    ipv6_anon_batch(anon, in, out, 1);
+}
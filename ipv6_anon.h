@@ -0,0 +1,88 @@
+#pragma once
+// ## Prefix preserving anonymization
+//
+// Keyed prefix preserving permutation of addresses in the style of Crypto-PAn:
+// two addresses that share a prefix of N bits are anonymized to two addresses
+// that share a prefix of exactly N bits, so subnet structure survives.
+//
+// Each output bit is the input bit flipped by a keyed PRF (SipHash-2-4) of the
+// input bits preceding it. The PRF is evaluated once per 4 bit step of the
+// prefix tree, producing the permutation of the next nibble, and tree nodes are
+// memoized in a bounded cache so that addresses from the same subnets only pay
+// for the bits that differ.
+//
+// A context is not thread safe. For multi-threaded use create one context per
+// thread with the same key, all contexts with the same key produce identical
+// results.
+//
+
+#include "ipv6.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ### ipv6_anon_t
+//
+// Opaque anonymization context holding the key and the prefix tree cache.
+//
+// ~~~~
+#define IPV6_ANON_KEY_SIZE 16
+typedef struct ipv6_anon_t ipv6_anon_t;
+// ~~~~
+
+
+// ### ipv6_anon_create
+//
+// Create a context from a secret key. `cache_entries` bounds the number of
+// memoized prefix tree nodes (rounded up to a power of two, 32 bytes each),
+// 0 selects a default of 64K entries.
+//
+// Returns NULL if memory could not be allocated.
+//
+// ~~~~
+ipv6_anon_t* IPV6_API_DECL(ipv6_anon_create) (
+    const uint8_t key[IPV6_ANON_KEY_SIZE],
+    size_t cache_entries);
+
+void IPV6_API_DECL(ipv6_anon_destroy) (
+    ipv6_anon_t* anon);
+// ~~~~
+
+
+// ### ipv6_anon_address
+//
+// Anonymize a single address. IPv6 addresses are permuted over all 128 bits.
+// IPv4 compatible addresses are permuted over their 32 bits, and addresses
+// in `::ffff:0:0/96` have their last 32 bits permuted the same way so that
+// `1.2.3.4` and `::ffff:1.2.3.4` map to the same IPv4 address. Any other
+// address with an IPv4 tail is an IPv6 address: `2001:db8::1.2.3.4` and
+// `2001:db8::102:304` give the same result.
+//
+// Flags, port and mask are copied from the input.
+//
+// ~~~~
+void IPV6_API_DECL(ipv6_anon_address) (
+    ipv6_anon_t* anon,
+    const ipv6_address_full_t* in,
+    ipv6_address_full_t* out);
+// ~~~~
+
+
+// ### ipv6_anon_batch
+//
+// Anonymize `count` addresses, `in` and `out` may be the same array. Prefix
+// tree nodes shared with the previous element are reused without a cache
+// lookup, so sorted input is the fastest case.
+//
+// ~~~~
+void IPV6_API_DECL(ipv6_anon_batch) (
+    ipv6_anon_t* anon,
+    const ipv6_address_full_t* in,
+    ipv6_address_full_t* out,
+    size_t count);
+// ~~~~
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
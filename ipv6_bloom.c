@@ -0,0 +1,291 @@
+#include "ipv6_bloom.h"
+#include "ipv6_config.h"
+#include "ipv6_internal.h"
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#define BLOOM_DEFAULT_BITS      12
+#define BLOOM_BLOCK_WORDS       8       // 32bit words per block
+#define BLOOM_BLOCK_BYTES       (BLOOM_BLOCK_WORDS * sizeof(uint32_t))
+#define BLOOM_BATCH             16      // lookups prefetched ahead in a batch
+#define BLOOM_MAGIC             0x42365049u     // "IP6B" in little-endian hosts
+#define BLOOM_VERSION           1
+
+//
+// Serialized image header, followed by num_blocks blocks
+//
+typedef struct {
+    uint32_t                magic;
+    uint32_t                version;
+    uint64_t                num_blocks;
+    uint64_t                entries;        // number of addresses added
+    uint64_t                reserved;
+} bloom_header_t;
+
+struct ipv6_bloom_t {
+    uint32_t*               blocks;         // num_blocks * BLOOM_BLOCK_WORDS words
+    uint64_t                num_blocks;
+    uint64_t                entries;
+    bool                    read_only;      // view of a serialized image
+};
+
+//
+// Odd constants selecting one bit in each word of a block
+//
+static const uint32_t bloom_salt[BLOOM_BLOCK_WORDS] = {
+    0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+    0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u,
+};
+
+//--------------------------------------------------------------------------------
+// Hash the normalized address, the high 32 bits select the block and the low
+// 32 bits select the bits within the block
+static uint64_t bloom_hash (const ipv6_address_full_t* addr)
+{
+    uint64_t hi, lo;
+    address_load_mapped(addr, &hi, &lo);
+
+    return address_hash(hi, lo);
+}
+
+//--------------------------------------------------------------------------------
+static uint32_t* bloom_block (const ipv6_bloom_t* bloom, uint64_t hash)
+{
+    // Multiply-shift maps the hash onto [0, num_blocks) without a division
+    const uint64_t index = ((hash >> 32) * bloom->num_blocks) >> 32;
+    return bloom->blocks + index * BLOOM_BLOCK_WORDS;
+}
+
+//--------------------------------------------------------------------------------
+static bool bloom_test (const uint32_t* block, uint64_t hash)
+{
+    const uint32_t key = (uint32_t)hash;
+    uint32_t missing = 0;
+
+    for (uint32_t i = 0; i < BLOOM_BLOCK_WORDS; ++i) {
+        const uint32_t bit = 1u << ((key * bloom_salt[i]) >> 27);
+        missing |= ~block[i] & bit;
+    }
+
+    return missing == 0;
+}
+
+//--------------------------------------------------------------------------------
+static ipv6_bloom_t* bloom_alloc (uint64_t num_blocks)
+{
+    ipv6_bloom_t* bloom = (ipv6_bloom_t*)calloc(1, sizeof(ipv6_bloom_t));
+    if (!bloom) {
+        return NULL;
+    }
+
+    bloom->blocks = (uint32_t*)calloc((size_t)num_blocks, BLOOM_BLOCK_BYTES);
+    if (!bloom->blocks) {
+        free(bloom);
+        return NULL;
+    }
+
+    bloom->num_blocks = num_blocks;
+    return bloom;
+}
+
+//--------------------------------------------------------------------------------
+ipv6_bloom_t* IPV6_API_DEF(ipv6_bloom_create) (
+    size_t expected_entries,
+    uint32_t bits_per_entry)
+{
+    if (bits_per_entry == 0) {
+        bits_per_entry = BLOOM_DEFAULT_BITS;
+    }
+
+    const uint64_t bits = (uint64_t)expected_entries * bits_per_entry;
+    const uint64_t block_bits = BLOOM_BLOCK_BYTES * 8;
+    uint64_t num_blocks = (bits + block_bits - 1) / block_bits;
+    if (num_blocks == 0) {
+        num_blocks = 1;
+    }
+
+    // Block selection uses 32 bits of the hash
+    if (num_blocks > UINT32_MAX) {
+        return NULL;
+    }
+
+    return bloom_alloc(num_blocks);
+}
+
+//--------------------------------------------------------------------------------
+ipv6_bloom_t* IPV6_API_DEF(ipv6_bloom_build) (
+    const ipv6_address_full_t* list,
+    size_t count,
+    uint32_t bits_per_entry)
+{
+    ipv6_bloom_t* bloom;
+
+    if (!list && count) {
+        return NULL;
+    }
+
+    bloom = ipv6_bloom_create(count, bits_per_entry);
+    if (!bloom) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        ipv6_bloom_add(bloom, &list[i]);
+    }
+
+    return bloom;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_bloom_destroy) (
+    ipv6_bloom_t* bloom)
+{
+    if (bloom) {
+        if (!bloom->read_only) {
+            free(bloom->blocks);
+        }
+        free(bloom);
+    }
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_bloom_add) (
+    ipv6_bloom_t* bloom,
+    const ipv6_address_full_t* addr)
+{
+    if (!bloom || !addr || bloom->read_only) {
+        return false;
+    }
+
+    const uint64_t hash = bloom_hash(addr);
+    const uint32_t key = (uint32_t)hash;
+    uint32_t* block = bloom_block(bloom, hash);
+
+    for (uint32_t i = 0; i < BLOOM_BLOCK_WORDS; ++i) {
+        block[i] |= 1u << ((key * bloom_salt[i]) >> 27);
+    }
+
+    bloom->entries++;
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_bloom_contains) (
+    const ipv6_bloom_t* bloom,
+    const ipv6_address_full_t* addr)
+{
+    if (!bloom || !addr) {
+        return false;
+    }
+
+    const uint64_t hash = bloom_hash(addr);
+    return bloom_test(bloom_block(bloom, hash), hash);
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_bloom_contains_batch) (
+    const ipv6_bloom_t* bloom,
+    const ipv6_address_full_t* in,
+    bool* out,
+    size_t count)
+{
+    uint64_t hashes[BLOOM_BATCH];
+    const uint32_t* blocks[BLOOM_BATCH];
+    size_t positive = 0;
+
+    if (!bloom || !in || !out) {
+        return 0;
+    }
+
+    while (count > 0) {
+        const uint32_t lanes = count < BLOOM_BATCH ? (uint32_t)count : BLOOM_BATCH;
+
+        // Issue all of the block loads first, then test
+        for (uint32_t j = 0; j < lanes; ++j) {
+            hashes[j] = bloom_hash(&in[j]);
+            blocks[j] = bloom_block(bloom, hashes[j]);
+            IPV6_PREFETCH(blocks[j]);
+        }
+
+        for (uint32_t j = 0; j < lanes; ++j) {
+            out[j] = bloom_test(blocks[j], hashes[j]);
+            positive += out[j];
+        }
+
+        in += lanes;
+        out += lanes;
+        count -= lanes;
+    }
+
+    return positive;
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_bloom_serialize) (
+    const ipv6_bloom_t* bloom,
+    void* buffer,
+    size_t buffer_bytes)
+{
+    bloom_header_t header;
+
+    if (!bloom) {
+        return 0;
+    }
+
+    const size_t image_bytes = sizeof(bloom_header_t) + (size_t)bloom->num_blocks * BLOOM_BLOCK_BYTES;
+    if (!buffer) {
+        return image_bytes;
+    }
+    if (buffer_bytes < image_bytes) {
+        return 0;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = BLOOM_MAGIC;
+    header.version = BLOOM_VERSION;
+    header.num_blocks = bloom->num_blocks;
+    header.entries = bloom->entries;
+
+    memcpy(buffer, &header, sizeof(header));
+    memcpy((uint8_t*)buffer + sizeof(header), bloom->blocks, image_bytes - sizeof(header));
+    return image_bytes;
+}
+
+//--------------------------------------------------------------------------------
+ipv6_bloom_t* IPV6_API_DEF(ipv6_bloom_view) (
+    const void* buffer,
+    size_t buffer_bytes)
+{
+    const bloom_header_t* header = (const bloom_header_t*)buffer;
+    ipv6_bloom_t* bloom;
+
+    if (!buffer || buffer_bytes < sizeof(bloom_header_t) || ((uintptr_t)buffer & 7) != 0) {
+        return NULL;
+    }
+
+    if (header->magic != BLOOM_MAGIC ||
+        header->version != BLOOM_VERSION ||
+        header->num_blocks == 0 ||
+        header->num_blocks > UINT32_MAX ||
+        header->num_blocks > (buffer_bytes - sizeof(bloom_header_t)) / BLOOM_BLOCK_BYTES)
+    {
+        return NULL;
+    }
+
+    bloom = (ipv6_bloom_t*)calloc(1, sizeof(ipv6_bloom_t));
+    if (!bloom) {
+        return NULL;
+    }
+
+    bloom->blocks = (uint32_t*)(uintptr_t)((const uint8_t*)buffer + sizeof(bloom_header_t));
+    bloom->num_blocks = header->num_blocks;
+    bloom->entries = header->entries;
+    bloom->read_only = true;
+    return bloom;
+}
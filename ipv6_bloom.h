@@ -0,0 +1,141 @@
+#pragma once
+// ## Address blocklist filter
+//
+// Split block Bloom filter keyed on addresses for blocklists that are too large
+// for an exact in-memory set. Every address maps to a single 32 byte block and
+// sets one bit in each of the block's eight 32bit words, so a lookup touches
+// exactly one cache line.
+//
+// IPv4 compatible addresses and IPv4 mapped addresses (`::ffff:1.2.3.4`) share
+// the same key. Port, mask and interface are ignored.
+//
+// The filter can be serialized into a flat buffer (e.g. written to a file) and
+// queried in place from that buffer, for example from a read-only mmap.
+//
+// False positive rate for a given number of bits per entry:
+//
+//     bits per entry:   8      10     12     16     20
+//     false positive:   2.6%   1.2%   0.55%  0.14%  0.04%
+//
+
+#include "ipv6.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ### ipv6_bloom_t
+//
+// Opaque filter, either owning its blocks or a read-only view of a buffer.
+//
+// ~~~~
+typedef struct ipv6_bloom_t ipv6_bloom_t;
+// ~~~~
+
+
+// ### ipv6_bloom_create
+//
+// Create an empty filter sized for `expected_entries` with `bits_per_entry`
+// bits of storage per entry, 0 selects 12 bits.
+//
+// ~~~~
+ipv6_bloom_t* IPV6_API_DECL(ipv6_bloom_create) (
+    size_t expected_entries,
+    uint32_t bits_per_entry);
+// ~~~~
+
+
+// ### ipv6_bloom_build
+//
+// Create a filter sized for and containing the `count` addresses in `list`.
+//
+// ~~~~
+ipv6_bloom_t* IPV6_API_DECL(ipv6_bloom_build) (
+    const ipv6_address_full_t* list,
+    size_t count,
+    uint32_t bits_per_entry);
+// ~~~~
+
+
+// ### ipv6_bloom_destroy
+//
+// Release a filter or a view, the buffer of a view is not touched.
+//
+// ~~~~
+void IPV6_API_DECL(ipv6_bloom_destroy) (
+    ipv6_bloom_t* bloom);
+// ~~~~
+
+
+// ### ipv6_bloom_add
+//
+// Add an address to the filter, returns false for read-only views.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_bloom_add) (
+    ipv6_bloom_t* bloom,
+    const ipv6_address_full_t* addr);
+// ~~~~
+
+
+// ### ipv6_bloom_contains
+//
+// Test an address, false means the address was never added, true means the
+// address was probably added.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_bloom_contains) (
+    const ipv6_bloom_t* bloom,
+    const ipv6_address_full_t* addr);
+// ~~~~
+
+
+// ### ipv6_bloom_contains_batch
+//
+// Test `count` addresses writing the results to `out`. Block addresses are
+// computed and prefetched ahead of the tests so that the cache misses of
+// consecutive lookups overlap.
+//
+// Returns the number of addresses that tested positive.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_bloom_contains_batch) (
+    const ipv6_bloom_t* bloom,
+    const ipv6_address_full_t* in,
+    bool* out,
+    size_t count);
+// ~~~~
+
+
+// ### ipv6_bloom_serialize
+//
+// Write the filter into `buffer` as a flat image: a 32 byte header followed by
+// the blocks in host byte order. Returns the image size in bytes, or 0 if
+// `buffer_bytes` is too small. Pass a NULL buffer to query the size.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_bloom_serialize) (
+    const ipv6_bloom_t* bloom,
+    void* buffer,
+    size_t buffer_bytes);
+// ~~~~
+
+
+// ### ipv6_bloom_view
+//
+// Create a read-only filter over an image produced by ipv6_bloom_serialize
+// without copying it. The buffer must be 8 byte aligned (32 byte alignment is
+// best) and outlive the view.
+//
+// Returns NULL if the image is invalid, truncated, or from a host with a
+// different byte order.
+//
+// ~~~~
+ipv6_bloom_t* IPV6_API_DECL(ipv6_bloom_view) (
+    const void* buffer,
+    size_t buffer_bytes);
+// ~~~~
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
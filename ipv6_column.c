@@ -0,0 +1,276 @@
+#include "ipv6_column.h"
+#include "ipv6_config.h"
+#include "ipv6_internal.h"
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#define COLUMN_MIN_CAPACITY     64
+#define COLUMN_BLOCK            64      // rows per bitmap word
+
+struct ipv6_column_t {
+    uint64_t*               hi;
+    uint64_t*               lo;
+    uint16_t*               port;
+    uint8_t*                mask;
+    uint8_t*                flags;
+    size_t                  size;
+    size_t                  capacity;
+};
+
+// Masked value a row must equal to match
+typedef struct {
+    uint64_t                mask_hi;
+    uint64_t                mask_lo;
+    uint64_t                hi;
+    uint64_t                lo;
+} column_pred_t;
+
+//--------------------------------------------------------------------------------
+static bool column_reserve (ipv6_column_t* column, size_t rows)
+{
+    size_t capacity = column->capacity ? column->capacity : COLUMN_MIN_CAPACITY;
+    void* p;
+
+    if (rows <= column->capacity) {
+        return true;
+    }
+
+    while (capacity < rows) {
+        capacity *= 2;
+    }
+
+    // Each array is replaced as soon as it grows so a failure leaves every
+    // array at least at the old capacity
+    if (!(p = realloc(column->hi, capacity * sizeof(uint64_t)))) return false;
+    column->hi = (uint64_t*)p;
+    if (!(p = realloc(column->lo, capacity * sizeof(uint64_t)))) return false;
+    column->lo = (uint64_t*)p;
+    if (!(p = realloc(column->port, capacity * sizeof(uint16_t)))) return false;
+    column->port = (uint16_t*)p;
+    if (!(p = realloc(column->mask, capacity))) return false;
+    column->mask = (uint8_t*)p;
+    if (!(p = realloc(column->flags, capacity))) return false;
+    column->flags = (uint8_t*)p;
+
+    column->capacity = capacity;
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+ipv6_column_t* IPV6_API_DEF(ipv6_column_create) (
+    size_t capacity)
+{
+    ipv6_column_t* column = (ipv6_column_t*)calloc(1, sizeof(ipv6_column_t));
+
+    if (column && !column_reserve(column, capacity)) {
+        ipv6_column_destroy(column);
+        return NULL;
+    }
+
+    return column;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_column_destroy) (
+    ipv6_column_t* column)
+{
+    if (column) {
+        free(column->hi);
+        free(column->lo);
+        free(column->port);
+        free(column->mask);
+        free(column->flags);
+        free(column);
+    }
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_column_append) (
+    ipv6_column_t* column,
+    const ipv6_address_full_t* addrs,
+    size_t count)
+{
+    if (!column || !addrs) {
+        return 0;
+    }
+
+    // Append what fits if the column can not grow to the full count
+    if (!column_reserve(column, column->size + count)) {
+        count = column->capacity - column->size;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const size_t row = column->size + i;
+
+        address_load_mapped(&addrs[i], &column->hi[row], &column->lo[row]);
+        column->port[row] = addrs[i].port;
+        column->mask[row] = (uint8_t)addrs[i].mask;
+        column->flags[row] = (uint8_t)(addrs[i].flags &
+            (IPV6_FLAG_HAS_PORT | IPV6_FLAG_HAS_MASK | IPV6_FLAG_IPV4_EMBED | IPV6_FLAG_IPV4_COMPAT));
+    }
+
+    column->size += count;
+    return count;
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_column_size) (
+    const ipv6_column_t* column)
+{
+    return column ? column->size : 0;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_column_get) (
+    const ipv6_column_t* column,
+    size_t row,
+    ipv6_address_full_t* out)
+{
+    if (!column || !out || row >= column->size) {
+        return false;
+    }
+
+    memset(out, 0, sizeof(ipv6_address_full_t));
+    out->flags = column->flags[row];
+    out->port = column->port[row];
+    out->mask = column->mask[row];
+
+    if (out->flags & IPV6_FLAG_IPV4_COMPAT) {
+        out->address.components[0] = (uint16_t)(column->lo[row] >> 16);
+        out->address.components[1] = (uint16_t)column->lo[row];
+    }
+    else {
+        address_store(&out->address, column->hi[row], column->lo[row]);
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+// Predicate selecting the first `bits` of an address, IPv4 compatible masks
+// count from the start of the IPv4 mapped address
+static void column_pred (
+    const ipv6_address_full_t* prefix,
+    bool use_mask,
+    column_pred_t* pred)
+{
+    const uint64_t compat = address_load_mapped(prefix, &pred->hi, &pred->lo);
+    uint32_t bits = 128;
+
+    if (use_mask && (prefix->flags & IPV6_FLAG_HAS_MASK)) {
+        bits = compat ? 96 + prefix->mask : prefix->mask;
+        bits = bits > 128 ? 128 : bits;
+    }
+
+    pred->mask_hi = PREFIX_HI_MASK(bits);
+    pred->mask_lo = PREFIX_LO_MASK(bits);
+    pred->hi &= pred->mask_hi;
+    pred->lo &= pred->mask_lo;
+}
+
+//--------------------------------------------------------------------------------
+// Match up to 64 rows against a predicate into one bitmap word. Branch free so
+// that the loop vectorizes.
+static uint64_t column_match_block (
+    const uint64_t* hi,
+    const uint64_t* lo,
+    size_t rows,
+    const column_pred_t* pred)
+{
+    const uint64_t mask_hi = pred->mask_hi, mask_lo = pred->mask_lo;
+    const uint64_t value_hi = pred->hi, value_lo = pred->lo;
+    uint64_t word = 0;
+
+    for (size_t j = 0; j < rows; ++j) {
+        const uint64_t match = (uint64_t)(((hi[j] & mask_hi) == value_hi) & ((lo[j] & mask_lo) == value_lo));
+        word |= match << j;
+    }
+
+    return word;
+}
+
+//--------------------------------------------------------------------------------
+static size_t column_scan (
+    const ipv6_column_t* column,
+    const column_pred_t* preds,
+    size_t count,
+    uint64_t* bitmap)
+{
+    size_t selected = 0;
+
+    if (!column || !bitmap) {
+        return 0;
+    }
+
+    for (size_t row = 0; row < column->size; row += COLUMN_BLOCK) {
+        const size_t rows = column->size - row < COLUMN_BLOCK ? column->size - row : COLUMN_BLOCK;
+        uint64_t word = 0;
+
+        for (size_t p = 0; p < count; ++p) {
+            word |= column_match_block(column->hi + row, column->lo + row, rows, &preds[p]);
+        }
+
+        bitmap[row / COLUMN_BLOCK] = word;
+        selected += count_ones64(word);
+    }
+
+    return selected;
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_column_scan_prefix) (
+    const ipv6_column_t* column,
+    const ipv6_address_full_t* prefix,
+    uint64_t* bitmap)
+{
+    column_pred_t pred;
+
+    if (!prefix) {
+        return 0;
+    }
+
+    column_pred(prefix, true, &pred);
+    return column_scan(column, &pred, 1, bitmap);
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_column_scan_equal) (
+    const ipv6_column_t* column,
+    const ipv6_address_full_t* addr,
+    uint64_t* bitmap)
+{
+    column_pred_t pred;
+
+    if (!addr) {
+        return 0;
+    }
+
+    column_pred(addr, false, &pred);
+    return column_scan(column, &pred, 1, bitmap);
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_column_scan_prefixes) (
+    const ipv6_column_t* column,
+    const ipv6_address_full_t* prefixes,
+    size_t count,
+    uint64_t* bitmap)
+{
+    column_pred_t preds[IPV6_COLUMN_MAX_SET];
+
+    if (!prefixes || count > IPV6_COLUMN_MAX_SET) {
+        return 0;
+    }
+
+    for (size_t p = 0; p < count; ++p) {
+        column_pred(&prefixes[p], true, &preds[p]);
+    }
+
+    return column_scan(column, preds, count, bitmap);
+}
@@ -0,0 +1,110 @@
+#pragma once
+// ## Columnar address store
+//
+// Structure of arrays storage for filtering many stored addresses: the high
+// and low 64 bits of every address, its mask, port and flags are kept in
+// separate arrays so a scan only touches the address columns.
+//
+// Scans evaluate one predicate over all rows into a selection bitmap, bit
+// `i % 64` of word `i / 64` is set when row `i` matches. The kernels are
+// branch free loops over blocks of 64 rows that compilers vectorize, e.g.
+// with `-O3 -mavx2` each block of rows is compared 4 addresses at a time.
+//
+// IPv4 compatible addresses are stored as IPv4 mapped addresses
+// (`::ffff:1.2.3.4`) so `10.0.0.0/8` and `::ffff:10.0.0.0/104` select the
+// same rows. Rows read back with ipv6_column_get keep their original form.
+//
+// A column is not thread safe for appends, concurrent scans are safe.
+//
+
+#include "ipv6.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ### ipv6_column_create
+//
+// Create an empty column with room for `capacity` rows, the column grows as
+// rows are appended.
+//
+// Returns NULL if memory could not be allocated.
+//
+// ~~~~
+#define IPV6_COLUMN_BITMAP_WORDS(rows) (((rows) + 63) / 64)
+#define IPV6_COLUMN_MAX_SET 16
+
+typedef struct ipv6_column_t ipv6_column_t;
+
+ipv6_column_t* IPV6_API_DECL(ipv6_column_create) (
+    size_t capacity);
+
+void IPV6_API_DECL(ipv6_column_destroy) (
+    ipv6_column_t* column);
+// ~~~~
+
+
+// ### ipv6_column_append
+//
+// Append `count` addresses, interfaces are not stored.
+//
+// Returns the number of rows appended, less than `count` only if memory could
+// not be allocated.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_column_append) (
+    ipv6_column_t* column,
+    const ipv6_address_full_t* addrs,
+    size_t count);
+// ~~~~
+
+
+// ### ipv6_column_size / ipv6_column_get
+//
+// Number of rows, and the address of row `row`. ipv6_column_get returns false
+// if the row is out of range.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_column_size) (
+    const ipv6_column_t* column);
+
+bool IPV6_API_DECL(ipv6_column_get) (
+    const ipv6_column_t* column,
+    size_t row,
+    ipv6_address_full_t* out);
+// ~~~~
+
+
+// ### ipv6_column_scan_prefix / ipv6_column_scan_equal / ipv6_column_scan_prefixes
+//
+// Select the rows whose address is within `prefix` (the first `mask` bits if
+// IPV6_FLAG_HAS_MASK is set, otherwise all 128 bits), equal to the address of
+// `addr` ignoring port and mask, or within any of `count` prefixes, at most
+// IPV6_COLUMN_MAX_SET.
+//
+// `bitmap` must hold IPV6_COLUMN_BITMAP_WORDS(rows) words, all of which are
+// written and bits past the last row are cleared.
+//
+// Returns the number of rows selected.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_column_scan_prefix) (
+    const ipv6_column_t* column,
+    const ipv6_address_full_t* prefix,
+    uint64_t* bitmap);
+
+size_t IPV6_API_DECL(ipv6_column_scan_equal) (
+    const ipv6_column_t* column,
+    const ipv6_address_full_t* addr,
+    uint64_t* bitmap);
+
+size_t IPV6_API_DECL(ipv6_column_scan_prefixes) (
+    const ipv6_column_t* column,
+    const ipv6_address_full_t* prefixes,
+    size_t count,
+    uint64_t* bitmap);
+// ~~~~
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
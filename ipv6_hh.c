@@ -0,0 +1,553 @@
+#include "ipv6_hh.h"
+#include "ipv6_config.h"
+#include "ipv6_internal.h"
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#define HH_DEFAULT_CAPACITY     1024
+#define HH_MAX_CAPACITY         (1u << 24)
+#define HH_EMPTY                UINT32_MAX
+#define HH_BATCH                16      // addresses keyed and prefetched together
+#define HH_FAMILIES             2       // indexed by the ipv4 flag of a level
+
+//
+// Space-Saving counter for one prefix
+//
+typedef struct {
+    uint64_t                hi;             // masked prefix
+    uint64_t                lo;
+    uint64_t                count;          // upper bound of the true count
+    uint64_t                error;          // maximum overestimate of count
+    uint32_t                hash;           // low bits of the prefix hash
+    uint32_t                slot;           // position in hh_level_t::table
+} hh_counter_t;
+
+//
+// Counters of one prefix level, kept in a min-heap on count so that the
+// counter to replace is always at the root, and indexed by a linear probing
+// table of heap positions
+//
+typedef struct {
+    hh_counter_t*           heap;
+    uint32_t*               table;
+    uint32_t                size;
+    uint32_t                capacity;
+    uint32_t                table_mask;
+    uint32_t                prefix_length;
+    uint64_t                mask_hi;
+    uint64_t                mask_lo;
+    bool                    ipv4;
+} hh_level_t;
+
+struct ipv6_hh_t {
+    ipv6_hh_config_t        config;         // normalized for comparison in merge
+    hh_level_t              levels[HH_FAMILIES * IPV6_HH_MAX_LEVELS];
+    uint32_t                num_levels;
+    uint64_t                total[HH_FAMILIES];
+};
+
+//--------------------------------------------------------------------------------
+static void hh_swap (hh_level_t* level, uint32_t a, uint32_t b)
+{
+    hh_counter_t* heap = level->heap;
+    const hh_counter_t temp = heap[a];
+
+    heap[a] = heap[b];
+    heap[b] = temp;
+    level->table[heap[a].slot] = a;
+    level->table[heap[b].slot] = b;
+}
+
+//--------------------------------------------------------------------------------
+static void hh_sift_down (hh_level_t* level, uint32_t index)
+{
+    const hh_counter_t* heap = level->heap;
+
+    for (;;) {
+        const uint32_t left = 2 * index + 1;
+        const uint32_t right = left + 1;
+        uint32_t smallest = left;
+
+        if (left >= level->size) {
+            break;
+        }
+        if (right < level->size && heap[right].count < heap[left].count) {
+            smallest = right;
+        }
+        if (heap[smallest].count >= heap[index].count) {
+            break;
+        }
+
+        hh_swap(level, index, smallest);
+        index = smallest;
+    }
+}
+
+//--------------------------------------------------------------------------------
+static void hh_sift_up (hh_level_t* level, uint32_t index)
+{
+    while (index > 0) {
+        const uint32_t parent = (index - 1) / 2;
+        if (level->heap[parent].count <= level->heap[index].count) {
+            break;
+        }
+
+        hh_swap(level, index, parent);
+        index = parent;
+    }
+}
+
+//--------------------------------------------------------------------------------
+// Find the heap index of a prefix, or HH_EMPTY with `slot` set to the table
+// position where it can be inserted
+static uint32_t hh_find (
+    const hh_level_t* level,
+    uint64_t hi,
+    uint64_t lo,
+    uint32_t hash,
+    uint32_t* slot)
+{
+    uint32_t position = hash & level->table_mask;
+
+    for (;;) {
+        const uint32_t index = level->table[position];
+        if (index == HH_EMPTY || (level->heap[index].hi == hi && level->heap[index].lo == lo)) {
+            *slot = position;
+            return index;
+        }
+        position = (position + 1) & level->table_mask;
+    }
+}
+
+//--------------------------------------------------------------------------------
+// Remove a table entry, shifting back later entries of the probe run into the
+// hole so that no tombstones are needed
+static void hh_table_remove (hh_level_t* level, uint32_t slot)
+{
+    const uint32_t mask = level->table_mask;
+    uint32_t hole = slot;
+    uint32_t next = (slot + 1) & mask;
+
+    while (level->table[next] != HH_EMPTY) {
+        const uint32_t index = level->table[next];
+        const uint32_t home = level->heap[index].hash & mask;
+
+        // The entry may move into the hole if the hole lies between its home
+        // position and its current position
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            level->table[hole] = index;
+            level->heap[index].slot = hole;
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+
+    level->table[hole] = HH_EMPTY;
+}
+
+//--------------------------------------------------------------------------------
+static void hh_level_add (
+    hh_level_t* level,
+    uint64_t hi,
+    uint64_t lo,
+    uint32_t hash,
+    uint64_t weight)
+{
+    hh_counter_t* counter;
+    uint64_t error = 0;
+    uint32_t slot;
+    uint32_t index = hh_find(level, hi, lo, hash, &slot);
+
+    if (index != HH_EMPTY) {
+        level->heap[index].count += weight;
+        hh_sift_down(level, index);
+        return;
+    }
+
+    if (level->size < level->capacity) {
+        index = level->size++;
+    }
+    else {
+        // Replace the smallest counter, the new prefix inherits its count as
+        // the error bound
+        index = 0;
+        error = level->heap[0].count;
+        hh_table_remove(level, level->heap[0].slot);
+        hh_find(level, hi, lo, hash, &slot);
+    }
+
+    counter = &level->heap[index];
+    counter->hi = hi;
+    counter->lo = lo;
+    counter->count = error + weight;
+    counter->error = error;
+    counter->hash = hash;
+    counter->slot = slot;
+    level->table[slot] = index;
+
+    if (index == 0) {
+        hh_sift_down(level, index);
+    }
+    else {
+        hh_sift_up(level, index);
+    }
+}
+
+//--------------------------------------------------------------------------------
+// Rebuild a level from counters sorted by descending count
+static void hh_level_load (
+    hh_level_t* level,
+    const hh_counter_t* sorted,
+    uint32_t count)
+{
+    memset(level->table, 0xff, ((size_t)level->table_mask + 1) * sizeof(uint32_t));
+    level->size = 0;
+
+    // Ascending order is a valid min-heap
+    while (count > 0) {
+        const hh_counter_t* counter = &sorted[--count];
+        uint32_t slot;
+
+        hh_find(level, counter->hi, counter->lo, counter->hash, &slot);
+        level->heap[level->size] = *counter;
+        level->heap[level->size].slot = slot;
+        level->table[slot] = level->size++;
+    }
+}
+
+//--------------------------------------------------------------------------------
+static int hh_compare_descending (const void* a, const void* b)
+{
+    const uint64_t count_a = ((const hh_counter_t*)a)->count;
+    const uint64_t count_b = ((const hh_counter_t*)b)->count;
+
+    return count_a < count_b ? 1 : count_a > count_b ? -1 : 0;
+}
+
+//--------------------------------------------------------------------------------
+// Combine two summaries. A prefix missing from a full summary may have been
+// counted up to its smallest count, which is added to both count and error.
+static bool hh_level_merge (
+    hh_level_t* dst,
+    const hh_level_t* src)
+{
+    const uint64_t dst_min = dst->size == dst->capacity ? dst->heap[0].count : 0;
+    const uint64_t src_min = src->size == src->capacity ? src->heap[0].count : 0;
+    const size_t total = (size_t)dst->size + src->size;
+    hh_counter_t* merged;
+    uint32_t count = 0;
+    uint32_t slot;
+
+    if (total == 0) {
+        return true;
+    }
+
+    merged = (hh_counter_t*)malloc(total * sizeof(hh_counter_t));
+    if (!merged) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < dst->size; ++i) {
+        const hh_counter_t* counter = &dst->heap[i];
+        const uint32_t index = hh_find(src, counter->hi, counter->lo, counter->hash, &slot);
+
+        merged[count] = *counter;
+        if (index != HH_EMPTY) {
+            merged[count].count += src->heap[index].count;
+            merged[count].error += src->heap[index].error;
+        }
+        else {
+            merged[count].count += src_min;
+            merged[count].error += src_min;
+        }
+        count++;
+    }
+
+    for (uint32_t i = 0; i < src->size; ++i) {
+        const hh_counter_t* counter = &src->heap[i];
+        if (hh_find(dst, counter->hi, counter->lo, counter->hash, &slot) == HH_EMPTY) {
+            merged[count] = *counter;
+            merged[count].count += dst_min;
+            merged[count].error += dst_min;
+            count++;
+        }
+    }
+
+    qsort(merged, count, sizeof(hh_counter_t), hh_compare_descending);
+    hh_level_load(dst, merged, count < dst->capacity ? count : dst->capacity);
+    free(merged);
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+static bool hh_level_init (
+    hh_level_t* level,
+    bool ipv4,
+    uint32_t prefix_length,
+    uint32_t capacity)
+{
+    uint32_t table_size = 1;
+
+    if (prefix_length > (ipv4 ? 32u : 128u)) {
+        return false;
+    }
+
+    // Keep the table at most half full
+    while (table_size < 2 * capacity) {
+        table_size <<= 1;
+    }
+
+    level->heap = (hh_counter_t*)calloc(capacity, sizeof(hh_counter_t));
+    level->table = (uint32_t*)malloc(table_size * sizeof(uint32_t));
+    if (!level->heap || !level->table) {
+        return false;
+    }
+
+    memset(level->table, 0xff, table_size * sizeof(uint32_t));
+    level->size = 0;
+    level->capacity = capacity;
+    level->table_mask = table_size - 1;
+    level->prefix_length = prefix_length;
+    level->ipv4 = ipv4;
+
+    // IPv4 keys live in the low 32 bits
+    if (ipv4) {
+        level->mask_hi = ~UINT64_C(0);
+        level->mask_lo = PREFIX_LO_MASK(96 + prefix_length);
+    }
+    else {
+        level->mask_hi = PREFIX_HI_MASK(prefix_length);
+        level->mask_lo = PREFIX_LO_MASK(prefix_length);
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+ipv6_hh_t* IPV6_API_DEF(ipv6_hh_create) (
+    const ipv6_hh_config_t* config)
+{
+    static const ipv6_hh_config_t defaults = {
+        { 32, 48, 64 }, 3,
+        { 16, 24 }, 2,
+        HH_DEFAULT_CAPACITY
+    };
+    ipv6_hh_t* hh;
+
+    if (!config) {
+        config = &defaults;
+    }
+
+    if (config->num_ipv6_levels > IPV6_HH_MAX_LEVELS ||
+        config->num_ipv4_levels > IPV6_HH_MAX_LEVELS ||
+        config->capacity > HH_MAX_CAPACITY)
+    {
+        return NULL;
+    }
+
+    hh = (ipv6_hh_t*)calloc(1, sizeof(ipv6_hh_t));
+    if (!hh) {
+        return NULL;
+    }
+
+    hh->config.capacity = config->capacity ? config->capacity : HH_DEFAULT_CAPACITY;
+    hh->config.num_ipv6_levels = config->num_ipv6_levels;
+    hh->config.num_ipv4_levels = config->num_ipv4_levels;
+
+    for (uint32_t i = 0; i < config->num_ipv6_levels; ++i) {
+        hh->config.ipv6_levels[i] = config->ipv6_levels[i];
+        if (!hh_level_init(&hh->levels[hh->num_levels++], false, config->ipv6_levels[i], hh->config.capacity)) {
+            ipv6_hh_destroy(hh);
+            return NULL;
+        }
+    }
+
+    for (uint32_t i = 0; i < config->num_ipv4_levels; ++i) {
+        hh->config.ipv4_levels[i] = config->ipv4_levels[i];
+        if (!hh_level_init(&hh->levels[hh->num_levels++], true, config->ipv4_levels[i], hh->config.capacity)) {
+            ipv6_hh_destroy(hh);
+            return NULL;
+        }
+    }
+
+    return hh;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_hh_destroy) (
+    ipv6_hh_t* hh)
+{
+    if (hh) {
+        for (uint32_t i = 0; i < hh->num_levels; ++i) {
+            free(hh->levels[i].heap);
+            free(hh->levels[i].table);
+        }
+        free(hh);
+    }
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_hh_reset) (
+    ipv6_hh_t* hh)
+{
+    if (!hh) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < hh->num_levels; ++i) {
+        hh_level_load(&hh->levels[i], NULL, 0);
+    }
+
+    hh->total[0] = 0;
+    hh->total[1] = 0;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_hh_add) (
+    ipv6_hh_t* hh,
+    const ipv6_address_full_t* addr,
+    uint64_t weight)
+{
+    ipv6_hh_add_batch(hh, addr, &weight, 1);
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_hh_add_batch) (
+    ipv6_hh_t* hh,
+    const ipv6_address_full_t* addrs,
+    const uint64_t* weights,
+    size_t count)
+{
+    uint64_t hi[HH_BATCH], lo[HH_BATCH], weight[HH_BATCH];
+    uint64_t key_hi[HH_BATCH], key_lo[HH_BATCH];
+    uint32_t hash[HH_BATCH];
+    bool ipv4[HH_BATCH];
+
+    if (!hh || !addrs) {
+        return;
+    }
+
+    while (count > 0) {
+        const uint32_t lanes = count < HH_BATCH ? (uint32_t)count : HH_BATCH;
+
+        for (uint32_t j = 0; j < lanes; ++j) {
+            ipv4[j] = address_load_key(&addrs[j], &hi[j], &lo[j]);
+            weight[j] = weights ? weights[j] : 1;
+            hh->total[ipv4[j]] += weight[j];
+        }
+
+        for (uint32_t i = 0; i < hh->num_levels; ++i) {
+            hh_level_t* level = &hh->levels[i];
+
+            // Issue the table loads of every lane first, then update
+            for (uint32_t j = 0; j < lanes; ++j) {
+                key_hi[j] = hi[j] & level->mask_hi;
+                key_lo[j] = lo[j] & level->mask_lo;
+                hash[j] = (uint32_t)address_hash(key_hi[j], key_lo[j]);
+                IPV6_PREFETCH(&level->table[hash[j] & level->table_mask]);
+            }
+
+            for (uint32_t j = 0; j < lanes; ++j) {
+                if (ipv4[j] == level->ipv4 && weight[j] != 0) {
+                    hh_level_add(level, key_hi[j], key_lo[j], hash[j], weight[j]);
+                }
+            }
+        }
+
+        addrs += lanes;
+        if (weights) {
+            weights += lanes;
+        }
+        count -= lanes;
+    }
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_hh_merge) (
+    ipv6_hh_t* dst,
+    const ipv6_hh_t* src)
+{
+    if (!dst || !src || memcmp(&dst->config, &src->config, sizeof(ipv6_hh_config_t)) != 0) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < dst->num_levels; ++i) {
+        if (!hh_level_merge(&dst->levels[i], &src->levels[i])) {
+            return false;
+        }
+    }
+
+    dst->total[0] += src->total[0];
+    dst->total[1] += src->total[1];
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_hh_top) (
+    const ipv6_hh_t* hh,
+    bool ipv4,
+    uint32_t prefix_length,
+    ipv6_hh_entry_t* out,
+    size_t max,
+    uint64_t* total)
+{
+    const hh_level_t* level = NULL;
+    hh_counter_t* sorted;
+    size_t count;
+
+    if (!hh) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < hh->num_levels; ++i) {
+        if (hh->levels[i].ipv4 == ipv4 && hh->levels[i].prefix_length == prefix_length) {
+            level = &hh->levels[i];
+            break;
+        }
+    }
+
+    if (total) {
+        *total = hh->total[ipv4];
+    }
+
+    if (!level || !out || level->size == 0) {
+        return 0;
+    }
+
+    sorted = (hh_counter_t*)malloc(level->size * sizeof(hh_counter_t));
+    if (!sorted) {
+        return 0;
+    }
+
+    memcpy(sorted, level->heap, level->size * sizeof(hh_counter_t));
+    qsort(sorted, level->size, sizeof(hh_counter_t), hh_compare_descending);
+
+    count = max < level->size ? max : level->size;
+    for (size_t i = 0; i < count; ++i) {
+        ipv6_address_full_t* prefix = &out[i].prefix;
+
+        memset(prefix, 0, sizeof(ipv6_address_full_t));
+        if (ipv4) {
+            prefix->flags = IPV6_FLAG_IPV4_COMPAT;
+            prefix->address.components[0] = (uint16_t)(sorted[i].lo >> 16);
+            prefix->address.components[1] = (uint16_t)sorted[i].lo;
+        }
+        else {
+            address_store(&prefix->address, sorted[i].hi, sorted[i].lo);
+        }
+        prefix->flags |= IPV6_FLAG_HAS_MASK;
+        prefix->mask = prefix_length;
+
+        out[i].count = sorted[i].count;
+        out[i].error = sorted[i].error;
+    }
+
+    free(sorted);
+    return count;
+}
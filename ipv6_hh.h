@@ -0,0 +1,151 @@
+#pragma once
+// ## Prefix heavy hitters
+//
+// Streaming detection of the prefixes responsible for most of the traffic at
+// several prefix lengths at once, e.g. the top /32, /48 and /64 IPv6 prefixes
+// and the top /16 and /24 IPv4 prefixes during an attack.
+//
+// Every prefix level keeps a Space-Saving summary of `capacity` counters, so
+// memory is fixed at creation. Any prefix carrying more than `total / capacity`
+// of the weight of its family is guaranteed to be reported, and every reported
+// count overestimates the true count by at most `error`.
+//
+// IPv4 compatible addresses and addresses in `::ffff:0:0/96`, written either
+// as `::ffff:1.2.3.4` or `::ffff:102:304`, are counted at the IPv4 levels. All
+// other addresses are counted at the IPv6 levels, including ones written with
+// an IPv4 tail such as `64:ff9b::1.2.3.4`.
+//
+// A sketch is not thread safe. For multi-threaded ingestion create one sketch
+// per thread with the same configuration and combine them with ipv6_hh_merge.
+//
+
+#include "ipv6.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ### ipv6_hh_config_t
+//
+// Prefix lengths tracked per family and the number of counters per level.
+// Unused entries of the level arrays are ignored.
+//
+// ~~~~
+#define IPV6_HH_MAX_LEVELS 8
+
+typedef struct {
+    uint32_t                ipv6_levels[IPV6_HH_MAX_LEVELS];    // prefix lengths 0-128
+    uint32_t                num_ipv6_levels;
+    uint32_t                ipv4_levels[IPV6_HH_MAX_LEVELS];    // prefix lengths 0-32
+    uint32_t                num_ipv4_levels;
+    uint32_t                capacity;                           // counters per level, 0 selects 1024
+} ipv6_hh_config_t;
+// ~~~~
+
+
+// ### ipv6_hh_entry_t
+//
+// A reported prefix. IPv4 prefixes are IPv4 compatible addresses, all prefixes
+// have IPV6_FLAG_HAS_MASK set with the prefix length in `mask`.
+// The true count lies within `[count - error, count]`.
+//
+// ~~~~
+typedef struct {
+    ipv6_address_full_t     prefix;
+    uint64_t                count;
+    uint64_t                error;
+} ipv6_hh_entry_t;
+// ~~~~
+
+
+// ### ipv6_hh_create
+//
+// Create a sketch, a NULL `config` tracks IPv6 /32, /48 and /64 and IPv4 /16
+// and /24 prefixes with 1024 counters per level.
+//
+// Returns NULL if a prefix length or the level count is out of range or memory
+// could not be allocated.
+//
+// ~~~~
+typedef struct ipv6_hh_t ipv6_hh_t;
+
+ipv6_hh_t* IPV6_API_DECL(ipv6_hh_create) (
+    const ipv6_hh_config_t* config);
+
+void IPV6_API_DECL(ipv6_hh_destroy) (
+    ipv6_hh_t* hh);
+// ~~~~
+
+
+// ### ipv6_hh_reset
+//
+// Drop all counters, for example at the start of a new measurement window.
+//
+// ~~~~
+void IPV6_API_DECL(ipv6_hh_reset) (
+    ipv6_hh_t* hh);
+// ~~~~
+
+
+// ### ipv6_hh_add
+//
+// Count `weight` (packets, bytes) for the prefixes of an address at every level
+// of its family. Port, mask and interface are ignored.
+//
+// ~~~~
+void IPV6_API_DECL(ipv6_hh_add) (
+    ipv6_hh_t* hh,
+    const ipv6_address_full_t* addr,
+    uint64_t weight);
+// ~~~~
+
+
+// ### ipv6_hh_add_batch
+//
+// Count `count` addresses with the matching `weights`, a NULL `weights` counts
+// each address once. Counter slots are prefetched ahead of the updates.
+//
+// ~~~~
+void IPV6_API_DECL(ipv6_hh_add_batch) (
+    ipv6_hh_t* hh,
+    const ipv6_address_full_t* addrs,
+    const uint64_t* weights,
+    size_t count);
+// ~~~~
+
+
+// ### ipv6_hh_merge
+//
+// Merge the counters of `src` into `dst`, both sketches must have been created
+// with the same configuration. The merged sketch keeps the guarantees of a
+// single sketch over the combined stream. `src` is not modified.
+//
+// Returns false if the configurations differ or memory could not be allocated.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_hh_merge) (
+    ipv6_hh_t* dst,
+    const ipv6_hh_t* src);
+// ~~~~
+
+
+// ### ipv6_hh_top
+//
+// Write up to `max` of the heaviest prefixes of one level to `out`, heaviest
+// first. `total` optionally receives the weight counted for the family.
+//
+// Returns the number of entries written, 0 if the level is not tracked.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_hh_top) (
+    const ipv6_hh_t* hh,
+    bool ipv4,
+    uint32_t prefix_length,
+    ipv6_hh_entry_t* out,
+    size_t max,
+    uint64_t* total);
+// ~~~~
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,235 @@
+#pragma once
+//
+// Helpers shared between the library translation units, not part of the API
+//
+
+#include "ipv6.h"
+
+//
+// Masks covering the first n bits of an address split into two 64bit lanes
+//
+#define PREFIX_HI_MASK(n) \
+    ((n) == 0 ? UINT64_C(0) : (n) >= 64 ? ~UINT64_C(0) : ~UINT64_C(0) << ((64 - (n)) & 63))
+#define PREFIX_LO_MASK(n) \
+    ((n) <= 64 ? UINT64_C(0) : ~UINT64_C(0) << ((128 - (n)) & 63))
+
+//
+// Hint that memory will be read soon
+//
+#if defined(__GNUC__) || defined(__clang__)
+#define IPV6_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define IPV6_PREFETCH(address) ((void)(address))
+#endif
+
+//
+// Keep cold paths out of hot loops
+//
+#if defined(__GNUC__) || defined(__clang__)
+#define IPV6_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define IPV6_NOINLINE __declspec(noinline)
+#else
+#define IPV6_NOINLINE
+#endif
+
+//
+// Storage duration of one object per thread, C99 has no keyword for it
+//
+#if defined(__GNUC__) || defined(__clang__)
+#define IPV6_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define IPV6_THREAD_LOCAL __declspec(thread)
+#else
+#define IPV6_THREAD_LOCAL _Thread_local
+#endif
+
+//
+// Ordering of loads and stores of values shared between threads
+//
+#if defined(__GNUC__) || defined(__clang__)
+#define IPV6_LOAD_ACQUIRE(pointer) __atomic_load_n(pointer, __ATOMIC_ACQUIRE)
+#define IPV6_STORE_RELEASE(pointer, value) __atomic_store_n(pointer, value, __ATOMIC_RELEASE)
+#define IPV6_FENCE_ACQUIRE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define IPV6_FENCE_RELEASE() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define IPV6_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+// Plain volatile accesses have acquire / release semantics under /volatile:ms
+#define IPV6_LOAD_ACQUIRE(pointer) (*(volatile const uint64_t*)(pointer))
+#define IPV6_STORE_RELEASE(pointer, value) (*(volatile uint64_t*)(pointer) = (value))
+#define IPV6_FENCE_ACQUIRE() _ReadWriteBarrier()
+#define IPV6_FENCE_RELEASE() _ReadWriteBarrier()
+// Interlocked operations are full barriers on every architecture
+static __inline void ipv6_fence (void)
+{
+    volatile long barrier = 0;
+    _InterlockedOr(&barrier, 0);
+}
+#define IPV6_FENCE() ipv6_fence()
+#else
+#define IPV6_LOAD_ACQUIRE(pointer) (*(volatile const uint64_t*)(pointer))
+#define IPV6_STORE_RELEASE(pointer, value) (*(volatile uint64_t*)(pointer) = (value))
+#define IPV6_FENCE_ACQUIRE()
+#define IPV6_FENCE_RELEASE()
+#define IPV6_FENCE()
+#endif
+
+//
+// Pointers shared between threads, the results are void* on every compiler
+//
+#if defined(__GNUC__) || defined(__clang__)
+#define IPV6_LOAD_ACQUIRE_PTR(pointer) ((void*)__atomic_load_n(pointer, __ATOMIC_ACQUIRE))
+#define IPV6_EXCHANGE_PTR(pointer, value) ((void*)__atomic_exchange_n(pointer, value, __ATOMIC_ACQ_REL))
+#elif defined(_MSC_VER)
+#define IPV6_LOAD_ACQUIRE_PTR(pointer) (*(void* volatile const*)(pointer))
+#define IPV6_EXCHANGE_PTR(pointer, value) _InterlockedExchangePointer((void* volatile*)(pointer), (value))
+#else
+#define IPV6_LOAD_ACQUIRE_PTR(pointer) ((void*)*(pointer))
+static inline void* ipv6_exchange_ptr (void** pointer, void* value)
+{
+    void* previous = *pointer;
+    *pointer = value;
+    return previous;
+}
+#define IPV6_EXCHANGE_PTR(pointer, value) ipv6_exchange_ptr((void**)(pointer), (value))
+#endif
+
+//
+// Select between two values using an all ones / all zeros mask
+//
+#define SELECT(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+
+//--------------------------------------------------------------------------------
+// Load the address components into two 64bit lanes, most significant bits first
+static inline void address_load (
+    const ipv6_address_t* in,
+    uint64_t* hi,
+    uint64_t* lo)
+{
+    const uint16_t* c = in->components;
+    *hi = (uint64_t)c[0] << 48 | (uint64_t)c[1] << 32 | (uint64_t)c[2] << 16 | (uint64_t)c[3];
+    *lo = (uint64_t)c[4] << 48 | (uint64_t)c[5] << 32 | (uint64_t)c[6] << 16 | (uint64_t)c[7];
+}
+
+//--------------------------------------------------------------------------------
+// Store two 64bit lanes into address components
+static inline void address_store (
+    ipv6_address_t* out,
+    uint64_t hi,
+    uint64_t lo)
+{
+    uint16_t* c = out->components;
+    c[0] = (uint16_t)(hi >> 48); c[1] = (uint16_t)(hi >> 32); c[2] = (uint16_t)(hi >> 16); c[3] = (uint16_t)hi;
+    c[4] = (uint16_t)(lo >> 48); c[5] = (uint16_t)(lo >> 32); c[6] = (uint16_t)(lo >> 16); c[7] = (uint16_t)lo;
+}
+
+//--------------------------------------------------------------------------------
+// Number of leading zero bits in a 64bit value, 64 for zero
+static inline uint32_t count_leading_zeros64 (
+    uint64_t value)
+{
+    if (value == 0) {
+        return 64;
+    }
+#if defined(__GNUC__) || defined(__clang__)
+    return (uint32_t)__builtin_clzll(value);
+#else
+    uint32_t count = 0;
+    while ((value & (UINT64_C(1) << 63)) == 0) {
+        value <<= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+//--------------------------------------------------------------------------------
+// Number of trailing zero bits in a 64bit value, 64 for zero
+static inline uint32_t count_trailing_zeros64 (
+    uint64_t value)
+{
+    if (value == 0) {
+        return 64;
+    }
+#if defined(__GNUC__) || defined(__clang__)
+    return (uint32_t)__builtin_ctzll(value);
+#else
+    uint32_t count = 0;
+    while ((value & 1) == 0) {
+        value >>= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+//--------------------------------------------------------------------------------
+// Number of set bits in a 64bit value
+static inline uint32_t count_ones64 (
+    uint64_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (uint32_t)__builtin_popcountll(value);
+#else
+    value = value - ((value >> 1) & UINT64_C(0x5555555555555555));
+    value = (value & UINT64_C(0x3333333333333333)) + ((value >> 2) & UINT64_C(0x3333333333333333));
+    value = (value + (value >> 4)) & UINT64_C(0x0f0f0f0f0f0f0f0f);
+    return (uint32_t)((value * UINT64_C(0x0101010101010101)) >> 56);
+#endif
+}
+
+//--------------------------------------------------------------------------------
+// Load an address into lanes with IPv4 compatible addresses moved into the IPv4
+// mapped range ::ffff:0:0/96, returns all ones for IPv4 compatible addresses
+static inline uint64_t address_load_mapped (
+    const ipv6_address_full_t* in,
+    uint64_t* hi,
+    uint64_t* lo)
+{
+    const uint16_t* c = in->address.components;
+    const uint64_t compat = 0 - (uint64_t)((in->flags & IPV6_FLAG_IPV4_COMPAT) != 0);
+    const uint64_t v4_lo =
+        UINT64_C(0x0000ffff00000000) | (uint64_t)c[0] << 16 | (uint64_t)c[1];
+    uint64_t v6_hi, v6_lo;
+
+    address_load(&in->address, &v6_hi, &v6_lo);
+    *hi = v6_hi & ~compat;
+    *lo = (v6_lo & ~compat) | (v4_lo & compat);
+    return compat;
+}
+
+//--------------------------------------------------------------------------------
+// Mix the two lanes of an address into a well distributed 64bit hash
+static inline uint64_t address_hash (
+    uint64_t hi,
+    uint64_t lo)
+{
+    uint64_t hash = hi * UINT64_C(0x9e3779b97f4a7c15) ^ (lo + UINT64_C(0x632be59bd9b4e019));
+    hash ^= hash >> 33;
+    hash *= UINT64_C(0xff51afd7ed558ccd);
+    hash ^= lo * UINT64_C(0xc2b2ae3d27d4eb4f);
+    hash ^= hash >> 33;
+    hash *= UINT64_C(0xc4ceb9fe1a85ec53);
+    hash ^= hash >> 33;
+    return hash;
+}
+
+//--------------------------------------------------------------------------------
+// Load an address into lanes keyed by family: IPv4 compatible addresses and
+// addresses in ::ffff:0:0/96 load their IPv4 address into the low 32 bits of
+// `lo`, an IPv4 tail on any other address is part of an IPv6 address.
+// Returns true for IPv4 addresses.
+static inline bool address_load_key (
+    const ipv6_address_full_t* in,
+    uint64_t* hi,
+    uint64_t* lo)
+{
+    const uint64_t compat = address_load_mapped(in, hi, lo);
+    const bool ipv4 = compat || (*hi == 0 && *lo >> 32 == 0xffff);
+
+    if (ipv4) {
+        *lo &= UINT64_C(0xffffffff);
+    }
+    return ipv4;
+}
@@ -0,0 +1,420 @@
+#include "ipv6_lpm.h"
+#include "ipv6_config.h"
+#include "ipv6_internal.h"
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#define LPM_MAGIC               0x4c365049u     // "IP6L" in little-endian hosts
+#define LPM_VERSION             1
+#define LPM_RANGE_BYTES         (2 * sizeof(uint64_t) + sizeof(uint32_t))
+#define LPM_BATCH               16      // searches interleaved in a batch
+
+//
+// Serialized image header, followed by the `ranges` high lanes, low lanes and
+// values of the range starts
+//
+typedef struct {
+    uint32_t                magic;
+    uint32_t                version;
+    uint64_t                ranges;
+    uint64_t                prefixes;       // number of prefixes compiled
+    uint64_t                reserved;
+} lpm_header_t;
+
+struct ipv6_lpm_t {
+    const uint64_t*         hi;             // range starts, ascending
+    const uint64_t*         lo;
+    const uint32_t*         values;         // value from each start to the next
+    uint64_t                ranges;
+    const void*             image;
+    size_t                  image_bytes;
+    bool                    read_only;      // view of a serialized image
+};
+
+// Prefix being compiled, the range from its start to its end
+typedef struct {
+    uint64_t                hi;
+    uint64_t                lo;
+    uint64_t                end_hi;
+    uint64_t                end_lo;
+    uint32_t                bits;
+    uint32_t                value;
+    size_t                  order;          // position in the input
+} lpm_prefix_t;
+
+// Ranges emitted by the compiler
+typedef struct {
+    uint64_t*               hi;
+    uint64_t*               lo;
+    uint32_t*               values;
+    uint64_t                count;
+    uint64_t                cursor_hi;      // first address without a range
+    uint64_t                cursor_lo;
+    bool                    done;           // the last address has a range
+} lpm_ranges_t;
+
+//--------------------------------------------------------------------------------
+static bool lpm_less_equal (uint64_t a_hi, uint64_t a_lo, uint64_t b_hi, uint64_t b_lo)
+{
+    return (a_hi < b_hi) | ((a_hi == b_hi) & (a_lo <= b_lo));
+}
+
+//--------------------------------------------------------------------------------
+// Order prefixes by start, shorter prefixes first, then by input position
+static int lpm_compare_prefix (const void* a, const void* b)
+{
+    const lpm_prefix_t* pa = (const lpm_prefix_t*)a;
+    const lpm_prefix_t* pb = (const lpm_prefix_t*)b;
+
+    if (pa->hi != pb->hi) {
+        return pa->hi < pb->hi ? -1 : 1;
+    }
+    if (pa->lo != pb->lo) {
+        return pa->lo < pb->lo ? -1 : 1;
+    }
+    if (pa->bits != pb->bits) {
+        return pa->bits < pb->bits ? -1 : 1;
+    }
+    return pa->order < pb->order ? -1 : pa->order > pb->order;
+}
+
+//--------------------------------------------------------------------------------
+// Give the addresses from the cursor up to and including `end` the value
+// `value`, extending the last range when it has the same value
+static void lpm_emit (lpm_ranges_t* ranges, uint64_t end_hi, uint64_t end_lo, uint32_t value)
+{
+    if (ranges->done || !lpm_less_equal(ranges->cursor_hi, ranges->cursor_lo, end_hi, end_lo)) {
+        return;
+    }
+
+    if (ranges->count == 0 || ranges->values[ranges->count - 1] != value) {
+        ranges->hi[ranges->count] = ranges->cursor_hi;
+        ranges->lo[ranges->count] = ranges->cursor_lo;
+        ranges->values[ranges->count] = value;
+        ranges->count++;
+    }
+
+    ranges->cursor_lo = end_lo + 1;
+    ranges->cursor_hi = end_hi + (ranges->cursor_lo == 0);
+    ranges->done = (end_hi & end_lo) == UINT64_MAX;
+}
+
+//--------------------------------------------------------------------------------
+// Sweep the sorted prefixes keeping the chain of prefixes containing the
+// current one, at most one per length
+static void lpm_compile (const lpm_prefix_t* prefixes, size_t count, lpm_ranges_t* ranges)
+{
+    const lpm_prefix_t* stack[129];
+    uint32_t values[129];
+    uint32_t depth = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        const lpm_prefix_t* prefix = &prefixes[i];
+
+        // Close the prefixes that end before this one starts
+        while (depth > 0 &&
+            !lpm_less_equal(prefix->hi, prefix->lo, stack[depth - 1]->end_hi, stack[depth - 1]->end_lo))
+        {
+            depth--;
+            lpm_emit(ranges, stack[depth]->end_hi, stack[depth]->end_lo, values[depth]);
+        }
+
+        // A repeated prefix replaces the value of the earlier one
+        if (depth > 0 &&
+            stack[depth - 1]->hi == prefix->hi &&
+            stack[depth - 1]->lo == prefix->lo &&
+            stack[depth - 1]->bits == prefix->bits)
+        {
+            values[depth - 1] = prefix->value;
+            continue;
+        }
+
+        // The gap before this prefix belongs to the enclosing prefix
+        if (prefix->hi != 0 || prefix->lo != 0) {
+            const uint64_t before_hi = prefix->hi - (prefix->lo == 0);
+            lpm_emit(ranges, before_hi, prefix->lo - 1, depth ? values[depth - 1] : IPV6_LPM_NONE);
+        }
+
+        stack[depth] = prefix;
+        values[depth] = prefix->value;
+        depth++;
+    }
+
+    while (depth > 0) {
+        depth--;
+        lpm_emit(ranges, stack[depth]->end_hi, stack[depth]->end_lo, values[depth]);
+    }
+
+    lpm_emit(ranges, UINT64_MAX, UINT64_MAX, IPV6_LPM_NONE);
+}
+
+//--------------------------------------------------------------------------------
+// Index of the last range starting at or before the address, the first range
+// always starts at ::
+static uint64_t lpm_search (const ipv6_lpm_t* table, uint64_t hi, uint64_t lo)
+{
+    uint64_t base = 0;
+    uint64_t n = table->ranges;
+
+    while (n > 1) {
+        const uint64_t half = n / 2;
+        const uint64_t mid = base + half;
+
+        base = lpm_less_equal(table->hi[mid], table->lo[mid], hi, lo) ? mid : base;
+        n -= half;
+    }
+
+    return base;
+}
+
+//--------------------------------------------------------------------------------
+// Load the prefixes as ranges in the IPv4 mapped form, false if a mask is
+// out of range
+static bool lpm_load (
+    const ipv6_address_full_t* prefixes,
+    const uint32_t* values,
+    size_t count,
+    lpm_prefix_t* out)
+{
+    for (size_t i = 0; i < count; ++i) {
+        lpm_prefix_t* prefix = &out[i];
+        const uint64_t compat = address_load_mapped(&prefixes[i], &prefix->hi, &prefix->lo);
+
+        prefix->bits = 128;
+        if (prefixes[i].flags & IPV6_FLAG_HAS_MASK) {
+            prefix->bits = compat ? 96 + prefixes[i].mask : prefixes[i].mask;
+        }
+        if (prefix->bits > 128) {
+            return false;
+        }
+
+        prefix->hi &= PREFIX_HI_MASK(prefix->bits);
+        prefix->lo &= PREFIX_LO_MASK(prefix->bits);
+        prefix->end_hi = prefix->hi | ~PREFIX_HI_MASK(prefix->bits);
+        prefix->end_lo = prefix->lo | ~PREFIX_LO_MASK(prefix->bits);
+        prefix->value = values ? values[i] : (uint32_t)i;
+        prefix->order = i;
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+// Allocate a table holding the image of the compiled ranges
+static ipv6_lpm_t* lpm_alloc (const lpm_ranges_t* ranges, size_t prefixes)
+{
+    const size_t image_bytes = sizeof(lpm_header_t) + (size_t)ranges->count * LPM_RANGE_BYTES;
+    ipv6_lpm_t* table = (ipv6_lpm_t*)calloc(1, sizeof(ipv6_lpm_t));
+    uint8_t* image = (uint8_t*)malloc(image_bytes);
+    lpm_header_t header;
+
+    if (!table || !image) {
+        free(table);
+        free(image);
+        return NULL;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = LPM_MAGIC;
+    header.version = LPM_VERSION;
+    header.ranges = ranges->count;
+    header.prefixes = prefixes;
+    memcpy(image, &header, sizeof(header));
+
+    uint64_t* hi = (uint64_t*)(image + sizeof(lpm_header_t));
+    uint64_t* lo = hi + ranges->count;
+    uint32_t* values = (uint32_t*)(lo + ranges->count);
+    memcpy(hi, ranges->hi, (size_t)ranges->count * sizeof(uint64_t));
+    memcpy(lo, ranges->lo, (size_t)ranges->count * sizeof(uint64_t));
+    memcpy(values, ranges->values, (size_t)ranges->count * sizeof(uint32_t));
+
+    table->hi = hi;
+    table->lo = lo;
+    table->values = values;
+    table->ranges = ranges->count;
+    table->image = image;
+    table->image_bytes = image_bytes;
+    return table;
+}
+
+//--------------------------------------------------------------------------------
+ipv6_lpm_t* IPV6_API_DEF(ipv6_lpm_build) (
+    const ipv6_address_full_t* prefixes,
+    const uint32_t* values,
+    size_t count)
+{
+    ipv6_lpm_t* table = NULL;
+    lpm_ranges_t ranges;
+
+    if (!prefixes && count) {
+        return NULL;
+    }
+
+    // Every prefix adds at most two ranges, the one at its start and the one
+    // after its end
+    memset(&ranges, 0, sizeof(ranges));
+    lpm_prefix_t* sorted = (lpm_prefix_t*)malloc((count ? count : 1) * sizeof(lpm_prefix_t));
+    ranges.hi = (uint64_t*)malloc((2 * count + 1) * sizeof(uint64_t));
+    ranges.lo = (uint64_t*)malloc((2 * count + 1) * sizeof(uint64_t));
+    ranges.values = (uint32_t*)malloc((2 * count + 1) * sizeof(uint32_t));
+
+    if (sorted && ranges.hi && ranges.lo && ranges.values &&
+        lpm_load(prefixes, values, count, sorted))
+    {
+        qsort(sorted, count, sizeof(lpm_prefix_t), lpm_compare_prefix);
+        lpm_compile(sorted, count, &ranges);
+        table = lpm_alloc(&ranges, count);
+    }
+
+    free(sorted);
+    free(ranges.hi);
+    free(ranges.lo);
+    free(ranges.values);
+    return table;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_lpm_destroy) (
+    ipv6_lpm_t* table)
+{
+    if (table) {
+        if (!table->read_only) {
+            free((void*)table->image);
+        }
+        free(table);
+    }
+}
+
+//--------------------------------------------------------------------------------
+uint32_t IPV6_API_DEF(ipv6_lpm_lookup) (
+    const ipv6_lpm_t* table,
+    const ipv6_address_full_t* addr)
+{
+    uint64_t hi, lo;
+
+    if (!table || !addr) {
+        return IPV6_LPM_NONE;
+    }
+
+    address_load_mapped(addr, &hi, &lo);
+    return table->values[lpm_search(table, hi, lo)];
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_lpm_lookup_batch) (
+    const ipv6_lpm_t* table,
+    const ipv6_address_full_t* in,
+    uint32_t* out,
+    size_t count)
+{
+    uint64_t hi[LPM_BATCH], lo[LPM_BATCH], base[LPM_BATCH];
+    size_t found = 0;
+
+    if (!table || !in || !out) {
+        return 0;
+    }
+
+    while (count > 0) {
+        const uint32_t lanes = count < LPM_BATCH ? (uint32_t)count : LPM_BATCH;
+        uint64_t n = table->ranges;
+
+        for (uint32_t j = 0; j < lanes; ++j) {
+            address_load_mapped(&in[j], &hi[j], &lo[j]);
+            base[j] = 0;
+        }
+
+        // Every lane takes the same number of steps, so step all of them
+        // together and prefetch the next probe of each
+        while (n > 1) {
+            const uint64_t half = n / 2;
+            n -= half;
+
+            for (uint32_t j = 0; j < lanes; ++j) {
+                const uint64_t mid = base[j] + half;
+                base[j] = lpm_less_equal(table->hi[mid], table->lo[mid], hi[j], lo[j]) ? mid : base[j];
+                IPV6_PREFETCH(&table->hi[base[j] + n / 2]);
+                IPV6_PREFETCH(&table->lo[base[j] + n / 2]);
+            }
+        }
+
+        for (uint32_t j = 0; j < lanes; ++j) {
+            out[j] = table->values[base[j]];
+            found += out[j] != IPV6_LPM_NONE;
+        }
+
+        in += lanes;
+        out += lanes;
+        count -= lanes;
+    }
+
+    return found;
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_lpm_serialize) (
+    const ipv6_lpm_t* table,
+    void* buffer,
+    size_t buffer_bytes)
+{
+    if (!table) {
+        return 0;
+    }
+
+    if (!buffer) {
+        return table->image_bytes;
+    }
+    if (buffer_bytes < table->image_bytes) {
+        return 0;
+    }
+
+    memcpy(buffer, table->image, table->image_bytes);
+    return table->image_bytes;
+}
+
+//--------------------------------------------------------------------------------
+ipv6_lpm_t* IPV6_API_DEF(ipv6_lpm_view) (
+    const void* buffer,
+    size_t buffer_bytes)
+{
+    const lpm_header_t* header = (const lpm_header_t*)buffer;
+    ipv6_lpm_t* table;
+
+    if (!buffer || buffer_bytes < sizeof(lpm_header_t) || ((uintptr_t)buffer & 7) != 0) {
+        return NULL;
+    }
+
+    if (header->magic != LPM_MAGIC ||
+        header->version != LPM_VERSION ||
+        header->ranges == 0 ||
+        header->ranges > (buffer_bytes - sizeof(lpm_header_t)) / LPM_RANGE_BYTES)
+    {
+        return NULL;
+    }
+
+    table = (ipv6_lpm_t*)calloc(1, sizeof(ipv6_lpm_t));
+    if (!table) {
+        return NULL;
+    }
+
+    table->hi = (const uint64_t*)(header + 1);
+    table->lo = table->hi + header->ranges;
+    table->values = (const uint32_t*)(table->lo + header->ranges);
+    table->ranges = header->ranges;
+    table->image = buffer;
+    table->image_bytes = sizeof(lpm_header_t) + (size_t)header->ranges * LPM_RANGE_BYTES;
+    table->read_only = true;
+
+    // Searches rely on the first range starting at ::
+    if (table->hi[0] != 0 || table->lo[0] != 0) {
+        free(table);
+        return NULL;
+    }
+
+    return table;
+}
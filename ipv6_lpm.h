@@ -0,0 +1,131 @@
+#pragma once
+// ## Longest prefix match table
+//
+// Immutable table mapping CIDR prefixes to 32bit values (a route, an ACL
+// action, an ASN) that answers longest prefix match lookups, compiled from a
+// list of parsed prefixes.
+//
+// The compiled table is a sorted array of the address ranges where the
+// longest matching prefix changes, stored as separate high/low 64 bit lanes
+// and a value array. The same arrays form a flat, position independent image
+// that can be written to a file once and mapped read-only at startup, lookups
+// then run directly against the mapped pages and processes mapping the same
+// file share its page cache:
+//
+//     int fd = open("routes.lpm", O_RDONLY);
+//     struct stat st;
+//     fstat(fd, &st);
+//     void* image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+//     ipv6_lpm_t* table = ipv6_lpm_view(image, st.st_size);
+//
+// IPv4 compatible prefixes (`10.0.0.0/8`) are stored as IPv4 mapped prefixes
+// (`::ffff:10.0.0.0/104`), so either form of an IPv4 address finds them.
+// Port and interface are ignored.
+//
+
+#include "ipv6.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ### ipv6_lpm_t
+//
+// Opaque table, either owning its arrays or a read-only view of an image.
+// Lookups are thread safe. IPV6_LPM_NONE is the value of addresses not
+// covered by any prefix.
+//
+// ~~~~
+#define IPV6_LPM_NONE UINT32_MAX
+
+typedef struct ipv6_lpm_t ipv6_lpm_t;
+// ~~~~
+
+
+// ### ipv6_lpm_build
+//
+// Compile `count` prefixes, `prefixes[i]` maps to `values[i]` or to `i` if
+// `values` is NULL. Addresses without IPV6_FLAG_HAS_MASK are /128 prefixes
+// and bits past the mask are ignored. If the same prefix is listed more than
+// once the last value wins, a prefix with the value IPV6_LPM_NONE removes its
+// range from a shorter covering prefix.
+//
+// Returns NULL if a mask is above 128 or memory could not be allocated.
+//
+// ~~~~
+ipv6_lpm_t* IPV6_API_DECL(ipv6_lpm_build) (
+    const ipv6_address_full_t* prefixes,
+    const uint32_t* values,
+    size_t count);
+// ~~~~
+
+
+// ### ipv6_lpm_destroy
+//
+// Free a table or a view, the image of a view is not touched.
+//
+// ~~~~
+void IPV6_API_DECL(ipv6_lpm_destroy) (
+    ipv6_lpm_t* table);
+// ~~~~
+
+
+// ### ipv6_lpm_lookup
+//
+// Value of the longest prefix containing the address of `addr`, or
+// IPV6_LPM_NONE.
+//
+// ~~~~
+uint32_t IPV6_API_DECL(ipv6_lpm_lookup) (
+    const ipv6_lpm_t* table,
+    const ipv6_address_full_t* addr);
+// ~~~~
+
+
+// ### ipv6_lpm_lookup_batch
+//
+// Look up `count` addresses into `out`, with the searches of several addresses
+// interleaved so their cache misses overlap. Returns the number of addresses
+// with a value other than IPV6_LPM_NONE.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_lpm_lookup_batch) (
+    const ipv6_lpm_t* table,
+    const ipv6_address_full_t* in,
+    uint32_t* out,
+    size_t count);
+// ~~~~
+
+
+// ### ipv6_lpm_serialize
+//
+// Write the table into `buffer` as a flat image: a 32 byte header with a
+// format version, followed by the range starts and values in host byte
+// order. Returns the image size in bytes, or 0 if `buffer_bytes` is too
+// small. Pass a NULL buffer to query the size.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_lpm_serialize) (
+    const ipv6_lpm_t* table,
+    void* buffer,
+    size_t buffer_bytes);
+// ~~~~
+
+
+// ### ipv6_lpm_view
+//
+// Create a read-only table over an image produced by ipv6_lpm_serialize
+// without copying it. The buffer must be 8 byte aligned and outlive the view.
+//
+// Returns NULL if the image is invalid, truncated, from another version or
+// from a host with a different byte order.
+//
+// ~~~~
+ipv6_lpm_t* IPV6_API_DECL(ipv6_lpm_view) (
+    const void* buffer,
+    size_t buffer_bytes);
+// ~~~~
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,364 @@
+#include "ipv6_math.h"
+#include "ipv6_config.h"
+#include "ipv6_internal.h"
+
+#if defined(__SIZEOF_INT128__)
+#define MATH_HAVE_INT128 1
+__extension__ typedef unsigned __int128 math_int128_t;
+#endif
+
+//--------------------------------------------------------------------------------
+// a + b into `hi`, `lo`, returns true if the sum wrapped
+static bool math_add (
+    uint64_t a_hi,
+    uint64_t a_lo,
+    uint64_t b_hi,
+    uint64_t b_lo,
+    uint64_t* hi,
+    uint64_t* lo)
+{
+#ifdef MATH_HAVE_INT128
+    const math_int128_t a = (math_int128_t)a_hi << 64 | a_lo;
+    const math_int128_t sum = a + ((math_int128_t)b_hi << 64 | b_lo);
+
+    *hi = (uint64_t)(sum >> 64);
+    *lo = (uint64_t)sum;
+    return sum < a;
+#else
+    const uint64_t sum_lo = a_lo + b_lo;
+    const uint64_t partial = a_hi + b_hi;
+    const uint64_t sum_hi = partial + (sum_lo < a_lo);
+
+    *hi = sum_hi;
+    *lo = sum_lo;
+    return (partial < a_hi) | (sum_hi < partial);
+#endif
+}
+
+//--------------------------------------------------------------------------------
+// a - b into `hi`, `lo`, returns true if the difference wrapped
+static bool math_sub (
+    uint64_t a_hi,
+    uint64_t a_lo,
+    uint64_t b_hi,
+    uint64_t b_lo,
+    uint64_t* hi,
+    uint64_t* lo)
+{
+#ifdef MATH_HAVE_INT128
+    const math_int128_t a = (math_int128_t)a_hi << 64 | a_lo;
+    const math_int128_t b = (math_int128_t)b_hi << 64 | b_lo;
+    const math_int128_t difference = a - b;
+
+    *hi = (uint64_t)(difference >> 64);
+    *lo = (uint64_t)difference;
+    return b > a;
+#else
+    *hi = a_hi - b_hi - (a_lo < b_lo);
+    *lo = a_lo - b_lo;
+    return (b_hi > a_hi) | ((b_hi == a_hi) & (b_lo > a_lo));
+#endif
+}
+
+//--------------------------------------------------------------------------------
+static bool math_less (uint64_t a_hi, uint64_t a_lo, uint64_t b_hi, uint64_t b_lo)
+{
+    return (a_hi < b_hi) | ((a_hi == b_hi) & (a_lo < b_lo));
+}
+
+//--------------------------------------------------------------------------------
+// Shift left by `shift` bits, 128 or more gives zero
+static void math_shift_left (uint64_t* hi, uint64_t* lo, uint32_t shift)
+{
+    if (shift >= 128) {
+        *hi = 0;
+        *lo = 0;
+    }
+    else if (shift >= 64) {
+        *hi = *lo << (shift - 64);
+        *lo = 0;
+    }
+    else if (shift > 0) {
+        *hi = *hi << shift | *lo >> (64 - shift);
+        *lo <<= shift;
+    }
+}
+
+//--------------------------------------------------------------------------------
+// Distance between two addresses in lanes
+static ipv6_u128_t math_distance (uint64_t a_hi, uint64_t a_lo, uint64_t b_hi, uint64_t b_lo)
+{
+    ipv6_u128_t distance;
+
+    if (math_less(b_hi, b_lo, a_hi, a_lo)) {
+        math_sub(a_hi, a_lo, b_hi, b_lo, &distance.hi, &distance.lo);
+    }
+    else {
+        math_sub(b_hi, b_lo, a_hi, a_lo, &distance.hi, &distance.lo);
+    }
+
+    return distance;
+}
+
+//--------------------------------------------------------------------------------
+// Step from one prefix of length `bits` to the next, `bits` from 1 to 128
+static void math_step (uint32_t bits, uint64_t* hi, uint64_t* lo)
+{
+    *hi = 0;
+    *lo = 1;
+    math_shift_left(hi, lo, 128 - bits);
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_math_add) (
+    const ipv6_address_t* addr,
+    ipv6_u128_t n,
+    ipv6_address_t* out)
+{
+    uint64_t hi, lo;
+    bool wrapped;
+
+    if (!addr || !out) {
+        return false;
+    }
+
+    address_load(addr, &hi, &lo);
+    wrapped = math_add(hi, lo, n.hi, n.lo, &hi, &lo);
+    address_store(out, hi, lo);
+    return !wrapped;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_math_sub) (
+    const ipv6_address_t* addr,
+    ipv6_u128_t n,
+    ipv6_address_t* out)
+{
+    uint64_t hi, lo;
+    bool wrapped;
+
+    if (!addr || !out) {
+        return false;
+    }
+
+    address_load(addr, &hi, &lo);
+    wrapped = math_sub(hi, lo, n.hi, n.lo, &hi, &lo);
+    address_store(out, hi, lo);
+    return !wrapped;
+}
+
+//--------------------------------------------------------------------------------
+int32_t IPV6_API_DEF(ipv6_math_compare) (
+    const ipv6_address_t* a,
+    const ipv6_address_t* b)
+{
+    uint64_t a_hi, a_lo, b_hi, b_lo;
+
+    address_load(a, &a_hi, &a_lo);
+    address_load(b, &b_hi, &b_lo);
+    return (int32_t)math_less(b_hi, b_lo, a_hi, a_lo) - (int32_t)math_less(a_hi, a_lo, b_hi, b_lo);
+}
+
+//--------------------------------------------------------------------------------
+ipv6_u128_t IPV6_API_DEF(ipv6_math_distance) (
+    const ipv6_address_t* a,
+    const ipv6_address_t* b)
+{
+    uint64_t a_hi, a_lo, b_hi, b_lo;
+
+    address_load(a, &a_hi, &a_lo);
+    address_load(b, &b_hi, &b_lo);
+    return math_distance(a_hi, a_lo, b_hi, b_lo);
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_math_first) (
+    const ipv6_address_t* addr,
+    uint32_t bits,
+    ipv6_address_t* out)
+{
+    uint64_t hi, lo;
+
+    if (!addr || !out || bits > 128) {
+        return false;
+    }
+
+    address_load(addr, &hi, &lo);
+    address_store(out, hi & PREFIX_HI_MASK(bits), lo & PREFIX_LO_MASK(bits));
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_math_last) (
+    const ipv6_address_t* addr,
+    uint32_t bits,
+    ipv6_address_t* out)
+{
+    uint64_t hi, lo;
+
+    if (!addr || !out || bits > 128) {
+        return false;
+    }
+
+    address_load(addr, &hi, &lo);
+    address_store(out, hi | ~PREFIX_HI_MASK(bits), lo | ~PREFIX_LO_MASK(bits));
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_math_next) (
+    const ipv6_address_t* addr,
+    uint32_t bits,
+    ipv6_address_t* out)
+{
+    uint64_t hi, lo, step_hi, step_lo;
+
+    if (!addr || !out || bits == 0 || bits > 128) {
+        return false;
+    }
+
+    address_load(addr, &hi, &lo);
+    math_step(bits, &step_hi, &step_lo);
+    if (math_add(hi & PREFIX_HI_MASK(bits), lo & PREFIX_LO_MASK(bits), step_hi, step_lo, &hi, &lo)) {
+        return false;
+    }
+
+    address_store(out, hi, lo);
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_math_prev) (
+    const ipv6_address_t* addr,
+    uint32_t bits,
+    ipv6_address_t* out)
+{
+    uint64_t hi, lo, step_hi, step_lo;
+
+    if (!addr || !out || bits == 0 || bits > 128) {
+        return false;
+    }
+
+    address_load(addr, &hi, &lo);
+    math_step(bits, &step_hi, &step_lo);
+    if (math_sub(hi & PREFIX_HI_MASK(bits), lo & PREFIX_LO_MASK(bits), step_hi, step_lo, &hi, &lo)) {
+        return false;
+    }
+
+    address_store(out, hi, lo);
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_math_nth) (
+    const ipv6_address_t* addr,
+    uint32_t bits,
+    ipv6_u128_t n,
+    ipv6_address_t* out)
+{
+    uint64_t hi, lo;
+
+    if (!addr || !out || bits > 128 ||
+        math_less(~PREFIX_HI_MASK(bits), ~PREFIX_LO_MASK(bits), n.hi, n.lo))
+    {
+        return false;
+    }
+
+    // The offset fits in the host bits, so it can be or'ed in
+    address_load(addr, &hi, &lo);
+    address_store(out, (hi & PREFIX_HI_MASK(bits)) | n.hi, (lo & PREFIX_LO_MASK(bits)) | n.lo);
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_math_add_batch) (
+    const ipv6_address_t* in,
+    const ipv6_u128_t* n,
+    ipv6_address_t* out,
+    size_t count)
+{
+    size_t added = 0;
+
+    if (!in || !n || !out) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t hi, lo;
+
+        address_load(&in[i], &hi, &lo);
+        added += !math_add(hi, lo, n[i].hi, n[i].lo, &hi, &lo);
+        address_store(&out[i], hi, lo);
+    }
+
+    return added;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_math_distance_batch) (
+    const ipv6_address_t* a,
+    const ipv6_address_t* b,
+    ipv6_u128_t* out,
+    size_t count)
+{
+    if (!a || !b || !out) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t a_hi, a_lo, b_hi, b_lo;
+
+        address_load(&a[i], &a_hi, &a_lo);
+        address_load(&b[i], &b_hi, &b_lo);
+        out[i] = math_distance(a_hi, a_lo, b_hi, b_lo);
+    }
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_math_subnets) (
+    const ipv6_address_t* addr,
+    uint32_t bits,
+    uint32_t sub_bits,
+    ipv6_u128_t index,
+    ipv6_address_t* out,
+    size_t count)
+{
+    uint64_t hi, lo, step_hi, step_lo, more_hi, more_lo;
+    uint64_t offset_hi = index.hi, offset_lo = index.lo;
+    size_t written = 0;
+
+    if (!addr || !out || sub_bits < bits || sub_bits > 128) {
+        return 0;
+    }
+
+    // Subnets after subnet `index`: 2^(sub_bits - bits) - index - 1
+    if (sub_bits - bits < 128) {
+        math_step(128 - (sub_bits - bits), &more_hi, &more_lo);
+        if (!math_less(index.hi, index.lo, more_hi, more_lo)) {
+            return 0;
+        }
+        math_sub(more_hi, more_lo, index.hi, index.lo, &more_hi, &more_lo);
+        math_sub(more_hi, more_lo, 0, 1, &more_hi, &more_lo);
+    }
+    else {
+        more_hi = ~index.hi;
+        more_lo = ~index.lo;
+    }
+
+    address_load(addr, &hi, &lo);
+    math_shift_left(&offset_hi, &offset_lo, 128 - sub_bits);
+    hi = (hi & PREFIX_HI_MASK(bits)) | offset_hi;
+    lo = (lo & PREFIX_LO_MASK(bits)) | offset_lo;
+    math_step(sub_bits, &step_hi, &step_lo);
+
+    while (written < count) {
+        address_store(&out[written++], hi, lo);
+        if (!(more_hi | more_lo)) {
+            break;
+        }
+        math_sub(more_hi, more_lo, 0, 1, &more_hi, &more_lo);
+        math_add(hi, lo, step_hi, step_lo, &hi, &lo);
+    }
+
+    return written;
+}
@@ -0,0 +1,171 @@
+#pragma once
+// ## Address arithmetic
+//
+// Arithmetic on the 128 bit value of an address for address planning: "the
+// next /64 after X", "how many addresses from A to B", "the Nth host of this
+// subnet". Components are read most significant first, so `2001:db8::ffff`
+// plus one is `2001:db8::1:0`.
+//
+// Offsets and distances are 128 bit values, ipv6_u128_t. The functions use
+// `unsigned __int128` where the compiler has it and pairs of 64 bit lanes
+// elsewhere, with the same results.
+//
+// The functions work on ipv6_address_t, which has no flags: an IPv4 compatible
+// address parsed from `10.0.0.1` keeps the IPv4 address in its first two
+// components. Use the IPv4 mapped form (`::ffff:10.0.0.1`, prefix length
+// 96 + n) for IPv4 arithmetic.
+//
+
+#include "ipv6.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ### ipv6_u128_t
+//
+// Unsigned 128 bit value as high and low 64 bits.
+//
+// ~~~~
+typedef struct {
+    uint64_t                hi;
+    uint64_t                lo;
+} ipv6_u128_t;
+// ~~~~
+
+
+// ### ipv6_math_add / ipv6_math_sub
+//
+// `addr + n` and `addr - n` into `out`. Returns false if the result wrapped
+// past `ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff` or below `::`, `out` then
+// holds the wrapped result.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_math_add) (
+    const ipv6_address_t* addr,
+    ipv6_u128_t n,
+    ipv6_address_t* out);
+
+bool IPV6_API_DECL(ipv6_math_sub) (
+    const ipv6_address_t* addr,
+    ipv6_u128_t n,
+    ipv6_address_t* out);
+// ~~~~
+
+
+// ### ipv6_math_compare / ipv6_math_distance
+//
+// Order of two addresses by value, -1, 0 or 1, and the difference between
+// them, `|b - a|`. The number of addresses from `a` to `b` inclusive is the
+// distance plus one, which does not fit 128 bits for `::` to
+// `ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff`.
+//
+// ~~~~
+int32_t IPV6_API_DECL(ipv6_math_compare) (
+    const ipv6_address_t* a,
+    const ipv6_address_t* b);
+
+ipv6_u128_t IPV6_API_DECL(ipv6_math_distance) (
+    const ipv6_address_t* a,
+    const ipv6_address_t* b);
+// ~~~~
+
+
+// ### ipv6_math_first / ipv6_math_last
+//
+// First and last address of the prefix of length `bits` containing `addr`.
+// Returns false if `bits` is above 128.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_math_first) (
+    const ipv6_address_t* addr,
+    uint32_t bits,
+    ipv6_address_t* out);
+
+bool IPV6_API_DECL(ipv6_math_last) (
+    const ipv6_address_t* addr,
+    uint32_t bits,
+    ipv6_address_t* out);
+// ~~~~
+
+
+// ### ipv6_math_next / ipv6_math_prev
+//
+// First address of the prefix of length `bits` after or before the one
+// containing `addr`, e.g. the next /64 after `2001:db8:0:5::1` is
+// `2001:db8:0:6::`. Returns false if there is no such prefix: `bits` is 0
+// or above 128, or the prefix is the last or first of the address space.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_math_next) (
+    const ipv6_address_t* addr,
+    uint32_t bits,
+    ipv6_address_t* out);
+
+bool IPV6_API_DECL(ipv6_math_prev) (
+    const ipv6_address_t* addr,
+    uint32_t bits,
+    ipv6_address_t* out);
+// ~~~~
+
+
+// ### ipv6_math_nth
+//
+// Address `n` of the prefix of length `bits` containing `addr`, counting the
+// first address as 0. Returns false if `bits` is above 128 or the prefix has
+// no address `n`.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_math_nth) (
+    const ipv6_address_t* addr,
+    uint32_t bits,
+    ipv6_u128_t n,
+    ipv6_address_t* out);
+// ~~~~
+
+
+// ### ipv6_math_add_batch / ipv6_math_distance_batch
+//
+// ipv6_math_add of `count` addresses and offsets, and ipv6_math_distance of
+// `count` pairs. ipv6_math_add_batch returns the number of sums that did
+// not wrap.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_math_add_batch) (
+    const ipv6_address_t* in,
+    const ipv6_u128_t* n,
+    ipv6_address_t* out,
+    size_t count);
+
+void IPV6_API_DECL(ipv6_math_distance_batch) (
+    const ipv6_address_t* a,
+    const ipv6_address_t* b,
+    ipv6_u128_t* out,
+    size_t count);
+// ~~~~
+
+
+// ### ipv6_math_subnets
+//
+// Allocate consecutive subnets: write the first addresses of up to `count`
+// prefixes of length `sub_bits` within the prefix of length `bits`
+// containing `addr`, starting from subnet number `index`. E.g. the /64s of
+// `2001:db8:1::/48` from index 16 are `2001:db8:1:10::`, `2001:db8:1:11::`
+// and so on.
+//
+// Returns the number of subnets written, less than `count` when the prefix
+// runs out of subnets, 0 if `sub_bits` is below `bits` or above 128.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_math_subnets) (
+    const ipv6_address_t* addr,
+    uint32_t bits,
+    uint32_t sub_bits,
+    ipv6_u128_t index,
+    ipv6_address_t* out,
+    size_t count);
+// ~~~~
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,166 @@
+#include "ipv6_packed.h"
+#include "ipv6_config.h"
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+// Layout of ipv6_packed_t.flags
+#define PACKED_FLAG_PORT        0x01
+#define PACKED_FLAG_EMBED       0x02
+#define PACKED_FLAG_COMPAT      0x04
+#define PACKED_ZONE_SHIFT       3
+
+// Arrays of packed addresses must not pick up padding
+typedef char packed_size_check[sizeof(ipv6_packed_t) == 20 ? 1 : -1];
+
+struct ipv6_zone_table_t {
+    uint32_t                count;
+    uint8_t                 lengths[IPV6_ZONE_TABLE_SIZE];
+    char                    names[IPV6_ZONE_TABLE_SIZE][IPV6_ZONE_NAME_SIZE];
+};
+
+//--------------------------------------------------------------------------------
+ipv6_zone_table_t* IPV6_API_DEF(ipv6_zone_table_create) (void)
+{
+    return (ipv6_zone_table_t*)calloc(1, sizeof(ipv6_zone_table_t));
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_zone_table_destroy) (
+    ipv6_zone_table_t* zones)
+{
+    free(zones);
+}
+
+//--------------------------------------------------------------------------------
+uint32_t IPV6_API_DEF(ipv6_zone_intern) (
+    ipv6_zone_table_t* zones,
+    const char* name,
+    size_t name_len)
+{
+    if (!zones || !name || name_len == 0 || name_len >= IPV6_ZONE_NAME_SIZE) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < zones->count; ++i) {
+        if (zones->lengths[i] == name_len && memcmp(zones->names[i], name, name_len) == 0) {
+            return i + 1;
+        }
+    }
+
+    if (zones->count == IPV6_ZONE_TABLE_SIZE) {
+        return 0;
+    }
+
+    // Names are kept nul terminated for callers that print them
+    memcpy(zones->names[zones->count], name, name_len);
+    zones->names[zones->count][name_len] = '\0';
+    zones->lengths[zones->count] = (uint8_t)name_len;
+    return ++zones->count;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_pack) (
+    const ipv6_address_full_t* in,
+    ipv6_packed_t* out,
+    ipv6_zone_table_t* zones)
+{
+    uint32_t zone = 0;
+
+    if (!in || !out) {
+        return false;
+    }
+
+    if ((in->flags & IPV6_FLAG_HAS_MASK) && in->mask > 128) {
+        return false;
+    }
+
+    if (in->iface_len) {
+        zone = ipv6_zone_intern(zones, in->iface, in->iface_len);
+        if (!zone) {
+            return false;
+        }
+    }
+
+    out->address = in->address;
+    out->port = in->port;
+    out->mask = (in->flags & IPV6_FLAG_HAS_MASK) ? (uint8_t)in->mask : IPV6_PACKED_NO_MASK;
+    out->flags = (uint8_t)(
+        ((in->flags & IPV6_FLAG_HAS_PORT) ? PACKED_FLAG_PORT : 0) |
+        ((in->flags & IPV6_FLAG_IPV4_EMBED) ? PACKED_FLAG_EMBED : 0) |
+        ((in->flags & IPV6_FLAG_IPV4_COMPAT) ? PACKED_FLAG_COMPAT : 0) |
+        (zone << PACKED_ZONE_SHIFT));
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_unpack) (
+    const ipv6_packed_t* in,
+    ipv6_address_full_t* out,
+    const ipv6_zone_table_t* zones)
+{
+    uint32_t zone;
+
+    if (!in || !out) {
+        return false;
+    }
+
+    zone = (uint32_t)in->flags >> PACKED_ZONE_SHIFT;
+    if (zone && (!zones || zone > zones->count)) {
+        return false;
+    }
+
+    memset(out, 0, sizeof(ipv6_address_full_t));
+    out->address = in->address;
+    out->port = in->port;
+    out->flags =
+        ((in->flags & PACKED_FLAG_PORT) ? IPV6_FLAG_HAS_PORT : 0) |
+        ((in->flags & PACKED_FLAG_EMBED) ? IPV6_FLAG_IPV4_EMBED : 0) |
+        ((in->flags & PACKED_FLAG_COMPAT) ? IPV6_FLAG_IPV4_COMPAT : 0);
+
+    if (in->mask != IPV6_PACKED_NO_MASK) {
+        out->flags |= IPV6_FLAG_HAS_MASK;
+        out->mask = in->mask;
+    }
+
+    if (zone) {
+        out->iface = zones->names[zone - 1];
+        out->iface_len = zones->lengths[zone - 1];
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_from_str_packed) (
+    const char* input,
+    size_t input_bytes,
+    ipv6_packed_t* out,
+    ipv6_zone_table_t* zones)
+{
+    ipv6_address_full_t full;
+
+    return ipv6_from_str(input, input_bytes, &full) && ipv6_pack(&full, out, zones);
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_to_str_packed) (
+    const ipv6_packed_t* in,
+    const ipv6_zone_table_t* zones,
+    char* output,
+    size_t output_bytes,
+    uint32_t options)
+{
+    ipv6_address_full_t full;
+
+    if (!ipv6_unpack(in, &full, zones)) {
+        return 0;
+    }
+
+    return ipv6_to_str_format(&full, output, output_bytes, options);
+}
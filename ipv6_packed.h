@@ -0,0 +1,129 @@
+#pragma once
+// ## Packed storage
+//
+// A 20 byte storage form of *ipv6_address_full_t* for holding large numbers
+// of addresses in memory, half the size of the full structure on 64-bit
+// builds and without a pointer, so arrays of packed addresses can be written
+// to disk or shared memory as they are.
+//
+// The address components, port, CIDR mask and IPv4 flags are kept exactly.
+// Zones are interned into an *ipv6_zone_table_t* owned by the caller and
+// stored as a 5 bit id, so a table holds at most IPV6_ZONE_TABLE_SIZE zones.
+//
+
+#include "ipv6.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ### ipv6_packed_t
+//
+// Packed address, 20 bytes with 2 byte alignment. `mask` is
+// IPV6_PACKED_NO_MASK unless the address has a CIDR mask, `flags` holds
+// IPV6_FLAG_HAS_PORT, the IPv4 flags and the zone id. Use ipv6_pack and
+// ipv6_unpack rather than reading the fields.
+//
+// ~~~~
+#define IPV6_PACKED_NO_MASK     0xff
+#define IPV6_ZONE_TABLE_SIZE    31
+#define IPV6_ZONE_NAME_SIZE     64
+
+typedef struct {
+    ipv6_address_t          address;
+    uint16_t                port;
+    uint8_t                 mask;
+    uint8_t                 flags;
+} ipv6_packed_t;
+// ~~~~
+
+
+// ### ipv6_zone_table_create
+//
+// Create an empty zone table. Interning is not thread safe, share a table
+// between threads only once it holds every zone or under a lock.
+//
+// Returns NULL if memory could not be allocated.
+//
+// ~~~~
+typedef struct ipv6_zone_table_t ipv6_zone_table_t;
+
+ipv6_zone_table_t* IPV6_API_DECL(ipv6_zone_table_create) (void);
+
+void IPV6_API_DECL(ipv6_zone_table_destroy) (
+    ipv6_zone_table_t* zones);
+// ~~~~
+
+
+// ### ipv6_zone_intern
+//
+// Find or add the zone `name` of `name_len` bytes.
+//
+// Returns the zone id from 1 to IPV6_ZONE_TABLE_SIZE, or 0 if the name is
+// empty, longer than IPV6_ZONE_NAME_SIZE - 1 bytes or the table is full.
+//
+// ~~~~
+uint32_t IPV6_API_DECL(ipv6_zone_intern) (
+    ipv6_zone_table_t* zones,
+    const char* name,
+    size_t name_len);
+// ~~~~
+
+
+// ### ipv6_pack
+//
+// Pack an address, interning its zone into `zones`. `zones` may be NULL for
+// addresses without a zone.
+//
+// Returns false if the address can not be packed without loss: a mask above
+// 128 or a zone that could not be interned.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_pack) (
+    const ipv6_address_full_t* in,
+    ipv6_packed_t* out,
+    ipv6_zone_table_t* zones);
+// ~~~~
+
+
+// ### ipv6_unpack
+//
+// Unpack an address. The zone of the result points into `zones` and stays
+// valid as long as the table. Returns false if the zone id is not in `zones`.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_unpack) (
+    const ipv6_packed_t* in,
+    ipv6_address_full_t* out,
+    const ipv6_zone_table_t* zones);
+// ~~~~
+
+
+// ### ipv6_from_str_packed / ipv6_to_str_packed
+//
+// Parse a string straight into the packed form and format a packed address
+// with ipv6_format_t `options`, the same as ipv6_from_str or
+// ipv6_to_str_format combined with ipv6_pack or ipv6_unpack.
+//
+// ipv6_from_str_packed returns false if the input does not parse or can not
+// be packed, ipv6_to_str_packed returns the size of the string minus the nul
+// byte or 0 on failure.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_from_str_packed) (
+    const char* input,
+    size_t input_bytes,
+    ipv6_packed_t* out,
+    ipv6_zone_table_t* zones);
+
+size_t IPV6_API_DECL(ipv6_to_str_packed) (
+    const ipv6_packed_t* in,
+    const ipv6_zone_table_t* zones,
+    char* output,
+    size_t output_bytes,
+    uint32_t options);
+// ~~~~
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,244 @@
+#include "ipv6_pattern.h"
+#include "ipv6_config.h"
+#include "ipv6_internal.h"
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#define PATTERN_BLOCK           64      // patterns per match word
+#define PATTERN_TEXT            128     // longest pattern after expanding wildcards
+
+struct ipv6_pattern_set_t {
+    uint64_t*               mask_hi;
+    uint64_t*               mask_lo;
+    uint64_t*               value_hi;
+    uint64_t*               value_lo;
+    size_t                  count;
+};
+
+//--------------------------------------------------------------------------------
+static bool pattern_separator (char c)
+{
+    return c == ':' || c == '.' || c == '/' || c == '[' || c == ']' || c == '%';
+}
+
+//--------------------------------------------------------------------------------
+// Write the lowest and highest text a wildcard can stand for: a whole IPv4
+// octet, a whole IPv6 component or one hex digit. Returns false for a
+// wildcard sharing an IPv4 octet with digits.
+static bool pattern_expand (
+    const char* input,
+    size_t input_bytes,
+    size_t position,
+    const char** low,
+    const char** high)
+{
+    size_t first = position, last = position + 1;
+    bool lone, decimal;
+
+    while (first > 0 && !pattern_separator(input[first - 1])) {
+        first--;
+    }
+    while (last < input_bytes && !pattern_separator(input[last])) {
+        last++;
+    }
+
+    lone = first == position && last == position + 1;
+    decimal = (first > 0 && input[first - 1] == '.') || (last < input_bytes && input[last] == '.');
+
+    *low = "0";
+    *high = decimal ? "255" : lone ? "ffff" : "f";
+    return lone || !decimal;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_pattern_from_str) (
+    const char* input,
+    size_t input_bytes,
+    ipv6_pattern_t* out)
+{
+    char low[PATTERN_TEXT], high[PATTERN_TEXT];
+    size_t low_bytes = 0, high_bytes = 0;
+    ipv6_address_full_t low_addr, high_addr;
+    uint64_t low_hi, low_lo, high_hi, high_lo;
+    uint32_t bits = 128;
+
+    if (!input || !out) {
+        return false;
+    }
+
+    // Parse the pattern with every wildcard at its lowest and at its highest,
+    // the bits that differ are the wildcard bits
+    for (size_t i = 0; i < input_bytes; ++i) {
+        const char* low_text = NULL;
+        const char* high_text = NULL;
+
+        if (input[i] == '*' && !pattern_expand(input, input_bytes, i, &low_text, &high_text)) {
+            return false;
+        }
+
+        if (low_bytes + 4 > PATTERN_TEXT || high_bytes + 4 > PATTERN_TEXT) {
+            return false;
+        }
+
+        if (low_text) {
+            memcpy(low + low_bytes, low_text, strlen(low_text));
+            memcpy(high + high_bytes, high_text, strlen(high_text));
+            low_bytes += strlen(low_text);
+            high_bytes += strlen(high_text);
+        }
+        else {
+            low[low_bytes++] = input[i];
+            high[high_bytes++] = input[i];
+        }
+    }
+
+    if (!ipv6_from_str(low, low_bytes, &low_addr) || !ipv6_from_str(high, high_bytes, &high_addr)) {
+        return false;
+    }
+
+    const uint64_t compat = address_load_mapped(&low_addr, &low_hi, &low_lo);
+    if (compat != address_load_mapped(&high_addr, &high_hi, &high_lo)) {
+        return false;
+    }
+
+    if (low_addr.flags & IPV6_FLAG_HAS_MASK) {
+        bits = compat ? 96 + low_addr.mask : low_addr.mask;
+    }
+    if (bits > 128) {
+        return false;
+    }
+
+    const uint64_t mask_hi = ~(low_hi ^ high_hi) & PREFIX_HI_MASK(bits);
+    const uint64_t mask_lo = ~(low_lo ^ high_lo) & PREFIX_LO_MASK(bits);
+    address_store(&out->mask, mask_hi, mask_lo);
+    address_store(&out->value, low_hi & mask_hi, low_lo & mask_lo);
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_pattern_match) (
+    const ipv6_pattern_t* pattern,
+    const ipv6_address_full_t* addr)
+{
+    uint64_t hi, lo, mask_hi, mask_lo, value_hi, value_lo;
+
+    if (!pattern || !addr) {
+        return false;
+    }
+
+    address_load_mapped(addr, &hi, &lo);
+    address_load(&pattern->mask, &mask_hi, &mask_lo);
+    address_load(&pattern->value, &value_hi, &value_lo);
+    return ((hi & mask_hi) == value_hi) & ((lo & mask_lo) == value_lo);
+}
+
+//--------------------------------------------------------------------------------
+ipv6_pattern_set_t* IPV6_API_DEF(ipv6_pattern_set_build) (
+    const ipv6_pattern_t* patterns,
+    size_t count)
+{
+    ipv6_pattern_set_t* set;
+
+    if (!patterns && count) {
+        return NULL;
+    }
+
+    set = (ipv6_pattern_set_t*)calloc(1, sizeof(ipv6_pattern_set_t));
+    if (!set) {
+        return NULL;
+    }
+
+    // One block holds the four arrays
+    set->mask_hi = (uint64_t*)malloc(4 * (count ? count : 1) * sizeof(uint64_t));
+    if (!set->mask_hi) {
+        free(set);
+        return NULL;
+    }
+
+    set->mask_lo = set->mask_hi + count;
+    set->value_hi = set->mask_lo + count;
+    set->value_lo = set->value_hi + count;
+    set->count = count;
+    for (size_t i = 0; i < count; ++i) {
+        address_load(&patterns[i].mask, &set->mask_hi[i], &set->mask_lo[i]);
+        address_load(&patterns[i].value, &set->value_hi[i], &set->value_lo[i]);
+        set->value_hi[i] &= set->mask_hi[i];
+        set->value_lo[i] &= set->mask_lo[i];
+    }
+
+    return set;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_pattern_set_destroy) (
+    ipv6_pattern_set_t* set)
+{
+    if (set) {
+        free(set->mask_hi);
+        free(set);
+    }
+}
+
+//--------------------------------------------------------------------------------
+// Match an address against up to 64 patterns into one bitmap word. Branch
+// free so that the loop vectorizes.
+static uint64_t pattern_match_block (
+    const ipv6_pattern_set_t* set,
+    size_t first,
+    size_t patterns,
+    uint64_t hi,
+    uint64_t lo)
+{
+    const uint64_t* mask_hi = set->mask_hi + first;
+    const uint64_t* mask_lo = set->mask_lo + first;
+    const uint64_t* value_hi = set->value_hi + first;
+    const uint64_t* value_lo = set->value_lo + first;
+    uint64_t word = 0;
+
+    for (size_t j = 0; j < patterns; ++j) {
+        const uint64_t match = (uint64_t)(((hi & mask_hi[j]) == value_hi[j]) & ((lo & mask_lo[j]) == value_lo[j]));
+        word |= match << j;
+    }
+
+    return word;
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_pattern_match_batch) (
+    const ipv6_pattern_set_t* set,
+    const ipv6_address_full_t* in,
+    uint32_t* out,
+    size_t count)
+{
+    size_t found = 0;
+
+    if (!set || !in || !out) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t hi, lo;
+
+        address_load_mapped(&in[i], &hi, &lo);
+        out[i] = IPV6_PATTERN_NONE;
+
+        for (size_t first = 0; first < set->count; first += PATTERN_BLOCK) {
+            const size_t patterns = set->count - first < PATTERN_BLOCK ? set->count - first : PATTERN_BLOCK;
+            const uint64_t word = pattern_match_block(set, first, patterns, hi, lo);
+
+            if (word) {
+                out[i] = (uint32_t)(first + count_trailing_zeros64(word));
+                found++;
+                break;
+            }
+        }
+    }
+
+    return found;
+}
@@ -0,0 +1,98 @@
+#pragma once
+// ## Address patterns
+//
+// Wildcard patterns for filtering addresses without formatting them, e.g.
+// `2001:db8:*:*::1`, `fe80::*:*`, `2001:db8::12*4` or `10.*.*.5`.
+//
+// A `*` standing for a whole IPv6 component or IPv4 octet matches any value
+// there, a `*` inside an IPv6 component matches any hex digit at that place.
+// Everything else follows the address grammar of ipv6_from_str, including
+// `::` and embedded IPv4 addresses, and a trailing `/mask` ignores the bits
+// past the mask. Patterns compile to a 128 bit mask and value: an address
+// matches when its bits under the mask equal the value.
+//
+// IPv4 patterns are compiled in the IPv4 mapped form, so `10.*.*.5` matches
+// both `10.1.2.5` and `::ffff:10.1.2.5`. Port and interface are ignored.
+//
+
+#include "ipv6.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ### ipv6_pattern_t
+//
+// Compiled pattern, bits of `value` outside of `mask` are zero.
+//
+// ~~~~
+#define IPV6_PATTERN_NONE UINT32_MAX
+
+typedef struct {
+    ipv6_address_t          mask;
+    ipv6_address_t          value;
+} ipv6_pattern_t;
+// ~~~~
+
+
+// ### ipv6_pattern_from_str
+//
+// Compile a pattern. Returns false if the pattern does not parse, a `*`
+// shares an IPv4 octet with digits, or the mask is above 128 (32 for IPv4).
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_pattern_from_str) (
+    const char* input,
+    size_t input_bytes,
+    ipv6_pattern_t* out);
+// ~~~~
+
+
+// ### ipv6_pattern_match
+//
+// Whether the address of `addr` matches `pattern`.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_pattern_match) (
+    const ipv6_pattern_t* pattern,
+    const ipv6_address_full_t* addr);
+// ~~~~
+
+
+// ### ipv6_pattern_set_build
+//
+// Copy `count` patterns into a set for matching many addresses against many
+// patterns. The masks and values are stored as separate arrays and matched
+// 64 patterns at a time by branch free loops that compilers vectorize.
+//
+// Returns NULL if memory could not be allocated.
+//
+// ~~~~
+typedef struct ipv6_pattern_set_t ipv6_pattern_set_t;
+
+ipv6_pattern_set_t* IPV6_API_DECL(ipv6_pattern_set_build) (
+    const ipv6_pattern_t* patterns,
+    size_t count);
+
+void IPV6_API_DECL(ipv6_pattern_set_destroy) (
+    ipv6_pattern_set_t* set);
+// ~~~~
+
+
+// ### ipv6_pattern_match_batch
+//
+// Index of the first pattern of the set matching each of `count` addresses
+// into `out`, IPV6_PATTERN_NONE for addresses matching no pattern. Returns
+// the number of addresses matching a pattern.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_pattern_match_batch) (
+    const ipv6_pattern_set_t* set,
+    const ipv6_address_full_t* in,
+    uint32_t* out,
+    size_t count);
+// ~~~~
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,414 @@
+#include "ipv6_pset.h"
+#include "ipv6_config.h"
+#include "ipv6_internal.h"
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+//
+// Both families are swept in the 128 bit space, IPv4 compatible prefixes as
+// their IPv4 mapped form. Ranges are inclusive at both ends so a range can
+// reach the last address.
+//
+typedef struct {
+    uint64_t                start_hi;
+    uint64_t                start_lo;
+    uint64_t                end_hi;
+    uint64_t                end_lo;
+} pset_range_t;
+
+typedef enum {
+    PSET_UNION,
+    PSET_INTERSECT,
+    PSET_DIFFERENCE
+} pset_op_t;
+
+// Sorted prefixes of one family read as merged ranges
+typedef struct {
+    const ipv6_address_full_t* prefixes;
+    size_t                  count;
+    size_t                  next;
+    uint64_t                compat;         // all ones when reading IPv4 compatible prefixes
+    uint64_t                last_hi;        // start of the last prefix read
+    uint64_t                last_lo;
+    pset_range_t            pending;        // read but not merged yet
+    bool                    has_pending;
+    bool                    invalid;
+} pset_input_t;
+
+// Result ranges, merged while adjacent and cut into prefixes
+typedef struct {
+    ipv6_address_full_t*    out;
+    size_t                  max;
+    size_t                  count;
+    uint64_t                compat;
+    pset_range_t            range;
+    bool                    has_range;
+} pset_output_t;
+
+//--------------------------------------------------------------------------------
+static bool pset_less_equal (uint64_t a_hi, uint64_t a_lo, uint64_t b_hi, uint64_t b_lo)
+{
+    return (a_hi < b_hi) | ((a_hi == b_hi) & (a_lo <= b_lo));
+}
+
+//--------------------------------------------------------------------------------
+// Whether a range starting at `hi`, `lo` overlaps `range` or follows it
+// without a gap
+static bool pset_touches (const pset_range_t* range, uint64_t hi, uint64_t lo)
+{
+    const uint64_t next_lo = range->end_lo + 1;
+    const uint64_t next_hi = range->end_hi + (next_lo == 0);
+
+    return pset_less_equal(hi, lo, range->end_hi, range->end_lo) || (hi == next_hi && lo == next_lo);
+}
+
+//--------------------------------------------------------------------------------
+// First address and prefix length in the 128 bit space, false if the mask is
+// out of range
+static bool pset_load (const ipv6_address_full_t* prefix, uint64_t* hi, uint64_t* lo, uint32_t* bits)
+{
+    const uint64_t compat = address_load_mapped(prefix, hi, lo);
+
+    *bits = 128;
+    if (prefix->flags & IPV6_FLAG_HAS_MASK) {
+        *bits = compat ? 96 + prefix->mask : prefix->mask;
+    }
+    if (*bits > 128) {
+        return false;
+    }
+
+    *hi &= PREFIX_HI_MASK(*bits);
+    *lo &= PREFIX_LO_MASK(*bits);
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+// Next prefix of the family as a range, false at the end or on invalid input
+static bool pset_read (pset_input_t* input, pset_range_t* range)
+{
+    while (input->next < input->count && !input->invalid) {
+        const ipv6_address_full_t* prefix = &input->prefixes[input->next++];
+        const uint64_t compat = 0 - (uint64_t)((prefix->flags & IPV6_FLAG_IPV4_COMPAT) != 0);
+        uint32_t bits;
+
+        if (compat != input->compat) {
+            continue;
+        }
+
+        input->invalid = !pset_load(prefix, &range->start_hi, &range->start_lo, &bits) ||
+            !pset_less_equal(input->last_hi, input->last_lo, range->start_hi, range->start_lo);
+        if (!input->invalid) {
+            range->end_hi = range->start_hi | ~PREFIX_HI_MASK(bits);
+            range->end_lo = range->start_lo | ~PREFIX_LO_MASK(bits);
+            input->last_hi = range->start_hi;
+            input->last_lo = range->start_lo;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//--------------------------------------------------------------------------------
+// Next range of the input with overlapping and adjacent prefixes merged
+static bool pset_pull (pset_input_t* input, pset_range_t* range)
+{
+    if (!input->has_pending) {
+        return false;
+    }
+
+    *range = input->pending;
+    while ((input->has_pending = pset_read(input, &input->pending)) &&
+        pset_touches(range, input->pending.start_hi, input->pending.start_lo))
+    {
+        if (pset_less_equal(range->end_hi, range->end_lo, input->pending.end_hi, input->pending.end_lo)) {
+            range->end_hi = input->pending.end_hi;
+            range->end_lo = input->pending.end_lo;
+        }
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+static void pset_input_init (
+    pset_input_t* input,
+    const ipv6_address_full_t* prefixes,
+    size_t count,
+    uint64_t compat)
+{
+    memset(input, 0, sizeof(pset_input_t));
+    input->prefixes = prefixes;
+    input->count = prefixes ? count : 0;
+    input->compat = compat;
+    input->has_pending = pset_read(input, &input->pending);
+}
+
+//--------------------------------------------------------------------------------
+static void pset_emit (pset_output_t* output, uint64_t hi, uint64_t lo, uint32_t bits)
+{
+    if (output->out && output->count < output->max) {
+        ipv6_address_full_t* prefix = &output->out[output->count];
+
+        memset(prefix, 0, sizeof(ipv6_address_full_t));
+        prefix->flags = IPV6_FLAG_HAS_MASK;
+        if (output->compat) {
+            prefix->flags |= IPV6_FLAG_IPV4_COMPAT;
+            prefix->address.components[0] = (uint16_t)(lo >> 16);
+            prefix->address.components[1] = (uint16_t)lo;
+            prefix->mask = bits - 96;
+        }
+        else {
+            address_store(&prefix->address, hi, lo);
+            prefix->mask = bits;
+        }
+    }
+
+    output->count++;
+}
+
+//--------------------------------------------------------------------------------
+// Cut a range into the fewest prefixes: from the start, the largest block
+// aligned to the start that ends within the range
+static void pset_cut (pset_output_t* output, const pset_range_t* range)
+{
+    uint64_t hi = range->start_hi;
+    uint64_t lo = range->start_lo;
+
+    for (;;) {
+        // Addresses left after the start, plus one
+        const uint64_t left_lo = range->end_lo - lo + 1;
+        const uint64_t left_hi = range->end_hi - hi - (range->end_lo < lo) + (left_lo == 0);
+        const uint32_t align = lo ? count_trailing_zeros64(lo) : 64 + count_trailing_zeros64(hi);
+        uint32_t fits = 128;
+
+        if (left_hi | left_lo) {
+            fits = left_hi ? 127 - count_leading_zeros64(left_hi) : 63 - count_leading_zeros64(left_lo);
+        }
+
+        const uint32_t bits = 128 - (align < fits ? align : fits);
+        const uint64_t last_hi = hi | ~PREFIX_HI_MASK(bits);
+        const uint64_t last_lo = lo | ~PREFIX_LO_MASK(bits);
+
+        pset_emit(output, hi, lo, bits);
+        if (last_hi == range->end_hi && last_lo == range->end_lo) {
+            break;
+        }
+
+        lo = last_lo + 1;
+        hi = last_hi + (lo == 0);
+    }
+}
+
+//--------------------------------------------------------------------------------
+// Add a result range, ranges are added in order of their start
+static void pset_add (pset_output_t* output, const pset_range_t* range)
+{
+    if (output->has_range && pset_touches(&output->range, range->start_hi, range->start_lo)) {
+        if (pset_less_equal(output->range.end_hi, output->range.end_lo, range->end_hi, range->end_lo)) {
+            output->range.end_hi = range->end_hi;
+            output->range.end_lo = range->end_lo;
+        }
+        return;
+    }
+
+    if (output->has_range) {
+        pset_cut(output, &output->range);
+    }
+    output->range = *range;
+    output->has_range = true;
+}
+
+//--------------------------------------------------------------------------------
+// Combine the merged ranges of both inputs
+static void pset_sweep (pset_op_t op, pset_input_t* a, pset_input_t* b, pset_output_t* output)
+{
+    pset_range_t ra, rb, range;
+    bool has_a = pset_pull(a, &ra);
+    bool has_b = pset_pull(b, &rb);
+
+    if (op == PSET_UNION) {
+        while (has_a || has_b) {
+            if (has_a && (!has_b || pset_less_equal(ra.start_hi, ra.start_lo, rb.start_hi, rb.start_lo))) {
+                pset_add(output, &ra);
+                has_a = pset_pull(a, &ra);
+            }
+            else {
+                pset_add(output, &rb);
+                has_b = pset_pull(b, &rb);
+            }
+        }
+    }
+    else if (op == PSET_INTERSECT) {
+        while (has_a && has_b) {
+            const bool a_first = pset_less_equal(ra.start_hi, ra.start_lo, rb.start_hi, rb.start_lo);
+            const bool a_ends = pset_less_equal(ra.end_hi, ra.end_lo, rb.end_hi, rb.end_lo);
+
+            range.start_hi = a_first ? rb.start_hi : ra.start_hi;
+            range.start_lo = a_first ? rb.start_lo : ra.start_lo;
+            range.end_hi = a_ends ? ra.end_hi : rb.end_hi;
+            range.end_lo = a_ends ? ra.end_lo : rb.end_lo;
+            if (pset_less_equal(range.start_hi, range.start_lo, range.end_hi, range.end_lo)) {
+                pset_add(output, &range);
+            }
+
+            if (a_ends) {
+                has_a = pset_pull(a, &ra);
+            }
+            else {
+                has_b = pset_pull(b, &rb);
+            }
+        }
+    }
+    else {
+        while (has_a) {
+            // Skip ranges of b before the range of a
+            while (has_b && !pset_less_equal(ra.start_hi, ra.start_lo, rb.end_hi, rb.end_lo)) {
+                has_b = pset_pull(b, &rb);
+            }
+
+            if (!has_b || !pset_less_equal(rb.start_hi, rb.start_lo, ra.end_hi, ra.end_lo)) {
+                pset_add(output, &ra);
+                has_a = pset_pull(a, &ra);
+                continue;
+            }
+
+            // The range of b overlaps, keep what comes before it
+            if (!pset_less_equal(rb.start_hi, rb.start_lo, ra.start_hi, ra.start_lo)) {
+                range.start_hi = ra.start_hi;
+                range.start_lo = ra.start_lo;
+                range.end_lo = rb.start_lo - 1;
+                range.end_hi = rb.start_hi - (rb.start_lo == 0);
+                pset_add(output, &range);
+            }
+
+            if (pset_less_equal(ra.end_hi, ra.end_lo, rb.end_hi, rb.end_lo)) {
+                has_a = pset_pull(a, &ra);
+            }
+            else {
+                ra.start_lo = rb.end_lo + 1;
+                ra.start_hi = rb.end_hi + (ra.start_lo == 0);
+                has_b = pset_pull(b, &rb);
+            }
+        }
+    }
+
+    if (output->has_range) {
+        pset_cut(output, &output->range);
+        output->has_range = false;
+    }
+
+    // Read the rest of the inputs to check they are sorted
+    while (pset_pull(a, &ra)) {
+    }
+    while (pset_pull(b, &rb)) {
+    }
+}
+
+//--------------------------------------------------------------------------------
+static size_t pset_combine (
+    pset_op_t op,
+    const ipv6_address_full_t* a,
+    size_t a_count,
+    const ipv6_address_full_t* b,
+    size_t b_count,
+    ipv6_address_full_t* out,
+    size_t max)
+{
+    pset_output_t output;
+    bool invalid = false;
+
+    memset(&output, 0, sizeof(output));
+    output.out = out;
+    output.max = max;
+
+    // IPv4 compatible prefixes first, then IPv6
+    for (uint32_t family = 0; family < 2; ++family) {
+        pset_input_t input_a, input_b;
+
+        output.compat = family ? 0 : ~UINT64_C(0);
+        pset_input_init(&input_a, a, a_count, output.compat);
+        pset_input_init(&input_b, b, b_count, output.compat);
+        pset_sweep(op, &input_a, &input_b, &output);
+        invalid |= input_a.invalid | input_b.invalid;
+    }
+
+    return invalid ? IPV6_PSET_INVALID : output.count;
+}
+
+//--------------------------------------------------------------------------------
+static int pset_compare (const void* a, const void* b)
+{
+    const ipv6_address_full_t* pa = (const ipv6_address_full_t*)a;
+    const ipv6_address_full_t* pb = (const ipv6_address_full_t*)b;
+    const uint32_t compat_a = (pa->flags & IPV6_FLAG_IPV4_COMPAT) != 0;
+    const uint32_t compat_b = (pb->flags & IPV6_FLAG_IPV4_COMPAT) != 0;
+    uint64_t a_hi, a_lo, b_hi, b_lo;
+    uint32_t a_bits, b_bits;
+
+    if (compat_a != compat_b) {
+        return compat_a ? -1 : 1;
+    }
+
+    pset_load(pa, &a_hi, &a_lo, &a_bits);
+    pset_load(pb, &b_hi, &b_lo, &b_bits);
+    if (a_hi != b_hi) {
+        return a_hi < b_hi ? -1 : 1;
+    }
+    if (a_lo != b_lo) {
+        return a_lo < b_lo ? -1 : 1;
+    }
+    return a_bits < b_bits ? -1 : a_bits > b_bits;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_pset_sort) (
+    ipv6_address_full_t* prefixes,
+    size_t count)
+{
+    if (prefixes && count > 1) {
+        qsort(prefixes, count, sizeof(ipv6_address_full_t), pset_compare);
+    }
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_pset_union) (
+    const ipv6_address_full_t* a,
+    size_t a_count,
+    const ipv6_address_full_t* b,
+    size_t b_count,
+    ipv6_address_full_t* out,
+    size_t max)
+{
+    return pset_combine(PSET_UNION, a, a_count, b, b_count, out, max);
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_pset_intersect) (
+    const ipv6_address_full_t* a,
+    size_t a_count,
+    const ipv6_address_full_t* b,
+    size_t b_count,
+    ipv6_address_full_t* out,
+    size_t max)
+{
+    return pset_combine(PSET_INTERSECT, a, a_count, b, b_count, out, max);
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_pset_difference) (
+    const ipv6_address_full_t* a,
+    size_t a_count,
+    const ipv6_address_full_t* b,
+    size_t b_count,
+    ipv6_address_full_t* out,
+    size_t max)
+{
+    return pset_combine(PSET_DIFFERENCE, a, a_count, b, b_count, out, max);
+}
@@ -0,0 +1,81 @@
+#pragma once
+// ## Prefix sets
+//
+// Union, intersection and difference of CIDR lists, e.g. "allowed minus
+// blocked" when compiling a policy. The inputs are sorted prefix lists and the
+// result is the minimal list of prefixes covering exactly the addresses of
+// the result set, in the same sorted order so results can be combined
+// further.
+//
+// Each operation is one linear sweep over both inputs. Overlapping and
+// adjacent prefixes of an input are merged into ranges, the ranges of the two
+// inputs are combined with 128 bit arithmetic and every range of the result
+// is cut into the fewest aligned prefixes.
+//
+// IPv4 compatible prefixes (`10.0.0.0/8`) and IPv6 prefixes are separate
+// families: `0.0.0.0/0` does not overlap `::/0`, and IPv4 mapped prefixes
+// such as `::ffff:10.0.0.0/104` are IPv6 prefixes. The port and interface of
+// the inputs are ignored.
+//
+
+#include "ipv6.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ### ipv6_pset_sort
+//
+// Sort prefixes into the order the set operations take: IPv4 compatible
+// prefixes first, then by first address and by mask. Addresses without
+// IPV6_FLAG_HAS_MASK are /32 or /128 prefixes.
+//
+// ~~~~
+void IPV6_API_DECL(ipv6_pset_sort) (
+    ipv6_address_full_t* prefixes,
+    size_t count);
+// ~~~~
+
+
+// ### ipv6_pset_union / ipv6_pset_intersect / ipv6_pset_difference
+//
+// Addresses in `a` or `b`, in both `a` and `b`, and in `a` but not in `b`.
+// Within each family the inputs must be sorted by first address, as by
+// ipv6_pset_sort. The union of `a` with an empty `b` is the minimal list of
+// `a`.
+//
+// Returns the number of prefixes in the result, of which the first `max` are
+// written to `out`. Pass a NULL `out` to query the size. Returns
+// IPV6_PSET_INVALID if a mask is out of range or an input is not sorted.
+//
+// ~~~~
+#define IPV6_PSET_INVALID SIZE_MAX
+
+size_t IPV6_API_DECL(ipv6_pset_union) (
+    const ipv6_address_full_t* a,
+    size_t a_count,
+    const ipv6_address_full_t* b,
+    size_t b_count,
+    ipv6_address_full_t* out,
+    size_t max);
+
+size_t IPV6_API_DECL(ipv6_pset_intersect) (
+    const ipv6_address_full_t* a,
+    size_t a_count,
+    const ipv6_address_full_t* b,
+    size_t b_count,
+    ipv6_address_full_t* out,
+    size_t max);
+
+size_t IPV6_API_DECL(ipv6_pset_difference) (
+    const ipv6_address_full_t* a,
+    size_t a_count,
+    const ipv6_address_full_t* b,
+    size_t b_count,
+    ipv6_address_full_t* out,
+    size_t max);
+// ~~~~
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
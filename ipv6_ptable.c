@@ -0,0 +1,789 @@
+#include "ipv6_ptable.h"
+#include "ipv6_config.h"
+#include "ipv6_internal.h"
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#define PTABLE_LINE             128     // keeps readers off each other's lines, and their neighbours
+#define PTABLE_PATH             136     // nodes created or replaced by one update
+#define PTABLE_DEPTH            129     // nodes on a path from the root, one per prefix length
+#define PTABLE_DIGITS           17      // radix sort bytes: mask, then 8 low and 8 high address bytes
+#define PTABLE_INVALID          255     // bits of a loader slot without a prefix
+
+//
+// Trie node covering the prefix of `bits` bits. Nodes are immutable once
+// published, a node without a value only joins two subtrees.
+//
+typedef struct ptable_node_t {
+    uint64_t                hi;             // prefix, bits past `bits` are zero
+    uint64_t                lo;
+    uint64_t                mask_hi;
+    uint64_t                mask_lo;
+    struct ptable_node_t*   child[2];       // by the bit after the prefix
+    struct ptable_node_t*   retired_next;
+    uint64_t                retired_epoch;  // epoch the node was replaced in
+    uint32_t                value;
+    uint32_t                bits;
+} ptable_node_t;
+
+struct ipv6_ptable_reader_t {
+    uint64_t                epoch;          // epoch read in, 0 outside of a lookup
+    void*                   owner;          // non NULL while attached
+    ipv6_ptable_t*          table;
+    uint8_t                 padding[PTABLE_LINE - sizeof(uint64_t) - 2 * sizeof(void*)];
+};
+
+//
+// Prefix parsed by a loader, bits past `bits` are zero
+//
+typedef struct {
+    uint64_t                hi;
+    uint64_t                lo;
+    uint32_t                value;
+    uint32_t                bits;           // PTABLE_INVALID if the slot has no prefix
+} ptable_entry_t;
+
+struct ipv6_ptable_loader_t {
+    ptable_entry_t*         entries;
+    size_t                  count;
+};
+
+struct ipv6_ptable_t {
+    ptable_node_t*          root;           // read by readers
+    uint64_t                epoch;
+    ipv6_ptable_reader_t*   readers;        // PTABLE_LINE aligned
+    uint32_t                max_readers;
+    void*                   reader_memory;
+
+    // Writer state
+    ptable_node_t*          retired;
+    ptable_node_t*          fresh[PTABLE_PATH];     // created by the update
+    ptable_node_t*          replaced[PTABLE_PATH];  // unlinked by the update
+    uint32_t                fresh_count;
+    uint32_t                replaced_count;
+};
+
+//--------------------------------------------------------------------------------
+// Bit `index` of an address, counting from the most significant
+static uint32_t ptable_bit (uint64_t hi, uint64_t lo, uint32_t index)
+{
+    return (uint32_t)(index < 64 ? hi >> (63 - index) : lo >> (127 - index)) & 1;
+}
+
+//--------------------------------------------------------------------------------
+// Number of leading bits two addresses share
+static uint32_t ptable_common (uint64_t a_hi, uint64_t a_lo, uint64_t b_hi, uint64_t b_lo)
+{
+    return (a_hi ^ b_hi) ? count_leading_zeros64(a_hi ^ b_hi) : 64 + count_leading_zeros64(a_lo ^ b_lo);
+}
+
+//--------------------------------------------------------------------------------
+static bool ptable_contains (const ptable_node_t* node, uint64_t hi, uint64_t lo)
+{
+    return ((hi & node->mask_hi) == node->hi) & ((lo & node->mask_lo) == node->lo);
+}
+
+//--------------------------------------------------------------------------------
+static ptable_node_t* ptable_node_new (uint64_t hi, uint64_t lo, uint32_t bits, uint32_t value)
+{
+    ptable_node_t* node = (ptable_node_t*)calloc(1, sizeof(ptable_node_t));
+
+    if (node) {
+        node->mask_hi = PREFIX_HI_MASK(bits);
+        node->mask_lo = PREFIX_LO_MASK(bits);
+        node->hi = hi & node->mask_hi;
+        node->lo = lo & node->mask_lo;
+        node->bits = bits;
+        node->value = value;
+    }
+
+    return node;
+}
+
+//--------------------------------------------------------------------------------
+// New node for this update, freed again if the update fails
+static ptable_node_t* ptable_alloc (
+    ipv6_ptable_t* table,
+    uint64_t hi,
+    uint64_t lo,
+    uint32_t bits,
+    uint32_t value)
+{
+    ptable_node_t* node;
+
+    if (table->fresh_count == PTABLE_PATH) {
+        return NULL;
+    }
+
+    node = ptable_node_new(hi, lo, bits, value);
+    if (node) {
+        table->fresh[table->fresh_count++] = node;
+    }
+
+    return node;
+}
+
+//--------------------------------------------------------------------------------
+// Copy of a published node, the original is retired if the update succeeds
+static ptable_node_t* ptable_copy (ipv6_ptable_t* table, ptable_node_t* node)
+{
+    ptable_node_t* copy = ptable_alloc(table, node->hi, node->lo, node->bits, node->value);
+
+    if (copy) {
+        copy->child[0] = node->child[0];
+        copy->child[1] = node->child[1];
+        table->replaced[table->replaced_count++] = node;
+    }
+
+    return copy;
+}
+
+//--------------------------------------------------------------------------------
+// Replacement of `node` with a new value and children, NULL or the single
+// child when a node without a value would join fewer than two subtrees
+static bool ptable_rebuild (
+    ipv6_ptable_t* table,
+    ptable_node_t* node,
+    uint32_t value,
+    ptable_node_t* child0,
+    ptable_node_t* child1,
+    ptable_node_t** out)
+{
+    if (value == IPV6_PTABLE_NONE && (!child0 || !child1)) {
+        table->replaced[table->replaced_count++] = node;
+        *out = child0 ? child0 : child1;
+        return true;
+    }
+
+    *out = ptable_copy(table, node);
+    if (!*out) {
+        return false;
+    }
+
+    (*out)->value = value;
+    (*out)->child[0] = child0;
+    (*out)->child[1] = child1;
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+// Copy of the subtree at `node` with the prefix inserted, sharing every node
+// off the path
+static bool ptable_insert_at (
+    ipv6_ptable_t* table,
+    ptable_node_t* node,
+    uint64_t hi,
+    uint64_t lo,
+    uint32_t bits,
+    uint32_t value,
+    ptable_node_t** out)
+{
+    uint32_t common;
+    ptable_node_t* leaf;
+
+    if (!node) {
+        *out = ptable_alloc(table, hi, lo, bits, value);
+        return *out != NULL;
+    }
+
+    common = ptable_common(node->hi, node->lo, hi, lo);
+    common = common < node->bits ? common : node->bits;
+    common = common < bits ? common : bits;
+
+    // The prefix is in the table
+    if (common == node->bits && common == bits) {
+        return ptable_rebuild(table, node, value, node->child[0], node->child[1], out);
+    }
+
+    // The prefix is below this node
+    if (common == node->bits) {
+        const uint32_t b = ptable_bit(hi, lo, node->bits);
+        ptable_node_t* child;
+
+        if (!ptable_insert_at(table, node->child[b], hi, lo, bits, value, &child)) {
+            return false;
+        }
+        return ptable_rebuild(table, node, node->value,
+            b ? node->child[0] : child, b ? child : node->child[1], out);
+    }
+
+    // The prefix covers this node
+    leaf = ptable_alloc(table, hi, lo, bits, value);
+    if (!leaf) {
+        return false;
+    }
+    if (common == bits) {
+        leaf->child[ptable_bit(node->hi, node->lo, bits)] = node;
+        *out = leaf;
+        return true;
+    }
+
+    // The prefix and this node split at `common`
+    *out = ptable_alloc(table, hi, lo, common, IPV6_PTABLE_NONE);
+    if (!*out) {
+        return false;
+    }
+    (*out)->child[ptable_bit(hi, lo, common)] = leaf;
+    (*out)->child[ptable_bit(node->hi, node->lo, common)] = node;
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+// Copy of the subtree at `node` without the prefix, false if the prefix is
+// not in the subtree or memory could not be allocated
+static bool ptable_remove_at (
+    ipv6_ptable_t* table,
+    ptable_node_t* node,
+    uint64_t hi,
+    uint64_t lo,
+    uint32_t bits,
+    ptable_node_t** out)
+{
+    ptable_node_t* child;
+    uint32_t b;
+
+    if (!node || node->bits > bits || !ptable_contains(node, hi, lo)) {
+        return false;
+    }
+
+    if (node->bits == bits) {
+        return node->value != IPV6_PTABLE_NONE &&
+            ptable_rebuild(table, node, IPV6_PTABLE_NONE, node->child[0], node->child[1], out);
+    }
+
+    b = ptable_bit(hi, lo, node->bits);
+    if (!ptable_remove_at(table, node->child[b], hi, lo, bits, &child)) {
+        return false;
+    }
+    return ptable_rebuild(table, node, node->value,
+        b ? node->child[0] : child, b ? child : node->child[1], out);
+}
+
+//--------------------------------------------------------------------------------
+// Free the retired nodes no reader can still see: a node retired in epoch `e`
+// is only reachable by readers that read in at epoch `e` or before
+static void ptable_reclaim (ipv6_ptable_t* table)
+{
+    ptable_node_t** link = &table->retired;
+    uint64_t oldest = UINT64_MAX;
+
+    for (uint32_t i = 0; i < table->max_readers; ++i) {
+        const uint64_t epoch = IPV6_LOAD_ACQUIRE(&table->readers[i].epoch);
+        oldest = epoch && epoch < oldest ? epoch : oldest;
+    }
+
+    while (*link) {
+        ptable_node_t* node = *link;
+        if (node->retired_epoch < oldest) {
+            *link = node->retired_next;
+            free(node);
+        }
+        else {
+            link = &node->retired_next;
+        }
+    }
+}
+
+//--------------------------------------------------------------------------------
+static void ptable_retire (ipv6_ptable_t* table, ptable_node_t* node, uint64_t epoch)
+{
+    node->retired_epoch = epoch;
+    node->retired_next = table->retired;
+    table->retired = node;
+}
+
+//--------------------------------------------------------------------------------
+static void ptable_retire_tree (ipv6_ptable_t* table, ptable_node_t* node, uint64_t epoch)
+{
+    if (node) {
+        ptable_retire_tree(table, node->child[0], epoch);
+        ptable_retire_tree(table, node->child[1], epoch);
+        ptable_retire(table, node, epoch);
+    }
+}
+
+//--------------------------------------------------------------------------------
+// Publish the new root of an update or undo the update
+static bool ptable_finish (ipv6_ptable_t* table, bool success, ptable_node_t* root)
+{
+    if (!success) {
+        for (uint32_t i = 0; i < table->fresh_count; ++i) {
+            free(table->fresh[i]);
+        }
+    }
+    else {
+        const uint64_t epoch = table->epoch;
+
+        // The full fence orders the swap before reading the reader epochs,
+        // pairing with the fence readers take after announcing theirs
+        (void)IPV6_EXCHANGE_PTR(&table->root, root);
+        IPV6_FENCE();
+
+        for (uint32_t i = 0; i < table->replaced_count; ++i) {
+            ptable_retire(table, table->replaced[i], epoch);
+        }
+
+        IPV6_STORE_RELEASE(&table->epoch, epoch + 1);
+        ptable_reclaim(table);
+    }
+
+    table->fresh_count = 0;
+    table->replaced_count = 0;
+    return success;
+}
+
+//--------------------------------------------------------------------------------
+// Load a prefix in the IPv4 mapped form, false if the mask is out of range
+static bool ptable_load (const ipv6_address_full_t* prefix, uint64_t* hi, uint64_t* lo, uint32_t* bits)
+{
+    const uint64_t compat = address_load_mapped(prefix, hi, lo);
+
+    *bits = 128;
+    if (prefix->flags & IPV6_FLAG_HAS_MASK) {
+        *bits = compat ? 96 + prefix->mask : prefix->mask;
+    }
+
+    return *bits <= 128;
+}
+
+//--------------------------------------------------------------------------------
+static void ptable_free_tree (ptable_node_t* node)
+{
+    if (node) {
+        ptable_free_tree(node->child[0]);
+        ptable_free_tree(node->child[1]);
+        free(node);
+    }
+}
+
+//--------------------------------------------------------------------------------
+// Byte `digit` of the sort key, the mask is the least significant
+static uint32_t ptable_digit (const ptable_entry_t* entry, uint32_t digit)
+{
+    if (digit == 0) {
+        return entry->bits;
+    }
+    return (uint32_t)((digit <= 8 ? entry->lo >> (8 * (digit - 1)) : entry->hi >> (8 * (digit - 9))) & 0xff);
+}
+
+//--------------------------------------------------------------------------------
+// Stable LSD radix sort by address then mask, skipping the bytes every key
+// shares such as the zero low half of /64 prefixes. Returns the array
+// holding the sorted entries, `entries` or `scratch`.
+static ptable_entry_t* ptable_sort (
+    ptable_entry_t* entries,
+    ptable_entry_t* scratch,
+    size_t count,
+    size_t* histogram)
+{
+    memset(histogram, 0, PTABLE_DIGITS * 256 * sizeof(size_t));
+    for (size_t i = 0; i < count; ++i) {
+        for (uint32_t d = 0; d < PTABLE_DIGITS; ++d) {
+            histogram[d * 256 + ptable_digit(&entries[i], d)]++;
+        }
+    }
+
+    for (uint32_t d = 0; d < PTABLE_DIGITS && count; ++d) {
+        size_t* offsets = &histogram[d * 256];
+        size_t total = 0;
+
+        if (offsets[ptable_digit(&entries[0], d)] == count) {
+            continue;
+        }
+
+        for (uint32_t b = 0; b < 256; ++b) {
+            const size_t bucket = offsets[b];
+            offsets[b] = total;
+            total += bucket;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            scratch[offsets[ptable_digit(&entries[i], d)]++] = entries[i];
+        }
+
+        ptable_entry_t* swap = entries;
+        entries = scratch;
+        scratch = swap;
+    }
+
+    return entries;
+}
+
+//--------------------------------------------------------------------------------
+// Pop the last node of the path, linking the node popped before it below it
+static ptable_node_t* ptable_pop (ptable_node_t** path, uint32_t* depth, ptable_node_t* last)
+{
+    ptable_node_t* node = path[--*depth];
+
+    if (last) {
+        node->child[ptable_bit(last->hi, last->lo, node->bits)] = last;
+    }
+    return node;
+}
+
+//--------------------------------------------------------------------------------
+// Build the trie of prefixes sorted by address and mask, which is a pre-order
+// walk of the trie. `path` holds the nodes from the root to the last prefix,
+// whose subtrees may still grow. A prefix outside the last node closes the
+// subtrees it is not in, joining them under a new node where the prefix
+// branches off. Returns false if memory could not be allocated, `root` then
+// holds the nodes built so far.
+static bool ptable_build (const ptable_entry_t* sorted, size_t count, ptable_node_t** root)
+{
+    ptable_node_t* path[PTABLE_DEPTH + 1];
+    uint32_t depth = 0;
+    bool success = true;
+
+    for (size_t i = 0; i < count && success; ++i) {
+        const ptable_entry_t* entry = &sorted[i];
+        ptable_node_t* last = NULL;
+
+        // The last slot of a prefix listed more than once wins
+        if (i + 1 < count && entry->bits == entry[1].bits && entry->hi == entry[1].hi && entry->lo == entry[1].lo) {
+            continue;
+        }
+
+        while (depth && (path[depth - 1]->bits > entry->bits || !ptable_contains(path[depth - 1], entry->hi, entry->lo))) {
+            last = ptable_pop(path, &depth, last);
+        }
+
+        // Sorting puts a prefix before those it contains, so the closed
+        // subtree branches off above the prefix
+        if (last) {
+            const uint32_t common = ptable_common(last->hi, last->lo, entry->hi, entry->lo);
+
+            if (depth && path[depth - 1]->bits == common) {
+                path[depth - 1]->child[ptable_bit(last->hi, last->lo, common)] = last;
+            }
+            else {
+                ptable_node_t* branch = ptable_node_new(entry->hi, entry->lo, common, IPV6_PTABLE_NONE);
+                path[depth++] = branch ? branch : last;
+                success = branch != NULL;
+                if (branch) {
+                    branch->child[ptable_bit(last->hi, last->lo, common)] = last;
+                }
+            }
+        }
+
+        if (success) {
+            path[depth] = ptable_node_new(entry->hi, entry->lo, entry->bits, entry->value);
+            success = path[depth] != NULL;
+            depth += success;
+        }
+    }
+
+    *root = NULL;
+    while (depth) {
+        *root = ptable_pop(path, &depth, *root);
+    }
+
+    return success;
+}
+
+//--------------------------------------------------------------------------------
+ipv6_ptable_t* IPV6_API_DEF(ipv6_ptable_create) (
+    uint32_t max_readers)
+{
+    ipv6_ptable_t* table = (ipv6_ptable_t*)calloc(1, sizeof(ipv6_ptable_t));
+
+    if (!table) {
+        return NULL;
+    }
+
+    table->reader_memory = calloc((size_t)max_readers + 1, sizeof(ipv6_ptable_reader_t));
+    if (!table->reader_memory) {
+        free(table);
+        return NULL;
+    }
+
+    table->readers = (ipv6_ptable_reader_t*)
+        (((uintptr_t)table->reader_memory + PTABLE_LINE - 1) & ~(uintptr_t)(PTABLE_LINE - 1));
+    table->max_readers = max_readers;
+    table->epoch = 1;
+    for (uint32_t i = 0; i < max_readers; ++i) {
+        table->readers[i].table = table;
+    }
+
+    return table;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_ptable_destroy) (
+    ipv6_ptable_t* table)
+{
+    if (table) {
+        while (table->retired) {
+            ptable_node_t* next = table->retired->retired_next;
+            free(table->retired);
+            table->retired = next;
+        }
+        ptable_free_tree(table->root);
+        free(table->reader_memory);
+        free(table);
+    }
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_ptable_insert) (
+    ipv6_ptable_t* table,
+    const ipv6_address_full_t* prefix,
+    uint32_t value)
+{
+    ptable_node_t* root = NULL;
+    uint64_t hi, lo;
+    uint32_t bits;
+
+    if (!table || !prefix || value == IPV6_PTABLE_NONE || !ptable_load(prefix, &hi, &lo, &bits)) {
+        return false;
+    }
+
+    hi &= PREFIX_HI_MASK(bits);
+    lo &= PREFIX_LO_MASK(bits);
+    const bool success = ptable_insert_at(table, table->root, hi, lo, bits, value, &root);
+    return ptable_finish(table, success, root);
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_ptable_remove) (
+    ipv6_ptable_t* table,
+    const ipv6_address_full_t* prefix)
+{
+    ptable_node_t* root = NULL;
+    uint64_t hi, lo;
+    uint32_t bits;
+
+    if (!table || !prefix || !ptable_load(prefix, &hi, &lo, &bits)) {
+        return false;
+    }
+
+    hi &= PREFIX_HI_MASK(bits);
+    lo &= PREFIX_LO_MASK(bits);
+    const bool success = ptable_remove_at(table, table->root, hi, lo, bits, &root);
+    return ptable_finish(table, success, root);
+}
+
+//--------------------------------------------------------------------------------
+ipv6_ptable_loader_t* IPV6_API_DEF(ipv6_ptable_loader_create) (
+    size_t count)
+{
+    ipv6_ptable_loader_t* loader = (ipv6_ptable_loader_t*)calloc(1, sizeof(ipv6_ptable_loader_t));
+
+    if (!loader) {
+        return NULL;
+    }
+
+    loader->entries = (ptable_entry_t*)malloc((count ? count : 1) * sizeof(ptable_entry_t));
+    if (!loader->entries) {
+        free(loader);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        loader->entries[i].bits = PTABLE_INVALID;
+    }
+    loader->count = count;
+
+    return loader;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_ptable_loader_destroy) (
+    ipv6_ptable_loader_t* loader)
+{
+    if (loader) {
+        free(loader->entries);
+        free(loader);
+    }
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_ptable_loader_parse) (
+    ipv6_ptable_loader_t* loader,
+    size_t first,
+    const char* const* inputs,
+    const size_t* input_bytes,
+    size_t count)
+{
+    size_t parsed = 0;
+
+    if (!loader || !inputs || first > loader->count || count > loader->count - first) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        ptable_entry_t* entry = &loader->entries[first + i];
+        const size_t bytes = input_bytes ? input_bytes[i] : (inputs[i] ? strlen(inputs[i]) : 0);
+        ipv6_address_full_t prefix;
+
+        entry->bits = PTABLE_INVALID;
+        if (inputs[i] && ipv6_from_str(inputs[i], bytes, &prefix) &&
+            ptable_load(&prefix, &entry->hi, &entry->lo, &entry->bits)) {
+            entry->hi &= PREFIX_HI_MASK(entry->bits);
+            entry->lo &= PREFIX_LO_MASK(entry->bits);
+            entry->value = (uint32_t)(first + i);
+            parsed++;
+        }
+        else {
+            entry->bits = PTABLE_INVALID;
+        }
+    }
+
+    return parsed;
+}
+
+//--------------------------------------------------------------------------------
+bool IPV6_API_DEF(ipv6_ptable_load) (
+    ipv6_ptable_t* table,
+    ipv6_ptable_loader_t* loader)
+{
+    ptable_entry_t* valid;
+    ptable_entry_t* scratch;
+    size_t* histogram;
+    ptable_node_t* root = NULL;
+    size_t count = 0;
+    bool success;
+
+    if (!table || !loader) {
+        return false;
+    }
+
+    valid = (ptable_entry_t*)malloc((loader->count ? loader->count : 1) * sizeof(ptable_entry_t));
+    scratch = (ptable_entry_t*)malloc((loader->count ? loader->count : 1) * sizeof(ptable_entry_t));
+    histogram = (size_t*)malloc(PTABLE_DIGITS * 256 * sizeof(size_t));
+    success = valid && scratch && histogram;
+
+    if (success) {
+        for (size_t i = 0; i < loader->count; ++i) {
+            valid[count] = loader->entries[i];
+            count += loader->entries[i].bits != PTABLE_INVALID;
+        }
+        success = ptable_build(ptable_sort(valid, scratch, count, histogram), count, &root);
+    }
+
+    if (!success) {
+        ptable_free_tree(root);
+    }
+    else {
+        const uint64_t epoch = table->epoch;
+        ptable_node_t* old = (ptable_node_t*)IPV6_EXCHANGE_PTR(&table->root, root);
+
+        IPV6_FENCE();
+        ptable_retire_tree(table, old, epoch);
+        IPV6_STORE_RELEASE(&table->epoch, epoch + 1);
+        ptable_reclaim(table);
+    }
+
+    free(valid);
+    free(scratch);
+    free(histogram);
+    return success;
+}
+
+//--------------------------------------------------------------------------------
+ipv6_ptable_reader_t* IPV6_API_DEF(ipv6_ptable_reader_attach) (
+    ipv6_ptable_t* table)
+{
+    if (!table) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < table->max_readers; ++i) {
+        ipv6_ptable_reader_t* reader = &table->readers[i];
+        if (!IPV6_LOAD_ACQUIRE_PTR(&reader->owner) && !IPV6_EXCHANGE_PTR(&reader->owner, reader)) {
+            return reader;
+        }
+    }
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_ptable_reader_detach) (
+    ipv6_ptable_reader_t* reader)
+{
+    if (reader) {
+        (void)IPV6_EXCHANGE_PTR(&reader->owner, NULL);
+    }
+}
+
+//--------------------------------------------------------------------------------
+// Announce the epoch the reader reads in and load the root of that version
+static const ptable_node_t* ptable_read_begin (ipv6_ptable_reader_t* reader)
+{
+    ipv6_ptable_t* table = reader->table;
+
+    IPV6_STORE_RELEASE(&reader->epoch, IPV6_LOAD_ACQUIRE(&table->epoch));
+    IPV6_FENCE();
+    return (const ptable_node_t*)IPV6_LOAD_ACQUIRE_PTR(&table->root);
+}
+
+//--------------------------------------------------------------------------------
+static void ptable_read_end (ipv6_ptable_reader_t* reader)
+{
+    IPV6_STORE_RELEASE(&reader->epoch, 0);
+}
+
+//--------------------------------------------------------------------------------
+static uint32_t ptable_search (const ptable_node_t* node, const ipv6_address_full_t* addr)
+{
+    uint32_t value = IPV6_PTABLE_NONE;
+    uint64_t hi, lo;
+
+    address_load_mapped(addr, &hi, &lo);
+
+    while (node && ptable_contains(node, hi, lo)) {
+        value = node->value != IPV6_PTABLE_NONE ? node->value : value;
+        if (node->bits == 128) {
+            break;
+        }
+        node = node->child[ptable_bit(hi, lo, node->bits)];
+    }
+
+    return value;
+}
+
+//--------------------------------------------------------------------------------
+uint32_t IPV6_API_DEF(ipv6_ptable_lookup) (
+    ipv6_ptable_reader_t* reader,
+    const ipv6_address_full_t* addr)
+{
+    uint32_t value;
+
+    if (!reader || !addr) {
+        return IPV6_PTABLE_NONE;
+    }
+
+    value = ptable_search(ptable_read_begin(reader), addr);
+    ptable_read_end(reader);
+    return value;
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_ptable_lookup_batch) (
+    ipv6_ptable_reader_t* reader,
+    const ipv6_address_full_t* in,
+    uint32_t* out,
+    size_t count)
+{
+    const ptable_node_t* root;
+    size_t found = 0;
+
+    if (!reader || !in || !out) {
+        return 0;
+    }
+
+    root = ptable_read_begin(reader);
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = ptable_search(root, &in[i]);
+        found += out[i] != IPV6_PTABLE_NONE;
+    }
+    ptable_read_end(reader);
+
+    return found;
+}
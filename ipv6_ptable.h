@@ -0,0 +1,164 @@
+#pragma once
+// ## Concurrent prefix table
+//
+// Longest prefix match table that is updated while any number of threads
+// look it up, for a control plane pushing route or policy changes to worker
+// threads.
+//
+// The table is a path compressed binary trie. Readers never take a lock and
+// never write a cache line shared with another thread: each reader announces
+// the epoch it reads in on its own cache line. Updates copy the nodes on the
+// path they change and publish the new root with a single atomic pointer
+// swap, so a lookup sees the table either before or after an update. Replaced
+// nodes are freed by the writer once every reader active when they were
+// replaced has finished its lookup.
+//
+// Updates must come from one thread at a time, e.g. the control plane thread
+// or under the caller's lock. Lookups may run on any thread through a reader
+// attached to the table, one reader per thread.
+//
+// IPv4 compatible prefixes (`10.0.0.0/8`) are stored as IPv4 mapped prefixes
+// (`::ffff:10.0.0.0/104`), so either form of an IPv4 address finds them.
+// Port and interface are ignored.
+//
+
+#include "ipv6.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ### ipv6_ptable_create
+//
+// Create an empty table that can be read by at most `max_readers` threads at
+// once. Readers must be detached and updates finished before the table is
+// destroyed.
+//
+// Returns NULL if memory could not be allocated.
+//
+// ~~~~
+#define IPV6_PTABLE_NONE UINT32_MAX
+
+typedef struct ipv6_ptable_t ipv6_ptable_t;
+
+ipv6_ptable_t* IPV6_API_DECL(ipv6_ptable_create) (
+    uint32_t max_readers);
+
+void IPV6_API_DECL(ipv6_ptable_destroy) (
+    ipv6_ptable_t* table);
+// ~~~~
+
+
+// ### ipv6_ptable_insert / ipv6_ptable_remove
+//
+// Map `prefix` to `value`, replacing the value of a prefix already in the
+// table, or remove `prefix`. Addresses without IPV6_FLAG_HAS_MASK are /128
+// prefixes and bits past the mask are ignored.
+//
+// ipv6_ptable_insert returns false if the mask is above 128, `value` is
+// IPV6_PTABLE_NONE or memory could not be allocated, in which case the table
+// is unchanged. ipv6_ptable_remove returns false if the prefix is not in the
+// table.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_ptable_insert) (
+    ipv6_ptable_t* table,
+    const ipv6_address_full_t* prefix,
+    uint32_t value);
+
+bool IPV6_API_DECL(ipv6_ptable_remove) (
+    ipv6_ptable_t* table,
+    const ipv6_address_full_t* prefix);
+// ~~~~
+
+
+// ### ipv6_ptable_loader_create / ipv6_ptable_loader_parse
+//
+// Bulk loader for replacing the whole table with `count` prefixes given as
+// strings, such as `2001:db8::/32` or `10.0.0.0/8`.
+//
+// ipv6_ptable_loader_parse parses `count` inputs into the slots starting at
+// `first`, the value of a prefix is its slot. Loaders are not thread safe
+// except for this call: threads may parse disjoint ranges of slots at the
+// same time, e.g. 16 threads each parsing a sixteenth of the inputs.
+// `input_bytes` may be NULL for NUL terminated inputs. Returns the number of
+// inputs that parsed, slots that do not parse or are never parsed are left
+// out of the table.
+//
+// ~~~~
+typedef struct ipv6_ptable_loader_t ipv6_ptable_loader_t;
+
+ipv6_ptable_loader_t* IPV6_API_DECL(ipv6_ptable_loader_create) (
+    size_t count);
+
+void IPV6_API_DECL(ipv6_ptable_loader_destroy) (
+    ipv6_ptable_loader_t* loader);
+
+size_t IPV6_API_DECL(ipv6_ptable_loader_parse) (
+    ipv6_ptable_loader_t* loader,
+    size_t first,
+    const char* const* inputs,
+    const size_t* input_bytes,
+    size_t count);
+// ~~~~
+
+
+// ### ipv6_ptable_load
+//
+// Replace the contents of the table with the prefixes of `loader`. The
+// prefixes are radix sorted by address and mask, which lists them in the
+// order of the trie, and the trie is built bottom up in one pass creating
+// each node once. When a prefix appears more than once the last slot wins.
+// Readers see the old or the new table, never a mix, and the old nodes are
+// freed like those of any other update.
+//
+// Returns false if memory could not be allocated, in which case the table is
+// unchanged.
+//
+// ~~~~
+bool IPV6_API_DECL(ipv6_ptable_load) (
+    ipv6_ptable_t* table,
+    ipv6_ptable_loader_t* loader);
+// ~~~~
+
+
+// ### ipv6_ptable_reader_attach / ipv6_ptable_reader_detach
+//
+// Claim one of the reader slots of the table for the calling thread, and
+// release it.
+//
+// Returns NULL if all `max_readers` slots are in use.
+//
+// ~~~~
+typedef struct ipv6_ptable_reader_t ipv6_ptable_reader_t;
+
+ipv6_ptable_reader_t* IPV6_API_DECL(ipv6_ptable_reader_attach) (
+    ipv6_ptable_t* table);
+
+void IPV6_API_DECL(ipv6_ptable_reader_detach) (
+    ipv6_ptable_reader_t* reader);
+// ~~~~
+
+
+// ### ipv6_ptable_lookup / ipv6_ptable_lookup_batch
+//
+// Value of the longest prefix containing the address of `addr`, or
+// IPV6_PTABLE_NONE, and the same for `count` addresses into `out`. A batch
+// reads a single version of the table and pays for announcing its epoch once.
+// ipv6_ptable_lookup_batch returns the number of addresses found.
+//
+// ~~~~
+uint32_t IPV6_API_DECL(ipv6_ptable_lookup) (
+    ipv6_ptable_reader_t* reader,
+    const ipv6_address_full_t* addr);
+
+size_t IPV6_API_DECL(ipv6_ptable_lookup_batch) (
+    ipv6_ptable_reader_t* reader,
+    const ipv6_address_full_t* in,
+    uint32_t* out,
+    size_t count);
+// ~~~~
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
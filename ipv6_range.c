@@ -0,0 +1,243 @@
+#include "ipv6_range.h"
+#include "ipv6_config.h"
+#include "ipv6_internal.h"
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#define RANGE_LINE              64      // cache line, four keys
+#define RANGE_BATCH             16      // searches stepped together in a batch
+
+//
+// Nodes are numbered from 1 in Eytzinger order, the children of node k are
+// 2k and 2k + 1. Node 0 stands for "before the first range" and has the
+// value IPV6_RANGE_NONE.
+//
+struct ipv6_range_t {
+    const uint64_t*         keys;           // start high/low lanes per node
+    const uint64_t*         ends;           // end high/low lanes per node
+    const uint32_t*         values;
+    uint64_t                count;
+    uint32_t                depth;          // levels of the tree
+    void*                   memory;
+};
+
+typedef struct {
+    uint64_t                hi;
+    uint64_t                lo;
+    uint64_t                end_hi;
+    uint64_t                end_lo;
+    uint32_t                value;
+} range_entry_t;
+
+//--------------------------------------------------------------------------------
+static bool range_less_equal (uint64_t a_hi, uint64_t a_lo, uint64_t b_hi, uint64_t b_lo)
+{
+    return (a_hi < b_hi) | ((a_hi == b_hi) & (a_lo <= b_lo));
+}
+
+//--------------------------------------------------------------------------------
+static int range_compare (const void* a, const void* b)
+{
+    const range_entry_t* ra = (const range_entry_t*)a;
+    const range_entry_t* rb = (const range_entry_t*)b;
+
+    if (ra->hi != rb->hi) {
+        return ra->hi < rb->hi ? -1 : 1;
+    }
+    return ra->lo < rb->lo ? -1 : ra->lo > rb->lo;
+}
+
+//--------------------------------------------------------------------------------
+// Place the sorted entries from `next` onwards into the subtree at `node` in
+// order, returns the next entry to place
+static size_t range_fill (
+    const range_entry_t* sorted,
+    size_t count,
+    size_t next,
+    uint64_t node,
+    uint64_t* keys,
+    uint64_t* ends,
+    uint32_t* values)
+{
+    if (node > count) {
+        return next;
+    }
+
+    next = range_fill(sorted, count, next, 2 * node, keys, ends, values);
+    keys[2 * node] = sorted[next].hi;
+    keys[2 * node + 1] = sorted[next].lo;
+    ends[2 * node] = sorted[next].end_hi;
+    ends[2 * node + 1] = sorted[next].end_lo;
+    values[node] = sorted[next].value;
+    return range_fill(sorted, count, next + 1, 2 * node + 1, keys, ends, values);
+}
+
+//--------------------------------------------------------------------------------
+// Prefetch the line holding the four nodes two levels below `node`
+static void range_prefetch (const ipv6_range_t* table, uint64_t node)
+{
+    const uint64_t below = 4 * node <= table->count ? 4 * node : 0;
+    IPV6_PREFETCH(&table->keys[2 * below]);
+}
+
+//--------------------------------------------------------------------------------
+// Value of the node a search ended at, `node` encodes the path taken with a 1
+// for every step right. The last step right was at the last start at or
+// before the address.
+static uint32_t range_value (const ipv6_range_t* table, uint64_t node, uint64_t hi, uint64_t lo)
+{
+    node >>= count_trailing_zeros64(node) + 1;
+
+    return range_less_equal(hi, lo, table->ends[2 * node], table->ends[2 * node + 1]) ?
+        table->values[node] : IPV6_RANGE_NONE;
+}
+
+//--------------------------------------------------------------------------------
+ipv6_range_t* IPV6_API_DEF(ipv6_range_build) (
+    const ipv6_address_full_t* starts,
+    const ipv6_address_full_t* ends,
+    const uint32_t* values,
+    size_t count)
+{
+    ipv6_range_t* table = NULL;
+    range_entry_t* sorted;
+    bool valid = true;
+
+    if ((!starts || !ends) && count) {
+        return NULL;
+    }
+
+    sorted = (range_entry_t*)malloc((count ? count : 1) * sizeof(range_entry_t));
+    if (!sorted) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        address_load_mapped(&starts[i], &sorted[i].hi, &sorted[i].lo);
+        address_load_mapped(&ends[i], &sorted[i].end_hi, &sorted[i].end_lo);
+        sorted[i].value = values ? values[i] : (uint32_t)i;
+        valid &= range_less_equal(sorted[i].hi, sorted[i].lo, sorted[i].end_hi, sorted[i].end_lo);
+    }
+
+    qsort(sorted, count, sizeof(range_entry_t), range_compare);
+
+    for (size_t i = 1; i < count; ++i) {
+        valid &= !range_less_equal(sorted[i].hi, sorted[i].lo, sorted[i - 1].end_hi, sorted[i - 1].end_lo);
+    }
+
+    // One block holds the keys aligned to a cache line, then the ends and
+    // values
+    const size_t nodes = count + 1;
+    const size_t bytes = RANGE_LINE + nodes * (4 * sizeof(uint64_t) + sizeof(uint32_t));
+    table = valid ? (ipv6_range_t*)calloc(1, sizeof(ipv6_range_t)) : NULL;
+    if (table) {
+        table->memory = calloc(1, bytes);
+    }
+
+    if (table && table->memory) {
+        uint64_t* keys = (uint64_t*)(((uintptr_t)table->memory + RANGE_LINE - 1) & ~(uintptr_t)(RANGE_LINE - 1));
+        uint64_t* node_ends = keys + 2 * nodes;
+        uint32_t* node_values = (uint32_t*)(node_ends + 2 * nodes);
+
+        node_values[0] = IPV6_RANGE_NONE;
+        range_fill(sorted, count, 0, 1, keys, node_ends, node_values);
+
+        table->keys = keys;
+        table->ends = node_ends;
+        table->values = node_values;
+        table->count = count;
+        table->depth = 64 - count_leading_zeros64(count);
+    }
+    else if (table) {
+        free(table);
+        table = NULL;
+    }
+
+    free(sorted);
+    return table;
+}
+
+//--------------------------------------------------------------------------------
+void IPV6_API_DEF(ipv6_range_destroy) (
+    ipv6_range_t* table)
+{
+    if (table) {
+        free(table->memory);
+        free(table);
+    }
+}
+
+//--------------------------------------------------------------------------------
+uint32_t IPV6_API_DEF(ipv6_range_lookup) (
+    const ipv6_range_t* table,
+    const ipv6_address_full_t* addr)
+{
+    uint64_t hi, lo, node = 1;
+
+    if (!table || !addr) {
+        return IPV6_RANGE_NONE;
+    }
+
+    address_load_mapped(addr, &hi, &lo);
+
+    while (node <= table->count) {
+        range_prefetch(table, node);
+        node = 2 * node + range_less_equal(table->keys[2 * node], table->keys[2 * node + 1], hi, lo);
+    }
+
+    return range_value(table, node, hi, lo);
+}
+
+//--------------------------------------------------------------------------------
+size_t IPV6_API_DEF(ipv6_range_lookup_batch) (
+    const ipv6_range_t* table,
+    const ipv6_address_full_t* in,
+    uint32_t* out,
+    size_t count)
+{
+    uint64_t hi[RANGE_BATCH], lo[RANGE_BATCH], node[RANGE_BATCH];
+    size_t found = 0;
+
+    if (!table || !in || !out) {
+        return 0;
+    }
+
+    while (count > 0) {
+        const uint32_t lanes = count < RANGE_BATCH ? (uint32_t)count : RANGE_BATCH;
+
+        for (uint32_t j = 0; j < lanes; ++j) {
+            address_load_mapped(&in[j], &hi[j], &lo[j]);
+            node[j] = 1;
+        }
+
+        // Searches end on the last level or the one above it, lanes that
+        // already left the tree stay where they are
+        for (uint32_t level = 0; level < table->depth; ++level) {
+            for (uint32_t j = 0; j < lanes; ++j) {
+                const bool inside = node[j] <= table->count;
+                const uint64_t probe = inside ? node[j] : 0;
+                const bool right = range_less_equal(table->keys[2 * probe], table->keys[2 * probe + 1], hi[j], lo[j]);
+
+                range_prefetch(table, probe);
+                node[j] = inside ? 2 * node[j] + right : node[j];
+            }
+        }
+
+        for (uint32_t j = 0; j < lanes; ++j) {
+            out[j] = range_value(table, node[j], hi[j], lo[j]);
+            found += out[j] != IPV6_RANGE_NONE;
+        }
+
+        in += lanes;
+        out += lanes;
+        count -= lanes;
+    }
+
+    return found;
+}
@@ -0,0 +1,84 @@
+#pragma once
+// ## Range table
+//
+// Immutable table mapping non-overlapping address ranges to 32bit values, for
+// databases such as GeoIP or ASN data that are published as start and end
+// address pairs rather than prefixes.
+//
+// Range starts are stored in Eytzinger (breadth first) order as 128 bit keys
+// split into high/low 64 bit lanes, so the first levels of every search share
+// a few cache lines and the nodes a search visits next are prefetched while
+// the current one is compared. The search itself is branch free.
+//
+// IPv4 compatible addresses (`10.0.0.0`) are stored as IPv4 mapped addresses
+// (`::ffff:10.0.0.0`), so either form of an IPv4 address finds them. Port,
+// mask and interface are ignored.
+//
+
+#include "ipv6.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ### ipv6_range_t
+//
+// Opaque table, lookups are thread safe. IPV6_RANGE_NONE is the value of
+// addresses outside every range.
+//
+// ~~~~
+#define IPV6_RANGE_NONE UINT32_MAX
+
+typedef struct ipv6_range_t ipv6_range_t;
+// ~~~~
+
+
+// ### ipv6_range_build
+//
+// Build a table of `count` inclusive ranges from `starts[i]` to `ends[i]`
+// mapping to `values[i]`, or to `i` if `values` is NULL. The ranges need not
+// be sorted.
+//
+// Returns NULL if a range ends before it starts, two ranges overlap or memory
+// could not be allocated.
+//
+// ~~~~
+ipv6_range_t* IPV6_API_DECL(ipv6_range_build) (
+    const ipv6_address_full_t* starts,
+    const ipv6_address_full_t* ends,
+    const uint32_t* values,
+    size_t count);
+
+void IPV6_API_DECL(ipv6_range_destroy) (
+    ipv6_range_t* table);
+// ~~~~
+
+
+// ### ipv6_range_lookup
+//
+// Value of the range containing the address of `addr`, or IPV6_RANGE_NONE.
+//
+// ~~~~
+uint32_t IPV6_API_DECL(ipv6_range_lookup) (
+    const ipv6_range_t* table,
+    const ipv6_address_full_t* addr);
+// ~~~~
+
+
+// ### ipv6_range_lookup_batch
+//
+// Look up `count` addresses into `out`, stepping the searches of several
+// addresses together so their cache misses overlap. Returns the number of
+// addresses inside a range.
+//
+// ~~~~
+size_t IPV6_API_DECL(ipv6_range_lookup_batch) (
+    const ipv6_range_t* table,
+    const ipv6_address_full_t* in,
+    uint32_t* out,
+    size_t count);
+// ~~~~
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -54,4 +54,5 @@ def process(filename):
 
         
 if __name__ == '__main__':
-    process('ipv6.h')
+    for header in ('ipv6.h', 'ipv6_anon.h', 'ipv6_bloom.h', 'ipv6_hh.h', 'ipv6_agg.h', 'ipv6_packed.h', 'ipv6_column.h', 'ipv6_lpm.h', 'ipv6_range.h', 'ipv6_acl.h', 'ipv6_ptable.h', 'ipv6_pset.h', 'ipv6_pattern.h', 'ipv6_math.h'):
+        process(header)
@@ -1,4 +1,17 @@
 #include "ipv6.h"
+#include "ipv6_anon.h"
+#include "ipv6_bloom.h"
+#include "ipv6_hh.h"
+#include "ipv6_agg.h"
+#include "ipv6_packed.h"
+#include "ipv6_column.h"
+#include "ipv6_lpm.h"
+#include "ipv6_range.h"
+#include "ipv6_acl.h"
+#include "ipv6_ptable.h"
+#include "ipv6_pset.h"
+#include "ipv6_pattern.h"
+#include "ipv6_math.h"
 #include "ipv6_config.h"
 #include "ipv6_test_config.h"
 
@@ -619,13 +632,2525 @@ static void test_invalid_to_str(test_status_t* status) {
     }    
 }
 
+// Representation of classification test data
+typedef struct {
+    const char*             input;
+    uint32_t                expected;
+} classify_test_data_t;
+
+static void test_classify (test_status_t* status) {
+#define SCOPE(s) ((uint32_t)(s) << IPV6_CLASS_SCOPE_SHIFT)
+    classify_test_data_t tests[] = {
+        { "::",                     IPV6_CLASS_UNSPECIFIED|IPV6_CLASS_BOGON },
+        { "::1",                    IPV6_CLASS_LOOPBACK|IPV6_CLASS_BOGON },
+        { "[::1]:80",               IPV6_CLASS_LOOPBACK|IPV6_CLASS_BOGON },
+        { "127.0.0.1",              IPV6_CLASS_LOOPBACK|IPV6_CLASS_BOGON },
+        { "0.1.2.3",                IPV6_CLASS_UNSPECIFIED|IPV6_CLASS_BOGON },
+        { "8.8.8.8",                0 },
+        { "2607:f8b0::1",           0 },
+        { "10.1.2.3:5555",          IPV6_CLASS_PRIVATE|IPV6_CLASS_BOGON },
+        { "172.31.255.255",         IPV6_CLASS_PRIVATE|IPV6_CLASS_BOGON },
+        { "172.32.0.0",             0 },
+        { "192.168.1.1",            IPV6_CLASS_PRIVATE|IPV6_CLASS_BOGON },
+        { "100.64.0.1",             IPV6_CLASS_SHARED|IPV6_CLASS_BOGON },
+        { "169.254.10.10",          IPV6_CLASS_LINK_LOCAL|IPV6_CLASS_BOGON },
+        { "192.0.0.9",              IPV6_CLASS_IETF_PROTOCOL },
+        { "192.0.0.8",              IPV6_CLASS_IETF_PROTOCOL|IPV6_CLASS_BOGON },
+        { "198.19.0.1",             IPV6_CLASS_BENCHMARK|IPV6_CLASS_BOGON },
+        { "203.0.113.7",            IPV6_CLASS_DOCUMENTATION|IPV6_CLASS_BOGON },
+        { "240.0.0.1",              IPV6_CLASS_RESERVED|IPV6_CLASS_BOGON },
+        { "255.255.255.255",        IPV6_CLASS_RESERVED|IPV6_CLASS_BROADCAST|IPV6_CLASS_BOGON },
+        { "224.0.0.251",            IPV6_CLASS_MULTICAST|SCOPE(IPV6_SCOPE_LINK_LOCAL) },
+        { "233.1.1.1",              IPV6_CLASS_MULTICAST|SCOPE(IPV6_SCOPE_GLOBAL) },
+        { "239.1.1.1",              IPV6_CLASS_MULTICAST|SCOPE(IPV6_SCOPE_ORGANIZATION_LOCAL) },
+        { "239.255.255.250",        IPV6_CLASS_MULTICAST|SCOPE(IPV6_SCOPE_SITE_LOCAL) },
+        { "::ffff:10.0.0.1",        IPV6_CLASS_IPV4_MAPPED|IPV6_CLASS_PRIVATE|IPV6_CLASS_BOGON },
+        { "::ffff:8.8.8.8",         IPV6_CLASS_IPV4_MAPPED },
+        { "64:ff9b::1.2.3.4",       IPV6_CLASS_NAT64 },
+        { "64:ff9b:1::1",           IPV6_CLASS_NAT64|IPV6_CLASS_BOGON },
+        { "100::1",                 IPV6_CLASS_DISCARD|IPV6_CLASS_BOGON },
+        { "2001:1::3",              IPV6_CLASS_IETF_PROTOCOL|IPV6_CLASS_BOGON },
+        { "2001:1::1",              IPV6_CLASS_IETF_PROTOCOL },
+        { "2001::1",                IPV6_CLASS_IETF_PROTOCOL|IPV6_CLASS_TEREDO },
+        { "2001:2::1",              IPV6_CLASS_IETF_PROTOCOL|IPV6_CLASS_BENCHMARK|IPV6_CLASS_BOGON },
+        { "2001:10::1",             IPV6_CLASS_IETF_PROTOCOL|IPV6_CLASS_ORCHID|IPV6_CLASS_BOGON },
+        { "2001:20::1",             IPV6_CLASS_IETF_PROTOCOL|IPV6_CLASS_ORCHID },
+        { "2001:db8::/32",          IPV6_CLASS_DOCUMENTATION|IPV6_CLASS_BOGON },
+        { "3fff:fff::1",            IPV6_CLASS_DOCUMENTATION|IPV6_CLASS_BOGON },
+        { "2002:c000:204::1",       IPV6_CLASS_6TO4 },
+        { "fd12:3456::1",           IPV6_CLASS_UNIQUE_LOCAL|IPV6_CLASS_PRIVATE|IPV6_CLASS_BOGON },
+        { "fe80::1%3",              IPV6_CLASS_LINK_LOCAL|IPV6_CLASS_BOGON },
+        { "fec0::1",                IPV6_CLASS_SITE_LOCAL|IPV6_CLASS_BOGON },
+        { "ff02::1",                IPV6_CLASS_MULTICAST|SCOPE(IPV6_SCOPE_LINK_LOCAL) },
+        { "ff05::1:3",              IPV6_CLASS_MULTICAST|SCOPE(IPV6_SCOPE_SITE_LOCAL) },
+        { "ff0e::101",              IPV6_CLASS_MULTICAST|SCOPE(IPV6_SCOPE_GLOBAL) },
+    };
+#undef SCOPE
+
+    ipv6_address_full_t addrs[LENGTHOF(tests)];
+    uint32_t batch[LENGTHOF(tests)];
+
+    for (uint32_t i = 0; i < LENGTHOF(tests); ++i) {
+        bool failed = false;
+
+        printf("ipv6_classify index: %u \"%s\"\n",
+            i,
+            tests[i].input);
+
+        if (!ipv6_from_str(tests[i].input, strlen(tests[i].input), &addrs[i])) {
+            TEST_FAILED("    ipv6_from_str failed for %s\n", tests[i].input);
+            continue;
+        }
+
+        uint32_t result = ipv6_classify(&addrs[i]);
+        if (result != tests[i].expected) {
+            TEST_FAILED("    ipv6_classify failed (%s), result: %08x, expected: %08x\n",
+                tests[i].input, result, tests[i].expected);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+
+    // The batch form must agree with the single address form
+    bool failed = false;
+    ipv6_classify_batch(addrs, batch, LENGTHOF(tests));
+    for (uint32_t i = 0; i < LENGTHOF(tests); ++i) {
+        if (batch[i] != ipv6_classify(&addrs[i])) {
+            TEST_FAILED("    ipv6_classify_batch mismatch at index %u (%s)\n", i, tests[i].input);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+}
+
+// Representation of RFC 6052 translation test data
+typedef struct {
+    const char*             prefix;
+    const char*             ipv4;
+    const char*             ipv6;
+} nat64_test_data_t;
+
+static void test_nat64 (test_status_t* status) {
+    // RFC 6052 section 2.4 examples
+    nat64_test_data_t tests[] = {
+        { "2001:db8::/32",          "192.0.2.33",           "2001:db8:c000:221::" },
+        { "2001:db8:100::/40",      "192.0.2.33",           "2001:db8:1c0:2:21::" },
+        { "2001:db8:122::/48",      "192.0.2.33",           "2001:db8:122:c000:2:2100::" },
+        { "2001:db8:122:300::/56",  "192.0.2.33",           "2001:db8:122:3c0:0:221::" },
+        { "2001:db8:122:344::/64",  "192.0.2.33",           "2001:db8:122:344:c0:2:2100:0" },
+        { "2001:db8:122:344::/96",  "192.0.2.33",           "2001:db8:122:344::192.0.2.33" },
+        { "64:ff9b::/96",           "192.0.2.33",           "64:ff9b::192.0.2.33" },
+        { "64:ff9b::/96",           "192.0.2.33:53",        "[64:ff9b::192.0.2.33]:53" },
+        { "::ffff:0:0/96",          "10.1.2.3",             "::ffff:10.1.2.3" },
+    };
+
+    char* tostr = (char*)alloca(IPV6_STRING_SIZE);
+
+    for (uint32_t i = 0; i < LENGTHOF(tests); ++i) {
+        ipv6_address_full_t prefix, ipv4, expected, synthesized, extracted;
+        bool failed = false;
+
+        printf("ipv6_nat64_synthesize index: %u \"%s\" + \"%s\"\n",
+            i,
+            tests[i].prefix,
+            tests[i].ipv4);
+
+        if (!ipv6_from_str(tests[i].prefix, strlen(tests[i].prefix), &prefix) ||
+            !ipv6_from_str(tests[i].ipv4, strlen(tests[i].ipv4), &ipv4) ||
+            !ipv6_from_str(tests[i].ipv6, strlen(tests[i].ipv6), &expected))
+        {
+            TEST_FAILED("    ipv6_from_str failed\n");
+            continue;
+        }
+
+        if (!ipv6_nat64_synthesize(&prefix, &ipv4, &synthesized)) {
+            TEST_FAILED("    ipv6_nat64_synthesize failed\n");
+        }
+        else if (ipv6_compare(&synthesized, &expected, IPV6_FLAG_IPV4_EMBED) != IPV6_COMPARE_OK ||
+                 memcmp(&synthesized.address, &expected.address, sizeof(ipv6_address_t)) != 0)
+        {
+            ipv6_to_str(&synthesized, tostr, IPV6_STRING_SIZE);
+            TEST_FAILED("    ipv6_nat64_synthesize mismatch: %s != %s\n", tostr, tests[i].ipv6);
+        }
+        else {
+            TEST_PASSED();
+        }
+
+        if (!ipv6_nat64_extract(&prefix, &expected, &extracted)) {
+            TEST_FAILED("    ipv6_nat64_extract failed\n");
+        }
+        else if (ipv6_compare(&extracted, &ipv4, 0) != IPV6_COMPARE_OK) {
+            ipv6_to_str(&extracted, tostr, IPV6_STRING_SIZE);
+            TEST_FAILED("    ipv6_nat64_extract mismatch: %s != %s\n", tostr, tests[i].ipv4);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+
+    // Negative and batch cases
+    {
+        ipv6_address_full_t prefix, column[4], copy[4];
+        bool failed = false;
+        const char* inputs[] = { "192.0.2.1", "2001:db8::1", "198.51.100.7:80", "10.0.0.1" };
+
+        ipv6_from_str("64:ff9b::/36", strlen("64:ff9b::/36"), &prefix);
+        if (ipv6_nat64_synthesize(&prefix, &prefix, &column[0])) {
+            TEST_FAILED("    ipv6_nat64_synthesize accepted a /36 prefix\n");
+        }
+        else {
+            TEST_PASSED();
+        }
+
+        ipv6_from_str("2001:db8::/32", strlen("2001:db8::/32"), &prefix);
+        ipv6_from_str("2001:db8:c000:221:ff00::", strlen("2001:db8:c000:221:ff00::"), &column[0]);
+        if (ipv6_nat64_extract(&prefix, &column[0], &column[1])) {
+            TEST_FAILED("    ipv6_nat64_extract accepted a non-zero u-octet\n");
+        }
+        else {
+            TEST_PASSED();
+        }
+
+        for (uint32_t i = 0; i < LENGTHOF(inputs); ++i) {
+            ipv6_from_str(inputs[i], strlen(inputs[i]), &column[i]);
+        }
+        memcpy(copy, column, sizeof(column));
+
+        ipv6_from_str("64:ff9b::/96", strlen("64:ff9b::/96"), &prefix);
+        if (ipv6_nat64_synthesize_batch(&prefix, column, column, LENGTHOF(column)) != 3 ||
+            ipv6_compare(&column[1], &copy[1], 0) != IPV6_COMPARE_OK)
+        {
+            TEST_FAILED("    ipv6_nat64_synthesize_batch failed\n");
+        }
+        else {
+            TEST_PASSED();
+        }
+
+        if (ipv6_nat64_extract_batch(&prefix, column, column, LENGTHOF(column)) != 3) {
+            TEST_FAILED("    ipv6_nat64_extract_batch failed\n");
+        }
+        else {
+            TEST_PASSED();
+        }
+
+        for (uint32_t i = 0; i < LENGTHOF(inputs); ++i) {
+            if (ipv6_compare(&column[i], &copy[i], 0) != IPV6_COMPARE_OK) {
+                TEST_FAILED("    batch round trip failed for %s\n", inputs[i]);
+            }
+            else {
+                TEST_PASSED();
+            }
+        }
+    }
+}
+
+// Representation of truncation test data
+typedef struct {
+    const char*             input;
+    uint32_t                ipv4_prefix;
+    uint32_t                ipv6_prefix;
+    const char*             expected;
+} truncate_test_data_t;
+
+static void test_truncate (test_status_t* status) {
+    truncate_test_data_t tests[] = {
+        { "192.168.77.12",                  24, 48,     "192.168.77.0" },
+        { "192.168.77.12:5555",             24, 48,     "192.168.77.0:5555" },
+        { "192.168.77.12",                  20, 48,     "192.168.64.0" },
+        { "192.168.77.12",                  0,  48,     "0.0.0.0" },
+        { "192.168.77.12",                  32, 48,     "192.168.77.12" },
+        { "2001:db8:1234:5678:9abc::1",     24, 48,     "2001:db8:1234::" },
+        { "2001:db8:1234:5678:9abc::1",     24, 64,     "2001:db8:1234:5678::" },
+        { "2001:db8:1234:5678:9abc::1",     24, 52,     "2001:db8:1234:5000::" },
+        { "[2001:db8:1234:5678::1]:443",    24, 48,     "[2001:db8:1234::]:443" },
+        { "2001:db8:1234:5678::1/128",      24, 128,    "2001:db8:1234:5678::1/128" },
+        { "::ffff:10.11.12.13",             24, 48,     "::ffff:10.11.12.0" },
+        { "::ffff:10.11.12.13",             16, 48,     "::ffff:10.11.0.0" },
+        { "2001:db8:aaaa:bbbb:cccc:dddd:1.2.3.4",   24, 48, "2001:db8:aaaa::" },
+        { "2001:db8:aaaa:bbbb:cccc:dddd:102:304",   24, 48, "2001:db8:aaaa::" },
+    };
+
+    const char* inputs[LENGTHOF(tests)];
+    size_t input_bytes[LENGTHOF(tests)];
+    char column[LENGTHOF(tests)][64];
+    char buffer[64];
+
+    for (uint32_t i = 0; i < LENGTHOF(tests); ++i) {
+        ipv6_address_full_t addr;
+        bool failed = false;
+
+        printf("ipv6_truncate index: %u \"%s\" /%u /%u\n",
+            i,
+            tests[i].input,
+            tests[i].ipv4_prefix,
+            tests[i].ipv6_prefix);
+
+        inputs[i] = tests[i].input;
+        input_bytes[i] = strlen(tests[i].input);
+
+        if (!ipv6_from_str(tests[i].input, strlen(tests[i].input), &addr) ||
+            !ipv6_truncate_batch(&addr, 1, tests[i].ipv4_prefix, tests[i].ipv6_prefix) ||
+            !wrapped_to_str(&addr, buffer, sizeof(buffer)))
+        {
+            TEST_FAILED("    ipv6_truncate_batch failed\n");
+        }
+        else if (strcmp(buffer, tests[i].expected) != 0) {
+            TEST_FAILED("    ipv6_truncate_batch mismatch: %s != %s\n", buffer, tests[i].expected);
+        }
+        else {
+            TEST_PASSED();
+        }
+
+        if (ipv6_truncate_str(tests[i].input, strlen(tests[i].input), buffer, sizeof(buffer),
+                tests[i].ipv4_prefix, tests[i].ipv6_prefix) != strlen(tests[i].expected) ||
+            strcmp(buffer, tests[i].expected) != 0)
+        {
+            TEST_FAILED("    ipv6_truncate_str mismatch: %s != %s\n", buffer, tests[i].expected);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+
+    // Column rewrite with the first rows prefixes, invalid rows are emptied
+    bool failed = false;
+    inputs[1] = "not-an-address";
+    input_bytes[1] = strlen(inputs[1]);
+    if (ipv6_truncate_str_batch(inputs, input_bytes, 3, &column[0][0], sizeof(column[0]), 24, 48) != 2 ||
+        strcmp(column[0], "192.168.77.0") != 0 ||
+        column[1][0] != '\0' ||
+        strcmp(column[2], "192.168.77.0") != 0)
+    {
+        TEST_FAILED("    ipv6_truncate_str_batch failed\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    if (ipv6_truncate_batch((ipv6_address_full_t*)buffer, 0, 33, 48) ||
+        ipv6_truncate_batch((ipv6_address_full_t*)buffer, 0, 24, 129))
+    {
+        TEST_FAILED("    ipv6_truncate_batch accepted an invalid prefix\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+}
+
+// Number of leading bits shared by two addresses
+static uint32_t common_prefix_bits (const ipv6_address_t* a, const ipv6_address_t* b, uint32_t max_bits) {
+    for (uint32_t bit = 0; bit < max_bits; ++bit) {
+        const uint32_t shift = 15 - (bit % 16);
+        if (((a->components[bit / 16] >> shift) & 1) != ((b->components[bit / 16] >> shift) & 1)) {
+            return bit;
+        }
+    }
+    return max_bits;
+}
+
+static void test_anon (test_status_t* status) {
+    static const uint8_t key[IPV6_ANON_KEY_SIZE] = {
+        0x21, 0x4b, 0x9a, 0x05, 0x77, 0xe1, 0x3c, 0x90, 0x5d, 0x11, 0xc8, 0x6e, 0x02, 0xfa, 0x43, 0xb7 };
+    const char* inputs[] = {
+        "2001:db8:1234:5678::1",
+        "2001:db8:1234:5678::2",
+        "2001:db8:1234:5679::1",
+        "2001:db8:ffff::1",
+        "2001:db9::1",
+        "fe80::1",
+        "[2001:db8:1234:5678::1]:443",
+        "2001:db8:1234:5678::1",
+        "10.1.2.3",
+        "10.1.2.4:80",
+        "10.200.0.1",
+        "192.168.1.1",
+        "::ffff:10.1.2.3",
+    };
+
+    ipv6_address_full_t addrs[LENGTHOF(inputs)];
+    ipv6_address_full_t single[LENGTHOF(inputs)];
+    ipv6_address_full_t batch[LENGTHOF(inputs)];
+    ipv6_address_full_t tiny[LENGTHOF(inputs)];
+    bool failed = false;
+
+    ipv6_anon_t* anon = ipv6_anon_create(key, 0);
+    ipv6_anon_t* other = ipv6_anon_create(key, 1);
+    if (!anon || !other) {
+        TEST_FAILED("    ipv6_anon_create failed\n");
+        ipv6_anon_destroy(anon);
+        ipv6_anon_destroy(other);
+        return;
+    }
+
+    for (uint32_t i = 0; i < LENGTHOF(inputs); ++i) {
+        ipv6_from_str(inputs[i], strlen(inputs[i]), &addrs[i]);
+        ipv6_anon_address(anon, &addrs[i], &single[i]);
+    }
+
+    // A fresh context with a single cache entry must produce identical output
+    ipv6_anon_batch(other, addrs, batch, LENGTHOF(inputs));
+    memcpy(tiny, addrs, sizeof(addrs));
+    ipv6_anon_batch(anon, tiny, tiny, LENGTHOF(inputs));
+
+    for (uint32_t i = 0; i < LENGTHOF(inputs); ++i) {
+        printf("ipv6_anon index: %u \"%s\"\n", i, inputs[i]);
+
+        if (memcmp(&single[i], &batch[i], sizeof(ipv6_address_full_t)) != 0 ||
+            memcmp(&single[i], &tiny[i], sizeof(ipv6_address_full_t)) != 0)
+        {
+            TEST_FAILED("    ipv6_anon results differ between contexts or batch\n");
+        }
+        else {
+            TEST_PASSED();
+        }
+
+        if (single[i].flags != addrs[i].flags || single[i].port != addrs[i].port) {
+            TEST_FAILED("    ipv6_anon modified flags or port\n");
+        }
+        else {
+            TEST_PASSED();
+        }
+
+        // Prefix preservation against every other address of the same family
+        for (uint32_t j = 0; j < LENGTHOF(inputs); ++j) {
+            const uint32_t family_i = addrs[i].flags & (IPV6_FLAG_IPV4_COMPAT|IPV6_FLAG_IPV4_EMBED);
+            const uint32_t family_j = addrs[j].flags & (IPV6_FLAG_IPV4_COMPAT|IPV6_FLAG_IPV4_EMBED);
+            const uint32_t bits = (family_i & IPV6_FLAG_IPV4_COMPAT) ? 32 : 128;
+            if (i == j || family_i != family_j) {
+                continue;
+            }
+            if (common_prefix_bits(&addrs[i].address, &addrs[j].address, bits) !=
+                common_prefix_bits(&single[i].address, &single[j].address, bits))
+            {
+                TEST_FAILED("    prefix not preserved between %s and %s\n", inputs[i], inputs[j]);
+            }
+            else {
+                TEST_PASSED();
+            }
+        }
+    }
+
+    if (memcmp(&single[0].address, &addrs[0].address, sizeof(ipv6_address_t)) == 0 ||
+        memcmp(&single[8].address, &addrs[8].address, sizeof(ipv6_address_t)) == 0)
+    {
+        TEST_FAILED("    ipv6_anon did not change the address\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    // Embedded and compatible forms of the same IPv4 address agree
+    if (single[12].address.components[6] != single[8].address.components[0] ||
+        single[12].address.components[7] != single[8].address.components[1] ||
+        single[12].address.components[5] != 0xffff)
+    {
+        TEST_FAILED("    ipv6_anon embedded IPv4 does not match compatible IPv4\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    // An IPv4 tail outside of ::ffff:0:0/96 is anonymized as IPv6, the same
+    // as the hex form of the address
+    {
+        const char* dotted = "2001:db8:aaaa:bbbb:cccc:dddd:1.2.3.4";
+        const char* hex = "2001:db8:aaaa:bbbb:cccc:dddd:102:304";
+        ipv6_address_full_t dotted_addr, hex_addr, dotted_out, hex_out;
+
+        ipv6_from_str(dotted, strlen(dotted), &dotted_addr);
+        ipv6_from_str(hex, strlen(hex), &hex_addr);
+        ipv6_anon_address(anon, &dotted_addr, &dotted_out);
+        ipv6_anon_address(anon, &hex_addr, &hex_out);
+
+        if (memcmp(&dotted_out.address, &hex_out.address, sizeof(ipv6_address_t)) != 0 ||
+            memcmp(&dotted_out.address.components[0], &dotted_addr.address.components[0], 12) == 0)
+        {
+            TEST_FAILED("    ipv6_anon %s and %s differ or keep the upper 96 bits\n", dotted, hex);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+
+    ipv6_anon_destroy(anon);
+    ipv6_anon_destroy(other);
+}
+
+static void test_bloom (test_status_t* status) {
+    enum { MEMBERS = 4096, PROBES = 65536 };
+    static ipv6_address_full_t members[MEMBERS];
+    static ipv6_address_full_t probes[PROBES];
+    static bool results[PROBES];
+    static uint64_t image[1024];
+    bool failed = false;
+
+    // Members are 2001:db8:<i>::1 hosts and 10.x.y.z addresses, probes are
+    // disjoint addresses from 2001:db8:8000::/33
+    memset(members, 0, sizeof(members));
+    memset(probes, 0, sizeof(probes));
+    for (uint32_t i = 0; i < MEMBERS; ++i) {
+        if (i & 1) {
+            members[i].address.components[0] = 0x2001;
+            members[i].address.components[1] = 0x0db8;
+            members[i].address.components[2] = (uint16_t)i;
+            members[i].address.components[7] = 1;
+        }
+        else {
+            members[i].flags = IPV6_FLAG_IPV4_COMPAT;
+            members[i].address.components[0] = 0x0a00 | (uint16_t)(i >> 8);
+            members[i].address.components[1] = (uint16_t)(i * 0x0101);
+        }
+    }
+    for (uint32_t i = 0; i < PROBES; ++i) {
+        probes[i].address.components[0] = 0x2001;
+        probes[i].address.components[1] = 0x0db8;
+        probes[i].address.components[2] = 0x8000 | (uint16_t)(i >> 4);
+        probes[i].address.components[7] = (uint16_t)(i & 0xf);
+    }
+
+    ipv6_bloom_t* bloom = ipv6_bloom_build(members, MEMBERS, 12);
+    if (!bloom) {
+        TEST_FAILED("    ipv6_bloom_build failed\n");
+        return;
+    }
+
+    // No false negatives, single and batch
+    size_t found = 0;
+    for (uint32_t i = 0; i < MEMBERS; ++i) {
+        found += ipv6_bloom_contains(bloom, &members[i]);
+    }
+    if (found != MEMBERS || ipv6_bloom_contains_batch(bloom, members, results, MEMBERS) != MEMBERS) {
+        TEST_FAILED("    ipv6_bloom false negative\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    // An IPv4 address and its mapped form share the key
+    ipv6_address_full_t mapped;
+    memset(&mapped, 0, sizeof(mapped));
+    mapped.flags = IPV6_FLAG_IPV4_EMBED;
+    mapped.address.components[5] = 0xffff;
+    mapped.address.components[6] = members[0].address.components[0];
+    mapped.address.components[7] = members[0].address.components[1];
+    if (!ipv6_bloom_contains(bloom, &mapped)) {
+        TEST_FAILED("    ipv6_bloom mapped address not found\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    // False positive rate of 12 bits per entry is about 0.55%
+    const size_t positives = ipv6_bloom_contains_batch(bloom, probes, results, PROBES);
+    printf("ipv6_bloom false positives: %u/%u\n", (uint32_t)positives, PROBES);
+    if (positives > PROBES / 100) {
+        TEST_FAILED("    ipv6_bloom false positive rate too high\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < PROBES; ++i) {
+        mismatches += results[i] != ipv6_bloom_contains(bloom, &probes[i]);
+    }
+    if (mismatches) {
+        TEST_FAILED("    ipv6_bloom batch differs from single (%u)\n", mismatches);
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    // Query the serialized image in place
+    const size_t bytes = ipv6_bloom_serialize(bloom, NULL, 0);
+    if (bytes > sizeof(image) ||
+        ipv6_bloom_serialize(bloom, image, bytes - 1) != 0 ||
+        ipv6_bloom_serialize(bloom, image, sizeof(image)) != bytes)
+    {
+        TEST_FAILED("    ipv6_bloom_serialize failed\n");
+        ipv6_bloom_destroy(bloom);
+        return;
+    }
+    TEST_PASSED();
+
+    ipv6_bloom_t* view = ipv6_bloom_view(image, bytes);
+    if (!view ||
+        ipv6_bloom_view(image, bytes - 1) != NULL ||
+        ipv6_bloom_add(view, &probes[0]) ||
+        ipv6_bloom_contains_batch(view, probes, results, PROBES) != positives ||
+        ipv6_bloom_contains_batch(view, members, results, MEMBERS) != MEMBERS)
+    {
+        TEST_FAILED("    ipv6_bloom_view differs from the filter\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    ipv6_bloom_destroy(view);
+    ipv6_bloom_destroy(bloom);
+}
+
+static void test_hh (test_status_t* status) {
+    enum { STREAM = 20000 };
+    static ipv6_address_full_t stream[STREAM];
+    static const ipv6_hh_config_t config = {
+        { 32, 48, 64 }, 3,
+        { 16, 24 }, 2,
+        64
+    };
+    // Expected heaviest prefix per level and its true count
+    static const struct {
+        bool ipv4;
+        uint32_t prefix_length;
+        const char* prefix;
+        uint64_t count;
+    } expected[] = {
+        { false, 32, "2001:db8::/32", 4000 },
+        { false, 48, "2001:db8:1::/48", 4000 },
+        { false, 64, "2001:db8:1:2::/64", 2000 },
+        { true, 16, "198.51.0.0", 3000 },
+        { true, 24, "198.51.100.0", 3000 },
+    };
+    ipv6_hh_entry_t top[4];
+    uint32_t random = 12345;
+    bool failed = false;
+
+    // 20% from 2001:db8:1::/48 (half of it from one /64), 15% from
+    // 198.51.100.0/24 as mapped and plain IPv4, the rest spread wide
+    memset(stream, 0, sizeof(stream));
+    for (uint32_t i = 0; i < STREAM; ++i) {
+        uint16_t* c = stream[i].address.components;
+        random = random * 1103515245u + 12345u;
+        if (i % 20 < 4) {
+            c[0] = 0x2001; c[1] = 0x0db8; c[2] = 1;
+            c[3] = (i % 20 < 2) ? 2 : (uint16_t)(random >> 16);
+            c[7] = (uint16_t)i;
+        }
+        else if (i % 20 < 7) {
+            const uint32_t index = (i & 1) ? 0 : IPV4_EMBED_INDEX;
+            stream[i].flags = (i & 1) ? IPV6_FLAG_IPV4_COMPAT : IPV6_FLAG_IPV4_EMBED;
+            c[5] = (i & 1) ? 0 : 0xffff;
+            c[index] = 0xc633;
+            c[index + 1] = (uint16_t)(0x6400 | (random >> 24));
+        }
+        else if (i % 20 < 12) {
+            stream[i].flags = IPV6_FLAG_IPV4_COMPAT;
+            c[0] = (uint16_t)(random >> 16);
+            c[1] = (uint16_t)random;
+        }
+        else {
+            c[0] = (uint16_t)(0x2400 + (random >> 22));
+            c[1] = (uint16_t)(random >> 6);
+            c[3] = (uint16_t)i;
+        }
+    }
+
+    ipv6_hh_t* hh = ipv6_hh_create(&config);
+    ipv6_hh_t* first = ipv6_hh_create(&config);
+    ipv6_hh_t* second = ipv6_hh_create(&config);
+    ipv6_hh_t* other = ipv6_hh_create(NULL);
+    if (!hh || !first || !second || !other) {
+        TEST_FAILED("    ipv6_hh_create failed\n");
+        ipv6_hh_destroy(hh);
+        ipv6_hh_destroy(first);
+        ipv6_hh_destroy(second);
+        ipv6_hh_destroy(other);
+        return;
+    }
+
+    // One sketch over the whole stream, and two halves that are merged
+    for (uint32_t i = 0; i < STREAM; ++i) {
+        ipv6_hh_add(hh, &stream[i], 1);
+    }
+    ipv6_hh_add_batch(first, stream, NULL, STREAM / 2);
+    ipv6_hh_add_batch(second, stream + STREAM / 2, NULL, STREAM / 2);
+
+    if (!ipv6_hh_merge(first, second) || ipv6_hh_merge(first, other)) {
+        TEST_FAILED("    ipv6_hh_merge configuration check failed\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    for (uint32_t i = 0; i < LENGTHOF(expected); ++i) {
+        const ipv6_hh_t* sketches[] = { hh, first };
+
+        for (uint32_t j = 0; j < LENGTHOF(sketches); ++j) {
+            char str[64];
+            uint64_t total = 0;
+            const size_t count = ipv6_hh_top(sketches[j], expected[i].ipv4, expected[i].prefix_length,
+                top, LENGTHOF(top), &total);
+
+            ipv6_to_str(&top[0].prefix, str, sizeof(str));
+            printf("ipv6_hh %s /%u: %s %u (error %u)\n", j ? "merged" : "single",
+                expected[i].prefix_length, str, (uint32_t)top[0].count, (uint32_t)top[0].error);
+
+            if (count != LENGTHOF(top) ||
+                strcmp(str, expected[i].prefix) != 0 ||
+                top[0].count < expected[i].count ||
+                top[0].count - top[0].error > expected[i].count ||
+                top[1].count > top[0].count ||
+                total != (expected[i].ipv4 ? 8000u : 12000u))
+            {
+                TEST_FAILED("    ipv6_hh top prefix mismatch, expected %s %u\n",
+                    expected[i].prefix, (uint32_t)expected[i].count);
+            }
+            else {
+                TEST_PASSED();
+            }
+        }
+    }
+
+    if (ipv6_hh_top(hh, false, 56, top, LENGTHOF(top), NULL) != 0) {
+        TEST_FAILED("    ipv6_hh_top reported an untracked level\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    ipv6_hh_reset(hh);
+    if (ipv6_hh_top(hh, false, 48, top, LENGTHOF(top), NULL) != 0) {
+        TEST_FAILED("    ipv6_hh_reset left counters\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    // An IPv4 tail outside of ::ffff:0:0/96 is counted as IPv6, the hex and
+    // dotted forms of a mapped address share a key
+    {
+        const char* inputs[] = { "2001:db8:1::1.2.3.4", "::ffff:1.2.3.4", "::ffff:102:304" };
+        ipv6_address_full_t tails[LENGTHOF(inputs)];
+        char ipv6_str[64] = "", ipv4_str[64] = "";
+        uint64_t ipv6_total = 0, ipv4_total = 0;
+
+        for (uint32_t i = 0; i < LENGTHOF(inputs); ++i) {
+            ipv6_from_str(inputs[i], strlen(inputs[i]), &tails[i]);
+        }
+        ipv6_hh_add_batch(hh, tails, NULL, LENGTHOF(tails));
+
+        const size_t ipv6_count = ipv6_hh_top(hh, false, 48, top, LENGTHOF(top), &ipv6_total);
+        ipv6_to_str(&top[0].prefix, ipv6_str, sizeof(ipv6_str));
+        const uint64_t ipv6_top = top[0].count;
+        const size_t ipv4_count = ipv6_hh_top(hh, true, 24, top, LENGTHOF(top), &ipv4_total);
+        ipv6_to_str(&top[0].prefix, ipv4_str, sizeof(ipv4_str));
+
+        if (ipv6_count != 1 || ipv6_total != 1 || ipv6_top != 1 || strcmp(ipv6_str, "2001:db8:1::/48") != 0 ||
+            ipv4_count != 1 || ipv4_total != 2 || top[0].count != 2 || strcmp(ipv4_str, "1.2.3.0") != 0)
+        {
+            TEST_FAILED("    ipv6_hh IPv4 tails counted as %s and %s\n", ipv6_str, ipv4_str);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+
+    ipv6_hh_destroy(hh);
+    ipv6_hh_destroy(first);
+    ipv6_hh_destroy(second);
+    ipv6_hh_destroy(other);
+}
+
+typedef struct {
+    ipv6_agg_bucket_t buckets[4];
+    uint32_t count;
+} agg_test_result_t;
+
+static void test_agg_flush_fn (
+    const ipv6_agg_bucket_t* bucket,
+    void* user_data)
+{
+    agg_test_result_t* result = (agg_test_result_t*)user_data;
+    if (result->count < LENGTHOF(result->buckets)) {
+        result->buckets[result->count] = *bucket;
+    }
+    result->count++;
+}
+
+static void test_agg (test_status_t* status) {
+    enum { RECORDS = 12000 };
+    static ipv6_address_full_t records[RECORDS];
+    static uint64_t bytes[RECORDS];
+    // Expected buckets in order of first use
+    static const struct {
+        const char* prefix;
+        uint64_t records;
+        uint64_t bytes;
+        uint64_t clients;
+    } expected[] = {
+        { "2001:db8:1::/48", 6000, 6000 * 100, 3000 },
+        { "2001:db8:2::/48", 3000, 3000 * 1500, 50 },
+        { "198.51.100.0", 3000, 3000 * 40, 256 },
+    };
+    agg_test_result_t single, merged, empty;
+    bool failed = false;
+
+    // Every client appears twice, IPv4 clients as both plain and mapped
+    memset(records, 0, sizeof(records));
+    for (uint32_t i = 0; i < RECORDS; ++i) {
+        uint16_t* c = records[i].address.components;
+        const uint32_t row = i % 4;
+        const uint32_t n = i / 4;
+
+        if (row < 2) {
+            c[0] = 0x2001; c[1] = 0x0db8; c[2] = 1;
+            c[3] = (uint16_t)(n % 1500);
+            c[7] = (uint16_t)row;
+            bytes[i] = 100;
+        }
+        else if (row == 2) {
+            c[0] = 0x2001; c[1] = 0x0db8; c[2] = 2;
+            c[7] = (uint16_t)(n % 50);
+            bytes[i] = 1500;
+        }
+        else if (n & 1) {
+            records[i].flags = IPV6_FLAG_IPV4_COMPAT;
+            c[0] = 0xc633;
+            c[1] = (uint16_t)(0x6400 | (n / 2 % 256));
+            bytes[i] = 40;
+        }
+        else {
+            records[i].flags = IPV6_FLAG_IPV4_EMBED;
+            c[5] = 0xffff;
+            c[6] = 0xc633;
+            c[7] = (uint16_t)(0x6400 | (n / 2 % 256));
+            bytes[i] = 40;
+        }
+    }
+
+    ipv6_agg_t* agg = ipv6_agg_create(48, 24, 16, 12);
+    ipv6_agg_t* first = ipv6_agg_create(48, 24, 16, 12);
+    ipv6_agg_t* second = ipv6_agg_create(48, 24, 16, 12);
+    ipv6_agg_t* small = ipv6_agg_create(48, 24, 2, 12);
+    if (!agg || !first || !second || !small) {
+        TEST_FAILED("    ipv6_agg_create failed\n");
+        ipv6_agg_destroy(agg);
+        ipv6_agg_destroy(first);
+        ipv6_agg_destroy(second);
+        ipv6_agg_destroy(small);
+        return;
+    }
+
+    for (uint32_t i = 0; i < RECORDS; ++i) {
+        ipv6_agg_add(agg, &records[i], bytes[i]);
+    }
+    ipv6_agg_add_batch(first, records, bytes, RECORDS / 2);
+    ipv6_agg_add_batch(second, records + RECORDS / 2, bytes + RECORDS / 2, RECORDS / 2);
+
+    // The third prefix does not fit into two buckets
+    if (!ipv6_agg_merge(first, second) ||
+        ipv6_agg_merge(small, first) ||
+        ipv6_agg_add_batch(small, records, NULL, 4) != 3)
+    {
+        TEST_FAILED("    ipv6_agg_merge or bucket limit failed\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    memset(&single, 0, sizeof(single));
+    memset(&merged, 0, sizeof(merged));
+    memset(&empty, 0, sizeof(empty));
+    ipv6_agg_flush(agg, test_agg_flush_fn, &single);
+    ipv6_agg_flush(first, test_agg_flush_fn, &merged);
+    ipv6_agg_flush(agg, test_agg_flush_fn, &empty);
+
+    if (single.count != LENGTHOF(expected) || merged.count != LENGTHOF(expected) || empty.count != 0) {
+        TEST_FAILED("    ipv6_agg_flush bucket count %u %u %u\n", single.count, merged.count, empty.count);
+        ipv6_agg_destroy(agg);
+        ipv6_agg_destroy(first);
+        ipv6_agg_destroy(second);
+        ipv6_agg_destroy(small);
+        return;
+    }
+
+    for (uint32_t i = 0; i < LENGTHOF(expected); ++i) {
+        const ipv6_agg_bucket_t* bucket = &single.buckets[i];
+        const uint64_t tolerance = expected[i].clients / 20 + 1;
+        char str[64];
+
+        ipv6_to_str(&bucket->prefix, str, sizeof(str));
+        printf("ipv6_agg %s records %u bytes %u clients %u\n", str,
+            (uint32_t)bucket->records, (uint32_t)bucket->bytes, (uint32_t)bucket->clients);
+
+        if (strcmp(str, expected[i].prefix) != 0 ||
+            bucket->records != expected[i].records ||
+            bucket->bytes != expected[i].bytes ||
+            bucket->clients + tolerance < expected[i].clients ||
+            bucket->clients > expected[i].clients + tolerance)
+        {
+            TEST_FAILED("    ipv6_agg bucket mismatch, expected %s\n", expected[i].prefix);
+        }
+        else {
+            TEST_PASSED();
+        }
+
+        // Merged shards agree exactly with the single aggregator
+        if (memcmp(bucket, &merged.buckets[i], sizeof(ipv6_agg_bucket_t)) != 0) {
+            TEST_FAILED("    ipv6_agg merged bucket differs for %s\n", expected[i].prefix);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+
+    // An IPv4 tail outside of ::ffff:0:0/96 is part of an IPv6 address, the
+    // hex and dotted forms of a mapped address share a bucket
+    {
+        const char* inputs[] = { "2001:db8:1::1.2.3.4", "64:ff9b::1.2.3.4", "::ffff:1.2.3.4", "::ffff:102:304" };
+        const char* prefixes[] = { "2001:db8:1::/48", "64:ff9b::/48", "1.2.3.0" };
+        const uint64_t counts[] = { 1, 1, 2 };
+        ipv6_address_full_t tails[LENGTHOF(inputs)];
+        char str[64];
+
+        for (uint32_t i = 0; i < LENGTHOF(inputs); ++i) {
+            ipv6_from_str(inputs[i], strlen(inputs[i]), &tails[i]);
+        }
+        memset(&single, 0, sizeof(single));
+        ipv6_agg_add_batch(agg, tails, NULL, LENGTHOF(tails));
+        ipv6_agg_flush(agg, test_agg_flush_fn, &single);
+
+        for (uint32_t i = 0; i < LENGTHOF(prefixes); ++i) {
+            str[0] = '\0';
+            if (i < single.count) {
+                ipv6_to_str(&single.buckets[i].prefix, str, sizeof(str));
+            }
+            if (single.count != LENGTHOF(prefixes) ||
+                strcmp(str, prefixes[i]) != 0 ||
+                single.buckets[i].records != counts[i])
+            {
+                TEST_FAILED("    ipv6_agg IPv4 tail bucket \"%s\", expected %s\n", str, prefixes[i]);
+            }
+            else {
+                TEST_PASSED();
+            }
+        }
+    }
+
+    ipv6_agg_destroy(agg);
+    ipv6_agg_destroy(first);
+    ipv6_agg_destroy(second);
+    ipv6_agg_destroy(small);
+}
+
+typedef struct {
+    const char* first;      // CIDR when last is NULL
+    const char* last;
+    uint64_t stride;
+    uint32_t expected_count;
+    const char* expected_first;
+    const char* expected_last;
+} iter_test_data_t;
+
+static void test_iter (test_status_t* status) {
+    static const iter_test_data_t tests[] = {
+        { "10.0.0.5/30", NULL, 1, 4, "10.0.0.4", "10.0.0.7" },
+        { "10.0.0.0/8", NULL, 1 << 20, 16, "10.0.0.0", "10.240.0.0" },
+        { "2001:db8::/126", NULL, 1, 4, "2001:db8::", "2001:db8::3" },
+        { "2001:db8::1", NULL, 1, 1, "2001:db8::1", "2001:db8::1" },
+        { "::ffff:10.0.0.0/126", NULL, 2, 2, "::ffff:10.0.0.0", "::ffff:10.0.0.2" },
+        { "2001:db8::fffe", "2001:db8::1:1", 1, 4, "2001:db8::fffe", "2001:db8::1:1" },
+        { "::ffff:ffff:ffff:fffe", "0:0:0:1::1", 1, 4, "::ffff:ffff:ffff:fffe", "::1:0:0:0:1" },
+        { "2001:db8::/112", NULL, 7, 9363, "2001:db8::", "2001:db8::fffe" },
+        { "10.0.0.9", "10.0.0.1", 1, 0, NULL, NULL },
+        { "10.0.0.1", "::1", 1, 0, NULL, NULL },
+    };
+    static ipv6_address_full_t stepped[9400];
+    static ipv6_address_full_t filled[9400];
+    char first_str[64], last_str[64];
+    bool failed = false;
+
+    for (uint32_t i = 0; i < LENGTHOF(tests); ++i) {
+        ipv6_address_full_t first, last;
+        ipv6_iter_t iter, copy;
+        uint32_t count = 0;
+        uint32_t fill_count = 0;
+        bool valid;
+
+        printf("ipv6_iter index: %u \"%s\" \"%s\"\n", i, tests[i].first, tests[i].last ? tests[i].last : "");
+
+        ipv6_from_str(tests[i].first, strlen(tests[i].first), &first);
+        if (tests[i].last) {
+            ipv6_from_str(tests[i].last, strlen(tests[i].last), &last);
+            valid = ipv6_iter_init_range(&iter, &first, &last, tests[i].stride, 0);
+        }
+        else {
+            valid = ipv6_iter_init_cidr(&iter, &first, tests[i].stride, 0);
+        }
+
+        if (valid != (tests[i].expected_count != 0)) {
+            TEST_FAILED("    ipv6_iter_init returned %u\n", valid);
+            continue;
+        }
+        TEST_PASSED();
+        if (!valid) {
+            continue;
+        }
+
+        // Step one at a time, and fill from a copy in uneven chunks
+        copy = iter;
+        while (count < LENGTHOF(stepped) && ipv6_iter_next(&iter, &stepped[count])) {
+            count++;
+        }
+        for (uint32_t chunk = 1; fill_count < LENGTHOF(filled); chunk = chunk % 19 + 1) {
+            const uint32_t room = LENGTHOF(filled) - fill_count;
+            const size_t n = ipv6_iter_fill(&copy, &filled[fill_count], chunk < room ? chunk : room);
+            fill_count += (uint32_t)n;
+            if (n < chunk) {
+                break;
+            }
+        }
+
+        ipv6_to_str(&stepped[0], first_str, sizeof(first_str));
+        ipv6_to_str(&stepped[count - 1], last_str, sizeof(last_str));
+        if (count != tests[i].expected_count ||
+            strcmp(first_str, tests[i].expected_first) != 0 ||
+            strcmp(last_str, tests[i].expected_last) != 0)
+        {
+            TEST_FAILED("    ipv6_iter %u addresses %s - %s, expected %u %s - %s\n",
+                count, first_str, last_str,
+                tests[i].expected_count, tests[i].expected_first, tests[i].expected_last);
+        }
+        else {
+            TEST_PASSED();
+        }
+
+        if (fill_count != count || memcmp(stepped, filled, count * sizeof(ipv6_address_full_t)) != 0) {
+            TEST_FAILED("    ipv6_iter_fill differs from ipv6_iter_next\n");
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+
+    // Sampling visits one address in each block of stride addresses
+    {
+        ipv6_address_full_t cidr;
+        ipv6_iter_t iter;
+        uint32_t count = 0;
+        uint32_t in_block = 0;
+
+        ipv6_from_str("2001:db8::/120", strlen("2001:db8::/120"), &cidr);
+        ipv6_iter_init_cidr(&iter, &cidr, 16, 0x5eed);
+        while (count < 32 && ipv6_iter_next(&iter, &stepped[count])) {
+            in_block += (stepped[count].address.components[7] >> 4) == count;
+            count++;
+        }
+
+        if (count != 16 || in_block != 16 || ipv6_iter_fill(&iter, filled, 4) != 0) {
+            TEST_FAILED("    ipv6_iter sampling visited %u addresses, %u in block\n", count, in_block);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+}
+
+typedef struct {
+    const char* input;
+    uint32_t options;
+    const char* expected;
+} format_test_data_t;
+
+static void test_format (test_status_t* status) {
+    static const format_test_data_t tests[] = {
+        { "2001:db8::1", IPV6_FORMAT_DEFAULT, "2001:db8::1" },
+        { "2001:db8::1", IPV6_FORMAT_EXPANDED, "2001:0db8:0000:0000:0000:0000:0000:0001" },
+        { "2001:DB8::ABCD", IPV6_FORMAT_UPPERCASE, "2001:DB8::ABCD" },
+        { "2001:db8::abcd", IPV6_FORMAT_EXPANDED|IPV6_FORMAT_UPPERCASE, "2001:0DB8:0000:0000:0000:0000:0000:ABCD" },
+        { "fedc:ba98:7654:3210:fedc:ba98:7654:3210", IPV6_FORMAT_EXPANDED, "fedc:ba98:7654:3210:fedc:ba98:7654:3210" },
+        { "::", IPV6_FORMAT_EXPANDED, "0000:0000:0000:0000:0000:0000:0000:0000" },
+        { "[::1]:8080", IPV6_FORMAT_DEFAULT, "[::1]:8080" },
+        { "[::1]:8080", IPV6_FORMAT_NO_BRACKETS, "::1" },
+        { "[::1]:8080", IPV6_FORMAT_EXPANDED, "[0000:0000:0000:0000:0000:0000:0000:0001]:8080" },
+        { "10.0.0.1", IPV6_FORMAT_EXPANDED, "0000:0000:0000:0000:0000:ffff:0a00:0001" },
+        { "10.0.0.1:80", IPV6_FORMAT_NO_BRACKETS, "10.0.0.1" },
+        { "::ffff:10.0.0.1", IPV6_FORMAT_EXPANDED|IPV6_FORMAT_UPPERCASE, "0000:0000:0000:0000:0000:FFFF:0A00:0001" },
+        { "fe80::1%3", IPV6_FORMAT_DEFAULT, "fe80::1" },
+        { "fe80::1%3", IPV6_FORMAT_ZONE, "fe80::1%3" },
+        { "fe80::1/64%3", IPV6_FORMAT_ZONE, "fe80::1/64%3" },
+        { "[fe80::1%eeee]:80", IPV6_FORMAT_ZONE|IPV6_FORMAT_EXPANDED,
+          "[fe80:0000:0000:0000:0000:0000:0000:0001%eeee]:80" },
+        { "2001:db8::/32", IPV6_FORMAT_EXPANDED, "2001:0db8:0000:0000:0000:0000:0000:0000/32" },
+    };
+    enum { STRIDE = 48 };
+    ipv6_address_full_t addrs[LENGTHOF(tests)];
+    char column[LENGTHOF(tests)][STRIDE];
+    char buffer[64];
+    bool failed = false;
+
+    for (uint32_t i = 0; i < LENGTHOF(tests); ++i) {
+        printf("ipv6_to_str_format index: %u \"%s\" %x\n", i, tests[i].input, tests[i].options);
+
+        if (!ipv6_from_str(tests[i].input, strlen(tests[i].input), &addrs[i])) {
+            TEST_FAILED("    ipv6_from_str failed\n");
+            continue;
+        }
+
+        const size_t length = ipv6_to_str_format(&addrs[i], buffer, sizeof(buffer), tests[i].options);
+        if (length != strlen(tests[i].expected) || strcmp(buffer, tests[i].expected) != 0) {
+            TEST_FAILED("    got \"%s\" expected \"%s\"\n", buffer, tests[i].expected);
+        }
+        else {
+            TEST_PASSED();
+        }
+
+        // One byte short of the expanded form is truncated
+        if ((tests[i].options & IPV6_FORMAT_EXPANDED) &&
+            ipv6_to_str_format(&addrs[i], buffer, IPV6_EXPANDED_LENGTH, tests[i].options) != 0)
+        {
+            TEST_FAILED("    expanded output was not truncated\n");
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+
+    // An undecorated expanded address fits exactly IPV6_EXPANDED_LENGTH + 1
+    // bytes, both alone and as a batch row
+    {
+        char exact[2][IPV6_EXPANDED_LENGTH + 1];
+
+        if (ipv6_to_str_format(&addrs[0], exact[0], sizeof(exact[0]), IPV6_FORMAT_EXPANDED) != IPV6_EXPANDED_LENGTH ||
+            ipv6_to_str_batch(&addrs[0], 1, exact[1], sizeof(exact[1]), IPV6_FORMAT_EXPANDED) != 1 ||
+            strcmp(exact[0], "2001:0db8:0000:0000:0000:0000:0000:0001") != 0 ||
+            strcmp(exact[0], exact[1]) != 0)
+        {
+            TEST_FAILED("    expanded output of exactly %u bytes was rejected\n", IPV6_EXPANDED_LENGTH + 1);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+
+    // Fixed width column output, padded with nul bytes
+    memset(column, 'x', sizeof(column));
+    if (ipv6_to_str_batch(addrs, LENGTHOF(tests), &column[0][0], STRIDE, IPV6_FORMAT_EXPANDED) != LENGTHOF(tests)) {
+        TEST_FAILED("    ipv6_to_str_batch did not write every row\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    for (uint32_t i = 0; i < LENGTHOF(tests); ++i) {
+        ipv6_to_str_format(&addrs[i], buffer, sizeof(buffer), IPV6_FORMAT_EXPANDED);
+        if (strcmp(column[i], buffer) != 0 || column[i][STRIDE - 1] != '\0') {
+            TEST_FAILED("    ipv6_to_str_batch row %u \"%.*s\"\n", i, STRIDE, column[i]);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+}
+
+static void test_trace (test_status_t* status) {
+    const char* inputs[] = {
+        "::1",
+        "10.0.0.1",
+        "2001:db8::1/64",
+        "[::1]:80",
+        "fe80::1%3",
+        "1::2::3",
+    };
+    ipv6_trace_entry_t entries[8];
+    ipv6_address_full_t addr;
+    bool failed = false;
+
+    ipv6_trace_t* trace = ipv6_trace_create(4);
+    if (!trace) {
+        TEST_FAILED("    ipv6_trace_create failed\n");
+        return;
+    }
+
+    if (ipv6_trace_read(trace, entries, LENGTHOF(entries)) != 0) {
+        TEST_FAILED("    ipv6_trace_read of an empty trace\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    ipv6_trace_attach(trace);
+    for (uint32_t i = 0; i < LENGTHOF(inputs); ++i) {
+        ipv6_from_str(inputs[i], strlen(inputs[i]), &addr);
+    }
+    ipv6_trace_attach(NULL);
+    ipv6_from_str("::2", 3, &addr);
+
+    // Only the last 4 parses are kept, oldest first
+    const size_t count = ipv6_trace_read(trace, entries, LENGTHOF(entries));
+    if (count != 4) {
+        TEST_FAILED("    ipv6_trace_read returned %u entries\n", (uint32_t)count);
+        ipv6_trace_destroy(trace);
+        return;
+    }
+    TEST_PASSED();
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const ipv6_trace_entry_t* entry = &entries[i];
+        const char* input = inputs[i + 2];
+        const bool valid = i + 2 < LENGTHOF(inputs) - 1;
+        uint32_t errors = 0;
+
+        printf("ipv6_trace %u: \"%s\" result %u\n", (uint32_t)entry->sequence, entry->input, entry->result);
+        for (uint32_t j = 0; j < entry->num_events; ++j) {
+            const ipv6_trace_event_t* event = &entry->events[j];
+            printf("    %u %s %u @%d\n", event->kind, ipv6_trace_state_str(event->state),
+                event->value, event->position);
+            errors += event->kind == IPV6_TRACE_ERROR;
+        }
+
+        if (entry->sequence != i + 2 ||
+            strcmp(entry->input, input) != 0 ||
+            entry->result != (uint32_t)valid ||
+            entry->num_events == 0 ||
+            errors != (valid ? 0u : 1u))
+        {
+            TEST_FAILED("    ipv6_trace entry mismatch for \"%s\"\n", input);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+
+    // The last event of the failed parse names the diagnostic
+    const ipv6_trace_entry_t* last = &entries[count - 1];
+    if (last->events[last->num_events - 1].kind != IPV6_TRACE_STATE ||
+        last->events[last->num_events - 2].kind != IPV6_TRACE_ERROR ||
+        last->events[last->num_events - 2].value != IPV6_DIAG_INVALID_ABBREV)
+    {
+        TEST_FAILED("    ipv6_trace failed parse did not record the error\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    ipv6_trace_destroy(trace);
+}
+
+//--------------------------------------------------------------------------------
+static void test_stats (test_status_t* status) {
+    const char* inputs[] = {
+        "::1",
+        "10.0.0.1",
+        "::ffff:1.2.3.4",
+        "[2001:db8::1]:80",
+        "1::2::3",
+    };
+    ipv6_stats_t first, second, total;
+    const ipv6_stats_t* blocks[] = { &first, NULL, &second };
+    ipv6_address_full_t addr;
+    bool failed = false;
+
+    memset(&first, 0, sizeof(first));
+    memset(&second, 0, sizeof(second));
+
+    ipv6_stats_attach(&first);
+    for (uint32_t i = 0; i < LENGTHOF(inputs); ++i) {
+        ipv6_from_str(inputs[i], strlen(inputs[i]), &addr);
+    }
+    ipv6_stats_attach(&second);
+    ipv6_from_str("::2", 3, &addr);
+    ipv6_stats_attach(NULL);
+    ipv6_from_str("::3", 3, &addr);
+
+    if (first.parses != 5 || first.successes != 4 ||
+        first.ipv6 != 2 || first.ipv4_compat != 1 || first.ipv4_embed != 1 ||
+        first.failures[IPV6_DIAG_INVALID_ABBREV] != 1)
+    {
+        TEST_FAILED("    ipv6_stats counters mismatch\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    // Successful parses consume their whole input
+    if (second.parses != 1 || second.successes != 1 || second.bytes != 3) {
+        TEST_FAILED("    ipv6_stats bytes %u for \"::2\"\n", (uint32_t)second.bytes);
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    ipv6_stats_snapshot(blocks, LENGTHOF(blocks), &total);
+    uint64_t failures = 0;
+    for (uint32_t i = 0; i < IPV6_DIAG_EVENT_COUNT; ++i) {
+        failures += total.failures[i];
+    }
+
+    if (total.parses != 6 || total.successes != 5 || total.ipv6 != 3 ||
+        failures != 1 || total.bytes != first.bytes + 3)
+    {
+        TEST_FAILED("    ipv6_stats_snapshot totals mismatch\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+}
+
+//--------------------------------------------------------------------------------
+static void test_packed (test_status_t* status) {
+    const char* inputs[] = {
+        "::1",
+        "2001:db8::1/48",
+        "[2001:db8::1]:443",
+        "fe80::1%3",
+        "[fe80::2/64%3]:80",
+        "fe80::3%a",
+        "10.1.2.3:80",
+        "10.0.0.0/8",
+        "::ffff:1.2.3.4",
+    };
+    ipv6_packed_t packed[LENGTHOF(inputs)];
+    ipv6_address_full_t addr, unpacked;
+    char expected[64], actual[64];
+    bool failed = false;
+
+    if (sizeof(ipv6_packed_t) != 20) {
+        TEST_FAILED("    sizeof(ipv6_packed_t) is %u\n", (uint32_t)sizeof(ipv6_packed_t));
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    ipv6_zone_table_t* zones = ipv6_zone_table_create();
+    if (!zones) {
+        TEST_FAILED("    ipv6_zone_table_create failed\n");
+        return;
+    }
+
+    for (uint32_t i = 0; i < LENGTHOF(inputs); ++i) {
+        const char* input = inputs[i];
+
+        if (!ipv6_from_str(input, strlen(input), &addr) ||
+            !ipv6_from_str_packed(input, strlen(input), &packed[i], zones) ||
+            !ipv6_unpack(&packed[i], &unpacked, zones))
+        {
+            TEST_FAILED("    ipv6_from_str_packed failed for \"%s\"\n", input);
+            continue;
+        }
+
+        ipv6_to_str_format(&addr, expected, sizeof(expected), IPV6_FORMAT_ZONE);
+        ipv6_to_str_packed(&packed[i], zones, actual, sizeof(actual), IPV6_FORMAT_ZONE);
+
+        // Lossless except for where the zone name is stored
+        if (ipv6_compare(&addr, &unpacked, 0) != IPV6_COMPARE_OK ||
+            addr.flags != unpacked.flags ||
+            addr.iface_len != unpacked.iface_len ||
+            (addr.iface_len && memcmp(addr.iface, unpacked.iface, addr.iface_len) != 0) ||
+            strcmp(expected, actual) != 0)
+        {
+            TEST_FAILED("    ipv6_packed round trip \"%s\" formatted as \"%s\"\n", expected, actual);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+
+    // "3" is interned once
+    if (ipv6_zone_intern(zones, "3", 1) != 1 || ipv6_zone_intern(zones, "a", 1) != 2) {
+        TEST_FAILED("    ipv6_zone_intern did not reuse zone ids\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    // Zones need a table, full tables and unknown ids fail
+    ipv6_from_str("fe80::1%3", 9, &addr);
+    for (uint32_t i = 0; i < IPV6_ZONE_TABLE_SIZE; ++i) {
+        char name[8];
+        sprintf(name, "f%u", i);
+        ipv6_zone_intern(zones, name, strlen(name));
+    }
+    if (ipv6_pack(&addr, &packed[0], NULL) ||
+        ipv6_from_str_packed("fe80::1%ffff", 12, &packed[0], zones) ||
+        !ipv6_pack(&addr, &packed[0], zones) ||
+        ipv6_unpack(&packed[0], &unpacked, NULL))
+    {
+        TEST_FAILED("    ipv6_pack accepted a zone it could not store\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    ipv6_zone_table_destroy(zones);
+}
+
+//--------------------------------------------------------------------------------
+static void test_column (test_status_t* status) {
+    const char* inputs[] = {
+        "2001:db8::1",
+        "2001:db8:1::1",
+        "[2001:db8::1]:80",
+        "2001:db9::1",
+        "10.1.2.3",
+        "::ffff:10.9.9.9",
+        "192.168.1.1:443",
+        "fe80::1",
+    };
+    // Rows selected by each filter within every repetition of the inputs
+    const uint32_t in_db8 = 0x07;       // 2001:db8::/32
+    const uint32_t in_ten = 0x30;       // 10.0.0.0/8
+    const uint32_t is_host = 0x05;      // 2001:db8::1
+    const uint32_t in_set = 0xf7;       // 2001:db8::/32, 10.0.0.0/8, 192.168.0.0/16, fe80::/10
+    const uint32_t repeat = 20;         // 160 rows, crossing bitmap words
+    ipv6_address_full_t addrs[LENGTHOF(inputs)];
+    ipv6_address_full_t filters[4], row;
+    uint64_t bitmap[IPV6_COLUMN_BITMAP_WORDS(LENGTHOF(inputs) * 20)];
+    bool failed = false;
+
+    ipv6_column_t* column = ipv6_column_create(0);
+    if (!column) {
+        TEST_FAILED("    ipv6_column_create failed\n");
+        return;
+    }
+
+    for (uint32_t i = 0; i < LENGTHOF(inputs); ++i) {
+        ipv6_from_str(inputs[i], strlen(inputs[i]), &addrs[i]);
+    }
+    for (uint32_t r = 0; r < repeat; ++r) {
+        ipv6_column_append(column, addrs, LENGTHOF(addrs));
+    }
+
+    if (ipv6_column_size(column) != LENGTHOF(inputs) * repeat) {
+        TEST_FAILED("    ipv6_column_size is %u\n", (uint32_t)ipv6_column_size(column));
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    // Rows read back in their original form
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < LENGTHOF(inputs) * repeat; ++i) {
+        const ipv6_address_full_t* expected = &addrs[i % LENGTHOF(inputs)];
+        if (!ipv6_column_get(column, i, &row) ||
+            ipv6_compare(&row, expected, 0) != IPV6_COMPARE_OK ||
+            row.flags != expected->flags)
+        {
+            mismatches++;
+        }
+    }
+    if (mismatches || ipv6_column_get(column, LENGTHOF(inputs) * repeat, &row)) {
+        TEST_FAILED("    ipv6_column_get returned %u different rows\n", mismatches);
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    ipv6_from_str("2001:db8::/32", 13, &filters[0]);
+    ipv6_from_str("10.0.0.0/8", 10, &filters[1]);
+    ipv6_from_str("192.168.0.0/16", 14, &filters[2]);
+    ipv6_from_str("fe80::/10", 9, &filters[3]);
+
+    for (uint32_t scan = 0; scan < 4; ++scan) {
+        size_t selected = 0;
+        uint32_t expected = 0;
+
+        switch (scan) {
+            case 0:
+                selected = ipv6_column_scan_prefix(column, &filters[0], bitmap);
+                expected = in_db8;
+                break;
+            case 1:
+                selected = ipv6_column_scan_prefix(column, &filters[1], bitmap);
+                expected = in_ten;
+                break;
+            case 2:
+                selected = ipv6_column_scan_equal(column, &addrs[0], bitmap);
+                expected = is_host;
+                break;
+            default:
+                selected = ipv6_column_scan_prefixes(column, filters, 4, bitmap);
+                expected = in_set;
+                break;
+        }
+
+        mismatches = 0;
+        size_t wanted = 0;
+        for (uint32_t i = 0; i < LENGTHOF(inputs) * repeat; ++i) {
+            const bool bit = (bitmap[i / 64] >> (i % 64)) & 1;
+            const bool want = (expected >> (i % LENGTHOF(inputs))) & 1;
+            mismatches += bit != want;
+            wanted += want;
+        }
+
+        // Bits past the last row are clear
+        if (mismatches ||
+            (bitmap[LENGTHOF(bitmap) - 1] >> ((LENGTHOF(inputs) * repeat) % 64)) != 0 ||
+            selected != wanted)
+        {
+            TEST_FAILED("    ipv6_column scan %u: %u rows differ, %u selected\n",
+                scan, mismatches, (uint32_t)selected);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+
+    ipv6_column_destroy(column);
+}
+
+//--------------------------------------------------------------------------------
+static void test_lpm (test_status_t* status) {
+    const char* prefixes[] = {
+        "::/0",
+        "2001:db8::/32",
+        "2001:db8:1::/48",
+        "2001:db8:1::1",
+        "10.0.0.0/8",
+        "10.1.0.0/16",
+        "2001:db8::/32",
+    };
+    const uint32_t values[] = { 100, 1, 2, 3, 4, IPV6_LPM_NONE, 5 };
+    const struct {
+        const char* input;
+        uint32_t value;         // with every prefix
+        uint32_t index;         // with only the first 2001:db8 prefixes, no values
+    } probes[] = {
+        { "2001:db8::5", 5, 0 },
+        { "2001:db8:1::1", 3, 2 },
+        { "2001:db8:1::2", 2, 1 },
+        { "2001:db8:2::", 5, 0 },
+        { "2001:db9::", 100, IPV6_LPM_NONE },
+        { "::", 100, IPV6_LPM_NONE },
+        { "10.2.3.4", 4, IPV6_LPM_NONE },
+        { "::ffff:10.2.3.4", 4, IPV6_LPM_NONE },
+        { "10.1.2.3", IPV6_LPM_NONE, IPV6_LPM_NONE },
+        { "ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff", 100, IPV6_LPM_NONE },
+    };
+    ipv6_address_full_t addrs[LENGTHOF(prefixes)], keys[LENGTHOF(probes)];
+    uint32_t results[LENGTHOF(probes)];
+    uint64_t image[256];
+    bool failed = false;
+
+    for (uint32_t i = 0; i < LENGTHOF(prefixes); ++i) {
+        ipv6_from_str(prefixes[i], strlen(prefixes[i]), &addrs[i]);
+    }
+    for (uint32_t i = 0; i < LENGTHOF(probes); ++i) {
+        ipv6_from_str(probes[i].input, strlen(probes[i].input), &keys[i]);
+    }
+
+    ipv6_lpm_t* table = ipv6_lpm_build(addrs, values, LENGTHOF(addrs));
+    ipv6_lpm_t* indexes = ipv6_lpm_build(&addrs[1], NULL, 3);
+    if (!table || !indexes) {
+        TEST_FAILED("    ipv6_lpm_build failed\n");
+        ipv6_lpm_destroy(table);
+        ipv6_lpm_destroy(indexes);
+        return;
+    }
+
+    for (uint32_t i = 0; i < LENGTHOF(probes); ++i) {
+        const uint32_t value = ipv6_lpm_lookup(table, &keys[i]);
+        const uint32_t index = ipv6_lpm_lookup(indexes, &keys[i]);
+
+        if (value != probes[i].value || index != probes[i].index) {
+            TEST_FAILED("    ipv6_lpm_lookup \"%s\" found %u and %u, expected %u and %u\n",
+                probes[i].input, value, index, probes[i].value, probes[i].index);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+
+    uint32_t mismatches = 0;
+    size_t found = ipv6_lpm_lookup_batch(table, keys, results, LENGTHOF(keys));
+    for (uint32_t i = 0; i < LENGTHOF(probes); ++i) {
+        mismatches += results[i] != probes[i].value;
+    }
+    if (mismatches || found != LENGTHOF(probes) - 1) {
+        TEST_FAILED("    ipv6_lpm_lookup_batch differs from single (%u)\n", mismatches);
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    // Lookups run against the serialized image in place
+    const size_t bytes = ipv6_lpm_serialize(table, NULL, 0);
+    if (bytes == 0 || bytes > sizeof(image) ||
+        ipv6_lpm_serialize(table, image, bytes - 1) != 0 ||
+        ipv6_lpm_serialize(table, image, sizeof(image)) != bytes)
+    {
+        TEST_FAILED("    ipv6_lpm_serialize failed\n");
+        ipv6_lpm_destroy(table);
+        ipv6_lpm_destroy(indexes);
+        return;
+    }
+
+    ipv6_lpm_t* view = ipv6_lpm_view(image, bytes);
+    mismatches = 0;
+    for (uint32_t i = 0; view && i < LENGTHOF(probes); ++i) {
+        mismatches += ipv6_lpm_lookup(view, &keys[i]) != probes[i].value;
+    }
+    if (!view || mismatches || ipv6_lpm_view(image, bytes - 1) || ipv6_lpm_view((uint8_t*)image + 4, bytes)) {
+        TEST_FAILED("    ipv6_lpm_view lookups differ (%u)\n", mismatches);
+    }
+    else {
+        TEST_PASSED();
+    }
+    ipv6_lpm_destroy(view);
+
+    image[0] ^= 1;
+    if (ipv6_lpm_view(image, bytes)) {
+        TEST_FAILED("    ipv6_lpm_view accepted a bad header\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    ipv6_lpm_destroy(table);
+    ipv6_lpm_destroy(indexes);
+}
+
+//--------------------------------------------------------------------------------
+static void test_range (test_status_t* status) {
+    const struct {
+        const char* start;
+        const char* end;
+        uint32_t value;
+    } ranges[] = {
+        { "2001:db8::", "2001:db8::ffff", 20 },
+        { "10.0.0.0", "10.255.255.255", 30 },
+        { "1.0.0.0", "1.0.0.255", 10 },
+        { "2001:db8:1::", "2001:db8:1::", 50 },
+        { "::ffff:11.0.0.0", "::ffff:11.0.0.10", 40 },
+    };
+    const struct {
+        const char* input;
+        uint32_t value;
+    } probes[] = {
+        { "1.0.0.5", 10 },
+        { "1.0.1.0", IPV6_RANGE_NONE },
+        { "0.255.255.255", IPV6_RANGE_NONE },
+        { "::ffff:10.1.1.1", 30 },
+        { "11.0.0.10", 40 },
+        { "11.0.0.11", IPV6_RANGE_NONE },
+        { "2001:db8::ffff", 20 },
+        { "2001:db8::1:0", IPV6_RANGE_NONE },
+        { "2001:db8:1::", 50 },
+        { "::", IPV6_RANGE_NONE },
+        { "ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff", IPV6_RANGE_NONE },
+    };
+    enum { SPACED = 1000 };
+    ipv6_address_full_t starts[SPACED], ends[SPACED], keys[2 * SPACED];
+    uint32_t values[LENGTHOF(ranges)], results[2 * SPACED];
+    bool failed = false;
+
+    for (uint32_t i = 0; i < LENGTHOF(ranges); ++i) {
+        ipv6_from_str(ranges[i].start, strlen(ranges[i].start), &starts[i]);
+        ipv6_from_str(ranges[i].end, strlen(ranges[i].end), &ends[i]);
+        values[i] = ranges[i].value;
+    }
+    for (uint32_t i = 0; i < LENGTHOF(probes); ++i) {
+        ipv6_from_str(probes[i].input, strlen(probes[i].input), &keys[i]);
+    }
+
+    ipv6_range_t* table = ipv6_range_build(starts, ends, values, LENGTHOF(ranges));
+    if (!table) {
+        TEST_FAILED("    ipv6_range_build failed\n");
+        return;
+    }
+
+    for (uint32_t i = 0; i < LENGTHOF(probes); ++i) {
+        const uint32_t value = ipv6_range_lookup(table, &keys[i]);
+        if (value != probes[i].value) {
+            TEST_FAILED("    ipv6_range_lookup \"%s\" found %u, expected %u\n",
+                probes[i].input, value, probes[i].value);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+    ipv6_range_destroy(table);
+
+    // Overlapping and reversed ranges
+    ipv6_from_str("10.1.0.0", 8, &starts[2]);
+    ipv6_from_str("10.1.0.5", 8, &ends[2]);
+    table = ipv6_range_build(starts, ends, values, LENGTHOF(ranges));
+    if (table || ipv6_range_build(&ends[0], &starts[0], NULL, 1)) {
+        TEST_FAILED("    ipv6_range_build accepted overlapping or reversed ranges\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+    ipv6_range_destroy(table);
+
+    // Every other /48 over several levels of the tree, batched and single
+    // lookups agree
+    memset(starts, 0, sizeof(starts));
+    memset(ends, 0, sizeof(ends));
+    memset(keys, 0, sizeof(keys));
+    for (uint32_t i = 0; i < SPACED; ++i) {
+        starts[i].address.components[0] = 0x2001;
+        starts[i].address.components[2] = (uint16_t)(2 * i);
+        ends[i] = starts[i];
+        for (uint32_t c = 3; c < IPV6_NUM_COMPONENTS; ++c) {
+            ends[i].address.components[c] = 0xffff;
+        }
+    }
+    for (uint32_t i = 0; i < 2 * SPACED; ++i) {
+        keys[i].address.components[0] = 0x2001;
+        keys[i].address.components[2] = (uint16_t)i;
+        keys[i].address.components[7] = (uint16_t)i;
+    }
+
+    table = ipv6_range_build(starts, ends, NULL, SPACED);
+    uint32_t mismatches = 0;
+    const size_t found = table ? ipv6_range_lookup_batch(table, keys, results, 2 * SPACED) : 0;
+    for (uint32_t i = 0; table && i < 2 * SPACED; ++i) {
+        const uint32_t expected = (i & 1) ? IPV6_RANGE_NONE : i / 2;
+        mismatches += results[i] != expected;
+        mismatches += ipv6_range_lookup(table, &keys[i]) != expected;
+    }
+    if (!table || mismatches || found != SPACED) {
+        TEST_FAILED("    ipv6_range lookups differ (%u)\n", mismatches);
+    }
+    else {
+        TEST_PASSED();
+    }
+    ipv6_range_destroy(table);
+}
+
+//--------------------------------------------------------------------------------
+static void test_acl (test_status_t* status) {
+    const char* rules[] = {
+        "[2001:db8::/32]:443",
+        "10.0.0.0/8:1000-2000",
+        "10.1.0.0/16",
+        "[2001:db8:1::/48]:80-89",
+        "2001:db8::/32",
+        "0.0.0.0/0:53",
+        "[::/0]:22",
+    };
+    const char* invalid[] = {
+        "10.0.0.0/8:2000-1000",
+        "10.0.0.0/8:70000",
+        "10.0.0.0/8:",
+        "10.0.0.0/8:1-",
+        "[2001:db8::]80",
+        "[2001:db8::]:8a",
+    };
+    const struct {
+        const char* input;
+        uint32_t rule;
+    } probes[] = {
+        { "[2001:db8::1]:443", 0 },
+        { "[2001:db8::1]:80", 4 },
+        { "[2001:db8:1::1]:85", 3 },
+        { "2001:db8:1::1", 4 },
+        { "10.1.2.3:1500", 1 },
+        { "10.1.2.3:80", 2 },
+        { "10.2.3.4:80", IPV6_ACL_NONE },
+        { "10.2.3.4:53", 5 },
+        { "[::ffff:10.2.3.4]:1000", 1 },
+        { "[fe80::1]:22", 6 },
+        { "[fe80::1]:23", IPV6_ACL_NONE },
+        { "fe80::1", IPV6_ACL_NONE },
+    };
+    enum { RANDOM_RULES = 200, RANDOM_PROBES = 2000 };
+    ipv6_acl_rule_t parsed[RANDOM_RULES];
+    ipv6_address_full_t keys[RANDOM_PROBES];
+    uint32_t results[RANDOM_PROBES];
+    uint32_t seed = 1;
+    bool failed = false;
+
+    for (uint32_t i = 0; i < LENGTHOF(rules); ++i) {
+        if (!ipv6_acl_rule_from_str(rules[i], strlen(rules[i]), &parsed[i])) {
+            TEST_FAILED("    ipv6_acl_rule_from_str \"%s\" failed\n", rules[i]);
+            return;
+        }
+    }
+    for (uint32_t i = 0; i < LENGTHOF(invalid); ++i) {
+        if (ipv6_acl_rule_from_str(invalid[i], strlen(invalid[i]), &parsed[LENGTHOF(rules)])) {
+            TEST_FAILED("    ipv6_acl_rule_from_str accepted \"%s\"\n", invalid[i]);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+
+    ipv6_acl_t* acl = ipv6_acl_build(parsed, LENGTHOF(rules));
+    if (!acl) {
+        TEST_FAILED("    ipv6_acl_build failed\n");
+        return;
+    }
+
+    for (uint32_t i = 0; i < LENGTHOF(probes); ++i) {
+        ipv6_from_str(probes[i].input, strlen(probes[i].input), &keys[i]);
+        const uint32_t rule = ipv6_acl_match(acl, &keys[i]);
+        if (rule != probes[i].rule) {
+            TEST_FAILED("    ipv6_acl_match \"%s\" matched %u, expected %u\n",
+                probes[i].input, rule, probes[i].rule);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+
+    // Lookups keep using the list read from the slot while a new one is
+    // published
+    ipv6_acl_t* slot = acl;
+    const ipv6_acl_t* current = ipv6_acl_current(&slot);
+    ipv6_acl_t* empty = ipv6_acl_build(NULL, 0);
+    if (ipv6_acl_publish(&slot, empty) != acl ||
+        ipv6_acl_current(&slot) != empty ||
+        ipv6_acl_match(current, &keys[0]) != 0 ||
+        ipv6_acl_match(ipv6_acl_current(&slot), &keys[0]) != IPV6_ACL_NONE)
+    {
+        TEST_FAILED("    ipv6_acl_publish did not swap the lists\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+    ipv6_acl_destroy(acl);
+    ipv6_acl_destroy(empty);
+
+    // Overlapping random rules spanning several bit vector words agree with
+    // evaluating the rules in order
+    memset(parsed, 0, sizeof(parsed));
+    memset(keys, 0, sizeof(keys));
+    for (uint32_t r = 0; r < RANDOM_RULES; ++r) {
+        const uint32_t masks[] = { 16, 20, 32, 48, 128 };
+        seed = seed * 1103515245 + 12345;
+        parsed[r].prefix.address.components[0] = 0x2001;
+        parsed[r].prefix.address.components[1] = (uint16_t)((seed >> 8) & 0xf000);
+        parsed[r].prefix.address.components[2] = (uint16_t)((seed >> 20) & 3);
+        parsed[r].prefix.flags = IPV6_FLAG_HAS_MASK;
+        parsed[r].prefix.mask = masks[(seed >> 4) % LENGTHOF(masks)];
+        parsed[r].port_min = (uint16_t)((seed >> 16) % 100);
+        parsed[r].port_max = (uint16_t)(parsed[r].port_min + (seed >> 24) % 50);
+    }
+    for (uint32_t i = 0; i < RANDOM_PROBES; ++i) {
+        seed = seed * 1103515245 + 12345;
+        keys[i].address.components[0] = 0x2001;
+        keys[i].address.components[1] = (uint16_t)((seed >> 8) & 0xf000);
+        keys[i].address.components[2] = (uint16_t)((seed >> 20) & 3);
+        keys[i].flags = IPV6_FLAG_HAS_PORT;
+        keys[i].port = (uint16_t)((seed >> 16) % 160);
+    }
+
+    acl = ipv6_acl_build(parsed, RANDOM_RULES);
+    uint32_t mismatches = 0;
+    size_t matched = acl ? ipv6_acl_match_batch(acl, keys, results, RANDOM_PROBES) : 0;
+    for (uint32_t i = 0; acl && i < RANDOM_PROBES; ++i) {
+        uint32_t expected = IPV6_ACL_NONE;
+        for (uint32_t r = 0; r < RANDOM_RULES && expected == IPV6_ACL_NONE; ++r) {
+            const uint32_t mask = parsed[r].prefix.mask;
+            bool inside = keys[i].port >= parsed[r].port_min && keys[i].port <= parsed[r].port_max;
+            for (uint32_t c = 0; c < IPV6_NUM_COMPONENTS && c * 16 < mask; ++c) {
+                const uint16_t bits = (uint16_t)(mask >= (c + 1) * 16 ? 0xffff : 0xffff << (16 - mask % 16));
+                inside &= ((keys[i].address.components[c] ^ parsed[r].prefix.address.components[c]) & bits) == 0;
+            }
+            expected = inside ? r : expected;
+        }
+        mismatches += results[i] != expected;
+        mismatches += ipv6_acl_match(acl, &keys[i]) != expected;
+        matched -= expected != IPV6_ACL_NONE;
+    }
+    if (!acl || mismatches || matched != 0) {
+        TEST_FAILED("    ipv6_acl_match differs from the rules in order (%u)\n", mismatches);
+    }
+    else {
+        TEST_PASSED();
+    }
+    ipv6_acl_destroy(acl);
+}
+
+//--------------------------------------------------------------------------------
+static void test_ptable (test_status_t* status) {
+    const struct {
+        const char* prefix;
+        uint32_t value;
+    } inserts[] = {
+        { "::/0", 100 },
+        { "2001:db8::/32", 1 },
+        { "2001:db8:1::/48", 2 },
+        { "2001:db8:1::1", 3 },
+        { "10.0.0.0/8", 4 },
+        { "2001:db8::/32", 5 },
+    };
+    const struct {
+        const char* input;
+        uint32_t value;         // after the inserts
+        uint32_t removed;       // after removing 2001:db8:1::/48 and ::/0
+    } probes[] = {
+        { "2001:db8::5", 5, 5 },
+        { "2001:db8:1::1", 3, 3 },
+        { "2001:db8:1::2", 2, 5 },
+        { "2001:db9::", 100, IPV6_PTABLE_NONE },
+        { "10.2.3.4", 4, 4 },
+        { "::ffff:10.2.3.4", 4, 4 },
+        { "11.2.3.4", 100, IPV6_PTABLE_NONE },
+    };
+    enum { SHADOW = 64, OPERATIONS = 2000, PROBES = 1000 };   // 16 prefixes per mask
+    ipv6_address_full_t shadow[SHADOW], present[SHADOW], keys[PROBES], addr;
+    uint32_t values[SHADOW], present_values[SHADOW], results[PROBES];
+    bool in_table[SHADOW];
+    uint32_t seed = 7;
+    bool failed = false;
+
+    ipv6_ptable_t* table = ipv6_ptable_create(2);
+    ipv6_ptable_reader_t* reader = ipv6_ptable_reader_attach(table);
+    ipv6_ptable_reader_t* second = ipv6_ptable_reader_attach(table);
+    if (!table || !reader || !second || ipv6_ptable_reader_attach(table)) {
+        TEST_FAILED("    ipv6_ptable reader slots are not claimed once each\n");
+        ipv6_ptable_reader_detach(reader);
+        ipv6_ptable_reader_detach(second);
+        ipv6_ptable_destroy(table);
+        return;
+    }
+    ipv6_ptable_reader_detach(second);
+    second = ipv6_ptable_reader_attach(table);
+    if (!second) {
+        TEST_FAILED("    ipv6_ptable reader slot is not released\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    for (uint32_t i = 0; i < LENGTHOF(inserts); ++i) {
+        ipv6_from_str(inserts[i].prefix, strlen(inserts[i].prefix), &addr);
+        if (!ipv6_ptable_insert(table, &addr, inserts[i].value)) {
+            TEST_FAILED("    ipv6_ptable_insert \"%s\" failed\n", inserts[i].prefix);
+        }
+    }
+
+    for (uint32_t pass = 0; pass < 2; ++pass) {
+        for (uint32_t i = 0; i < LENGTHOF(probes); ++i) {
+            const uint32_t expected = pass ? probes[i].removed : probes[i].value;
+            ipv6_from_str(probes[i].input, strlen(probes[i].input), &keys[i]);
+            const uint32_t value = ipv6_ptable_lookup(pass ? second : reader, &keys[i]);
+            if (value != expected) {
+                TEST_FAILED("    ipv6_ptable_lookup \"%s\" found %u, expected %u\n",
+                    probes[i].input, value, expected);
+            }
+            else {
+                TEST_PASSED();
+            }
+        }
+
+        if (pass == 0) {
+            ipv6_from_str("2001:db8:1::/48", 15, &addr);
+            bool removed = ipv6_ptable_remove(table, &addr) && !ipv6_ptable_remove(table, &addr);
+            ipv6_from_str("::/0", 4, &addr);
+            removed &= ipv6_ptable_remove(table, &addr);
+            ipv6_from_str("2001:db9::/32", 13, &addr);
+            removed &= !ipv6_ptable_remove(table, &addr);
+            addr.mask = 129;
+            if (!removed ||
+                ipv6_ptable_insert(table, &addr, 1) ||
+                ipv6_ptable_insert(table, &keys[0], IPV6_PTABLE_NONE))
+            {
+                TEST_FAILED("    ipv6_ptable_remove or invalid insert\n");
+            }
+        }
+    }
+
+    // Random inserts and removes of nested prefixes agree with a table
+    // compiled from the prefixes left
+    memset(shadow, 0, sizeof(shadow));
+    memset(keys, 0, sizeof(keys));
+    for (uint32_t i = 0; i < SHADOW; ++i) {
+        const uint32_t masks[] = { 20, 24, 28, 128 };
+        shadow[i].address.components[0] = 0x2001;
+        shadow[i].address.components[1] = (uint16_t)((i % 16) << 12);
+        shadow[i].flags = IPV6_FLAG_HAS_MASK;
+        shadow[i].mask = masks[i / 16];
+        in_table[i] = false;
+    }
+    for (uint32_t i = 0; i < PROBES; ++i) {
+        seed = seed * 1103515245 + 12345;
+        keys[i].address.components[0] = 0x2001;
+        keys[i].address.components[1] = (uint16_t)(((seed >> 8) & 0xf000) | (((seed >> 20) & 1) ? 0 : (seed >> 16) & 0xff));
+        keys[i].address.components[7] = (uint16_t)((seed >> 24) & 1);
+    }
+
+    ipv6_ptable_reader_detach(reader);
+    ipv6_ptable_reader_detach(second);
+    ipv6_ptable_destroy(table);
+    table = ipv6_ptable_create(1);
+    reader = ipv6_ptable_reader_attach(table);
+    uint32_t errors = 0;
+    for (uint32_t op = 0; table && op < OPERATIONS; ++op) {
+        seed = seed * 1103515245 + 12345;
+        const uint32_t i = (seed >> 16) % SHADOW;
+
+        if ((seed >> 8) & 1) {
+            values[i] = op;
+            in_table[i] = true;
+            errors += !ipv6_ptable_insert(table, &shadow[i], op);
+        }
+        else {
+            errors += ipv6_ptable_remove(table, &shadow[i]) != in_table[i];
+            in_table[i] = false;
+        }
+    }
+
+    size_t count = 0;
+    for (uint32_t i = 0; i < SHADOW; ++i) {
+        if (in_table[i]) {
+            present[count] = shadow[i];
+            present_values[count++] = values[i];
+        }
+    }
+
+    ipv6_lpm_t* expected = ipv6_lpm_build(present, present_values, count);
+    uint32_t mismatches = 0;
+    if (reader && expected) {
+        ipv6_ptable_lookup_batch(reader, keys, results, PROBES);
+        for (uint32_t i = 0; i < PROBES; ++i) {
+            mismatches += results[i] != ipv6_lpm_lookup(expected, &keys[i]);
+        }
+    }
+    if (!reader || !expected || errors || mismatches) {
+        TEST_FAILED("    ipv6_ptable differs after updates (%u errors, %u lookups)\n", errors, mismatches);
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    // Loading the prefixes left replaces the table with the same lookups,
+    // the value of a loaded prefix is its slot
+    const char* texts[SHADOW + 3];
+    char buffers[SHADOW][64];
+    for (uint32_t i = 0; i < count; ++i) {
+        ipv6_to_str(&present[i], buffers[i], sizeof(buffers[i]));
+        texts[i] = buffers[i];
+    }
+    texts[count] = "2001:db8::/129";
+    texts[count + 1] = "not a prefix";
+    texts[count + 2] = "2001::/16";     // slot never parsed
+
+    ipv6_lpm_destroy(expected);
+    expected = ipv6_lpm_build(present, NULL, count);
+    ipv6_ptable_loader_t* loader = ipv6_ptable_loader_create(count + 3);
+    const size_t half = (count + 2) / 2;
+    const size_t parsed = ipv6_ptable_loader_parse(loader, 0, texts, NULL, half) +
+        ipv6_ptable_loader_parse(loader, half, texts + half, NULL, count + 2 - half);
+    mismatches = 0;
+    if (reader && expected && parsed == count && ipv6_ptable_load(table, loader)) {
+        ipv6_ptable_lookup_batch(reader, keys, results, PROBES);
+        for (uint32_t i = 0; i < PROBES; ++i) {
+            mismatches += results[i] != ipv6_lpm_lookup(expected, &keys[i]);
+        }
+    }
+    if (!reader || !expected || parsed != count || mismatches) {
+        TEST_FAILED("    ipv6_ptable_load of %u prefixes parsed %u, %u lookups differ\n",
+            (uint32_t)count, (uint32_t)parsed, mismatches);
+    }
+    else {
+        TEST_PASSED();
+    }
+    ipv6_ptable_loader_destroy(loader);
+
+    // The last slot of a duplicate prefix wins
+    loader = ipv6_ptable_loader_create(LENGTHOF(inserts));
+    for (uint32_t i = 0; i < LENGTHOF(inserts); ++i) {
+        ipv6_ptable_loader_parse(loader, i, &inserts[i].prefix, NULL, 1);
+    }
+    if (!ipv6_ptable_load(table, loader)) {
+        TEST_FAILED("    ipv6_ptable_load failed\n");
+    }
+    for (uint32_t i = 0; i < LENGTHOF(probes); ++i) {
+        const uint32_t slot = probes[i].value == 100 ? 0 : probes[i].value;
+        ipv6_from_str(probes[i].input, strlen(probes[i].input), &addr);
+        const uint32_t value = ipv6_ptable_lookup(reader, &addr);
+        if (value != slot) {
+            TEST_FAILED("    ipv6_ptable_load \"%s\" found %u, expected %u\n", probes[i].input, value, slot);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+    ipv6_ptable_loader_destroy(loader);
+
+    ipv6_lpm_destroy(expected);
+    ipv6_ptable_reader_detach(reader);
+    ipv6_ptable_destroy(table);
+}
+
+//--------------------------------------------------------------------------------
+// Parse a space separated list of prefixes, returns the number parsed
+static size_t parse_prefix_list (const char* list, ipv6_address_full_t* out, size_t max) {
+    size_t count = 0;
+
+    while (*list && count < max) {
+        const char* end = strchr(list, ' ');
+        const size_t bytes = end ? (size_t)(end - list) : strlen(list);
+        if (!ipv6_from_str(list, bytes, &out[count])) {
+            break;
+        }
+        count++;
+        list += bytes + (end != NULL);
+    }
+
+    return count;
+}
+
+//--------------------------------------------------------------------------------
+static void test_pset (test_status_t* status) {
+    enum { UNION, INTERSECT, DIFFERENCE };
+    const struct {
+        uint32_t op;
+        const char* a;
+        const char* b;
+        const char* expected;
+    } tests[] = {
+        { UNION, "10.0.0.0/9 10.128.0.0/9", "", "10.0.0.0/8" },
+        { UNION, "2001:db8::/33 2001:db8::1", "2001:db8:8000::/33", "2001:db8::/32" },
+        { UNION, "10.0.0.0/24 10.0.0.128/25", "10.0.1.0/24", "10.0.0.0/23" },
+        { UNION, "::/1", "8000::/1", "::/0" },
+        { UNION, "10.0.0.1 10.0.0.2", "", "10.0.0.1/32 10.0.0.2/32" },
+        { INTERSECT, "10.0.0.0/8 192.168.0.0/16 2001:db8::/32", "10.1.2.0/24 192.168.0.0/15 2001:db8:1::/48",
+            "10.1.2.0/24 192.168.0.0/16 2001:db8:1::/48" },
+        { INTERSECT, "0.0.0.0/0", "::/0", "" },
+        { INTERSECT, "10.0.0.0/8", "::ffff:10.0.0.0/104", "" },
+        { INTERSECT, "10.0.0.0/16 10.2.0.0/16", "10.1.0.0/16 10.3.0.0/16", "" },
+        { DIFFERENCE, "10.0.0.0/8", "10.0.0.0/9 10.128.0.0/10", "10.192.0.0/10" },
+        { DIFFERENCE, "10.0.0.0/30", "10.0.0.1", "10.0.0.0/32 10.0.0.2/31" },
+        { DIFFERENCE, "10.0.0.0/8 2001:db8::/32", "0.0.0.0/0", "2001:db8::/32" },
+        { DIFFERENCE, "::/0", "::/1", "8000::/1" },
+        { DIFFERENCE, "fe00::/7", "ff00::/8", "fe00::/8" },
+        { UNION, "ffff:ffff:ffff:ffff:ffff:ffff:ffff:fffe/127", "ffff:ffff:ffff:ffff:ffff:ffff:ffff:fffc/127",
+            "ffff:ffff:ffff:ffff:ffff:ffff:ffff:fffc/126" },
+    };
+    const char* invalid[] = {
+        "10.1.0.0/16 10.0.0.0/16",
+        "2001:db8::/64 2001::/16",
+        "10.0.0.0/33",
+    };
+    enum { MAX = 16, SET = 24, ROUNDS = 300 };
+    ipv6_address_full_t a[MAX], b[MAX], out[MAX], ra[SET], rb[SET], result[256];
+    char text[512];
+    uint32_t seed = 5;
+    bool failed = false;
+
+    for (uint32_t i = 0; i < LENGTHOF(tests); ++i) {
+        const size_t a_count = parse_prefix_list(tests[i].a, a, MAX);
+        const size_t b_count = parse_prefix_list(tests[i].b, b, MAX);
+        size_t count = 0, length = 0;
+
+        if (tests[i].op == UNION) {
+            count = ipv6_pset_union(a, a_count, b, b_count, out, MAX);
+        }
+        else if (tests[i].op == INTERSECT) {
+            count = ipv6_pset_intersect(a, a_count, b, b_count, out, MAX);
+        }
+        else {
+            count = ipv6_pset_difference(a, a_count, b, b_count, out, MAX);
+        }
+
+        text[0] = '\0';
+        for (size_t j = 0; j < count && j < MAX; ++j) {
+            length += (size_t)sprintf(text + length, j ? " " : "");
+            length += ipv6_to_str(&out[j], text + length, sizeof(text) - length);
+            if (out[j].flags & IPV6_FLAG_IPV4_COMPAT) {
+                length += (size_t)sprintf(text + length, "/%u", out[j].mask);
+            }
+        }
+        if (strcmp(text, tests[i].expected) != 0) {
+            TEST_FAILED("    ipv6_pset op %u of \"%s\" and \"%s\" is \"%s\", expected \"%s\"\n",
+                tests[i].op, tests[i].a, tests[i].b, text, tests[i].expected);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+
+    // Removing one address from a /32 leaves one prefix per bit after the mask
+    parse_prefix_list("2001:db8::/32", a, MAX);
+    parse_prefix_list("2001:db8::1", b, MAX);
+    if (ipv6_pset_difference(a, 1, b, 1, NULL, 0) != 96) {
+        TEST_FAILED("    ipv6_pset_difference of a /32 and an address is not 96 prefixes\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    for (uint32_t i = 0; i < LENGTHOF(invalid); ++i) {
+        const size_t count = parse_prefix_list(invalid[i], a, MAX);
+        if (ipv6_pset_union(a, count, NULL, 0, out, MAX) != IPV6_PSET_INVALID ||
+            ipv6_pset_difference(b, 1, a, count, out, MAX) != IPV6_PSET_INVALID)
+        {
+            TEST_FAILED("    ipv6_pset accepts \"%s\"\n", invalid[i]);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+    parse_prefix_list("2001:db8::/32", a, MAX);
+    a[0].mask = 129;
+    if (ipv6_pset_intersect(a, 1, a, 1, out, MAX) != IPV6_PSET_INVALID) {
+        TEST_FAILED("    ipv6_pset accepts a mask of 129\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    // Random sets of prefixes within 10.0.0.0/24 against address bitmaps: the
+    // result covers the same addresses with sorted, disjoint prefixes, and no
+    // two of them are the halves of a larger prefix
+    uint32_t errors = 0;
+    for (uint32_t round = 0; round < ROUNDS; ++round) {
+        uint8_t in_a[256], in_b[256], covered[256];
+        memset(in_a, 0, sizeof(in_a));
+        memset(in_b, 0, sizeof(in_b));
+        memset(covered, 0, sizeof(covered));
+
+        for (uint32_t i = 0; i < SET; ++i) {
+            ipv6_address_full_t* prefix = i < SET / 2 ? &ra[i] : &rb[i - SET / 2];
+            uint8_t* bitmap = i < SET / 2 ? in_a : in_b;
+            seed = seed * 1103515245 + 12345;
+            const uint32_t mask = 24 + (seed >> 16) % 9;
+            const uint32_t size = 1u << (32 - mask);
+            const uint32_t first = ((seed >> 8) & 0xff) & ~(size - 1);
+
+            memset(prefix, 0, sizeof(ipv6_address_full_t));
+            prefix->flags = IPV6_FLAG_IPV4_COMPAT | IPV6_FLAG_HAS_MASK;
+            prefix->mask = mask;
+            prefix->address.components[0] = 0x0a00;
+            prefix->address.components[1] = (uint16_t)first;
+            memset(bitmap + first, 1, size);
+        }
+        ipv6_pset_sort(ra, SET / 2);
+        ipv6_pset_sort(rb, SET / 2);
+
+        const uint32_t op = round % 3;
+        size_t count;
+        if (op == UNION) {
+            count = ipv6_pset_union(ra, SET / 2, rb, SET / 2, result, LENGTHOF(result));
+        }
+        else if (op == INTERSECT) {
+            count = ipv6_pset_intersect(ra, SET / 2, rb, SET / 2, result, LENGTHOF(result));
+        }
+        else {
+            count = ipv6_pset_difference(ra, SET / 2, rb, SET / 2, result, LENGTHOF(result));
+        }
+
+        uint32_t next = 0;
+        for (size_t i = 0; count <= LENGTHOF(result) && i < count; ++i) {
+            const uint32_t size = 1u << (32 - result[i].mask);
+            const uint32_t first = result[i].address.components[1];
+            errors += first < next || result[i].address.components[0] != 0x0a00;
+            next = first + size;
+            for (uint32_t j = first; j < next && j < 256; ++j) {
+                covered[j] = 1;
+            }
+            if (i > 0 && result[i - 1].mask == result[i].mask &&
+                result[i - 1].address.components[1] + size == first && (first & size))
+            {
+                errors++;
+            }
+        }
+        for (uint32_t j = 0; j < 256; ++j) {
+            const uint8_t expected = op == UNION ? (in_a[j] | in_b[j]) :
+                op == INTERSECT ? (in_a[j] & in_b[j]) : (in_a[j] & !in_b[j]);
+            errors += covered[j] != expected;
+        }
+        errors += count > LENGTHOF(result);
+    }
+    if (errors) {
+        TEST_FAILED("    ipv6_pset random sets differ from bitmaps (%u errors)\n", errors);
+    }
+    else {
+        TEST_PASSED();
+    }
+}
+
+//--------------------------------------------------------------------------------
+static void test_pattern (test_status_t* status) {
+    const char* patterns[] = {
+        "2001:db8:*:*::1",
+        "10.*.*.5",
+        "2001:db8::12*4",
+        "fe80::*",
+        "::ffff:192.168.*.*",
+        "2001:db8:*::/48",
+        "*::",
+    };
+    const char* invalid[] = {
+        "10.1*.0.1",
+        "10.0.0.0/33",
+        "2001:db8::*:*:*:*:*:*:*:*",
+        "2001:db8::g*",
+        "*.*.*",
+    };
+    const struct {
+        const char* input;
+        uint32_t pattern;       // first matching pattern
+    } probes[] = {
+        { "2001:db8:1:2::1", 0 },
+        { "2001:db8:ffff:0:0:0:0:1", 0 },
+        { "2001:db8:1:2::2", 5 },
+        { "2001:db8:0:1::1", 0 },
+        { "10.1.2.5", 1 },
+        { "::ffff:10.200.0.5", 1 },
+        { "10.1.2.6", IPV6_PATTERN_NONE },
+        { "2001:db8::1234", 2 },
+        { "2001:db8::12f4", 2 },
+        { "2001:db8::1235", 5 },
+        { "fe80::abcd", 3 },
+        { "abcd::", 6 },
+        { "192.168.3.4", 4 },
+        { "192.169.3.4", IPV6_PATTERN_NONE },
+        { "2001:db9::1", IPV6_PATTERN_NONE },
+        { "::1", IPV6_PATTERN_NONE },
+    };
+    enum { SET = 200, ADDRESSES = 100 };
+    ipv6_pattern_t compiled[SET];
+    ipv6_address_full_t addrs[LENGTHOF(probes)];
+    uint32_t results[LENGTHOF(probes)];
+    bool failed = false;
+
+    for (uint32_t i = 0; i < LENGTHOF(patterns); ++i) {
+        if (!ipv6_pattern_from_str(patterns[i], strlen(patterns[i]), &compiled[i])) {
+            TEST_FAILED("    ipv6_pattern_from_str \"%s\" failed\n", patterns[i]);
+            return;
+        }
+    }
+
+    for (uint32_t i = 0; i < LENGTHOF(invalid); ++i) {
+        ipv6_pattern_t pattern;
+        if (ipv6_pattern_from_str(invalid[i], strlen(invalid[i]), &pattern)) {
+            TEST_FAILED("    ipv6_pattern_from_str \"%s\" should fail\n", invalid[i]);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+
+    ipv6_pattern_set_t* set = ipv6_pattern_set_build(compiled, LENGTHOF(patterns));
+    for (uint32_t i = 0; i < LENGTHOF(probes); ++i) {
+        ipv6_from_str(probes[i].input, strlen(probes[i].input), &addrs[i]);
+    }
+    const size_t found = ipv6_pattern_match_batch(set, addrs, results, LENGTHOF(probes));
+
+    size_t expected_found = 0;
+    for (uint32_t i = 0; i < LENGTHOF(probes); ++i) {
+        uint32_t first = IPV6_PATTERN_NONE;
+        for (uint32_t p = 0; p < LENGTHOF(patterns) && first == IPV6_PATTERN_NONE; ++p) {
+            first = ipv6_pattern_match(&compiled[p], &addrs[i]) ? p : first;
+        }
+        expected_found += probes[i].pattern != IPV6_PATTERN_NONE;
+
+        if (results[i] != probes[i].pattern || first != probes[i].pattern) {
+            TEST_FAILED("    ipv6_pattern \"%s\" matched %u and %u, expected %u\n",
+                probes[i].input, results[i], first, probes[i].pattern);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+    if (!set || found != expected_found) {
+        TEST_FAILED("    ipv6_pattern_match_batch found %u, expected %u\n", (uint32_t)found, (uint32_t)expected_found);
+    }
+    ipv6_pattern_set_destroy(set);
+
+    // A set larger than one block: only the last of 200 single address
+    // patterns matches
+    for (uint32_t i = 0; i < SET; ++i) {
+        char text[64];
+        sprintf(text, "2001:db8::%x:*", i);
+        ipv6_pattern_from_str(text, strlen(text), &compiled[i]);
+    }
+    set = ipv6_pattern_set_build(compiled, SET);
+    ipv6_from_str("2001:db8::c7:1", 14, &addrs[0]);
+    ipv6_from_str("2001:db8::c8:1", 14, &addrs[1]);
+    if (!set || ipv6_pattern_match_batch(set, addrs, results, 2) != 1 ||
+        results[0] != SET - 1 || results[1] != IPV6_PATTERN_NONE)
+    {
+        TEST_FAILED("    ipv6_pattern_match_batch over %u patterns\n", SET);
+    }
+    else {
+        TEST_PASSED();
+    }
+    ipv6_pattern_set_destroy(set);
+}
+
+//--------------------------------------------------------------------------------
+static void test_math (test_status_t* status) {
+    enum { ADD, SUB, NEXT, PREV, FIRST, LAST, NTH };
+    const struct {
+        uint32_t op;
+        const char* input;
+        uint64_t n_hi;          // offset for ADD, SUB and NTH
+        uint64_t n_lo;
+        uint32_t bits;          // prefix length for the other operations
+        const char* expected;   // NULL if the operation fails
+    } tests[] = {
+        { ADD, "2001:db8::ffff", 0, 1, 0, "2001:db8::1:0" },
+        { ADD, "2001:db8::", 1, 0, 0, "2001:db8:0:1::" },
+        { ADD, "::ffff:ffff:ffff:ffff", 0, 1, 0, "0:0:0:1::" },
+        { ADD, "ffff:ffff:ffff:ffff:ffff:ffff:ffff:fffe", 0, 1, 0, "ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff" },
+        { ADD, "ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff", 0, 1, 0, NULL },
+        { ADD, "8000::", UINT64_C(0x8000000000000000), 0, 0, NULL },
+        { SUB, "2001:db8::1:0", 0, 1, 0, "2001:db8::ffff" },
+        { SUB, "0:0:0:1::", 0, 1, 0, "::ffff:ffff:ffff:ffff" },
+        { SUB, "::1", 0, 1, 0, "::" },
+        { SUB, "::", 0, 1, 0, NULL },
+        { NEXT, "2001:db8:0:5::1", 0, 0, 64, "2001:db8:0:6::" },
+        { NEXT, "2001:db8:ffff::", 0, 0, 48, "2001:db9::" },
+        { NEXT, "ffff:ffff:ffff:ffff::", 0, 0, 64, NULL },
+        { NEXT, "2001:db8::", 0, 0, 0, NULL },
+        { NEXT, "2001:db8::1", 0, 0, 128, "2001:db8::2" },
+        { PREV, "2001:db8:0:5::1", 0, 0, 64, "2001:db8:0:4::" },
+        { PREV, "2001:db8::", 0, 0, 32, "2001:db7::" },
+        { PREV, "::ffff", 0, 0, 64, NULL },
+        { FIRST, "2001:db8:1:2:3:4:5:6", 0, 0, 48, "2001:db8:1::" },
+        { FIRST, "2001:db8::1", 0, 0, 129, NULL },
+        { LAST, "2001:db8:1:2:3:4:5:6", 0, 0, 64, "2001:db8:1:2:ffff:ffff:ffff:ffff" },
+        { LAST, "2001:db8::", 0, 0, 0, "ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff" },
+        { NTH, "2001:db8::/64", 0, 10, 64, "2001:db8::a" },
+        { NTH, "2001:db8::/120", 0, 255, 120, "2001:db8::ff" },
+        { NTH, "2001:db8::/120", 0, 256, 120, NULL },
+        { NTH, "2001:db8::/32", 1, 0, 32, "2001:db8:0:1::" },
+    };
+    ipv6_address_full_t in, expected;
+    ipv6_address_t out, subnets[4];
+    bool failed = false;
+
+    for (uint32_t i = 0; i < LENGTHOF(tests); ++i) {
+        const ipv6_u128_t n = { tests[i].n_hi, tests[i].n_lo };
+        bool success = false;
+
+        ipv6_from_str(tests[i].input, strlen(tests[i].input), &in);
+        memset(&out, 0, sizeof(out));
+        switch (tests[i].op) {
+            case ADD: success = ipv6_math_add(&in.address, n, &out); break;
+            case SUB: success = ipv6_math_sub(&in.address, n, &out); break;
+            case NEXT: success = ipv6_math_next(&in.address, tests[i].bits, &out); break;
+            case PREV: success = ipv6_math_prev(&in.address, tests[i].bits, &out); break;
+            case FIRST: success = ipv6_math_first(&in.address, tests[i].bits, &out); break;
+            case LAST: success = ipv6_math_last(&in.address, tests[i].bits, &out); break;
+            case NTH: success = ipv6_math_nth(&in.address, tests[i].bits, n, &out); break;
+        }
+
+        if (tests[i].expected) {
+            ipv6_from_str(tests[i].expected, strlen(tests[i].expected), &expected);
+        }
+        if (success != (tests[i].expected != NULL) ||
+            (success && memcmp(&out, &expected.address, sizeof(out)) != 0))
+        {
+            TEST_FAILED("    ipv6_math op %u of \"%s\" failed\n", tests[i].op, tests[i].input);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+
+    // Compare and distance
+    ipv6_address_full_t low, high;
+    ipv6_from_str("2001:db8::ffff", 14, &low);
+    ipv6_from_str("2001:db8:0:1::1", 15, &high);
+    const ipv6_u128_t distance = ipv6_math_distance(&low.address, &high.address);
+    const ipv6_u128_t reverse = ipv6_math_distance(&high.address, &low.address);
+    if (ipv6_math_compare(&low.address, &high.address) != -1 ||
+        ipv6_math_compare(&high.address, &low.address) != 1 ||
+        ipv6_math_compare(&low.address, &low.address) != 0 ||
+        distance.hi != 0 || distance.lo != UINT64_C(0xffffffffffff0002) ||
+        reverse.hi != distance.hi || reverse.lo != distance.lo)
+    {
+        TEST_FAILED("    ipv6_math_compare or ipv6_math_distance\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    ipv6_from_str("::", 2, &low);
+    ipv6_from_str("ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff", 39, &high);
+    ipv6_u128_t distances[2];
+    const ipv6_address_t lows[2] = { low.address, high.address };
+    const ipv6_address_t highs[2] = { high.address, high.address };
+    ipv6_math_distance_batch(lows, highs, distances, 2);
+    if (distances[0].hi != UINT64_MAX || distances[0].lo != UINT64_MAX || distances[1].hi || distances[1].lo) {
+        TEST_FAILED("    ipv6_math_distance_batch\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    // Batch additions agree with single ones
+    const ipv6_u128_t offsets[2] = { { 0, 5 }, { 0, 1 } };
+    ipv6_address_t sums[2];
+    if (ipv6_math_add_batch(lows, offsets, sums, 2) != 1 ||
+        sums[0].components[7] != 5 || sums[1].components[0] != 0 || sums[1].components[7] != 0)
+    {
+        TEST_FAILED("    ipv6_math_add_batch\n");
+    }
+    else {
+        TEST_PASSED();
+    }
+
+    // Subnets
+    const struct {
+        const char* prefix;
+        uint32_t bits;
+        uint32_t sub_bits;
+        uint64_t index;
+        size_t count;           // subnets written of 4
+        const char* first;
+        const char* last;
+    } allocations[] = {
+        { "2001:db8:1::", 48, 64, 16, 4, "2001:db8:1:10::", "2001:db8:1:13::" },
+        { "2001:db8:1::", 48, 64, 65534, 2, "2001:db8:1:fffe::", "2001:db8:1:ffff::" },
+        { "2001:db8:1::", 48, 64, 65536, 0, NULL, NULL },
+        { "2001:db8:1::", 48, 48, 0, 1, "2001:db8:1::", "2001:db8:1::" },
+        { "2001:db8:1::", 48, 40, 0, 0, NULL, NULL },
+        { "10.0.0.0", 0, 128, UINT64_MAX - 1, 4, "::ffff:ffff:ffff:fffe", "0:0:0:1::1" },
+        { "ffff:ffff:ffff:ffff:ffff:ffff:ffff:fff0", 124, 126, 2, 2,
+            "ffff:ffff:ffff:ffff:ffff:ffff:ffff:fff8", "ffff:ffff:ffff:ffff:ffff:ffff:ffff:fffc" },
+    };
+    for (uint32_t i = 0; i < LENGTHOF(allocations); ++i) {
+        const ipv6_u128_t index = { 0, allocations[i].index };
+        ipv6_address_full_t first, last;
+
+        ipv6_from_str(allocations[i].prefix, strlen(allocations[i].prefix), &in);
+        const size_t count = ipv6_math_subnets(&in.address, allocations[i].bits, allocations[i].sub_bits,
+            index, subnets, LENGTHOF(subnets));
+        if (allocations[i].first) {
+            ipv6_from_str(allocations[i].first, strlen(allocations[i].first), &first);
+            ipv6_from_str(allocations[i].last, strlen(allocations[i].last), &last);
+        }
+        if (count != allocations[i].count || (count &&
+            (memcmp(&subnets[0], &first.address, sizeof(ipv6_address_t)) != 0 ||
+             memcmp(&subnets[count - 1], &last.address, sizeof(ipv6_address_t)) != 0)))
+        {
+            TEST_FAILED("    ipv6_math_subnets of \"%s\" from %u wrote %u\n",
+                allocations[i].prefix, (uint32_t)allocations[i].index, (uint32_t)count);
+        }
+        else {
+            TEST_PASSED();
+        }
+    }
+}
+
 int main (void) {
     test_group_t test_groups[] = {
         { "test_parsing", test_parsing },
         { "test_parsing_diag", test_parsing_diag },
         { "test_comparisons", test_comparisons },
         { "test_api_use_loopback_const", test_api_use_loopback_const },
-        { "test_invalid_to_str", test_invalid_to_str }
+        { "test_invalid_to_str", test_invalid_to_str },
+        { "test_classify", test_classify },
+        { "test_nat64", test_nat64 },
+        { "test_truncate", test_truncate },
+        { "test_anon", test_anon },
+        { "test_bloom", test_bloom },
+        { "test_hh", test_hh },
+        { "test_agg", test_agg },
+        { "test_iter", test_iter },
+        { "test_format", test_format },
+        { "test_trace", test_trace },
+        { "test_stats", test_stats },
+        { "test_packed", test_packed },
+        { "test_column", test_column },
+        { "test_lpm", test_lpm },
+        { "test_range", test_range },
+        { "test_acl", test_acl },
+        { "test_ptable", test_ptable },
+        { "test_pset", test_pset },
+        { "test_pattern", test_pattern },
+        { "test_math", test_math },
     };
 
     uint32_t total_failures = 0;